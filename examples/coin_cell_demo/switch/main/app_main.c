@@ -9,6 +9,7 @@
 #include "esp_wifi.h"
 #include "esp_sleep.h"
 #include "esp_pm.h"
+#include "esp_timer.h"
 #if CONFIG_PM_ENABLE
 #include "driver/gpio.h"
 #endif
@@ -31,6 +32,8 @@
 
 #if CONFIG_EXAMPLE_SWITCH_STATUS_PERSISTED
 #define BULB_STATUS_KEY       "bulb_key"
+
+static uint8_t g_bulb_status = 0;
 #endif
 
 static const char *TAG = "app_switch";
@@ -84,6 +87,32 @@ static void app_wifi_init()
     ESP_ERROR_CHECK(esp_wifi_start());
 }
 
+/*
+ * Nothing but the frame comes between the press and the radio: the status is toggled in RAM,
+ * the logs and the NVS write come after the frame is sent.
+ */
+static void app_switch_send_press(int64_t press_time)
+{
+    /* status = 0: OFF, 1: ON, 2: TOGGLE */
+#if CONFIG_EXAMPLE_SWITCH_STATUS_PERSISTED
+    uint8_t status = g_bulb_status ^= 1;
+#else
+    uint8_t status = 2;
+#endif
+    int64_t send_time = esp_timer_get_time();
+
+    esp_err_t ret = espnow_ctrl_initiator_send(ESPNOW_ATTRIBUTE_KEY_1, ESPNOW_ATTRIBUTE_POWER, status);
+    int64_t done_time = esp_timer_get_time();
+
+#if CONFIG_EXAMPLE_SWITCH_STATUS_PERSISTED
+    espnow_storage_set(BULB_STATUS_KEY, &status, sizeof(status));
+#endif
+
+    ESP_LOGI(TAG, "switch send press, key status: %d, ret: %s", status, esp_err_to_name(ret));
+    ESP_LOGI(TAG, "press to send: %d us, sent in: %d ms", (int)(send_time - press_time),
+             (int)((done_time - send_time) / 1000));
+}
+
 #ifdef CONFIG_EXAMPLE_USE_COIN_CELL_BUTTON
 
 #if CONFIG_EXAMPLE_USE_COIN_CELL_BUTTON_V1
@@ -135,17 +164,7 @@ static void control_task(void *pvParameter)
 
     for (;;) {
         if (task_state == ESPNOW_TASK_STATE_SEND_RECORD) {
-            uint8_t status = 0;
-            /* status = 0: OFF, 1: ON, 2: TOGGLE */
-#if CONFIG_EXAMPLE_SWITCH_STATUS_PERSISTED
-            espnow_storage_get(BULB_STATUS_KEY, &status, sizeof(status));
-            status ^= 1;
-            espnow_storage_set(BULB_STATUS_KEY, &status, sizeof(status));
-#else
-            status = 2;
-#endif
-            ESP_LOGI(TAG, "switch send press");
-            espnow_ctrl_initiator_send(ESPNOW_ATTRIBUTE_KEY_1, ESPNOW_ATTRIBUTE_POWER, status);
+            app_switch_send_press(esp_timer_get_time());
 
             task_state = ESPNOW_TASK_STATE_DONE;
         }
@@ -197,7 +216,6 @@ static void control_task(void *pvParameter)
 static void control_task(void *pvParameter)
 {
     button_event_t evt_data;
-    uint8_t status = 0;
 
     board_led_on(true);
 
@@ -211,6 +229,7 @@ static void control_task(void *pvParameter)
         ESP_LOGI(TAG, "Nothing received");
         return;
     }
+    int64_t press_time = esp_timer_get_time();
     iot_button_stop();
 #if CONFIG_PM_ENABLE
     power_save_set(false);
@@ -219,19 +238,8 @@ static void control_task(void *pvParameter)
     esp_wifi_force_wakeup_acquire();
 #endif
 
-    ESP_LOGI(TAG, "Button event: %d", evt_data);
     if (evt_data == BUTTON_SINGLE_CLICK) {
-        ESP_LOGI(TAG, "switch send press");
-#if CONFIG_EXAMPLE_SWITCH_STATUS_PERSISTED
-        espnow_storage_get(BULB_STATUS_KEY, &status, sizeof(status));
-        status ^= 1;
-        espnow_storage_set(BULB_STATUS_KEY, &status, sizeof(status));
-#else
-        status = 2;
-#endif
-        /* status = 0: OFF, 1: ON, 2: TOGGLE */
-        ESP_LOGI(TAG, "key status: %d", status);
-        espnow_ctrl_initiator_send(ESPNOW_ATTRIBUTE_KEY_1, ESPNOW_ATTRIBUTE_POWER, status);
+        app_switch_send_press(press_time);
     } else if (evt_data == BUTTON_LONG_PRESS_UP) {
         ESP_LOGI(TAG, "switch bind press");
         espnow_ctrl_initiator_bind(ESPNOW_ATTRIBUTE_KEY_1, true);
@@ -239,7 +247,7 @@ static void control_task(void *pvParameter)
         ESP_LOGI(TAG, "switch unbind press");
         espnow_ctrl_initiator_bind(ESPNOW_ATTRIBUTE_KEY_1, false);
     } else {
-        ESP_LOGI(TAG, "event not handled");
+        ESP_LOGI(TAG, "event not handled: %d", evt_data);
     }
 #if CONFIG_PM_ENABLE || CONFIG_ESPNOW_LIGHT_SLEEP
     esp_wifi_force_wakeup_release();
@@ -288,7 +296,6 @@ static void app_switch_button_event_cb(void *arg, void *usr_data)
 static void control_task(void *pvParameter)
 {
     button_event_t evt_data;
-    uint8_t status = 0;
     g_button_queue = xQueueCreate(5, sizeof(button_event_t));
     if (!g_button_queue) {
         ESP_LOGE(TAG, "Error creating queue.");
@@ -305,6 +312,7 @@ static void control_task(void *pvParameter)
             ESP_LOGI(TAG, "Nothing received");
             continue;
         }
+        int64_t press_time = esp_timer_get_time();
 #if CONFIG_PM_ENABLE
         power_save_set(false);
 #endif
@@ -312,19 +320,8 @@ static void control_task(void *pvParameter)
         esp_wifi_force_wakeup_acquire();
 #endif
 
-        ESP_LOGI(TAG, "Button event: %d", evt_data);
         if (evt_data == BUTTON_SINGLE_CLICK) {
-            ESP_LOGI(TAG, "switch send press");
-#if CONFIG_EXAMPLE_SWITCH_STATUS_PERSISTED
-            espnow_storage_get(BULB_STATUS_KEY, &status, sizeof(status));
-            status ^= 1;
-            espnow_storage_set(BULB_STATUS_KEY, &status, sizeof(status));
-#else
-            status = 2;
-#endif
-            /* status = 0: OFF, 1: ON, 2: TOGGLE */
-            ESP_LOGI(TAG, "key status: %d", status);
-            espnow_ctrl_initiator_send(ESPNOW_ATTRIBUTE_KEY_1, ESPNOW_ATTRIBUTE_POWER, status);
+            app_switch_send_press(press_time);
         } else if (evt_data == BUTTON_DOUBLE_CLICK) {
             ESP_LOGI(TAG, "switch bind press");
             espnow_ctrl_initiator_bind(ESPNOW_ATTRIBUTE_KEY_1, true);
@@ -332,7 +329,7 @@ static void control_task(void *pvParameter)
             ESP_LOGI(TAG, "switch unbind press");
             espnow_ctrl_initiator_bind(ESPNOW_ATTRIBUTE_KEY_1, false);
         } else {
-            ESP_LOGI(TAG, "event not handled");
+            ESP_LOGI(TAG, "event not handled: %d", evt_data);
         }
 #if CONFIG_PM_ENABLE || CONFIG_ESPNOW_LIGHT_SLEEP
         esp_wifi_force_wakeup_release();
@@ -420,6 +417,9 @@ static void app_driver_init(void)
 void app_main(void)
 {
     espnow_storage_init();
+#if CONFIG_EXAMPLE_SWITCH_STATUS_PERSISTED
+    espnow_storage_get(BULB_STATUS_KEY, &g_bulb_status, sizeof(g_bulb_status));
+#endif
 
     app_wifi_init();
     app_driver_init();
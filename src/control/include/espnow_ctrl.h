@@ -22,10 +22,14 @@ extern "C" {
 #define ESP_EVENT_ESPNOW_CTRL_UNBIND        (ESP_EVENT_ESPNOW_CTRL_BASE + 1)
 #define ESP_EVENT_ESPNOW_CTRL_BIND_ERROR    (ESP_EVENT_ESPNOW_CTRL_BASE + 2)
 
+#ifndef CONFIG_ESPNOW_CONTROL_BIND_LIST_SIZE
+#define CONFIG_ESPNOW_CONTROL_BIND_LIST_SIZE 32
+#endif
+
 /**
  * @brief Maximum number of device in bind list
  */
-#define ESPNOW_BIND_LIST_MAX_SIZE  32
+#define ESPNOW_BIND_LIST_MAX_SIZE  CONFIG_ESPNOW_CONTROL_BIND_LIST_SIZE
 
 /**
  * @brief Control attribute.
@@ -77,6 +81,12 @@ typedef enum {
     ESPNOW_ATTRIBUTE_STATUS_LOW_BATTERY = 0x0301,
     ESPNOW_ATTRIBUTE_BATTERY_LEVEL      = 0x0302,
     ESPNOW_ATTRIBUTE_CHARGING_STATE     = 0x0303,
+
+    /**< batch */
+    ESPNOW_ATTRIBUTE_BATCH              = 0xff00, /**< A list of espnow_ctrl_tlv_t follows, responder_value_i is its size */
+    ESPNOW_ATTRIBUTE_BATCH_TARGET       = 0xff01, /**< In the list, the updates after it are for the responder of the MAC in its value */
+    ESPNOW_ATTRIBUTE_BATCH_MEMBERS      = 0xff02, /**< In the list, espnow_ctrl_members_t of the responders to acknowledge the batch */
+    ESPNOW_ATTRIBUTE_BATCH_ACK          = 0xff03, /**< Acknowledgement of a batch to the initiator, responder_value_i is its seq */
 } espnow_attribute_t;
 
 typedef enum {
@@ -116,6 +126,49 @@ typedef struct espnow_ctrl_data_s {
     char responder_value_s[0];   /**< NULL terminated string */
 } espnow_ctrl_data_t;
 
+/**
+ * @brief Update in the list of a batch frame, the value is little endian and takes 0 to 4 bytes
+ */
+typedef struct {
+    uint16_t attribute;     /**< Responder's attribute, or ESPNOW_ATTRIBUTE_BATCH_TARGET */
+    uint8_t size;           /**< Size of the value */
+    uint8_t value[0];       /**< Value */
+} __attribute__((packed)) espnow_ctrl_tlv_t;
+
+/**
+ * @brief Update of a responder's attribute in a batch
+ */
+typedef struct {
+    espnow_attribute_t attribute;   /**< Responder's attribute */
+    uint32_t value;                 /**< Responder value */
+} espnow_ctrl_attr_t;
+
+/**
+ * @brief Update of a batch for one responder only
+ */
+typedef struct {
+    uint8_t mac[6];                 /**< Responder's MAC address */
+    espnow_ctrl_attr_t attr;        /**< Update replacing the one for all the responders of the same attribute */
+} espnow_ctrl_override_t;
+
+/**
+ * @brief Responders to acknowledge a batch, each in its time slot after the frame
+ */
+typedef struct {
+    uint16_t seq;           /**< Sending of the initiator, a responder applies the updates of a sending once */
+    uint8_t slot_ms;        /**< Length of a time slot, the responder i in the list acknowledges in the slot i */
+    uint8_t addrs[0][6];    /**< MAC addresses of the responders, a part of them would be shared by two devices */
+} __attribute__((packed)) espnow_ctrl_members_t;
+
+/**
+ * @brief Responder of a reliable sending and its result
+ */
+typedef struct {
+    uint8_t mac[6];         /**< Responder's MAC address */
+    bool acked;             /**< The responder acknowledged the updates */
+    uint8_t tries;          /**< Frames sent to the responder */
+} espnow_ctrl_member_t;
+
 /**
  * @brief  The bind callback function
  *
@@ -143,6 +196,17 @@ typedef void (* espnow_ctrl_data_cb_t)(espnow_attribute_t initiator_attribute,
                                        espnow_attribute_t responder_attribute,
                                        uint32_t responder_value);
 
+/**
+ * @brief  The batch control data callback function, the updates of a frame are given at once
+ *
+ * @param[in]  initiator_attribute  the received initiator's attribute
+ * @param[in]  attrs  the updates for this responder, the overrides for it applied
+ * @param[in]  num  number of the updates
+ *
+ */
+typedef void (* espnow_ctrl_batch_cb_t)(espnow_attribute_t initiator_attribute,
+                                        const espnow_ctrl_attr_t *attrs, size_t num);
+
 /**
  * @brief  The raw control data callback function
  *
@@ -178,6 +242,55 @@ esp_err_t espnow_ctrl_initiator_bind(espnow_attribute_t initiator_attribute, boo
  */
 esp_err_t espnow_ctrl_initiator_send(espnow_attribute_t initiator_attribute, espnow_attribute_t responder_attribute, uint32_t responder_value);
 
+/**
+ * @brief  The initiator sends several updates in one broadcast control data frame, e.g. a scene
+ *
+ * @note   The responders registered with espnow_ctrl_responder_batch() get the updates at once, the others
+ *         get them one by one through the callback of espnow_ctrl_responder_data(). The responders of older
+ *         releases get one update of the attribute ESPNOW_ATTRIBUTE_BATCH.
+ *
+ * @param[in]  initiator_attribute  the sending initiator's attribute
+ * @param[in]  attrs  the updates for all the responders
+ * @param[in]  num  number of the updates for all the responders
+ * @param[in]  overrides  the updates for one responder, grouped by MAC address, may be NULL
+ * @param[in]  override_num  number of the updates for one responder
+ *
+ * @return
+ *    - ESP_OK: succeed
+ *    - ESP_ERR_INVALID_SIZE: the updates do not fit in a frame of ESPNOW_DATA_LEN
+ *    - others: fail
+ */
+esp_err_t espnow_ctrl_initiator_send_batch(espnow_attribute_t initiator_attribute,
+                                           const espnow_ctrl_attr_t *attrs, size_t num,
+                                           const espnow_ctrl_override_t *overrides, size_t override_num);
+
+/**
+ * @brief  The initiator sends a batch to the responders until each acknowledges it or the time is over
+ *
+ * @note   The responders listed in a frame acknowledge it one after the other, in time slots of
+ *         CONFIG_ESPNOW_CONTROL_RELIABLE_SLOT ms. The frame is sent again to the responders not acknowledging it,
+ *         a responder applies the updates once however many frames it gets. The acknowledgements are received on
+ *         the channel of the initiator after sending the frame, the one found with
+ *         CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING. They are taken whatever handler of
+ *         ESPNOW_DATA_TYPE_CONTROL_DATA is set, the other frames are passed on to it while sending.
+ *
+ * @param[in]  initiator_attribute  the sending initiator's attribute
+ * @param[in]  attrs  the updates for all the responders
+ * @param[in]  num  number of the updates
+ * @param[inout]  members  the responders with their MAC address, output whether each acknowledged and the frames sent to it
+ * @param[in]  member_num  number of the responders
+ * @param[in]  wait_ms  time to send the frames in, the last frame sent is waited for
+ *
+ * @return
+ *    - ESP_OK: all the responders acknowledged
+ *    - ESP_ERR_TIMEOUT: some responders did not acknowledge in wait_ms
+ *    - ESP_ERR_INVALID_SIZE: the updates leave no room for a responder in a frame
+ *    - others: fail
+ */
+esp_err_t espnow_ctrl_initiator_send_reliable(espnow_attribute_t initiator_attribute,
+                                              const espnow_ctrl_attr_t *attrs, size_t num,
+                                              espnow_ctrl_member_t *members, size_t member_num, uint32_t wait_ms);
+
 /**
  * @brief  The responder creates a bind task to process the received bind frame
  *
@@ -207,6 +320,31 @@ esp_err_t espnow_ctrl_responder_bind(uint32_t wait_ms, int8_t rssi, espnow_ctrl_
  */
 esp_err_t espnow_ctrl_responder_data(espnow_ctrl_data_cb_t cb);
 
+/**
+ * @brief  The responder registers batch control data callback function
+ *
+ * @param[in]  cb  the batch control data callback function
+ *
+ * @return
+ *    - ESP_OK: succeed
+ *    - others: fail
+ */
+esp_err_t espnow_ctrl_responder_batch(espnow_ctrl_batch_cb_t cb);
+
+/**
+ * @brief  The responder announces its channel to the initiators, which learn it for the next sending
+ *
+ * @note   It is sent on the current channel only, the initiators awake on it learn it. The responders registered
+ *         with espnow_ctrl_responder_data() or espnow_ctrl_responder_batch() announce it on their own when the
+ *         router connected is on a new channel.
+ *
+ * @return
+ *    - ESP_OK: succeed
+ *    - ESP_ERR_NOT_SUPPORTED: CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING is not enabled
+ *    - others: fail
+ */
+esp_err_t espnow_ctrl_responder_announce_channel(void);
+
 /**
  * @brief  The responder gets bound list
  *
@@ -222,7 +360,7 @@ esp_err_t espnow_ctrl_responder_get_bindlist(espnow_ctrl_bind_info_t *list, size
 /**
  * @brief  The responder sets bound list
  *
- * @attention  The bound information will be stored to flash
+ * @attention  The bound information will be stored to flash, it is not bound when the flash write fails
  *
  * @param[in]  info  the bound information to be set
  *
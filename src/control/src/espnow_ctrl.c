@@ -12,11 +12,14 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 
+#include "esp_attr.h"
 #include "esp_wifi.h"
 #include "esp_sleep.h"
 #include "esp_now.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
 #include "esp_mac.h"
@@ -25,6 +28,7 @@
 #include "esp_system.h"
 #endif
 
+#include "esp_event.h"
 #include "esp_event_base.h"
 
 #include "espnow.h"
@@ -35,10 +39,31 @@
 
 
 extern wifi_country_t g_self_country;
+
+#define ESPNOW_BINDLIST_NUM_KEY         "bind_num"
+#define ESPNOW_BINDLIST_ITEM_KEY        "bind_%u"
+#define ESPNOW_BINDLIST_LEGACY_KEY      "bindlist"
+#define ESPNOW_BINDLIST_LEGACY_SIZE     32
+
+/**
+ * @brief Bind list stored as one blob by the older releases, moved to the entries stored one by one
+ */
 typedef struct {
     size_t size;
     bool   is_init;
-    espnow_ctrl_bind_info_t data[ESPNOW_BIND_LIST_MAX_SIZE];
+    espnow_ctrl_bind_info_t data[ESPNOW_BINDLIST_LEGACY_SIZE];
+} espnow_bindlist_legacy_t;
+
+/**
+ * @brief Bound initiators, looked up by (MAC, attribute) in an open addressing index.
+ *        Entry i is stored in the key "bind_<i>", a bind or an unbind only writes the entries it moves.
+ */
+typedef struct {
+    uint16_t size;
+    bool     is_init;
+    espnow_ctrl_bind_info_t *data;  /**< ESPNOW_BIND_LIST_MAX_SIZE entries, the bound ones first */
+    uint16_t *index;                /**< Position in data + 1 by hash with linear probing, 0 for an empty slot */
+    uint16_t index_size;            /**< Power of 2, at least twice ESPNOW_BIND_LIST_MAX_SIZE, never full */
 } espnow_bindlist_t;
 
 static const char *TAG = "espnow_ctrl";
@@ -50,6 +75,7 @@ uint32_t g_timestamp = 0;
 espnow_ctrl_bind_cb_t g_bind_cb = NULL;
 espnow_ctrl_data_cb_t g_data_cb = NULL;
 espnow_ctrl_data_raw_cb_t g_data_raw_cb = NULL;
+espnow_ctrl_batch_cb_t g_batch_cb = NULL;
 
 #ifdef CONFIG_ESPNOW_ALL_SECURITY
 #define CONFIG_ESPNOW_CONTROL_SECURITY 1
@@ -61,8 +87,48 @@ espnow_ctrl_data_raw_cb_t g_data_raw_cb = NULL;
 
 #ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING
 #define ESPNOW_CHANNEL_KEY       "ch_key"
+#define ESPNOW_CHANNEL_HISTORY_KEY "ch_history"
 #define RESEND_SCAN_COUNT_MAX (sizeof(scan_channel_sequence) * 2)
 
+#ifndef CONFIG_ESPNOW_CONTROL_CHANNEL_HISTORY_NUM
+#define CONFIG_ESPNOW_CONTROL_CHANNEL_HISTORY_NUM 8
+#endif
+
+#define ESPNOW_CHANNEL_NUM_MAX      14
+#define ESPNOW_CHANNEL_PROBE_MAX    (ESPNOW_CHANNEL_NUM_MAX * (CONFIG_ESPNOW_CONTROL_RETRANSMISSION_TIMES + 1))
+#define ESPNOW_CHANNEL_HIT          64  /**< Weight of an ACK, the weights of a responder decay by a quarter per ACK */
+#define ESPNOW_CHANNEL_LOSS_PERCENT 30  /**< Chance a probe on the channel of the responders gets no ACK */
+#define ESPNOW_CHANNEL_SAVE_DELAY   1000 /**< ms, the channels heard out of a sending are saved together after it */
+
+/**
+ * @brief Channels a responder was heard on
+ */
+typedef struct {
+    uint8_t mac[6];
+    uint8_t channel;                        /**< Channel of the last ACK or announcement */
+    uint16_t hits[ESPNOW_CHANNEL_NUM_MAX];  /**< Weight of each channel, by ESPNOW_CHANNEL_HIT per ACK */
+    uint32_t seen;                          /**< Sequence of the last time heard, the oldest entry is replaced */
+} espnow_ctrl_channel_entry_t;
+
+typedef struct {
+    uint32_t seq;
+    espnow_ctrl_channel_entry_t entry[CONFIG_ESPNOW_CONTROL_CHANNEL_HISTORY_NUM];
+} espnow_ctrl_channel_history_t;
+
+#ifdef CONFIG_ESPNOW_CONTROL_CHANNEL_RTC_CACHE
+#define ESPNOW_CHANNEL_HISTORY_ATTR RTC_DATA_ATTR   /**< Kept in deep sleep, cleared at power-on */
+#else
+#define ESPNOW_CHANNEL_HISTORY_ATTR
+#endif
+
+static ESPNOW_CHANNEL_HISTORY_ATTR espnow_ctrl_channel_history_t g_channel_history = {0};
+static ESPNOW_CHANNEL_HISTORY_ATTR bool g_channel_history_loaded = false;
+static bool g_channel_history_changed = false;
+/**< The history is learned on the receive task, planned on the sending task and saved by the timer task */
+static portMUX_TYPE g_channel_lock = portMUX_INITIALIZER_UNLOCKED;
+static TimerHandle_t g_channel_save_timer = NULL;
+static uint32_t g_ack_magic = 0;
+
 #ifndef CONFIG_ESPNOW_VERSION
 #define ESPNOW_VERSION                  2
 #else
@@ -92,41 +158,249 @@ static const espnow_frame_head_t g_initiator_frame = {
 };
 #endif
 
-static void espnow_load_bindlist(void)
+static uint32_t espnow_bindlist_hash(const uint8_t *mac, espnow_attribute_t initiator_attribute)
+{
+    uint32_t value = 2166136261UL;
+
+    for (int i = 0; i < 6; ++i) {
+        value = (value ^ mac[i]) * 16777619UL;
+    }
+
+    value = (value ^ (initiator_attribute & 0xff)) * 16777619UL;
+    value = (value ^ ((initiator_attribute >> 8) & 0xff)) * 16777619UL;
+
+    return value;
+}
+
+/**
+ * @brief Slot of the index holding the entry, or the empty slot it would take
+ */
+static uint16_t espnow_bindlist_slot(const uint8_t *mac, espnow_attribute_t initiator_attribute)
+{
+    uint16_t mask = g_bindlist.index_size - 1;
+    uint16_t slot = espnow_bindlist_hash(mac, initiator_attribute) & mask;
+
+    for (; g_bindlist.index[slot]; slot = (slot + 1) & mask) {
+        const espnow_ctrl_bind_info_t *info = g_bindlist.data + g_bindlist.index[slot] - 1;
+
+        if (!memcmp(info->mac, mac, 6) && info->initiator_attribute == initiator_attribute) {
+            break;
+        }
+    }
+
+    return slot;
+}
+
+/**
+ * @brief Empty a slot of the index, the entries probed past it are shifted back so none is left unreachable
+ */
+static void espnow_bindlist_index_remove(uint16_t slot)
+{
+    uint16_t mask = g_bindlist.index_size - 1;
+
+    g_bindlist.index[slot] = 0;
+
+    for (uint16_t next = (slot + 1) & mask; g_bindlist.index[next]; next = (next + 1) & mask) {
+        const espnow_ctrl_bind_info_t *info = g_bindlist.data + g_bindlist.index[next] - 1;
+        uint16_t home = espnow_bindlist_hash(info->mac, info->initiator_attribute) & mask;
+
+        /**< The entry stays unless its home slot is cyclically in (slot, next] */
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            g_bindlist.index[slot] = g_bindlist.index[next];
+            g_bindlist.index[next] = 0;
+            slot = next;
+        }
+    }
+}
+
+/**
+ * @brief Add an entry in RAM only
+ */
+static bool espnow_bindlist_insert(const espnow_ctrl_bind_info_t *info)
+{
+    uint16_t slot = espnow_bindlist_slot(info->mac, info->initiator_attribute);
+
+    if (g_bindlist.index[slot] || g_bindlist.size >= ESPNOW_BIND_LIST_MAX_SIZE) {
+        return false;
+    }
+
+    memcpy(g_bindlist.data[g_bindlist.size].mac, info->mac, 6);
+    g_bindlist.data[g_bindlist.size].initiator_attribute = info->initiator_attribute;
+    g_bindlist.index[slot] = ++g_bindlist.size;
+
+    return true;
+}
+
+static esp_err_t espnow_bindlist_store(uint16_t pos)
+{
+    char key[16] = {0};
+
+    snprintf(key, sizeof(key), ESPNOW_BINDLIST_ITEM_KEY, pos);
+    esp_err_t ret = espnow_storage_set(key, g_bindlist.data + pos, sizeof(espnow_ctrl_bind_info_t));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Store the bindlist entry %d", esp_err_to_name(ret), pos);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Rewrite all the entries, the keys left from a list of old_num entries are erased
+ */
+static esp_err_t espnow_bindlist_store_all(uint16_t old_num)
+{
+    esp_err_t ret = ESP_OK;
+    char key[16]  = {0};
+
+    for (uint16_t i = 0; i < g_bindlist.size && ret == ESP_OK; ++i) {
+        ret = espnow_bindlist_store(i);
+    }
+
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Store the bindlist of %d entries", esp_err_to_name(ret), g_bindlist.size);
+
+    ret = espnow_storage_set(ESPNOW_BINDLIST_NUM_KEY, &g_bindlist.size, sizeof(g_bindlist.size));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Store the bindlist size", esp_err_to_name(ret));
+
+    for (uint16_t i = g_bindlist.size; i < old_num; ++i) {
+        snprintf(key, sizeof(key), ESPNOW_BINDLIST_ITEM_KEY, i);
+        espnow_storage_erase(key);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_load_bindlist(void)
+{
+    if (g_bindlist.is_init) {
+        return ESP_OK;
+    }
+
+    uint16_t num = 0;
+    char key[16] = {0};
+    espnow_ctrl_bind_info_t info = {0};
+
+    for (g_bindlist.index_size = 1; g_bindlist.index_size < ESPNOW_BIND_LIST_MAX_SIZE * 2; g_bindlist.index_size <<= 1);
+
+    g_bindlist.data  = ESP_CALLOC(ESPNOW_BIND_LIST_MAX_SIZE, sizeof(espnow_ctrl_bind_info_t));
+    g_bindlist.index = ESP_CALLOC(g_bindlist.index_size, sizeof(uint16_t));
+
+    if (!g_bindlist.data || !g_bindlist.index) {
+        ESP_LOGE(TAG, "[%s, %d] OOM allocating the bindlist of %d entries", __func__, __LINE__, ESPNOW_BIND_LIST_MAX_SIZE);
+        ESP_FREE(g_bindlist.data);
+        ESP_FREE(g_bindlist.index);
+        return ESP_ERR_NO_MEM;
+    }
+
+    g_bindlist.size    = 0;
+    g_bindlist.is_init = true;
+
+    if (espnow_storage_get(ESPNOW_BINDLIST_NUM_KEY, &num, sizeof(num)) == ESP_OK) {
+        for (uint16_t i = 0; i < num; ++i) {
+            snprintf(key, sizeof(key), ESPNOW_BINDLIST_ITEM_KEY, i);
+
+            if (espnow_storage_get(key, &info, sizeof(info)) == ESP_OK) {
+                espnow_bindlist_insert(&info);
+            }
+        }
+
+        /**< An unbind cut short leaves an entry twice, or an entry missing, the positions are stored again */
+        if (g_bindlist.size != num) {
+            espnow_bindlist_store_all(num);
+        }
+    } else {
+        espnow_bindlist_legacy_t *legacy = ESP_CALLOC(1, sizeof(espnow_bindlist_legacy_t));
+
+        if (legacy && espnow_storage_get(ESPNOW_BINDLIST_LEGACY_KEY, legacy, sizeof(espnow_bindlist_legacy_t)) == ESP_OK) {
+            for (size_t i = 0; i < MIN(legacy->size, ESPNOW_BINDLIST_LEGACY_SIZE); ++i) {
+                espnow_bindlist_insert(legacy->data + i);
+            }
+
+            ESP_LOGI(TAG, "Move the bindlist of %d entries to the entry keys", g_bindlist.size);
+            espnow_bindlist_store_all(0);
+            espnow_storage_erase(ESPNOW_BINDLIST_LEGACY_KEY);
+        }
+
+        ESP_FREE(legacy);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_bindlist_add(const espnow_ctrl_bind_info_t *info)
 {
-    if(!g_bindlist.is_init) {
-        espnow_storage_get("bindlist", &g_bindlist, sizeof(g_bindlist));
-        g_bindlist.is_init = true;
+    if (g_bindlist.index[espnow_bindlist_slot(info->mac, info->initiator_attribute)]) {
+        return ESP_OK;
+    }
+
+    if (!espnow_bindlist_insert(info)) {
+        return ESP_ERR_ESPNOW_FULL;
+    }
+
+    esp_err_t ret = espnow_bindlist_store(g_bindlist.size - 1);
+
+    if (ret == ESP_OK) {
+        ret = espnow_storage_set(ESPNOW_BINDLIST_NUM_KEY, &g_bindlist.size, sizeof(g_bindlist.size));
+    }
+
+    /**< The entry is not kept in RAM when it is not in the flash, the initiator binds again */
+    if (ret != ESP_OK) {
+        espnow_bindlist_index_remove(espnow_bindlist_slot(info->mac, info->initiator_attribute));
+        memset(g_bindlist.data + --g_bindlist.size, 0, sizeof(espnow_ctrl_bind_info_t));
     }
+
+    return ret;
 }
 
-static void espnow_remove_item_from_bindlist(int item_index)
+static esp_err_t espnow_remove_item_from_bindlist(uint16_t slot)
 {
+    esp_err_t ret = ESP_OK;
+    esp_err_t err = ESP_OK;
+    char key[16]  = {0};
+    uint16_t pos  = g_bindlist.index[slot] - 1;
+    uint16_t last = g_bindlist.size - 1;
+
+    espnow_bindlist_index_remove(slot);
+
+    /**< The last entry fills the hole, the entries are kept packed for espnow_ctrl_responder_get_bindlist() */
+    if (pos != last) {
+        memcpy(g_bindlist.data + pos, g_bindlist.data + last, sizeof(espnow_ctrl_bind_info_t));
+        slot = espnow_bindlist_slot(g_bindlist.data[last].mac, g_bindlist.data[last].initiator_attribute);
+        g_bindlist.index[slot] = pos + 1;
+        ret = espnow_bindlist_store(pos);
+    }
+
+    memset(g_bindlist.data + last, 0, sizeof(espnow_ctrl_bind_info_t));
     g_bindlist.size--;
 
-    memcpy(g_bindlist.data + item_index, g_bindlist.data + g_bindlist.size, sizeof(espnow_ctrl_bind_info_t));
-    memset(g_bindlist.data + g_bindlist.size, 0, sizeof(espnow_ctrl_bind_info_t));
+    /**< The list loaded again is repaired by espnow_load_bindlist() if a write is missing */
+    err = espnow_storage_set(ESPNOW_BINDLIST_NUM_KEY, &g_bindlist.size, sizeof(g_bindlist.size));
+    snprintf(key, sizeof(key), ESPNOW_BINDLIST_ITEM_KEY, last);
+    espnow_storage_erase(key);
+
+    /**< The first error is returned, the later writes are still tried */
+    if (err != ESP_OK && ret == ESP_OK) {
+        ret = err;
+    }
+
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Remove the bindlist entry %d", esp_err_to_name(ret), pos);
 
-    espnow_storage_set("bindlist", &g_bindlist, sizeof(g_bindlist));
-    return;
+    return ESP_OK;
 }
 
 static bool espnow_ctrl_responder_is_bindlist(const uint8_t *mac, espnow_attribute_t initiator_attribute)
 {
-    espnow_load_bindlist();
-    for (int i = 0; i < g_bindlist.size; ++i) {
-        if (!memcmp(g_bindlist.data[i].mac, mac, 6)
-                && g_bindlist.data[i].initiator_attribute == initiator_attribute) {
-            return true;
-        }
+    if (espnow_load_bindlist() != ESP_OK) {
+        return false;
     }
 
-    return false;
+    return g_bindlist.index[espnow_bindlist_slot(mac, initiator_attribute)] != 0;
 }
 
 esp_err_t espnow_ctrl_responder_get_bindlist(espnow_ctrl_bind_info_t *list, size_t *size)
 {
-    espnow_load_bindlist();
+    ESP_PARAM_CHECK(size);
+
+    esp_err_t ret = espnow_load_bindlist();
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_load_bindlist");
+
     if (!list) {
         *size = g_bindlist.size;
     } else {
@@ -139,75 +413,293 @@ esp_err_t espnow_ctrl_responder_get_bindlist(espnow_ctrl_bind_info_t *list, size
 
 esp_err_t espnow_ctrl_responder_set_bindlist(const espnow_ctrl_bind_info_t *info)
 {
-    espnow_load_bindlist();
-    if (g_bindlist.size >= ESPNOW_BIND_LIST_MAX_SIZE) {
-        return ESP_ERR_ESPNOW_FULL;
-    }
+    ESP_PARAM_CHECK(info);
 
-    if (!espnow_ctrl_responder_is_bindlist(info->mac, info->initiator_attribute)) {
-        memcpy(g_bindlist.data + g_bindlist.size, info, sizeof(espnow_ctrl_bind_info_t));
-        g_bindlist.size++;
-        espnow_storage_set("bindlist", &g_bindlist, sizeof(g_bindlist));
-    }
+    esp_err_t ret = espnow_load_bindlist();
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_load_bindlist");
 
-    return ESP_OK;
+    return espnow_bindlist_add(info);
 }
 
 esp_err_t espnow_ctrl_responder_remove_bindlist(const espnow_ctrl_bind_info_t *info)
 {
-    espnow_load_bindlist();
-    for (int i = 0; i < g_bindlist.size; ++i) {
-        if (!memcmp(g_bindlist.data + i, info, sizeof(espnow_ctrl_bind_info_t))) {
-            espnow_remove_item_from_bindlist(i);
-            break;
-        }
+    ESP_PARAM_CHECK(info);
+
+    esp_err_t ret = espnow_load_bindlist();
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_load_bindlist");
+
+    uint16_t slot = espnow_bindlist_slot(info->mac, info->initiator_attribute);
+
+    if (g_bindlist.index[slot]) {
+        ret = espnow_remove_item_from_bindlist(slot);
     }
 
-    return ESP_OK;
+    return ret;
 }
 
 esp_err_t espnow_ctrl_responder_clear_bindlist(void)
 {
-    memset(g_bindlist.data, 0, sizeof(espnow_ctrl_bind_info_t)*ESPNOW_BIND_LIST_MAX_SIZE);
+    esp_err_t ret = espnow_load_bindlist();
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_load_bindlist");
+
+    uint16_t num = g_bindlist.size;
+
+    memset(g_bindlist.data, 0, sizeof(espnow_ctrl_bind_info_t) * ESPNOW_BIND_LIST_MAX_SIZE);
+    memset(g_bindlist.index, 0, sizeof(uint16_t) * g_bindlist.index_size);
     g_bindlist.size = 0;
-    espnow_storage_set("bindlist", &g_bindlist, sizeof(g_bindlist));
 
-    return ESP_OK;
+    return espnow_bindlist_store_all(num);
 }
 
 #ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_FORWARD
-static esp_err_t espnow_ctrl_responder_forward(uint8_t type, uint8_t *src_addr, const void *data, size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
+#ifndef CONFIG_ESPNOW_CONTROL_RELAY_WINDOW
+#define CONFIG_ESPNOW_CONTROL_RELAY_WINDOW  60
+#endif
+
+#ifndef CONFIG_ESPNOW_CONTROL_RELAY_RATE
+#define CONFIG_ESPNOW_CONTROL_RELAY_RATE    4
+#endif
+
+#define ESPNOW_RELAY_QUEUE_SIZE     8
+#define ESPNOW_RELAY_PENDING_NUM    8
+#define ESPNOW_RELAY_SOURCE_NUM     8   /**< Initiators the rate of relaying is limited for */
+#define ESPNOW_RELAY_RSSI_STRONG    (-30)
+#define ESPNOW_RELAY_RSSI_WEAK      (-90)
+
+/**
+ * @brief A frame to relay, or with no data the magic of a frame relayed by another responder
+ */
+typedef struct {
+    uint32_t magic;
+    TickType_t due;                 /**< Relayed at this tick unless another responder relays it first */
+    size_t size;
+    espnow_forward_data_t data[0];
+} espnow_ctrl_relay_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint8_t tokens;                 /**< Relays left, one more every 1000 / CONFIG_ESPNOW_CONTROL_RELAY_RATE ms */
+    TickType_t refill;              /**< Tick of the last token added */
+} espnow_ctrl_relay_source_t;
+
+static QueueHandle_t g_relay_queue = NULL;
+static espnow_ctrl_relay_source_t g_relay_source[ESPNOW_RELAY_SOURCE_NUM] = {0};
+
+/**
+ * @brief Take a token of the initiator, the initiator relayed the least recently is replaced
+ */
+static bool espnow_ctrl_relay_allow(const uint8_t *src_addr)
+{
+    TickType_t now     = xTaskGetTickCount();
+    TickType_t period  = pdMS_TO_TICKS(1000 / CONFIG_ESPNOW_CONTROL_RELAY_RATE);
+    espnow_ctrl_relay_source_t *source = NULL;
+
+    for (int i = 0; i < ESPNOW_RELAY_SOURCE_NUM; ++i) {
+        if (!memcmp(g_relay_source[i].mac, src_addr, 6)) {
+            source = g_relay_source + i;
+            break;
+        }
+
+        if (!source || now - g_relay_source[i].refill > now - source->refill) {
+            source = g_relay_source + i;
+        }
+    }
+
+    if (memcmp(source->mac, src_addr, 6)) {
+        memcpy(source->mac, src_addr, 6);
+        source->tokens = CONFIG_ESPNOW_CONTROL_RELAY_RATE;
+        source->refill = now;
+    }
+
+    if (period && now - source->refill >= period) {
+        TickType_t num = (now - source->refill) / period;
+        source->tokens = MIN(source->tokens + num, CONFIG_ESPNOW_CONTROL_RELAY_RATE);
+        source->refill += num * period;
+    }
+
+    if (!source->tokens) {
+        return false;
+    }
+
+    source->tokens--;
+
+    return true;
+}
+
+static void espnow_ctrl_relay_send(espnow_ctrl_relay_t *relay)
 {
     uint8_t primary           = 0;
     wifi_second_chan_t second = 0;
-    int retransmit_count = 0;
+
+    esp_wifi_get_channel(&primary, &second);
+
+    for (int i = 0; i < g_self_country.nchan; ++i) {
+        uint8_t channel = g_self_country.schan + i;
+
+        /**< The channel can not be switched when connected to a router */
+        if (channel != primary && esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE) != ESP_OK) {
+            continue;
+        }
+
+        /**< The channel of the frame is the one it is sent on, as the receivers filter the adjacent channels */
+        relay->data->frame_head.channel = channel;
+        esp_now_send(ESPNOW_ADDR_BROADCAST, (uint8_t *)relay->data, relay->size);
+    }
+
+    esp_wifi_set_channel(primary, second);
+}
+
+/**
+ * @brief Relay the frames off the task of the receiving. A frame waits a time growing with the weaker RSSI it was
+ *        heard with, and is dropped when another responder relays it first, so the responder hearing the initiator
+ *        the best relays it for the responders around.
+ */
+static void espnow_ctrl_relay_task(void *arg)
+{
+    espnow_ctrl_relay_t *pending[ESPNOW_RELAY_PENDING_NUM] = {NULL};
+    espnow_ctrl_relay_t *relay = NULL;
+    uint32_t relayed[ESPNOW_RELAY_PENDING_NUM] = {0};  /**< Magic of the frames relayed by others, heard maybe before them */
+    size_t relayed_next = 0;
+
+    for (;;) {
+        TickType_t now  = xTaskGetTickCount();
+        TickType_t wait = portMAX_DELAY;
+
+        for (int i = 0; i < ESPNOW_RELAY_PENDING_NUM; ++i) {
+            if (!pending[i]) {
+                continue;
+            }
+
+            if ((int32_t)(pending[i]->due - now) > 0) {
+                wait = MIN(wait, pending[i]->due - now);
+                continue;
+            }
+
+            if (espnow_ctrl_relay_allow(pending[i]->data->src_addr)) {
+                espnow_ctrl_relay_send(pending[i]);
+            } else {
+                ESP_LOGD(TAG, "Relay rate limited, src_addr: "MACSTR, MAC2STR(pending[i]->data->src_addr));
+            }
+
+            ESP_FREE(pending[i]);
+        }
+
+        if (xQueueReceive(g_relay_queue, &relay, wait) != pdPASS) {
+            continue;
+        }
+
+        if (!relay->size) {
+            relayed[relayed_next] = relay->magic;
+            relayed_next = (relayed_next + 1) % ESPNOW_RELAY_PENDING_NUM;
+
+            for (int i = 0; i < ESPNOW_RELAY_PENDING_NUM; ++i) {
+                if (pending[i] && pending[i]->magic == relay->magic) {
+                    ESP_LOGD(TAG, "Relay cancelled, magic: 0x%" PRIx32, relay->magic);
+                    ESP_FREE(pending[i]);
+                }
+            }
+
+            ESP_FREE(relay);
+            continue;
+        }
+
+        for (int i = 0; relay && i < ESPNOW_RELAY_PENDING_NUM; ++i) {
+            if (relayed[i] == relay->magic) {
+                ESP_FREE(relay);
+            }
+        }
+
+        for (int i = 0; relay && i < ESPNOW_RELAY_PENDING_NUM; ++i) {
+            if (!pending[i]) {
+                pending[i] = relay;
+                relay      = NULL;
+            }
+        }
+
+        if (relay) {
+            ESP_LOGW(TAG, "Relay dropped, %d frames pending", ESPNOW_RELAY_PENDING_NUM);
+            ESP_FREE(relay);
+        }
+    }
+}
+
+/**
+ * @brief A control frame heard again from another device than the initiator is relayed by a responder
+ */
+static void espnow_ctrl_relay_duplicate(espnow_data_type_t type, const uint8_t *addr, const uint8_t *src_addr,
+                                        const espnow_frame_head_t *frame_head, const wifi_pkt_rx_ctrl_t *rx_ctrl)
+{
+    if ((type != ESPNOW_DATA_TYPE_CONTROL_BIND && type != ESPNOW_DATA_TYPE_CONTROL_DATA) || !memcmp(addr, src_addr, 6)) {
+        return;
+    }
+
+    espnow_ctrl_relay_t *relay = ESP_CALLOC(1, sizeof(espnow_ctrl_relay_t));
+
+    if (!relay) {
+        return;
+    }
+
+    relay->magic = frame_head->magic;
+
+    if (xQueueSend(g_relay_queue, &relay, 0) != pdPASS) {
+        ESP_FREE(relay);
+    }
+}
+
+static esp_err_t espnow_ctrl_responder_forward(uint8_t type, uint8_t *src_addr, const void *data, size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
+{
     espnow_ctrl_data_t *ctrl_data = (espnow_ctrl_data_t *)data;
-    espnow_forward_data_t *espnow_data = ESP_MALLOC(sizeof(espnow_forward_data_t) + size);
-    if (!espnow_data) {
+    espnow_ctrl_relay_t *relay    = NULL;
+    int rssi = MIN(MAX(rx_ctrl->rssi, ESPNOW_RELAY_RSSI_WEAK), ESPNOW_RELAY_RSSI_STRONG);
+
+    if (!ctrl_data->frame_head.forward_ttl) {
+        return ESP_OK;
+    }
+
+    if (!g_relay_queue) {
+        g_relay_queue = xQueueCreate(ESPNOW_RELAY_QUEUE_SIZE, sizeof(espnow_ctrl_relay_t *));
+        ESP_ERROR_RETURN(!g_relay_queue, ESP_ERR_NO_MEM, "Create the relay queue");
+
+        if (xTaskCreate(espnow_ctrl_relay_task, "espnow_ctrl_relay", 3 * 1024, NULL,
+                        tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+            vQueueDelete(g_relay_queue);
+            g_relay_queue = NULL;
+            ESP_LOGE(TAG, "Create the relay task");
+            return ESP_ERR_NO_MEM;
+        }
+
+        espnow_set_duplicate_cb(espnow_ctrl_relay_duplicate);
+    }
+
+    relay = ESP_MALLOC(sizeof(espnow_ctrl_relay_t) + sizeof(espnow_forward_data_t) + size);
+    if (!relay) {
         ESP_LOGE(TAG, "[%s, %d] OOM allocating forward buffer (%u B)",
                  __func__, __LINE__, (unsigned)(sizeof(espnow_forward_data_t) + size));
         return ESP_ERR_NO_MEM;
     }
 
-    espnow_data->type = type;
-    espnow_data->version = ESPNOW_VERSION;
+    relay->magic = ctrl_data->frame_head.magic;
+    relay->size  = sizeof(espnow_forward_data_t) + size;
+    relay->due   = xTaskGetTickCount() + pdMS_TO_TICKS(CONFIG_ESPNOW_CONTROL_RELAY_WINDOW * (ESPNOW_RELAY_RSSI_STRONG - rssi)
+                   / (ESPNOW_RELAY_RSSI_STRONG - ESPNOW_RELAY_RSSI_WEAK) + esp_random() % (CONFIG_ESPNOW_CONTROL_RELAY_WINDOW / 8 + 1));
+
+    relay->data->type = type;
+    relay->data->version = ESPNOW_VERSION;
     /* 'size' is uint8_t for wire compatibility with esp-now <= v2.5.3; the
      * authoritative length passed to esp_now_send is the size_t 'size' arg. */
-    espnow_data->size = (uint8_t)size;
-    memcpy(&espnow_data->frame_head, &ctrl_data->frame_head, sizeof(espnow_frame_head_t));
-    memcpy(espnow_data->dest_addr, ESPNOW_ADDR_BROADCAST, 6);
-    memcpy(espnow_data->src_addr, src_addr, 6);
-    memcpy(espnow_data->payload, data, size);
-
-    esp_wifi_get_channel(&primary, &second);
-    while (retransmit_count < g_self_country.nchan) {
-        esp_wifi_set_channel(g_self_country.schan + retransmit_count, WIFI_SECOND_CHAN_NONE);
-        esp_now_send(ESPNOW_ADDR_BROADCAST, (uint8_t *)espnow_data, sizeof(espnow_forward_data_t) + size);
-        retransmit_count++;
+    relay->data->size = (uint8_t)size;
+    memcpy(&relay->data->frame_head, &ctrl_data->frame_head, sizeof(espnow_frame_head_t));
+    relay->data->frame_head.forward_ttl--;
+    memcpy(relay->data->dest_addr, ESPNOW_ADDR_BROADCAST, 6);
+    memcpy(relay->data->src_addr, src_addr, 6);
+    memcpy(relay->data->payload, data, size);
+
+    if (xQueueSend(g_relay_queue, &relay, 0) != pdPASS) {
+        ESP_LOGW(TAG, "[%s, %d] Relay queue full", __func__, __LINE__);
+        ESP_FREE(relay);
+        return ESP_FAIL;
     }
-    esp_wifi_set_channel(primary, second);
 
-    ESP_FREE(espnow_data);
     return ESP_OK;
 }
 #endif
@@ -254,31 +746,35 @@ static esp_err_t espnow_ctrl_responder_bind_process(uint8_t *src_addr, void *dat
                 &bind_error, sizeof(bind_error), 0);
         } else if (bind_cb_flag){
             if (!espnow_ctrl_responder_is_bindlist(src_addr, ctrl_data->initiator_attribute)) {
-                g_bindlist.data[g_bindlist.size].initiator_attribute = ctrl_data->initiator_attribute;
-                memcpy(g_bindlist.data[g_bindlist.size].mac, src_addr, 6);
+                espnow_ctrl_bind_info_t bind_info = {
+                    .initiator_attribute = ctrl_data->initiator_attribute,
+                };
+                memcpy(bind_info.mac, src_addr, 6);
 
                 esp_event_post(ESP_EVENT_ESPNOW, ESP_EVENT_ESPNOW_CTRL_BIND,
-                                g_bindlist.data + g_bindlist.size, sizeof(espnow_ctrl_bind_info_t), 0);
+                                &bind_info, sizeof(espnow_ctrl_bind_info_t), 0);
 #ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING
                 vTaskDelay(pdMS_TO_TICKS(100));
 #endif
-                g_bindlist.size++;
-                espnow_storage_set("bindlist", &g_bindlist, sizeof(g_bindlist));
+                if (espnow_bindlist_add(&bind_info) != ESP_OK) {
+                    ESP_LOGW(TAG, "Bind " MACSTR " fail", MAC2STR(src_addr));
+                }
             }
         }
-    } else {
-        for (int i = 0; i < g_bindlist.size; ++i) {
-            if (!memcmp(g_bindlist.data[i].mac, src_addr, 6)
-                    && g_bindlist.data[i].initiator_attribute == ctrl_data->initiator_attribute) {
-                esp_event_post(ESP_EVENT_ESPNOW, ESP_EVENT_ESPNOW_CTRL_UNBIND,
-                                g_bindlist.data + i, sizeof(espnow_ctrl_bind_info_t), 0);
+    } else if (espnow_ctrl_responder_is_bindlist(src_addr, ctrl_data->initiator_attribute)) {
+        uint16_t slot = espnow_bindlist_slot(src_addr, ctrl_data->initiator_attribute);
+
+        esp_event_post(ESP_EVENT_ESPNOW, ESP_EVENT_ESPNOW_CTRL_UNBIND,
+                        g_bindlist.data + g_bindlist.index[slot] - 1, sizeof(espnow_ctrl_bind_info_t), 0);
 #ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING
-                vTaskDelay(pdMS_TO_TICKS(100));
+        vTaskDelay(pdMS_TO_TICKS(100));
 #endif
 
-                espnow_remove_item_from_bindlist(i);
-                break;
-            }
+        /**< The bindlist may have changed in the delay */
+        slot = espnow_bindlist_slot(src_addr, ctrl_data->initiator_attribute);
+
+        if (g_bindlist.index[slot]) {
+            espnow_remove_item_from_bindlist(slot);
         }
     }
 
@@ -302,26 +798,314 @@ esp_err_t espnow_ctrl_responder_bind(uint32_t wait_ms, int8_t rssi, espnow_ctrl_
     return ESP_OK;
 }
 
-static esp_err_t espnow_ctrl_responder_data_process(uint8_t *src_addr, void *data,
-                      size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
+/**
+ * @brief Updates of a batch for this responder, an update for it replaces the one for all with the same attribute
+ */
+static size_t espnow_ctrl_batch_parse(const uint8_t *list, size_t size, const uint8_t *self_mac, espnow_ctrl_attr_t *attrs)
 {
-    ESP_PARAM_CHECK(src_addr);
-    ESP_PARAM_CHECK(data);
-    ESP_PARAM_CHECK(size);
-    ESP_PARAM_CHECK(rx_ctrl);
-
-    espnow_ctrl_data_t *ctrl_data = (espnow_ctrl_data_t *)data;
-    ESP_LOGD(TAG, "src_addr: "MACSTR", espnow_ctrl_responder_recv, value: %d",
-                MAC2STR(src_addr), ctrl_data->responder_value_i);
+    size_t num    = 0;
+    bool selected = true;
 
-#ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING
-    if (ctrl_data->frame_head.ack) {
-        espnow_send(ESPNOW_DATA_TYPE_ACK, ESPNOW_ADDR_BROADCAST, &ctrl_data->frame_head, sizeof(ctrl_data->frame_head), &ctrl_data->frame_head, pdMS_TO_TICKS(100));
-    }
-#endif
+    for (size_t offset = 0; offset + sizeof(espnow_ctrl_tlv_t) <= size;) {
+        const espnow_ctrl_tlv_t *item = (const espnow_ctrl_tlv_t *)(list + offset);
+        uint16_t attribute = item->attribute;
+        uint8_t item_size  = item->size;
+        uint32_t value     = 0;
+        size_t i           = 0;
+
+        if (offset + sizeof(espnow_ctrl_tlv_t) + item_size > size) {
+            break;
+        }
+
+        offset += sizeof(espnow_ctrl_tlv_t) + item_size;
+
+        if (attribute == ESPNOW_ATTRIBUTE_BATCH_TARGET) {
+            selected = item_size == 6 && (!memcmp(item->value, self_mac, 6) || ESPNOW_ADDR_IS_BROADCAST(item->value));
+            continue;
+        }
+
+        if (attribute == ESPNOW_ATTRIBUTE_BATCH_MEMBERS) {
+            continue;
+        }
+
+        if (!selected || item_size > sizeof(value)) {
+            continue;
+        }
+
+        for (int n = 0; n < item_size; ++n) {
+            value |= (uint32_t)item->value[n] << (n * 8);
+        }
+
+        for (i = 0; i < num && attrs[i].attribute != attribute; ++i);
+
+        attrs[i].attribute = attribute;
+        attrs[i].value     = value;
+        num += (i == num);
+    }
+
+    return num;
+}
+
+static void espnow_ctrl_responder_batch_process(const espnow_ctrl_data_t *ctrl_data, size_t size)
+{
+    size_t list_size = MIN((size_t)ctrl_data->responder_value_i, size - sizeof(espnow_ctrl_data_t));
+    uint8_t self_mac[6] = {0};
+    espnow_ctrl_attr_t *attrs = NULL;
+    size_t num = 0;
+
+    if (!g_batch_cb && !g_data_cb) {
+        return;
+    }
+
+    attrs = ESP_MALLOC(MAX(list_size / sizeof(espnow_ctrl_tlv_t), 1) * sizeof(espnow_ctrl_attr_t));
+
+    if (!attrs) {
+        ESP_LOGE(TAG, "[%s, %d] OOM allocating the batch of %u B", __func__, __LINE__, (unsigned)list_size);
+        return;
+    }
+
+    esp_wifi_get_mac(WIFI_IF_STA, self_mac);
+    num = espnow_ctrl_batch_parse((const uint8_t *)ctrl_data->responder_value_s, list_size, self_mac, attrs);
+
+    /**< The application not taking batches gets the updates one by one */
+    if (g_batch_cb) {
+        g_batch_cb(ctrl_data->initiator_attribute, attrs, num);
+    } else {
+        for (size_t i = 0; i < num; ++i) {
+            g_data_cb(ctrl_data->initiator_attribute, attrs[i].attribute, attrs[i].value);
+        }
+    }
+
+    ESP_FREE(attrs);
+}
+
+#ifndef CONFIG_ESPNOW_CONTROL_RELIABLE_SLOT
+#define CONFIG_ESPNOW_CONTROL_RELIABLE_SLOT 8
+#endif
+
+#define ESPNOW_RELIABLE_MARGIN_MS   30  /**< Wait after the last slot, the responders take the frame at different times */
+#define ESPNOW_RELIABLE_SOURCE_NUM  4   /**< Initiators the last sending applied is kept for */
+#define ESPNOW_RELIABLE_MEMBERS_MAX ((UINT8_MAX - sizeof(espnow_ctrl_members_t)) / 6)
+
+/**
+ * @brief Reliable sending of the initiator, the acknowledgements are taken in the espnow task
+ */
+typedef struct {
+    uint16_t seq;
+    espnow_ctrl_member_t *members;
+    size_t num;
+    bool *in_frame;             /**< The member is listed in the frame waiting for the acknowledgements */
+    size_t waiting;             /**< Members listed in the frame not acknowledging it yet */
+} espnow_ctrl_reliable_t;
+
+typedef struct {
+    uint8_t mac[6];
+    uint16_t seq;
+} espnow_ctrl_reliable_source_t;
+
+typedef struct {
+    espnow_addr_t dest_addr;
+    espnow_attribute_t initiator_attribute;
+    uint16_t seq;
+    bool pending;
+} espnow_ctrl_reliable_reply_t;
+
+static espnow_ctrl_reliable_t g_reliable = {0};
+static SemaphoreHandle_t g_reliable_sem = NULL;
+static portMUX_TYPE g_reliable_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static espnow_ctrl_reliable_source_t g_reliable_source[ESPNOW_RELIABLE_SOURCE_NUM] = {0};
+static size_t g_reliable_source_next = 0;
+static TimerHandle_t g_reliable_timer = NULL;
+static espnow_ctrl_reliable_reply_t g_reliable_reply = {0};
+static handler_for_data_t g_reliable_next_handle = NULL; /**< Handler of the control frames while sending, if any */
+
+static void espnow_ctrl_initiator_reliable_ack(const uint8_t *src_addr, const espnow_ctrl_data_t *ctrl_data)
+{
+    bool done = false;
+
+    portENTER_CRITICAL(&g_reliable_lock);
+
+    if (g_reliable.members && (uint16_t)ctrl_data->responder_value_i == g_reliable.seq) {
+        for (size_t i = 0; i < g_reliable.num; ++i) {
+            espnow_ctrl_member_t *member = g_reliable.members + i;
+
+            if (member->acked || memcmp(member->mac, src_addr, 6)) {
+                continue;
+            }
+
+            member->acked = true;
+            done = g_reliable.in_frame[i] && g_reliable.waiting && !--g_reliable.waiting;
+            break;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_reliable_lock);
+
+    /**< The semaphore is never deleted, a late give is taken off before the next frame */
+    if (done) {
+        xSemaphoreGive(g_reliable_sem);
+    }
+}
+
+static void espnow_ctrl_reliable_timer_cb(TimerHandle_t timer)
+{
+    espnow_ctrl_reliable_reply_t reply = {0};
+    espnow_frame_head_t frame_head = {
+        .broadcast = true,
+        .security  = CONFIG_ESPNOW_CONTROL_SECURITY,
+    };
+
+    portENTER_CRITICAL(&g_reliable_lock);
+    reply = g_reliable_reply;
+    g_reliable_reply.pending = false;
+    portEXIT_CRITICAL(&g_reliable_lock);
+
+    if (!reply.pending) {
+        return;
+    }
+
+    espnow_ctrl_data_t data = {
+        .initiator_attribute = reply.initiator_attribute,
+        .responder_attribute = ESPNOW_ATTRIBUTE_BATCH_ACK,
+        .responder_value_i   = reply.seq,
+    };
+
+    /**< Broadcast with the destination in the header, the initiator is not a peer. The timer service task
+         waits no longer than a slot for the radio, an acknowledgement later than its slot is of no use */
+    esp_err_t ret = espnow_send(ESPNOW_DATA_TYPE_CONTROL_DATA, reply.dest_addr, &data, sizeof(espnow_ctrl_data_t),
+                                &frame_head, pdMS_TO_TICKS(CONFIG_ESPNOW_CONTROL_RELIABLE_SLOT));
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "<%s> Send the acknowledgement of the batch", esp_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Responders to acknowledge a batch, true when the updates are to be applied: once per sending of an initiator.
+ *        A responder listed acknowledges in its slot, again for each frame as the initiator may not have got it.
+ */
+static bool espnow_ctrl_responder_members(const uint8_t *src_addr, const espnow_ctrl_data_t *ctrl_data, size_t size)
+{
+    size_t list_size = MIN((size_t)ctrl_data->responder_value_i, size - sizeof(espnow_ctrl_data_t));
+    const uint8_t *list = (const uint8_t *)ctrl_data->responder_value_s;
+    const espnow_ctrl_members_t *members = NULL;
+    size_t member_num = 0;
+    uint8_t self_mac[6] = {0};
+    bool apply = true;
+    size_t i = 0;
+
+    for (size_t offset = 0; offset + sizeof(espnow_ctrl_tlv_t) <= list_size;) {
+        const espnow_ctrl_tlv_t *item = (const espnow_ctrl_tlv_t *)(list + offset);
+
+        if (offset + sizeof(espnow_ctrl_tlv_t) + item->size > list_size) {
+            break;
+        }
+
+        offset += sizeof(espnow_ctrl_tlv_t) + item->size;
+
+        if (item->attribute == ESPNOW_ATTRIBUTE_BATCH_MEMBERS && item->size >= sizeof(espnow_ctrl_members_t)) {
+            members    = (const espnow_ctrl_members_t *)item->value;
+            member_num = (item->size - sizeof(espnow_ctrl_members_t)) / 6;
+        }
+    }
+
+    if (!members) {
+        return true;
+    }
+
+    /**< Only the espnow task gets here */
+    for (i = 0; i < ESPNOW_RELIABLE_SOURCE_NUM && memcmp(g_reliable_source[i].mac, src_addr, 6); ++i);
+
+    if (i < ESPNOW_RELIABLE_SOURCE_NUM) {
+        apply = g_reliable_source[i].seq != members->seq;
+    } else {
+        i = g_reliable_source_next;
+        g_reliable_source_next = (g_reliable_source_next + 1) % ESPNOW_RELIABLE_SOURCE_NUM;
+        memcpy(g_reliable_source[i].mac, src_addr, 6);
+    }
+
+    g_reliable_source[i].seq = members->seq;
+
+    esp_wifi_get_mac(WIFI_IF_STA, self_mac);
+
+    for (i = 0; i < member_num && memcmp(members->addrs[i], self_mac, 6); ++i);
+
+    if (i == member_num) {
+        return apply;
+    }
+
+    if (!g_reliable_timer) {
+        g_reliable_timer = xTimerCreate("espnow_ctrl_ack", 1, pdFALSE, NULL, espnow_ctrl_reliable_timer_cb);
+
+        if (!g_reliable_timer) {
+            ESP_LOGW(TAG, "Create the timer of the batch acknowledgement");
+            return apply;
+        }
+    }
+
+    portENTER_CRITICAL(&g_reliable_lock);
+    memcpy(g_reliable_reply.dest_addr, src_addr, 6);
+    g_reliable_reply.initiator_attribute = ctrl_data->initiator_attribute;
+    g_reliable_reply.seq                 = members->seq;
+    g_reliable_reply.pending             = true;
+    portEXIT_CRITICAL(&g_reliable_lock);
+
+    /**< In its slot, at a random time in the first half of it */
+    TickType_t delay = pdMS_TO_TICKS(i * members->slot_ms + esp_random() % (members->slot_ms / 2 + 1));
+    xTimerChangePeriod(g_reliable_timer, delay ? delay : 1, portMAX_DELAY);
+
+    return apply;
+}
+
+/**
+ * @brief Takes the acknowledgements of a reliable sending before the handler of the control frames,
+ *        the other frames are passed on to it
+ */
+static esp_err_t espnow_ctrl_initiator_reliable_recv(uint8_t *src_addr, void *data,
+                      size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
+{
+    const espnow_ctrl_data_t *ctrl_data = (const espnow_ctrl_data_t *)data;
+    handler_for_data_t next_handle = g_reliable_next_handle;
+
+    if (src_addr && ctrl_data && size >= sizeof(espnow_ctrl_data_t)
+            && ctrl_data->responder_attribute == ESPNOW_ATTRIBUTE_BATCH_ACK) {
+        espnow_ctrl_initiator_reliable_ack(src_addr, ctrl_data);
+        return ESP_OK;
+    }
+
+    return next_handle ? next_handle(src_addr, data, size, rx_ctrl) : ESP_OK;
+}
+
+static esp_err_t espnow_ctrl_responder_data_process(uint8_t *src_addr, void *data,
+                      size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
+{
+    ESP_PARAM_CHECK(src_addr);
+    ESP_PARAM_CHECK(data);
+    ESP_PARAM_CHECK(size);
+    ESP_PARAM_CHECK(rx_ctrl);
+
+    espnow_ctrl_data_t *ctrl_data = (espnow_ctrl_data_t *)data;
+    ESP_LOGD(TAG, "src_addr: "MACSTR", espnow_ctrl_responder_recv, value: %d",
+                MAC2STR(src_addr), ctrl_data->responder_value_i);
+
+    if (ctrl_data->responder_attribute == ESPNOW_ATTRIBUTE_BATCH_ACK) {
+        espnow_ctrl_initiator_reliable_ack(src_addr, ctrl_data);
+        return ESP_OK;
+    }
+
+#ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING
+    if (ctrl_data->frame_head.ack) {
+        espnow_send(ESPNOW_DATA_TYPE_ACK, ESPNOW_ADDR_BROADCAST, &ctrl_data->frame_head, sizeof(ctrl_data->frame_head), &ctrl_data->frame_head, pdMS_TO_TICKS(100));
+    }
+#endif
 
     if (espnow_ctrl_responder_is_bindlist(src_addr, ctrl_data->initiator_attribute)) {
-        if (g_data_cb) {
+        if (ctrl_data->responder_attribute == ESPNOW_ATTRIBUTE_BATCH && size >= sizeof(espnow_ctrl_data_t)) {
+            if (espnow_ctrl_responder_members(src_addr, ctrl_data, size)) {
+                espnow_ctrl_responder_batch_process(ctrl_data, size);
+            }
+        } else if (g_data_cb) {
             g_data_cb(ctrl_data->initiator_attribute, ctrl_data->responder_attribute, ctrl_data->responder_value_i);
         }
 
@@ -337,115 +1121,393 @@ static esp_err_t espnow_ctrl_responder_data_process(uint8_t *src_addr, void *dat
     return ESP_OK;
 }
 
+#ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING
+esp_err_t espnow_ctrl_responder_announce_channel(void)
+{
+    uint8_t primary           = 0;
+    wifi_second_chan_t second = 0;
+    espnow_frame_head_t frame_head = {
+        .broadcast    = true,
+        .forward_ttl  = CONFIG_ESPNOW_CONTROL_FORWARD_TTL,
+        .forward_rssi = CONFIG_ESPNOW_CONTROL_FORWARD_RSSI,
+        .security     = CONFIG_ESPNOW_CONTROL_SECURITY,
+    };
+
+    esp_wifi_get_channel(&primary, &second);
+
+    /**< An ACK of no sending, the magic matches none so the initiators only learn the channel in the frame head.
+         The initiators take the ACKs as they forward them, so it is sent for forwarding like the other ACKs */
+    frame_head.channel = primary;
+    frame_head.magic   = esp_random();
+
+    ESP_LOGI(TAG, "Announce channel: %d", primary);
+
+    return espnow_send(ESPNOW_DATA_TYPE_ACK, ESPNOW_ADDR_BROADCAST, &frame_head, sizeof(frame_head), &frame_head, pdMS_TO_TICKS(100));
+}
+
+static void espnow_ctrl_responder_channel_handler(void *arg, esp_event_base_t event_base,
+                                                  int32_t event_id, void *event_data)
+{
+    static uint8_t s_channel = 0;
+    wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+
+    if (event->channel != s_channel) {
+        s_channel = event->channel;
+        espnow_ctrl_responder_announce_channel();
+    }
+}
+
+static void espnow_ctrl_responder_channel_watch(void)
+{
+    static bool s_registered = false;
+
+    if (!s_registered) {
+        s_registered = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED,
+                                                  espnow_ctrl_responder_channel_handler, NULL) == ESP_OK;
+    }
+}
+#else
+esp_err_t espnow_ctrl_responder_announce_channel(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static void espnow_ctrl_responder_channel_watch(void)
+{
+}
+#endif
+
 esp_err_t espnow_ctrl_responder_data(espnow_ctrl_data_cb_t cb)
 {
     g_data_cb        = cb;
     espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_CONTROL_DATA, 1, espnow_ctrl_responder_data_process);
+    espnow_ctrl_responder_channel_watch();
+
+    return ESP_OK;
+}
+
+esp_err_t espnow_ctrl_responder_batch(espnow_ctrl_batch_cb_t cb)
+{
+    g_batch_cb       = cb;
+    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_CONTROL_DATA, 1, espnow_ctrl_responder_data_process);
+    espnow_ctrl_responder_channel_watch();
 
     return ESP_OK;
 }
 
 #ifdef CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING
+/**
+ * @brief Read the history from NVS out of the lock, the first task to finish installs it
+ */
+static void espnow_ctrl_channel_load(void)
+{
+    uint8_t channel = 0;
+    espnow_ctrl_channel_history_t *history = NULL;
+
+    if (g_channel_history_loaded) {
+        return;
+    }
+
+    history = ESP_CALLOC(1, sizeof(espnow_ctrl_channel_history_t));
+    if (!history) {
+        ESP_LOGW(TAG, "<ESP_ERR_NO_MEM> channel history, loaded with the next sending");
+        return;
+    }
+
+    if (espnow_storage_get(ESPNOW_CHANNEL_HISTORY_KEY, history, sizeof(espnow_ctrl_channel_history_t)) != ESP_OK) {
+        memset(history, 0, sizeof(espnow_ctrl_channel_history_t));
+
+        /**< The channel saved by the older releases starts the history, of no responder in particular */
+        if (espnow_storage_get(ESPNOW_CHANNEL_KEY, &channel, sizeof(channel)) == ESP_OK
+                && channel >= 1 && channel <= ESPNOW_CHANNEL_NUM_MAX) {
+            memcpy(history->entry[0].mac, ESPNOW_ADDR_BROADCAST, 6);
+            history->entry[0].channel = channel;
+            history->entry[0].hits[channel - 1] = ESPNOW_CHANNEL_HIT;
+        }
+    }
+
+    portENTER_CRITICAL(&g_channel_lock);
+
+    if (!g_channel_history_loaded) {
+        memcpy(&g_channel_history, history, sizeof(espnow_ctrl_channel_history_t));
+        g_channel_history_loaded = true;
+    }
+
+    portEXIT_CRITICAL(&g_channel_lock);
+
+    ESP_FREE(history);
+}
+
+/**
+ * @brief Learn the channel a responder was heard on. The weight of the channel grows and the others of the
+ *        responder decay, so the channel it moved to takes over after a few ACKs.
+ */
+static void espnow_ctrl_channel_learn(const uint8_t *mac, uint8_t channel)
+{
+    espnow_ctrl_channel_entry_t *entry = NULL;
+    bool moved = false;
+
+    if (channel < 1 || channel > ESPNOW_CHANNEL_NUM_MAX) {
+        return;
+    }
+
+    espnow_ctrl_channel_load();
+
+    portENTER_CRITICAL(&g_channel_lock);
+
+    for (int i = 0; i < CONFIG_ESPNOW_CONTROL_CHANNEL_HISTORY_NUM; ++i) {
+        espnow_ctrl_channel_entry_t *item = g_channel_history.entry + i;
+
+        if (!memcmp(item->mac, mac, 6)) {
+            entry = item;
+            break;
+        }
+
+        /**< The responder heard the least recently is replaced */
+        if (!entry || item->seen < entry->seen) {
+            entry = item;
+        }
+    }
+
+    if (memcmp(entry->mac, mac, 6)) {
+        memset(entry, 0, sizeof(espnow_ctrl_channel_entry_t));
+        memcpy(entry->mac, mac, 6);
+    }
+
+    for (int i = 0; i < ESPNOW_CHANNEL_NUM_MAX; ++i) {
+        entry->hits[i] -= entry->hits[i] / 4;
+    }
+
+    entry->hits[channel - 1] += ESPNOW_CHANNEL_HIT;
+    moved          = entry->channel != channel;
+    entry->channel = channel;
+    entry->seen    = ++g_channel_history.seq;
+
+    /**< The flash is written when a responder changes channel, the weights of the hits on the same channel
+         are saved with the next change */
+    g_channel_history_changed |= moved;
+
+    portEXIT_CRITICAL(&g_channel_lock);
+}
+
+/**
+ * @brief Save the history out of the receive path: by the sending task once the sending is over,
+ *        or by the timer task for the channels heard out of a sending
+ */
+static void espnow_ctrl_channel_save(void)
+{
+    espnow_ctrl_channel_history_t *history = NULL;
+
+    if (!g_channel_history_changed) {
+        return;
+    }
+
+    history = ESP_MALLOC(sizeof(espnow_ctrl_channel_history_t));
+    if (!history) {
+        ESP_LOGW(TAG, "<ESP_ERR_NO_MEM> channel history, saved with the next sending");
+        return;
+    }
+
+    /**< The flash is written from a copy, the receive task keeps learning meanwhile */
+    portENTER_CRITICAL(&g_channel_lock);
+    g_channel_history_changed = false;
+    memcpy(history, &g_channel_history, sizeof(espnow_ctrl_channel_history_t));
+    portEXIT_CRITICAL(&g_channel_lock);
+
+    espnow_storage_set(ESPNOW_CHANNEL_HISTORY_KEY, history, sizeof(espnow_ctrl_channel_history_t));
+    ESP_FREE(history);
+}
+
+static void espnow_ctrl_channel_save_timer_cb(TimerHandle_t timer)
+{
+    espnow_ctrl_channel_save();
+}
+
+static void espnow_ctrl_channel_save_later(void)
+{
+    if (!g_channel_history_changed) {
+        return;
+    }
+
+    if (!g_channel_save_timer) {
+        g_channel_save_timer = xTimerCreate("espnow_ctrl_ch", pdMS_TO_TICKS(ESPNOW_CHANNEL_SAVE_DELAY), pdFALSE,
+                                            NULL, espnow_ctrl_channel_save_timer_cb);
+
+        if (!g_channel_save_timer) {
+            ESP_LOGW(TAG, "Create the timer saving the channels, saved with the next sending");
+            return;
+        }
+    }
+
+    xTimerReset(g_channel_save_timer, 0);
+}
+
+/**
+ * @brief The responders not heard in a sending are less likely on the channels probed for a full window
+ *        with no answer, as a probe misses the responders on its channel with ESPNOW_CHANNEL_LOSS_PERCENT.
+ *        The probe answered ends the wait, the other responders on its channel may answer after it.
+ */
+static void espnow_ctrl_channel_missed(const uint8_t *sequence, size_t num, uint32_t seq)
+{
+    portENTER_CRITICAL(&g_channel_lock);
+
+    for (int n = 0; n < CONFIG_ESPNOW_CONTROL_CHANNEL_HISTORY_NUM; ++n) {
+        espnow_ctrl_channel_entry_t *entry = g_channel_history.entry + n;
+
+        if (entry->seen > seq) {
+            continue;
+        }
+
+        for (size_t i = 0; i < num; ++i) {
+            entry->hits[sequence[i] - 1] = entry->hits[sequence[i] - 1] * ESPNOW_CHANNEL_LOSS_PERCENT / 100;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_channel_lock);
+}
+
+/**
+ * @brief Order of the channels to probe. The chance the responders are on a channel is its weight in the history,
+ *        each channel counting once more. A probe on the right channel misses with ESPNOW_CHANNEL_LOSS_PERCENT,
+ *        the next probe goes to the channel of the highest chance of not having been found yet.
+ */
+static size_t espnow_ctrl_channel_plan(uint8_t *sequence, size_t max, uint32_t *expected_ms, uint32_t probe_ms, uint32_t *seq)
+{
+    float chance[ESPNOW_CHANNEL_NUM_MAX] = {0};
+    float total     = 0;
+    float expected  = 0;
+    float missed    = 1;
+    size_t num      = 0;
+
+    espnow_ctrl_channel_load();
+
+    portENTER_CRITICAL(&g_channel_lock);
+
+    for (int i = 0; i < g_self_country.nchan && g_self_country.schan + i <= ESPNOW_CHANNEL_NUM_MAX; ++i) {
+        uint8_t channel = g_self_country.schan + i;
+        chance[channel - 1] = 1;
+
+        for (int n = 0; n < CONFIG_ESPNOW_CONTROL_CHANNEL_HISTORY_NUM; ++n) {
+            chance[channel - 1] += g_channel_history.entry[n].hits[channel - 1];
+        }
+
+        total += chance[channel - 1];
+    }
+
+    /**< The responders heard after it are found by this sending */
+    *seq = g_channel_history.seq;
+
+    portEXIT_CRITICAL(&g_channel_lock);
+
+    for (num = 0; num < max; ++num) {
+        int best = 0;
+
+        for (int i = 1; i < ESPNOW_CHANNEL_NUM_MAX; ++i) {
+            if (chance[i] > chance[best]) {
+                best = i;
+            }
+        }
+
+        if (chance[best] <= 0) {
+            break;
+        }
+
+        sequence[num] = best + 1;
+
+        /**< Found at this probe: on the channel, not found before and not lost */
+        float found = chance[best] / total * (100 - ESPNOW_CHANNEL_LOSS_PERCENT) / 100;
+        expected += found * (num + 1) * probe_ms;
+        missed   -= found;
+        chance[best] = chance[best] * ESPNOW_CHANNEL_LOSS_PERCENT / 100;
+    }
+
+    /**< Not found at all, every probe is spent */
+    *expected_ms = expected + MAX(missed, 0) * num * probe_ms;
+
+    return num;
+}
+
 static esp_err_t espnow_ctrl_initiator_ack(uint8_t *src_addr, void *data,
                       size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
 {
     espnow_frame_head_t *frame_head = (espnow_frame_head_t *)data;
 
-    uint8_t channel = frame_head ? frame_head->channel : 1;
+    if (!frame_head || size < sizeof(espnow_frame_head_t)) {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    ESP_LOGI(TAG, "src_addr: "MACSTR", %s, channel: %d", MAC2STR(src_addr), __func__, channel);
+    ESP_LOGI(TAG, "src_addr: "MACSTR", %s, channel: %d", MAC2STR(src_addr), __func__, frame_head->channel);
 
-    espnow_storage_set(ESPNOW_CHANNEL_KEY, &channel, sizeof(channel));
+    espnow_ctrl_channel_learn(src_addr, frame_head->channel);
 
-    if (g_bind_sem) {
+    /**< The channel announced by a responder, or acknowledged after the sending, is only learned */
+    if (!g_bind_sem) {
+        espnow_ctrl_channel_save_later();
+    } else if (frame_head->magic == g_ack_magic) {
         xSemaphoreGive(g_bind_sem);
     }
 
     return ESP_OK;
 }
 
-static esp_err_t espnow_ctrl_initiator_handle(espnow_data_type_t type, espnow_attribute_t initiator_attribute, espnow_attribute_t responder_attribute, uint32_t responder_value)
+static esp_err_t espnow_ctrl_initiator_handle(espnow_data_type_t type, espnow_ctrl_data_t *data, size_t size)
 {
-    esp_err_t ret = ESP_OK;
+    esp_err_t ret = ESP_FAIL;
+    uint8_t sequence[ESPNOW_CHANNEL_PROBE_MAX] = {0};
+    uint32_t expected_ms = 0;
+    uint32_t probe_ms    = CONFIG_ESPNOW_CONTROL_WAIT_ACK_DURATION;
+    size_t probe_num     = 0;
+    size_t probe         = 0;
+    uint32_t seq         = 0;
+    int64_t start_time   = esp_timer_get_time();
+#ifdef CONFIG_ESPNOW_LIGHT_SLEEP
+    bool timer_wakeup_enabled = false;
+    probe_ms += CONFIG_ESPNOW_LIGHT_SLEEP_DURATION;
+#endif
 
     g_bind_sem = xSemaphoreCreateBinary();
     if (!g_bind_sem) {
         return ESP_FAIL;
     }
 
-    BaseType_t bind_sem_ret = pdFAIL;
-    int retransmit_count = 0;
-    uint8_t channel = 1;
-#ifdef CONFIG_ESPNOW_LIGHT_SLEEP
-    bool timer_wakeup_enabled = false;
-#endif
-    espnow_storage_get(ESPNOW_CHANNEL_KEY, &channel, sizeof(channel));
-    espnow_ctrl_data_t data = {
-        .frame_head = {
-            .broadcast                  = true,
-            .forward_ttl                = CONFIG_ESPNOW_CONTROL_FORWARD_TTL,
-            .forward_rssi               = CONFIG_ESPNOW_CONTROL_FORWARD_RSSI,
-            .magic                      = esp_random(),
-            .ack                        = true,
-            .channel                    = channel,
-            .filter_adjacent_channel    = true,
-            .security                   = CONFIG_ESPNOW_CONTROL_SECURITY,
-        },
-        .initiator_attribute = initiator_attribute,
-        .responder_attribute = responder_attribute,
-        .responder_value_i   = responder_value
+    probe_num = espnow_ctrl_channel_plan(sequence, MIN(g_self_country.nchan * (CONFIG_ESPNOW_CONTROL_RETRANSMISSION_TIMES + 1),
+                                                       ESPNOW_CHANNEL_PROBE_MAX), &expected_ms, probe_ms, &seq);
+
+    ESP_LOGD(TAG, "Channel probes: %d, first: %d, %d, %d, expected latency: %" PRIu32 " ms, worst: %" PRIu32 " ms",
+             (int)probe_num, sequence[0], sequence[1], sequence[2], expected_ms, (uint32_t)(probe_num * probe_ms));
+
+    data->frame_head = (espnow_frame_head_t) {
+        .broadcast                  = true,
+        .forward_ttl                = CONFIG_ESPNOW_CONTROL_FORWARD_TTL,
+        .forward_rssi               = CONFIG_ESPNOW_CONTROL_FORWARD_RSSI,
+        .magic                      = esp_random(),
+        .ack                        = true,
+        .filter_adjacent_channel    = true,
+        .security                   = CONFIG_ESPNOW_CONTROL_SECURITY,
     };
+    g_ack_magic = data->frame_head.magic;
     espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_ACK, true, espnow_ctrl_initiator_ack);
 
-    do {
-        espnow_send(type, ESPNOW_ADDR_BROADCAST, &data, sizeof(espnow_ctrl_data_t), &data.frame_head, portMAX_DELAY);
-        bind_sem_ret = xSemaphoreTake(g_bind_sem, pdMS_TO_TICKS(CONFIG_ESPNOW_CONTROL_WAIT_ACK_DURATION));
+    for (probe = 0; probe < probe_num; ++probe) {
+        data->frame_head.channel = sequence[probe];
+        espnow_send(type, ESPNOW_ADDR_BROADCAST, data, size, &data->frame_head, portMAX_DELAY);
 
-        if (bind_sem_ret == pdPASS) {
+        if (xSemaphoreTake(g_bind_sem, pdMS_TO_TICKS(CONFIG_ESPNOW_CONTROL_WAIT_ACK_DURATION)) == pdPASS) {
+            ret = ESP_OK;
             break;
         }
-#ifdef CONFIG_ESPNOW_LIGHT_SLEEP
-        esp_wifi_force_wakeup_release();
-        esp_sleep_enable_timer_wakeup(CONFIG_ESPNOW_LIGHT_SLEEP_DURATION * 1000);
-        timer_wakeup_enabled = true;
-        esp_light_sleep_start();
-        esp_wifi_force_wakeup_acquire();
-#endif
-    } while (retransmit_count ++ < CONFIG_ESPNOW_CONTROL_RETRANSMISSION_TIMES);
 
-    if (bind_sem_ret != pdPASS) {
-        for (int i = 0; i < g_self_country.nchan; i++) {
-            if (g_self_country.schan + i == channel) {
-                continue;
-            }
-            data.frame_head.channel = g_self_country.schan + i;
-            retransmit_count = 0;
-            do {
-                espnow_send(type, ESPNOW_ADDR_BROADCAST, &data, sizeof(espnow_ctrl_data_t), &data.frame_head, portMAX_DELAY);
-                bind_sem_ret = xSemaphoreTake(g_bind_sem, pdMS_TO_TICKS(CONFIG_ESPNOW_CONTROL_WAIT_ACK_DURATION));
-                if (bind_sem_ret == pdPASS) {
-                    ret = ESP_OK;
-                    break;
-                } else {
-                    ret = ESP_FAIL;
-                }
 #ifdef CONFIG_ESPNOW_LIGHT_SLEEP
-                if (retransmit_count < CONFIG_ESPNOW_CONTROL_RETRANSMISSION_TIMES || (i < g_self_country.nchan - 1 &&
-                    // !(Second last channel, however last channel is the saved channel)
-                    !(i == g_self_country.nchan - 2 && g_self_country.schan + i + 1 == channel))) {
-                    esp_wifi_force_wakeup_release();
-                    esp_sleep_enable_timer_wakeup(CONFIG_ESPNOW_LIGHT_SLEEP_DURATION * 1000);
-                    timer_wakeup_enabled = true;
-                    esp_light_sleep_start();
-                    esp_wifi_force_wakeup_acquire();
-                }
-#endif
-            } while (retransmit_count ++ < CONFIG_ESPNOW_CONTROL_RETRANSMISSION_TIMES);
-            if (ret == ESP_OK) {
-                break;
-            }
+        if (probe < probe_num - 1) {
+            esp_wifi_force_wakeup_release();
+            esp_sleep_enable_timer_wakeup(CONFIG_ESPNOW_LIGHT_SLEEP_DURATION * 1000);
+            timer_wakeup_enabled = true;
+            esp_light_sleep_start();
+            esp_wifi_force_wakeup_acquire();
         }
+#endif
     }
+
 #ifdef CONFIG_ESPNOW_LIGHT_SLEEP
     if (timer_wakeup_enabled) {
         esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
@@ -454,6 +1516,13 @@ static esp_err_t espnow_ctrl_initiator_handle(espnow_data_type_t type, espnow_at
     vSemaphoreDelete(g_bind_sem);
     g_bind_sem = NULL;
 
+    /**< probe is the probe answered, or probe_num when none is */
+    espnow_ctrl_channel_missed(sequence, probe, seq);
+    espnow_ctrl_channel_save();
+
+    ESP_LOGI(TAG, "Channel %d, probes: %d, latency: %d ms, expected: %" PRIu32 " ms", ret == ESP_OK ? sequence[probe] : 0,
+             (int)MIN(probe + 1, probe_num), (int)((esp_timer_get_time() - start_time) / 1000), expected_ms);
+
     ESP_ERROR_RETURN(ret != ESP_OK, ret,  "espnow_broadcast, ret: %d", ret);
 
     return ESP_OK;
@@ -461,14 +1530,31 @@ static esp_err_t espnow_ctrl_initiator_handle(espnow_data_type_t type, espnow_at
 
 esp_err_t espnow_ctrl_initiator_bind(espnow_attribute_t initiator_attribute, bool enable)
 {
-    return espnow_ctrl_initiator_handle(ESPNOW_DATA_TYPE_CONTROL_BIND, initiator_attribute, ESPNOW_ATTRIBUTE_BASE, enable);
+    espnow_ctrl_data_t data = {
+        .initiator_attribute = initiator_attribute,
+        .responder_attribute = ESPNOW_ATTRIBUTE_BASE,
+        .responder_value_i   = enable,
+    };
+
+    return espnow_ctrl_initiator_handle(ESPNOW_DATA_TYPE_CONTROL_BIND, &data, sizeof(espnow_ctrl_data_t));
 }
 
 esp_err_t espnow_ctrl_initiator_send(espnow_attribute_t initiator_attribute,
                                      espnow_attribute_t responder_attribute,
                                      uint32_t responder_value)
 {
-    return espnow_ctrl_initiator_handle(ESPNOW_DATA_TYPE_CONTROL_DATA, initiator_attribute, responder_attribute, responder_value);
+    espnow_ctrl_data_t data = {
+        .initiator_attribute = initiator_attribute,
+        .responder_attribute = responder_attribute,
+        .responder_value_i   = responder_value,
+    };
+
+    return espnow_ctrl_initiator_handle(ESPNOW_DATA_TYPE_CONTROL_DATA, &data, sizeof(espnow_ctrl_data_t));
+}
+
+static esp_err_t espnow_ctrl_initiator_send_frame(espnow_ctrl_data_t *data, size_t size)
+{
+    return espnow_ctrl_initiator_handle(ESPNOW_DATA_TYPE_CONTROL_DATA, data, size);
 }
 #else
 esp_err_t espnow_ctrl_initiator_bind(espnow_attribute_t initiator_attribute, bool enable)
@@ -507,8 +1593,234 @@ esp_err_t espnow_ctrl_initiator_send(espnow_attribute_t initiator_attribute,
 
     return ESP_OK;
 }
+
+static esp_err_t espnow_ctrl_initiator_send_frame(espnow_ctrl_data_t *data, size_t size)
+{
+    esp_err_t ret = espnow_send(ESPNOW_DATA_TYPE_CONTROL_DATA, ESPNOW_ADDR_BROADCAST, data,
+                                size, &g_initiator_frame, pdMS_TO_TICKS(1000));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret,  "espnow_broadcast, ret: %d", ret);
+
+    return ESP_OK;
+}
 #endif
 
+/**
+ * @brief Append an update to the list of a batch, false when it does not fit in the frame
+ */
+static bool espnow_ctrl_batch_put(uint8_t *list, size_t *offset, size_t max, uint16_t attribute,
+                                  const uint8_t *value, uint8_t size)
+{
+    espnow_ctrl_tlv_t *item = (espnow_ctrl_tlv_t *)(list + *offset);
+
+    if (*offset + sizeof(espnow_ctrl_tlv_t) + size > max) {
+        return false;
+    }
+
+    item->attribute = attribute;
+    item->size      = size;
+    memcpy(item->value, value, size);
+    *offset += sizeof(espnow_ctrl_tlv_t) + size;
+
+    return true;
+}
+
+static bool espnow_ctrl_batch_put_attr(uint8_t *list, size_t *offset, size_t max, const espnow_ctrl_attr_t *attr)
+{
+    /**< The value takes the fewest bytes, little endian */
+    uint8_t value[4] = {attr->value, attr->value >> 8, attr->value >> 16, attr->value >> 24};
+    uint8_t size = attr->value > 0xffff ? 4 : attr->value > 0xff ? 2 : attr->value ? 1 : 0;
+
+    return espnow_ctrl_batch_put(list, offset, max, attr->attribute, value, size);
+}
+
+esp_err_t espnow_ctrl_initiator_send_batch(espnow_attribute_t initiator_attribute,
+                                           const espnow_ctrl_attr_t *attrs, size_t num,
+                                           const espnow_ctrl_override_t *overrides, size_t override_num)
+{
+    ESP_PARAM_CHECK(attrs || !num);
+    ESP_PARAM_CHECK(overrides || !override_num);
+    ESP_PARAM_CHECK(num || override_num);
+
+    esp_err_t ret  = ESP_ERR_INVALID_SIZE;
+    size_t size    = 0;
+    size_t max     = ESPNOW_DATA_LEN - sizeof(espnow_ctrl_data_t);
+    espnow_ctrl_data_t *data = ESP_CALLOC(1, ESPNOW_DATA_LEN);
+    ESP_ERROR_RETURN(!data, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> batch frame");
+
+    uint8_t *list = (uint8_t *)data->responder_value_s;
+    data->initiator_attribute = initiator_attribute;
+    data->responder_attribute = ESPNOW_ATTRIBUTE_BATCH;
+
+    for (size_t i = 0; i < num; ++i) {
+        ESP_ERROR_GOTO(!espnow_ctrl_batch_put_attr(list, &size, max, attrs + i), EXIT,
+                       "The batch does not fit in a frame, attribute %d of %d", i, num);
+    }
+
+    /**< The updates for all the responders come first, the ones of a responder override them */
+    for (size_t i = 0; i < override_num; ++i) {
+        if (i == 0 || memcmp(overrides[i].mac, overrides[i - 1].mac, 6)) {
+            ESP_ERROR_GOTO(!espnow_ctrl_batch_put(list, &size, max, ESPNOW_ATTRIBUTE_BATCH_TARGET, overrides[i].mac, 6),
+                           EXIT, "The batch does not fit in a frame, override %d of %d", i, override_num);
+        }
+
+        ESP_ERROR_GOTO(!espnow_ctrl_batch_put_attr(list, &size, max, &overrides[i].attr), EXIT,
+                       "The batch does not fit in a frame, override %d of %d", i, override_num);
+    }
+
+    /**< One frame, so one channel scan and one ACK on the auto channel path */
+    data->responder_value_i = size;
+    ret = espnow_ctrl_initiator_send_frame(data, sizeof(espnow_ctrl_data_t) + size);
+
+EXIT:
+    ESP_FREE(data);
+    return ret;
+}
+
+esp_err_t espnow_ctrl_initiator_send_reliable(espnow_attribute_t initiator_attribute,
+                                              const espnow_ctrl_attr_t *attrs, size_t num,
+                                              espnow_ctrl_member_t *members, size_t member_num, uint32_t wait_ms)
+{
+    ESP_PARAM_CHECK(attrs && num);
+    ESP_PARAM_CHECK(members && member_num);
+
+    esp_err_t ret      = ESP_ERR_INVALID_SIZE;
+    size_t size        = 0;
+    size_t max         = ESPNOW_DATA_LEN - sizeof(espnow_ctrl_data_t);
+    size_t capacity    = 0;
+    size_t cursor      = 0;
+    size_t acked       = 0;
+    size_t frames      = 0;
+    bool enabled       = false;
+    bool *in_frame     = NULL;
+    handler_for_data_t handle = NULL;
+    TickType_t start   = xTaskGetTickCount();
+    espnow_ctrl_data_t *data = ESP_CALLOC(1, ESPNOW_DATA_LEN);
+    ESP_ERROR_RETURN(!data, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> batch frame");
+
+    uint8_t *list = (uint8_t *)data->responder_value_s;
+    data->initiator_attribute = initiator_attribute;
+    data->responder_attribute = ESPNOW_ATTRIBUTE_BATCH;
+
+    for (size_t i = 0; i < num; ++i) {
+        ESP_ERROR_GOTO(!espnow_ctrl_batch_put_attr(list, &size, max, attrs + i), EXIT,
+                       "The batch does not fit in a frame, attribute %d of %d", i, num);
+    }
+
+    /**< The responders not acknowledging yet take the room left in the frame */
+    ESP_ERROR_GOTO(size + sizeof(espnow_ctrl_tlv_t) + sizeof(espnow_ctrl_members_t) + 6 > max, EXIT,
+                   "The batch leaves no room for the responders, size: %d", size);
+    capacity = MIN((max - size - sizeof(espnow_ctrl_tlv_t) - sizeof(espnow_ctrl_members_t)) / 6,
+                   ESPNOW_RELIABLE_MEMBERS_MAX);
+
+    in_frame = ESP_CALLOC(member_num, sizeof(bool));
+    ret = ESP_ERR_NO_MEM;
+    ESP_ERROR_GOTO(!in_frame, EXIT, "<ESP_ERR_NO_MEM> responders of the batch");
+
+    if (!g_reliable_sem) {
+        g_reliable_sem = xSemaphoreCreateBinary();
+        ESP_ERROR_GOTO(!g_reliable_sem, EXIT, "Create the semaphore of the batch acknowledgements");
+    }
+
+    ret = ESP_ERR_INVALID_STATE;
+    portENTER_CRITICAL(&g_reliable_lock);
+
+    if (!g_reliable.members) {
+        for (size_t i = 0; i < member_num; ++i) {
+            members[i].acked = false;
+            members[i].tries = 0;
+        }
+
+        g_reliable.seq      = esp_random();
+        g_reliable.members  = members;
+        g_reliable.num      = member_num;
+        g_reliable.in_frame = in_frame;
+        g_reliable.waiting  = 0;
+        ret = ESP_OK;
+    }
+
+    portEXIT_CRITICAL(&g_reliable_lock);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "A reliable sending is in progress");
+
+    /**< The acknowledgements are taken before the handler of the control frames, whichever is set */
+    espnow_get_config_for_data_type(ESPNOW_DATA_TYPE_CONTROL_DATA, &enabled);
+    espnow_get_handle_for_data_type(ESPNOW_DATA_TYPE_CONTROL_DATA, &handle);
+    g_reliable_next_handle = enabled ? handle : NULL;
+    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_CONTROL_DATA, true, espnow_ctrl_initiator_reliable_recv);
+
+    espnow_ctrl_tlv_t *item = (espnow_ctrl_tlv_t *)(list + size);
+    espnow_ctrl_members_t *frame_members = (espnow_ctrl_members_t *)item->value;
+    item->attribute        = ESPNOW_ATTRIBUTE_BATCH_MEMBERS;
+    frame_members->seq     = g_reliable.seq;
+    frame_members->slot_ms = CONFIG_ESPNOW_CONTROL_RELIABLE_SLOT;
+
+    for (;;) {
+        uint32_t elapsed_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+        size_t listed = 0;
+
+        if (elapsed_ms >= wait_ms) {
+            break;
+        }
+
+        /**< Round robin over the responders left, each gets its turn when they do not fit in a frame */
+        portENTER_CRITICAL(&g_reliable_lock);
+
+        for (size_t n = 0, i = cursor; n < member_num; ++n, i = (i + 1) % member_num) {
+            in_frame[i] = !members[i].acked && listed < capacity;
+
+            if (in_frame[i]) {
+                memcpy(frame_members->addrs[listed++], members[i].mac, 6);
+                members[i].tries++;
+                cursor = (i + 1) % member_num;
+            }
+        }
+
+        g_reliable.waiting = listed;
+        portEXIT_CRITICAL(&g_reliable_lock);
+
+        if (!listed) {
+            break;
+        }
+
+        item->size = sizeof(espnow_ctrl_members_t) + listed * 6;
+        data->responder_value_i = size + sizeof(espnow_ctrl_tlv_t) + item->size;
+        xSemaphoreTake(g_reliable_sem, 0);
+
+        /**< A new magic each frame, or the responders drop it as a duplicate */
+        if (espnow_ctrl_initiator_send_frame(data, sizeof(espnow_ctrl_data_t) + data->responder_value_i) == ESP_OK) {
+            uint32_t slots_ms = listed * CONFIG_ESPNOW_CONTROL_RELIABLE_SLOT + ESPNOW_RELIABLE_MARGIN_MS;
+            xSemaphoreTake(g_reliable_sem, pdMS_TO_TICKS(MIN(slots_ms, wait_ms - elapsed_ms)));
+        }
+
+        frames++;
+    }
+
+    portENTER_CRITICAL(&g_reliable_lock);
+    memset(&g_reliable, 0, sizeof(espnow_ctrl_reliable_t));
+    portEXIT_CRITICAL(&g_reliable_lock);
+
+    /**< Unless the handler has been set again while sending */
+    espnow_get_handle_for_data_type(ESPNOW_DATA_TYPE_CONTROL_DATA, &handle);
+
+    if (handle == espnow_ctrl_initiator_reliable_recv) {
+        espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_CONTROL_DATA, enabled, g_reliable_next_handle);
+    }
+
+    g_reliable_next_handle = NULL;
+
+    for (size_t i = 0; i < member_num; ++i) {
+        acked += members[i].acked;
+    }
+
+    ESP_LOGI(TAG, "Reliable batch, acknowledged: %d/%d, frames: %d, spent: %" PRIu32 " ms", acked, member_num, frames,
+             (uint32_t)((xTaskGetTickCount() - start) * portTICK_PERIOD_MS));
+    ret = acked == member_num ? ESP_OK : ESP_ERR_TIMEOUT;
+
+EXIT:
+    ESP_FREE(in_frame);
+    ESP_FREE(data);
+    return ret;
+}
+
 esp_err_t espnow_ctrl_send(const espnow_addr_t dest_addr, const espnow_ctrl_data_t *data, const espnow_frame_head_t *frame_head, TickType_t wait_ticks)
 {
     ESP_PARAM_CHECK(dest_addr);
@@ -1147,12 +1147,12 @@ static int sec_func(int argc, char **argv)
             ESP_LOGI(TAG, "info, num: %d, list: %s", num, (char *)addrs_list);
             ESP_FREE(addrs_list);
 
-            ESP_LOGI(TAG, "|         mac       | Channel | Rssi | Security version |");
+            ESP_LOGI(TAG, "|         mac       | Channel | Rssi | Security version | Cipher suites |");
 
             for (int i = 0; i < num; ++i) {
-                ESP_LOGI(TAG, "| "MACSTR" |   %d   |  %d  | %d |",
+                ESP_LOGI(TAG, "| "MACSTR" |   %d   |  %d  | %d | 0x%x |",
                          MAC2STR(info_list[i].mac), info_list[i].channel, info_list[i].rssi,
-                         info_list[i].sec_ver);
+                         ESPNOW_SEC_VER(info_list[i].sec_ver), ESPNOW_SEC_VER_SUITES(info_list[i].sec_ver));
             }
         }
 
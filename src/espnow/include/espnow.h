@@ -170,7 +170,8 @@ typedef struct espnow_frame_head_s {
     bool filter_adjacent_channel : 1;  /**< Because ESP-NOW is sent through HT20, it can receive packets from adjacent channels */
     bool filter_weak_signal      : 1;  /**< When the signal received by the receiving device is lower than forward_rssi, frame_head data will be discarded */
     bool security                : 1;  /**< The payload data is encrypted if security is true */
-    uint16_t                     : 4;  /**< Reserved */
+    uint16_t key_id              : 2;  /**< Id of the key the payload is encrypted with, filled in by espnow_send */
+    uint16_t                     : 2;  /**< Reserved */
 
     /**
      * @brief Configure broadcast
@@ -291,6 +292,42 @@ esp_err_t espnow_set_config_for_data_type(espnow_data_type_t type, bool enable,
  */
 esp_err_t espnow_get_config_for_data_type(espnow_data_type_t type, bool *enable);
 
+/**
+ * @brief Get the receive callback function of the corresponding ESP-NOW data type
+ *
+ * @param[in]  type  data type defined by espnow_data_type_t
+ * @param[out]  handle  store the callback function set by espnow_set_config_for_data_type, NULL if none
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ */
+esp_err_t espnow_get_handle_for_data_type(espnow_data_type_t type, handler_for_data_t *handle);
+
+/**
+ * @brief   Callback function of an ESP-NOW frame received again, e.g. forwarded by another device
+ *
+ * @param[in]  type  data type of the frame
+ * @param[in]  addr  MAC address of the device the copy is received from
+ * @param[in]  src_addr  MAC address of the device the frame comes from
+ * @param[in]  frame_head  frame head of the copy
+ * @param[in]  rx_ctrl  received packet radio metadata header
+ *
+ * @note  It is called in the Wi-Fi task and should not block
+ */
+typedef void (*espnow_duplicate_cb_t)(espnow_data_type_t type, const uint8_t *addr, const uint8_t *src_addr,
+                                      const espnow_frame_head_t *frame_head, const wifi_pkt_rx_ctrl_t *rx_ctrl);
+
+/**
+ * @brief Set the callback function of the frames dropped as they were already received
+ *
+ * @param[in]  cb  the callback function, NULL to remove it
+ *
+ * @return
+ *    - ESP_OK
+ */
+esp_err_t espnow_set_duplicate_cb(espnow_duplicate_cb_t cb);
+
 /**
  * @brief      Set group ID addresses
  *
@@ -320,6 +357,13 @@ esp_err_t espnow_del_group(const espnow_group_t group_id);
  */
 int espnow_get_group_num(void);
 
+/**
+ * @brief      Get the number of the frames dropped as the receive queue was full, since ESP-NOW was initialized
+ *
+ * @return     the number of the frames dropped
+ */
+uint32_t espnow_get_recv_drop_num(void);
+
 /**
  * @brief      Get group ID addresses
  *
@@ -425,6 +469,103 @@ esp_err_t espnow_get_dec_key(uint8_t key_info[APP_KEY_LEN]);
  */
 esp_err_t espnow_erase_dec_key(void);
 
+/**
+ * @brief Set the next security key info
+ *        The next key is only used to decrypt the data until espnow_switch_key is called,
+ *        so the devices which have switched can still talk to the ones which have not.
+ *
+ * @attention Set sec_enable in espnow_config to true when ESP-NOW initializes, or the function will return failed.
+ *
+ * @param[in]  key_info  security key info
+ *
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ */
+esp_err_t espnow_set_next_key(uint8_t key_info[APP_KEY_LEN]);
+
+/**
+ * @brief Get the next security key info
+ *
+ * @param[out]  key_info  security key info
+ *
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_NOT_FOUND
+ */
+esp_err_t espnow_get_next_key(uint8_t key_info[APP_KEY_LEN]);
+
+/**
+ * @brief Set the id of the current security key info
+ *        Used when the key is received from a device which has switched keys before.
+ *
+ * @param[in]  key_id  key id, see ESPNOW_SEC_KEY_ID_MASK
+ *
+ *    - ESP_OK
+ *    - ESP_FAIL
+ */
+esp_err_t espnow_set_key_id(uint8_t key_id);
+
+/**
+ * @brief Get the id of the current security key info
+ *
+ * @return the key id carried in the frames sent
+ */
+uint8_t espnow_get_key_id(void);
+
+/**
+ * @brief Promote the next security key info to the current one
+ *        The data is encrypted with the next key from now on, the previous key is kept
+ *        to decrypt the data from the devices which have not switched yet.
+ *        A device also switches by itself on the first data it decrypts with the next key.
+ *        Both keys are stored, so neither is lost when the device reboots in the middle of a switch.
+ *
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_INVALID_STATE
+ */
+esp_err_t espnow_switch_key(void);
+
+/**
+ * @brief Set the cipher suite of the security data, on this device only and at once
+ *        All the devices in the network use the same suite, it is sent to the responders with the key
+ *        in the handshake. To change the suite of the responders that have the key already,
+ *        call espnow_set_next_sec_suite, espnow_sec_initiator_rekey and espnow_sec_initiator_switch_key.
+ *
+ * @param[in]  suite  cipher suite defined by espnow_sec_suite_t
+ *
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_NOT_SUPPORTED
+ */
+esp_err_t espnow_set_sec_suite(uint8_t suite);
+
+/**
+ * @brief Get the cipher suite of the security data
+ *
+ * @return cipher suite defined by espnow_sec_suite_t
+ */
+uint8_t espnow_get_sec_suite(void);
+
+/**
+ * @brief Set the cipher suite of the next key
+ *        The suite is used together with the next key, from the switch to it on.
+ *        The rekey of the initiator sends it to the responders with the next key.
+ *
+ * @param[in]  suite  cipher suite defined by espnow_sec_suite_t
+ *
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_NOT_SUPPORTED
+ */
+esp_err_t espnow_set_next_sec_suite(uint8_t suite);
+
+/**
+ * @brief Get the cipher suite of the next key
+ *
+ * @return cipher suite defined by espnow_sec_suite_t
+ */
+uint8_t espnow_get_next_sec_suite(void);
+
 #ifdef __cplusplus
 }
 #endif /**< _cplusplus */
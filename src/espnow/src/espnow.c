@@ -12,6 +12,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 
 #include "esp_wifi.h"
 #include "esp_sleep.h"
@@ -121,14 +122,57 @@ typedef struct {
 static const char *TAG                  = "espnow";
 static bool g_set_channel_flag          = true;
 static espnow_config_t *g_espnow_config = NULL;
-static espnow_sec_t *g_espnow_sec = NULL, *g_espnow_dec = NULL;
+static espnow_sec_t *g_espnow_sec = NULL, *g_espnow_dec[ESPNOW_SEC_KEY_SLOT_NUM] = { NULL };
 static EventGroupHandle_t g_event_group = NULL;
 static QueueHandle_t g_espnow_queue = NULL;
 static QueueHandle_t g_ack_queue = NULL;
 static uint32_t g_buffered_num;
-static uint8_t g_espnow_sec_key[APP_KEY_LEN] = {0}, g_espnow_dec_key[APP_KEY_LEN] = {0};
+static uint8_t g_espnow_sec_key[ESPNOW_SEC_KEY_SLOT_NUM][APP_KEY_LEN] = {0}, g_espnow_dec_key[ESPNOW_SEC_KEY_SLOT_NUM][APP_KEY_LEN] = {0};
 static bool g_read_from_nvs = true, g_read_dec_from_nvs = true;
 
+/**
+ * @brief The current key lives in slot ESPNOW_SEC_KEY_SLOT(g_espnow_key_id), the next one in the other slot.
+ *        Switching over is a single store of g_espnow_key_id.
+ */
+#define ESPNOW_SEC_KEY_SLOT(key_id)     ((key_id) & 0x1)
+#define ESPNOW_SEC_KEY_ID_NEXT(key_id)  (((key_id) + 1) & ESPNOW_SEC_KEY_ID_MASK)
+#define ESPNOW_SEC_KEY_ID_NONE          0xFF
+static volatile uint8_t g_espnow_key_id = 0;
+
+#ifndef CONFIG_ESPNOW_SEC_SUITE
+#define CONFIG_ESPNOW_SEC_SUITE         ESPNOW_SEC_SUITE_AES_CCM
+#endif
+static uint8_t g_espnow_dec_key_id[ESPNOW_SEC_KEY_SLOT_NUM] = { ESPNOW_SEC_KEY_ID_NONE, ESPNOW_SEC_KEY_ID_NONE };
+
+/**
+ * @brief Cipher suite of the next key, it is bound to the key slot and switched to together with the key
+ */
+static uint8_t g_espnow_next_suite = CONFIG_ESPNOW_SEC_SUITE;
+
+/**
+ * @brief g_sec_lock guards the key slots against the receive path, which decrypts with g_espnow_dec[]
+ *        and switches to the next key by itself when a frame carries the next key id.
+ */
+static SemaphoreHandle_t g_sec_lock = NULL;
+static TimerHandle_t g_sec_store_timer = NULL;
+
+/**
+ * @brief Both key slots are stored in one NVS entry, so that a reboot in the middle of a switch
+ *        finds either the state before or after it, with the previous or the next key kept.
+ *        The sending key of the other slot is always the same as its decryption key.
+ */
+#define ESPNOW_SEC_KEY_SLOTS_KEY        "key_slots"
+typedef struct {
+    uint8_t key_id;
+    bool sec_key_set;
+    uint8_t sec_key[APP_KEY_LEN];
+    uint8_t dec_key_id[ESPNOW_SEC_KEY_SLOT_NUM];
+    uint8_t dec_key[ESPNOW_SEC_KEY_SLOT_NUM][APP_KEY_LEN];
+    bool suite_set;                                 /**< False in the entries stored before the suites of the slots */
+    uint8_t suite;
+    uint8_t dec_suite[ESPNOW_SEC_KEY_SLOT_NUM];
+} __attribute__((packed)) espnow_sec_key_slots_t;
+
 static struct {
     uint8_t type;
     uint16_t magic;
@@ -145,6 +189,7 @@ static espnow_frame_head_t g_espnow_frame_head_default = ESPNOW_FRAME_CONFIG_DEF
 
 wifi_country_t g_self_country = {0};
 static SemaphoreHandle_t g_send_lock = NULL;
+static uint32_t g_recv_drop_num      = 0;   /**< Frames dropped as g_espnow_queue was full */
 
 typedef struct espnow_recv_handle {
     espnow_data_type_t type;
@@ -154,6 +199,7 @@ typedef struct espnow_recv_handle {
 
 /* Keep the type order same with espnow_data_type_t */
 static espnow_recv_handle_t g_recv_handle[ESPNOW_DATA_TYPE_MAX];
+static espnow_duplicate_cb_t g_duplicate_cb = NULL;
 
 static bool queue_over_write(espnow_msg_id_t msg_id, const void *const data, size_t data_len, void *arg, TickType_t xTicksToWait)
 {
@@ -272,6 +318,10 @@ void espnow_recv_cb(const uint8_t *addr, const uint8_t *data, int size)
                 i++, index = (g_msg_magic_cache_next + i) % ESPNOW_MSG_CACHE) {
             if (g_msg_magic_cache[index].type == espnow_data->type
                     && g_msg_magic_cache[index].magic == frame_head->magic) {
+                if (g_duplicate_cb) {
+                    g_duplicate_cb(espnow_data->type, addr, espnow_data->src_addr, frame_head, rx_ctrl);
+                }
+
                 return ;
             }
         }
@@ -280,6 +330,10 @@ void espnow_recv_cb(const uint8_t *addr, const uint8_t *data, int size)
                 i++, index = (g_msg_magic_cache_next + i) % ESPNOW_MSG_CACHE) {
             if (g_msg_magic_sec_cache[index].type == espnow_data->type
                     && g_msg_magic_sec_cache[index].magic == frame_head->magic) {
+                if (g_duplicate_cb) {
+                    g_duplicate_cb(espnow_data->type, addr, espnow_data->src_addr, frame_head, rx_ctrl);
+                }
+
                 return ;
             }
         }
@@ -390,6 +444,7 @@ void espnow_recv_cb(const uint8_t *addr, const uint8_t *data, int size)
 
         if (queue_over_write(ESPNOW_EVENT_RECEIVE, q_data, sizeof(espnow_pkt_t) + real_size, NULL, g_espnow_config->send_max_timeout) != pdPASS) {
             ESP_LOGW(TAG, "[%s, %d] Send event queue failed", __func__, __LINE__);
+            g_recv_drop_num++;
             ESP_FREE(q_data);
             return ;
         }
@@ -573,6 +628,7 @@ esp_err_t espnow_send(espnow_data_type_t type, const espnow_addr_t dest_addr, co
     espnow_frame_head_t *frame_head = NULL;
     espnow_data_t *espnow_data = NULL;
     bool enc = false;
+    uint8_t key_id = 0;
     /* Authoritative payload length passed to esp_now_send (may exceed 255).
      * espnow_data->size only carries its low 8 bits for legacy peer parsers. */
     size_t real_size = 0;
@@ -580,28 +636,46 @@ esp_err_t espnow_send(espnow_data_type_t type, const espnow_addr_t dest_addr, co
     if (g_espnow_config->sec_enable && (data_head ? data_head->security : g_espnow_frame_head_default.security)
         && type != ESPNOW_DATA_TYPE_ACK && type != ESPNOW_DATA_TYPE_FORWARD
         && type != ESPNOW_DATA_TYPE_SECURITY_STATUS && type != ESPNOW_DATA_TYPE_SECURITY) {
-        ESP_ERROR_RETURN(!(g_espnow_sec && g_espnow_sec->state == ESPNOW_SEC_OVER), ESP_FAIL, "Security key is not set");
+        ESP_ERROR_RETURN(!g_espnow_sec, ESP_FAIL, "Security key is not set");
         size_t enc_len = 0;
-        espnow_data = ESP_MALLOC(sizeof(espnow_data_t) + size + g_espnow_sec->tag_len + IV_LEN);
-        if (!espnow_data) {
-            ESP_LOGE(TAG, "Not enough memory!");
-            return ret;
-        }
         uint8_t key_info[APP_KEY_LEN];
         uint8_t iv_info[IV_LEN];
 
         ret = espnow_get_key(key_info);
         if (ret) {
-            ESP_FREE(espnow_data);
             ESP_LOGE(TAG, "Get security key fail for encrypt, err_name: %s", esp_err_to_name(ret));
             return ret;
         }
 
+        /**
+         * The receive path may switch to the next key and re-create the cipher context of g_espnow_sec,
+         * the key id, the key and the context are taken together until the frame is sealed
+         */
+        xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+
+        if (g_espnow_sec->state != ESPNOW_SEC_OVER) {
+            xSemaphoreGive(g_sec_lock);
+            ESP_LOGE(TAG, "Security key is not set");
+            return ESP_FAIL;
+        }
+
+        espnow_data = ESP_MALLOC(sizeof(espnow_data_t) + size + g_espnow_sec->tag_len + IV_LEN);
+        if (!espnow_data) {
+            xSemaphoreGive(g_sec_lock);
+            ESP_LOGE(TAG, "Not enough memory!");
+            return ret;
+        }
+
+        key_id = g_espnow_key_id;
+        memcpy(key_info, g_espnow_sec_key[ESPNOW_SEC_KEY_SLOT(key_id)], APP_KEY_LEN);
+
         esp_fill_random(iv_info, IV_LEN);
         memcpy(key_info + KEY_LEN, iv_info, IV_LEN);
-        espnow_set_key(key_info);
+        espnow_sec_setkey(g_espnow_sec, key_info);
 
         ret = espnow_sec_auth_encrypt(g_espnow_sec, data, size, espnow_data->payload, size + g_espnow_sec->tag_len, &enc_len, g_espnow_sec->tag_len);
+        xSemaphoreGive(g_sec_lock);
+
         real_size = enc_len + IV_LEN;
         espnow_data->size = (uint8_t)real_size;
         if (ret == ESP_OK) {
@@ -632,6 +706,7 @@ esp_err_t espnow_send(espnow_data_type_t type, const espnow_addr_t dest_addr, co
 
     if (enc) {
         frame_head->security = true;
+        frame_head->key_id   = key_id;
     }
 
     if (!frame_head->magic) {
@@ -842,6 +917,61 @@ EXIT:
     return ESP_OK;
 }
 
+static void espnow_sec_key_switch_store_later(void);
+static esp_err_t espnow_sec_key_switch(void);
+
+/**
+ * @brief Decrypt with the key slot of the key id in the frame. A frame authenticated with the next key
+ *        comes from a device that has switched already, so switch too in case the switch-over command was lost.
+ */
+static esp_err_t espnow_recv_decrypt(const espnow_data_t *espnow_data, size_t real_size,
+                                     uint8_t *data, size_t data_cap, size_t *size)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t key_id = espnow_data->frame_head.key_id;
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+    uint8_t key_info[APP_KEY_LEN];
+    bool switched = false;
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+
+    espnow_sec_t *dec = g_espnow_dec[slot];
+    ret = (dec && dec->state == ESPNOW_SEC_OVER) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Security key is not set");
+
+    ret = espnow_get_dec_key(key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Get security key fail for decrypt, err_name: %s", esp_err_to_name(ret));
+
+    if (g_espnow_dec_key_id[slot] != key_id) {
+        ESP_LOGD(TAG, "No security key for key id: %d", key_id);
+        ret = ESP_ERR_NOT_FOUND;
+        goto EXIT;
+    }
+
+    memcpy(key_info, g_espnow_dec_key[slot], APP_KEY_LEN);
+    memcpy(key_info + KEY_LEN, espnow_data->payload + (real_size - IV_LEN), IV_LEN);
+    espnow_sec_setkey(dec, key_info);
+
+    ret = espnow_sec_auth_decrypt(dec, espnow_data->payload, (real_size - IV_LEN), data, data_cap, size, dec->tag_len);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_decrypt, err_name: %s", esp_err_to_name(ret));
+
+    if (key_id == ESPNOW_SEC_KEY_ID_NEXT(g_espnow_key_id) && espnow_sec_key_switch() == ESP_OK) {
+        ESP_LOGI(TAG, "Switch to key id: %d, used by " MACSTR, key_id, MAC2STR(espnow_data->src_addr));
+        switched = true;
+    }
+
+EXIT:
+    xSemaphoreGive(g_sec_lock);
+    memset(key_info, 0, sizeof(key_info));
+
+    /* Not to block the receiving on NVS */
+    if (switched) {
+        espnow_sec_key_switch_store_later();
+    }
+
+    return ret;
+}
+
 /* real_size: payload length excluding the espnow_data_t header. Authoritative;
  * espnow_data->size is wire-legacy and must not be trusted for bounds checks. */
 static esp_err_t espnow_recv_process(espnow_pkt_t *q_data, size_t real_size)
@@ -884,23 +1014,8 @@ static esp_err_t espnow_recv_process(espnow_pkt_t *q_data, size_t real_size)
                 goto EXIT;
             }
             if (g_espnow_config->sec_enable) {
-                if (g_espnow_dec && g_espnow_dec->state == ESPNOW_SEC_OVER) {
-                    uint8_t key_info[APP_KEY_LEN];
-
-                    ret = espnow_get_dec_key(key_info);
-                    if (ret) {
-                        ESP_LOGE(TAG, "Get security key fail for decrypt, err_name: %s", esp_err_to_name(ret));
-                        goto EXIT;
-                    }
-                    memcpy(key_info + KEY_LEN, espnow_data->payload + (real_size - IV_LEN), IV_LEN);
-                    espnow_set_dec_key(key_info);
-
-                    ret = espnow_sec_auth_decrypt(g_espnow_dec, espnow_data->payload, (real_size - IV_LEN), data, data_cap, &size, g_espnow_dec->tag_len);
-                    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_decrypt, err_name: %s", esp_err_to_name(ret));
-                } else {
-                    ESP_LOGE(TAG, "Security key is not set");
-                    goto EXIT;
-                }
+                ret = espnow_recv_decrypt(espnow_data, real_size, data, data_cap, &size);
+                ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "");
             } else {
                 goto EXIT;
             }
@@ -1110,6 +1225,142 @@ static void wifi_event_handler(void *arg, esp_event_base_t event_base,
     }
 }
 
+static esp_err_t espnow_next_key_install(const uint8_t key_info[APP_KEY_LEN])
+{
+    uint8_t key_id = ESPNOW_SEC_KEY_ID_NEXT(g_espnow_key_id);
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+
+    int ret = espnow_sec_set_suite(g_espnow_dec[slot], g_espnow_next_suite);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_set_suite");
+
+    ret = espnow_sec_setkey(g_espnow_dec[slot], (uint8_t *)key_info);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_setkey %x", ret);
+
+    memcpy(g_espnow_sec_key[slot], key_info, APP_KEY_LEN);
+    memcpy(g_espnow_dec_key[slot], key_info, APP_KEY_LEN);
+    g_espnow_dec_key_id[slot] = key_id;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Store both key slots, called without g_sec_lock held
+ */
+static esp_err_t espnow_sec_key_slots_store(void)
+{
+    espnow_sec_key_slots_t slots = { 0 };
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+    slots.key_id = g_espnow_key_id;
+    slots.sec_key_set = !g_read_from_nvs;
+    memcpy(slots.sec_key, g_espnow_sec_key[ESPNOW_SEC_KEY_SLOT(g_espnow_key_id)], APP_KEY_LEN);
+    memcpy(slots.dec_key_id, g_espnow_dec_key_id, sizeof(slots.dec_key_id));
+    memcpy(slots.dec_key, g_espnow_dec_key, sizeof(slots.dec_key));
+    slots.suite_set = true;
+    slots.suite = g_espnow_sec->suite;
+
+    for (int i = 0; i < ESPNOW_SEC_KEY_SLOT_NUM; ++i) {
+        slots.dec_suite[i] = g_espnow_dec[i]->suite;
+    }
+
+    xSemaphoreGive(g_sec_lock);
+
+    esp_err_t ret = espnow_storage_set(ESPNOW_SEC_KEY_SLOTS_KEY, &slots, sizeof(slots));
+    memset(&slots, 0, sizeof(slots));
+
+    return ret;
+}
+
+static esp_err_t espnow_sec_key_slots_restore(void)
+{
+    espnow_sec_key_slots_t slots = { 0 };
+
+    esp_err_t ret = espnow_storage_get(ESPNOW_SEC_KEY_SLOTS_KEY, &slots, sizeof(slots));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "");
+
+    g_espnow_key_id = slots.key_id & ESPNOW_SEC_KEY_ID_MASK;
+    uint8_t current = ESPNOW_SEC_KEY_SLOT(g_espnow_key_id);
+
+    /* The suite of the switched key wins over the "sec_suite" entry, which is stored after it */
+    if (slots.suite_set && espnow_sec_set_suite(g_espnow_sec, slots.suite) == ESP_OK) {
+        espnow_sec_set_suite(g_espnow_dec[current], slots.suite);
+        g_espnow_next_suite = slots.suite;
+    }
+
+    if (slots.sec_key_set) {
+        memcpy(g_espnow_sec_key[current], slots.sec_key, APP_KEY_LEN);
+        g_read_from_nvs = false;
+    }
+
+    for (int i = 0; i < ESPNOW_SEC_KEY_SLOT_NUM; ++i) {
+        g_espnow_dec_key_id[i] = slots.dec_key_id[i];
+        memcpy(g_espnow_dec_key[i], slots.dec_key[i], APP_KEY_LEN);
+
+        /* The previous or the next key, the current one is set by the application as before */
+        if (i != current && slots.dec_key_id[i] != ESPNOW_SEC_KEY_ID_NONE) {
+            if (slots.suite_set && espnow_sec_set_suite(g_espnow_dec[i], slots.dec_suite[i]) == ESP_OK) {
+                g_espnow_next_suite = slots.dec_suite[i];
+            }
+
+            memcpy(g_espnow_sec_key[i], slots.dec_key[i], APP_KEY_LEN);
+            espnow_sec_setkey(g_espnow_dec[i], slots.dec_key[i]);
+        }
+    }
+
+    if (slots.dec_key_id[current] == g_espnow_key_id) {
+        g_read_dec_from_nvs = false;
+    }
+
+    memset(&slots, 0, sizeof(slots));
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Re-create the cipher contexts for the suite, called with g_sec_lock held
+ */
+static esp_err_t espnow_sec_suite_apply(uint8_t suite)
+{
+    esp_err_t ret = espnow_sec_set_suite(g_espnow_sec, suite);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_set_suite");
+
+    for (int i = 0; i < ESPNOW_SEC_KEY_SLOT_NUM; ++i) {
+        ret = espnow_sec_set_suite(g_espnow_dec[i], suite);
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_set_suite");
+    }
+
+    return ESP_OK;
+}
+
+static void espnow_sec_key_slots_load(void)
+{
+    uint8_t key_id = 0;
+    uint8_t suite = CONFIG_ESPNOW_SEC_SUITE;
+    uint8_t key_info[APP_KEY_LEN];
+
+    espnow_storage_get("sec_suite", &suite, sizeof(uint8_t));
+
+    if (espnow_sec_suite_apply(suite) != ESP_OK) {
+        espnow_sec_suite_apply(ESPNOW_SEC_SUITE_AES_CCM);
+    }
+
+    g_espnow_next_suite = g_espnow_sec->suite;
+
+    if (espnow_sec_key_slots_restore() == ESP_OK) {
+        return;
+    }
+
+    /* Stored by the firmware without the key slots */
+    if (espnow_storage_get("key_id", &key_id, sizeof(uint8_t)) == ESP_OK) {
+        g_espnow_key_id = key_id & ESPNOW_SEC_KEY_ID_MASK;
+    }
+
+    /* A rotation was in progress before reboot */
+    if (espnow_storage_get("next_key_info", key_info, APP_KEY_LEN) == ESP_OK) {
+        espnow_next_key_install(key_info);
+    }
+}
+
 esp_err_t espnow_init(const espnow_config_t *config)
 {
     ESP_LOGI(TAG, "esp-now Version: %d.%d.%d", ESP_NOW_VER_MAJOR, ESP_NOW_VER_MINOR, ESP_NOW_VER_PATCH);
@@ -1142,10 +1393,21 @@ esp_err_t espnow_init(const espnow_config_t *config)
     }
 
     if (config->sec_enable) {
+        g_sec_lock = xSemaphoreCreateMutex();
+        ESP_ERROR_RETURN(!g_sec_lock, ESP_FAIL, "Create security semaphore mutex fail");
+
         g_espnow_sec = ESP_MALLOC(sizeof(espnow_sec_t));
-        g_espnow_dec = ESP_MALLOC(sizeof(espnow_sec_t));
         espnow_sec_init(g_espnow_sec);
-        espnow_sec_init(g_espnow_dec);
+
+        for (int i = 0; i < ESPNOW_SEC_KEY_SLOT_NUM; ++i) {
+            g_espnow_dec[i] = ESP_MALLOC(sizeof(espnow_sec_t));
+            espnow_sec_init(g_espnow_dec[i]);
+        }
+
+        /* The suites of the contexts are re-created while restoring the key slots */
+        xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+        espnow_sec_key_slots_load();
+        xSemaphoreGive(g_sec_lock);
     }
 
     uint32_t *enable = (uint32_t *)&config->receive_enable;
@@ -1195,10 +1457,22 @@ esp_err_t espnow_deinit(void)
             ESP_FREE(g_espnow_sec);
         }
 
-        if (g_espnow_dec) {
-            espnow_sec_deinit(g_espnow_dec);
-            ESP_FREE(g_espnow_dec);
+        for (int i = 0; i < ESPNOW_SEC_KEY_SLOT_NUM; ++i) {
+            if (g_espnow_dec[i]) {
+                espnow_sec_deinit(g_espnow_dec[i]);
+                ESP_FREE(g_espnow_dec[i]);
+            }
+
+            g_espnow_dec_key_id[i] = ESPNOW_SEC_KEY_ID_NONE;
+        }
+
+        if (g_sec_store_timer) {
+            xTimerDelete(g_sec_store_timer, portMAX_DELAY);
+            g_sec_store_timer = NULL;
         }
+
+        vSemaphoreDelete(g_sec_lock);
+        g_sec_lock = NULL;
     }
 
     ESP_ERROR_CHECK(esp_event_handler_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler));
@@ -1242,36 +1516,70 @@ esp_err_t espnow_get_config_for_data_type(espnow_data_type_t type, bool *enable)
     return ESP_OK;
 }
 
+esp_err_t espnow_get_handle_for_data_type(espnow_data_type_t type, handler_for_data_t *handle)
+{
+    ESP_PARAM_CHECK(type >= ESPNOW_DATA_TYPE_ACK && type < ESPNOW_DATA_TYPE_MAX);
+    ESP_PARAM_CHECK(handle);
+
+    *handle = g_recv_handle[type].handle;
+
+    return ESP_OK;
+}
+
+esp_err_t espnow_set_duplicate_cb(espnow_duplicate_cb_t cb)
+{
+    g_duplicate_cb = cb;
+
+    return ESP_OK;
+}
+
+uint32_t espnow_get_recv_drop_num(void)
+{
+    return g_recv_drop_num;
+}
+
 esp_err_t espnow_set_key(uint8_t key_info[APP_KEY_LEN])
 {
     ESP_PARAM_CHECK(g_espnow_sec);
     ESP_PARAM_CHECK(key_info);
 
     ESP_LOG_BUFFER_HEX_LEVEL(TAG, key_info, APP_KEY_LEN, ESP_LOG_DEBUG);
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(g_espnow_key_id);
     int ret = espnow_sec_setkey(g_espnow_sec, key_info);
-    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_setkey %x", ret);
 
-    if (memcmp(key_info, g_espnow_sec_key, KEY_LEN) == 0)
+    if (ret != ESP_OK || memcmp(key_info, g_espnow_sec_key[slot], KEY_LEN) == 0) {
+        xSemaphoreGive(g_sec_lock);
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_setkey %x", ret);
         return ret;
+    }
+
+    memcpy(g_espnow_sec_key[slot], key_info, APP_KEY_LEN);
+    xSemaphoreGive(g_sec_lock);
 
-    memcpy(g_espnow_sec_key, key_info, APP_KEY_LEN);
     ret = espnow_storage_set("key_info", key_info, APP_KEY_LEN);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_storage_set, key: key_info");
+    g_read_from_nvs = false;
 
-    return ret;
+    return espnow_sec_key_slots_store();
 }
 
 esp_err_t espnow_get_key(uint8_t key_info[APP_KEY_LEN])
 {
     ESP_PARAM_CHECK(key_info);
 
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(g_espnow_key_id);
+
     if (g_read_from_nvs == false) {
-        memcpy(key_info, g_espnow_sec_key, APP_KEY_LEN);
+        memcpy(key_info, g_espnow_sec_key[slot], APP_KEY_LEN);
         return ESP_OK;
     }
 
-    esp_err_t ret = espnow_storage_get("key_info", g_espnow_sec_key, APP_KEY_LEN);
+    esp_err_t ret = espnow_storage_get("key_info", g_espnow_sec_key[slot], APP_KEY_LEN);
     if (ret == ESP_OK) {
-        memcpy(key_info, g_espnow_sec_key, APP_KEY_LEN);
+        memcpy(key_info, g_espnow_sec_key[slot], APP_KEY_LEN);
         g_read_from_nvs = false;
     }
     return ret;
@@ -1280,40 +1588,59 @@ esp_err_t espnow_get_key(uint8_t key_info[APP_KEY_LEN])
 esp_err_t espnow_erase_key(void)
 {
     g_read_from_nvs = true;
-    memset(g_espnow_sec_key, 0, APP_KEY_LEN);
+    memset(g_espnow_sec_key[ESPNOW_SEC_KEY_SLOT(g_espnow_key_id)], 0, APP_KEY_LEN);
+    espnow_storage_erase(ESPNOW_SEC_KEY_SLOTS_KEY);
     return espnow_storage_erase("key_info");
 }
 
 esp_err_t espnow_set_dec_key(uint8_t key_info[APP_KEY_LEN])
 {
-    ESP_PARAM_CHECK(g_espnow_dec);
     ESP_PARAM_CHECK(key_info);
+    ESP_PARAM_CHECK(g_sec_lock);
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+
+    uint8_t key_id = g_espnow_key_id;
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+    bool changed = memcmp(key_info, g_espnow_dec_key[slot], KEY_LEN) != 0;
 
     ESP_LOG_BUFFER_HEX_LEVEL(TAG, key_info, APP_KEY_LEN, ESP_LOG_DEBUG);
-    int ret = espnow_sec_setkey(g_espnow_dec, key_info);
+    int ret = espnow_sec_setkey(g_espnow_dec[slot], key_info);
+
+    if (ret == ESP_OK) {
+        g_espnow_dec_key_id[slot] = key_id;
+        memcpy(g_espnow_dec_key[slot], key_info, APP_KEY_LEN);
+    }
+
+    xSemaphoreGive(g_sec_lock);
     ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_setkey %x", ret);
 
-    if (memcmp(key_info, g_espnow_dec_key, KEY_LEN) == 0)
+    if (!changed)
         return ret;
 
-    memcpy(g_espnow_dec_key, key_info, APP_KEY_LEN);
     ret = espnow_storage_set("dec_key_info", key_info, APP_KEY_LEN);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_storage_set, key: dec_key_info");
+    g_read_dec_from_nvs = false;
 
-    return ret;
+    return espnow_sec_key_slots_store();
 }
 
 esp_err_t espnow_get_dec_key(uint8_t key_info[APP_KEY_LEN])
 {
     ESP_PARAM_CHECK(key_info);
 
+    uint8_t key_id = g_espnow_key_id;
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+
     if (g_read_dec_from_nvs == false) {
-        memcpy(key_info, g_espnow_dec_key, APP_KEY_LEN);
+        memcpy(key_info, g_espnow_dec_key[slot], APP_KEY_LEN);
         return ESP_OK;
     }
 
-    esp_err_t ret = espnow_storage_get("dec_key_info", g_espnow_dec_key, APP_KEY_LEN);
+    esp_err_t ret = espnow_storage_get("dec_key_info", g_espnow_dec_key[slot], APP_KEY_LEN);
     if (ret == ESP_OK) {
-        memcpy(key_info, g_espnow_dec_key, APP_KEY_LEN);
+        memcpy(key_info, g_espnow_dec_key[slot], APP_KEY_LEN);
+        g_espnow_dec_key_id[slot] = key_id;
         g_read_dec_from_nvs = false;
     }
     return ret;
@@ -1321,7 +1648,234 @@ esp_err_t espnow_get_dec_key(uint8_t key_info[APP_KEY_LEN])
 
 esp_err_t espnow_erase_dec_key(void)
 {
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(g_espnow_key_id);
+
     g_read_dec_from_nvs = true;
-    memset(g_espnow_dec_key, 0, APP_KEY_LEN);
+    g_espnow_dec_key_id[slot] = ESPNOW_SEC_KEY_ID_NONE;
+    memset(g_espnow_dec_key[slot], 0, APP_KEY_LEN);
+    espnow_storage_erase(ESPNOW_SEC_KEY_SLOTS_KEY);
     return espnow_storage_erase("dec_key_info");
 }
+
+esp_err_t espnow_set_next_key(uint8_t key_info[APP_KEY_LEN])
+{
+    ESP_PARAM_CHECK(g_espnow_sec);
+    ESP_PARAM_CHECK(key_info);
+
+    ESP_LOG_BUFFER_HEX_LEVEL(TAG, key_info, APP_KEY_LEN, ESP_LOG_DEBUG);
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+    esp_err_t ret = espnow_next_key_install(key_info);
+    xSemaphoreGive(g_sec_lock);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_next_key_install");
+
+    return espnow_sec_key_slots_store();
+}
+
+esp_err_t espnow_get_next_key(uint8_t key_info[APP_KEY_LEN])
+{
+    ESP_PARAM_CHECK(key_info);
+
+    uint8_t key_id = ESPNOW_SEC_KEY_ID_NEXT(g_espnow_key_id);
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+
+    if (g_espnow_dec_key_id[slot] != key_id) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    memcpy(key_info, g_espnow_dec_key[slot], APP_KEY_LEN);
+
+    return ESP_OK;
+}
+
+esp_err_t espnow_set_key_id(uint8_t key_id)
+{
+    ESP_PARAM_CHECK(g_espnow_sec);
+
+    key_id &= ESPNOW_SEC_KEY_ID_MASK;
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+
+    uint8_t old_key_id = g_espnow_key_id;
+    uint8_t old_slot = ESPNOW_SEC_KEY_SLOT(old_key_id);
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+
+    if (key_id == old_key_id) {
+        xSemaphoreGive(g_sec_lock);
+        return ESP_OK;
+    }
+
+    /* Move the current key to the slot of the new id */
+    if (slot != old_slot) {
+        espnow_sec_t *dec = g_espnow_dec[slot];
+
+        memcpy(g_espnow_sec_key[slot], g_espnow_sec_key[old_slot], APP_KEY_LEN);
+        memcpy(g_espnow_dec_key[slot], g_espnow_dec_key[old_slot], APP_KEY_LEN);
+        g_espnow_dec[slot] = g_espnow_dec[old_slot];
+        g_espnow_dec[old_slot] = dec;
+        g_espnow_dec_key_id[slot] = g_espnow_dec_key_id[old_slot];
+        g_espnow_dec_key_id[old_slot] = ESPNOW_SEC_KEY_ID_NONE;
+    }
+
+    if (g_espnow_dec_key_id[slot] == old_key_id) {
+        g_espnow_dec_key_id[slot] = key_id;
+    }
+
+    g_espnow_key_id = key_id;
+
+    xSemaphoreGive(g_sec_lock);
+
+    espnow_storage_erase("next_key_info");
+
+    esp_err_t ret = espnow_sec_key_slots_store();
+    ret |= espnow_storage_set("key_id", &key_id, sizeof(uint8_t));
+
+    return ret;
+}
+
+uint8_t espnow_get_key_id(void)
+{
+    return g_espnow_key_id;
+}
+
+/**
+ * @brief Use the next key to send from now on, called with g_sec_lock held
+ */
+static esp_err_t espnow_sec_key_switch(void)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t key_id = ESPNOW_SEC_KEY_ID_NEXT(g_espnow_key_id);
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+
+    ESP_ERROR_RETURN(g_espnow_dec_key_id[slot] != key_id, ESP_ERR_INVALID_STATE, "Next key is not set");
+
+    /* The next key is used with the suite it was installed with */
+    ret = espnow_sec_set_suite(g_espnow_sec, g_espnow_dec[slot]->suite);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_set_suite");
+
+    ret = espnow_sec_setkey(g_espnow_sec, g_espnow_sec_key[slot]);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_setkey %x", ret);
+
+    /* Both slots are filled, from here on the sending side uses the next key */
+    g_espnow_key_id = key_id;
+    g_read_from_nvs = false;
+    g_read_dec_from_nvs = false;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief The key slots go first, they are what is restored on boot, the single entries are kept
+ *        for the firmware without the key slots
+ */
+static esp_err_t espnow_sec_key_switch_store(void)
+{
+    uint8_t key_id = g_espnow_key_id;
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+    uint8_t suite = g_espnow_sec->suite;
+    esp_err_t ret = espnow_sec_key_slots_store();
+
+    ret |= espnow_storage_set("sec_suite", &suite, sizeof(uint8_t));
+    ret |= espnow_storage_set("key_info", g_espnow_sec_key[slot], APP_KEY_LEN);
+    ret |= espnow_storage_set("dec_key_info", g_espnow_dec_key[slot], APP_KEY_LEN);
+    ret |= espnow_storage_set("key_id", &key_id, sizeof(uint8_t));
+    espnow_storage_erase("next_key_info");
+
+    return ret;
+}
+
+static void espnow_sec_key_switch_store_timer_cb(TimerHandle_t timer)
+{
+    if (espnow_sec_key_switch_store() != ESP_OK) {
+        ESP_LOGW(TAG, "Store the switched key fail");
+    }
+}
+
+static void espnow_sec_key_switch_store_later(void)
+{
+    if (!g_sec_store_timer) {
+        g_sec_store_timer = xTimerCreate("espnow_sec_key", 1, pdFALSE, NULL, espnow_sec_key_switch_store_timer_cb);
+    }
+
+    if (!g_sec_store_timer || xTimerReset(g_sec_store_timer, 0) != pdPASS) {
+        espnow_sec_key_switch_store_timer_cb(NULL);
+    }
+}
+
+esp_err_t espnow_switch_key(void)
+{
+    ESP_PARAM_CHECK(g_espnow_sec);
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+    esp_err_t ret = espnow_sec_key_switch();
+    uint8_t key_id = g_espnow_key_id;
+    xSemaphoreGive(g_sec_lock);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_key_switch");
+
+    ESP_LOGI(TAG, "Switch to key id: %d", key_id);
+
+    return espnow_sec_key_switch_store();
+}
+
+esp_err_t espnow_set_sec_suite(uint8_t suite)
+{
+    ESP_PARAM_CHECK(g_espnow_sec);
+    ESP_PARAM_CHECK(suite < ESPNOW_SEC_SUITE_MAX);
+
+    ESP_ERROR_RETURN(!(espnow_sec_suite_supported() & BIT(suite)), ESP_ERR_NOT_SUPPORTED,
+                     "Cipher suite %d is not supported", suite);
+
+    /* The cipher contexts are re-created, espnow_send() and the receive path use them under the lock */
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+
+    if (suite == g_espnow_sec->suite) {
+        xSemaphoreGive(g_sec_lock);
+        return ESP_OK;
+    }
+
+    esp_err_t ret = espnow_sec_suite_apply(suite);
+    g_espnow_next_suite = suite;
+    xSemaphoreGive(g_sec_lock);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_suite_apply");
+
+    ret = espnow_sec_key_slots_store();
+    ret |= espnow_storage_set("sec_suite", &suite, sizeof(uint8_t));
+
+    return ret;
+}
+
+uint8_t espnow_get_sec_suite(void)
+{
+    return g_espnow_sec ? g_espnow_sec->suite : CONFIG_ESPNOW_SEC_SUITE;
+}
+
+esp_err_t espnow_set_next_sec_suite(uint8_t suite)
+{
+    ESP_PARAM_CHECK(g_espnow_sec);
+    ESP_PARAM_CHECK(suite < ESPNOW_SEC_SUITE_MAX);
+
+    ESP_ERROR_RETURN(!(espnow_sec_suite_supported() & BIT(suite)), ESP_ERR_NOT_SUPPORTED,
+                     "Cipher suite %d is not supported", suite);
+
+    xSemaphoreTake(g_sec_lock, portMAX_DELAY);
+
+    uint8_t key_id = ESPNOW_SEC_KEY_ID_NEXT(g_espnow_key_id);
+    uint8_t slot = ESPNOW_SEC_KEY_SLOT(key_id);
+    esp_err_t ret = ESP_OK;
+
+    g_espnow_next_suite = suite;
+
+    /* The next key has been installed already, it is used with the new suite as well */
+    if (g_espnow_dec_key_id[slot] == key_id) {
+        ret = espnow_sec_set_suite(g_espnow_dec[slot], suite);
+    }
+
+    xSemaphoreGive(g_sec_lock);
+
+    return ret;
+}
+
+uint8_t espnow_get_next_sec_suite(void)
+{
+    return g_espnow_sec ? g_espnow_next_suite : CONFIG_ESPNOW_SEC_SUITE;
+}
@@ -0,0 +1,93 @@
+// Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+
+#include "mbedtls/sha256.h"
+
+#include "espnow.h"
+#include "espnow_ota.h"
+#include "espnow_utils.h"
+
+static const char *TAG = "espnow_ota_hash";
+
+esp_err_t espnow_ota_hash(const void *data, size_t size, uint8_t *hash, size_t hash_len)
+{
+    ESP_PARAM_CHECK(data || !size);
+    ESP_PARAM_CHECK(hash);
+    ESP_PARAM_CHECK(hash_len <= 32);
+
+    int ret = 0;
+    uint8_t sha_256[32] = {0};
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    ret = mbedtls_sha256(data, size, sha_256, 0);
+#else
+    ret = mbedtls_sha256_ret(data, size, sha_256, 0);
+#endif
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "mbedtls_sha256, ret: -0x%x", -ret);
+
+    memcpy(hash, sha_256, hash_len);
+
+    return ESP_OK;
+}
+
+uint32_t espnow_ota_mac_hash(const uint8_t mac[ESPNOW_ADDR_LEN], uint32_t seed)
+{
+    uint32_t value = 2166136261UL ^ seed;
+
+    for (int i = 0; i < ESPNOW_ADDR_LEN; ++i) {
+        value = (value ^ mac[i]) * 16777619UL;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Bits of a MAC address in the filter by double hashing, the step is odd so the bits differ
+ */
+#define ESPNOW_OTA_FILTER_SEED2     0x5BD1E995
+
+void espnow_ota_filter_add(uint8_t *filter, size_t size, uint8_t hash_num, uint32_t seed, const uint8_t mac[ESPNOW_ADDR_LEN])
+{
+    uint32_t bits = size * 8;
+    uint32_t h1   = espnow_ota_mac_hash(mac, seed);
+    uint32_t h2   = espnow_ota_mac_hash(mac, seed ^ ESPNOW_OTA_FILTER_SEED2) | 1;
+
+    for (uint32_t i = 0; bits && i < hash_num; ++i) {
+        uint32_t bit = (h1 + i * h2) % bits;
+        filter[bit / 8] |= BIT(bit % 8);
+    }
+}
+
+bool espnow_ota_filter_test(const uint8_t *filter, size_t size, uint8_t hash_num, uint32_t seed, const uint8_t mac[ESPNOW_ADDR_LEN])
+{
+    uint32_t bits = size * 8;
+    uint32_t h1   = espnow_ota_mac_hash(mac, seed);
+    uint32_t h2   = espnow_ota_mac_hash(mac, seed ^ ESPNOW_OTA_FILTER_SEED2) | 1;
+
+    if (!bits || !hash_num) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < hash_num; ++i) {
+        uint32_t bit = (h1 + i * h2) % bits;
+
+        if (!(filter[bit / 8] & BIT(bit % 8))) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -12,8 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
@@ -23,6 +26,7 @@
 #include "freertos/semphr.h"
 
 #include "esp_wifi.h"
+#include "esp_timer.h"
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
 #include "esp_mac.h"
@@ -31,6 +35,9 @@
 #include "esp_system.h"
 #endif
 
+#include "esp_crc.h"
+#include "nvs.h"
+
 #include "espnow.h"
 #include "espnow_ota.h"
 #include "espnow_utils.h"
@@ -38,15 +45,84 @@
 static const char *TAG = "espnow_ota_initatior";
 static bool g_ota_send_running_flag   = false;
 static SemaphoreHandle_t g_ota_send_exit_sem = NULL;
+static volatile bool g_ota_scan_stop  = false;  /**< Set by the stop of the upgrade, a scan returns on it */
 
 static size_t g_scan_num = 0;
 static espnow_ota_responder_t *g_info_list = NULL;
 static bool g_info_en = false;
+static size_t g_info_capacity       = 0;    /**< Entries g_info_list has room for, doubled when full */
+static uint16_t *g_info_index       = NULL; /**< Open addressing table of g_info_list by MAC, index + 1, 0 for empty */
+static size_t g_info_index_size     = 0;
+static SemaphoreHandle_t g_info_lock = NULL; /**< g_info_list is filled by the receive task while the scan reads it */
 
 #ifndef CONFIG_ESPNOW_OTA_RETRY_COUNT
 #define CONFIG_ESPNOW_OTA_RETRY_COUNT           50
 #endif
 
+#ifndef CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM
+#define CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM        8
+#endif
+
+#ifdef CONFIG_ESPNOW_OTA_COMPRESS
+#define ESPNOW_OTA_COMPRESS_ENABLE              1
+#else
+#define ESPNOW_OTA_COMPRESS_ENABLE              0
+#endif
+
+#ifdef CONFIG_ESPNOW_OTA_PACE
+#define ESPNOW_OTA_PACE_ENABLE                  1
+#else
+#define ESPNOW_OTA_PACE_ENABLE                  0
+#endif
+
+#ifdef CONFIG_ESPNOW_OTA_CHECKPOINT
+#define ESPNOW_OTA_CHECKPOINT_ENABLE            1
+#else
+#define ESPNOW_OTA_CHECKPOINT_ENABLE            0
+#endif
+
+/**< The header and the data of a checkpoint are two NVS entries, the keys are at most 15 characters */
+#define ESPNOW_OTA_CHECKPOINT_KEY               "ota_cp_%08" PRIx32
+#define ESPNOW_OTA_CHECKPOINT_DATA_KEY          "ota_cd_%08" PRIx32
+#define ESPNOW_OTA_CHECKPOINT_VERSION           1
+/**< The campaigns that have a checkpoint, the ones of the firmwares not sent any more are erased */
+#define ESPNOW_OTA_CHECKPOINT_LIST_KEY          "ota_cp_list"
+
+/**< AIMD of the packet rate, halved when the receive queue of a responder overflowed, raised by a step otherwise */
+#define ESPNOW_OTA_PACE_RATE_STEP               20      /**< Packets per second */
+#define ESPNOW_OTA_PACE_RATE_MIN                20
+#define ESPNOW_OTA_PACE_DROP_PERMILLE           20      /**< Frames dropped by a queue taken as an overflow */
+#define ESPNOW_OTA_PACE_LOSS_PERMILLE           50      /**< Loss left to the next round by the retransmissions */
+#define ESPNOW_OTA_PACE_RETRANSMIT_MAX          MAX(CONFIG_ESPNOW_OTA_RETRANSMISSION_TIMES, 4)
+
+/**< Repair packets sent on top of the most packets any responder lost in a block,
+     covers the repair packets lost on the air and the ones that add no rank */
+#define ESPNOW_OTA_FEC_MARGIN                   2
+
+/**< Time of the NACK reply of a responder, the replies are spread over the window of all */
+#define ESPNOW_OTA_NACK_SLOT_MS                 10
+#define ESPNOW_OTA_NACK_WINDOW_MAX              1000
+
+#ifndef CONFIG_ESPNOW_OTA_READ_AHEAD_NUM
+#define CONFIG_ESPNOW_OTA_READ_AHEAD_NUM        4
+#endif
+
+#ifndef CONFIG_ESPNOW_OTA_READ_AHEAD_BLOCK_SIZE
+#define CONFIG_ESPNOW_OTA_READ_AHEAD_BLOCK_SIZE 4096
+#endif
+
+#ifndef CONFIG_ESPNOW_OTA_CAMPAIGN_MAX
+#define CONFIG_ESPNOW_OTA_CAMPAIGN_MAX          4
+#endif
+
+#ifndef CONFIG_ESPNOW_OTA_RELAY_HOPS
+#define CONFIG_ESPNOW_OTA_RELAY_HOPS            0
+#endif
+
+#ifndef CONFIG_ESPNOW_OTA_RELAY_PACKET_INTERVAL
+#define CONFIG_ESPNOW_OTA_RELAY_PACKET_INTERVAL 5
+#endif
+
 #ifndef CONFIG_ESPNOW_OTA_SEND_FORWARD_TTL
 #define CONFIG_ESPNOW_OTA_SEND_FORWARD_TTL      0
 #endif
@@ -59,6 +135,26 @@ static bool g_info_en = false;
 #define CONFIG_ESPNOW_OTA_WAIT_RESPONSE_TIMEOUT (10 * 1000)
 #endif
 
+/**< Time of the info reply of a responder, the replies are spread over the window of the responders left */
+#define ESPNOW_OTA_SCAN_SLOT_MS                 4
+#define ESPNOW_OTA_SCAN_WINDOW_MIN              100
+#define ESPNOW_OTA_SCAN_WINDOW_FIRST            500
+#define ESPNOW_OTA_SCAN_WINDOW_MAX              4000
+#define ESPNOW_OTA_SCAN_MARGIN_MS               100  /**< Wait for the replies queued after the window */
+#define ESPNOW_OTA_STOP_CHECK_MS                100  /**< The long waits of an upgrade check for the stop in slices */
+
+/**< The first request of a scan asks one part of the responders for their number */
+#define ESPNOW_OTA_SCAN_PROBE_PARTS             16
+#define ESPNOW_OTA_SCAN_PARTS_MAX               128
+
+/**< The filter fits in a legacy frame, 10 bits and 7 hashes a MAC give about 1% of false positives */
+#define ESPNOW_OTA_SCAN_FILTER_SIZE             (ESPNOW_OTA_LEGACY_DATA_LEN - sizeof(espnow_ota_scan_t))
+#define ESPNOW_OTA_SCAN_FILTER_BITS             10
+#define ESPNOW_OTA_SCAN_FILTER_HASH_NUM         7
+#define ESPNOW_OTA_SCAN_FILTER_CAPACITY         (ESPNOW_OTA_SCAN_FILTER_SIZE * 8 / ESPNOW_OTA_SCAN_FILTER_BITS)
+
+#define ESPNOW_OTA_INFO_CAPACITY_MIN            16
+
 
 static bool addrs_remove(uint8_t addrs_list[][ESPNOW_ADDR_LEN],
                          size_t *addrs_num, const uint8_t addr[6])
@@ -81,23 +177,100 @@ static bool addrs_remove(uint8_t addrs_list[][ESPNOW_ADDR_LEN],
     return false;
 }
 
+/**
+ * @brief Slot of the MAC in g_info_index, the empty one it goes to when it is not in g_info_list
+ */
+static size_t espnow_ota_info_slot(const uint8_t *mac)
+{
+    size_t mask = g_info_index_size - 1;
+    size_t slot = espnow_ota_mac_hash(mac, 0) & mask;
+
+    while (g_info_index[slot] && !ESPNOW_ADDR_IS_EQUAL(g_info_list[g_info_index[slot] - 1].mac, mac)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+static espnow_ota_responder_t *espnow_ota_info_find(const uint8_t *mac)
+{
+    if (!g_info_index) {
+        return NULL;
+    }
+
+    uint16_t index = g_info_index[espnow_ota_info_slot(mac)];
+    return index ? g_info_list + index - 1 : NULL;
+}
+
+/**
+ * @brief Double the room of g_info_list, the index is rebuilt at twice the entries
+ */
+static esp_err_t espnow_ota_info_grow(void)
+{
+    size_t capacity = g_info_capacity ? g_info_capacity * 2 : ESPNOW_OTA_INFO_CAPACITY_MIN;
+    ESP_ERROR_RETURN(capacity > UINT16_MAX, ESP_ERR_NO_MEM, "Too many responders, capacity: %d", capacity);
+
+    espnow_ota_responder_t *info_list = ESP_REALLOC(g_info_list, capacity * sizeof(espnow_ota_responder_t));
+    ESP_ERROR_RETURN(!info_list, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> g_info_list");
+    g_info_list     = info_list;
+    g_info_capacity = capacity;
+
+    ESP_FREE(g_info_index);
+    g_info_index_size = 0;
+    g_info_index = ESP_CALLOC(capacity * 2, sizeof(uint16_t));
+    ESP_ERROR_RETURN(!g_info_index, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> g_info_index");
+    g_info_index_size = capacity * 2;
+
+    for (size_t i = 0; i < g_scan_num; ++i) {
+        g_info_index[espnow_ota_info_slot(g_info_list[i].mac)] = i + 1;
+    }
+
+    return ESP_OK;
+}
+
 static esp_err_t espnow_ota_info(uint8_t *src_addr, void *data,
                       size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
 {
+    esp_err_t ret = ESP_OK;
     espnow_ota_info_t *recv_data = (espnow_ota_info_t *)data;
+    espnow_ota_responder_t *info = NULL;
 
-    for (int i = 0; i < g_scan_num; ++i) {
-        if (ESPNOW_ADDR_IS_EQUAL((g_info_list)[i].mac, src_addr)) {
-            return ESP_OK;
+    xSemaphoreTake(g_info_lock, portMAX_DELAY);
+
+    if (espnow_ota_info_find(src_addr)) {
+        goto EXIT;
+    }
+
+    if (g_scan_num == g_info_capacity || !g_info_index) {
+        ret = espnow_ota_info_grow();
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_info_grow", esp_err_to_name(ret));
+    }
+
+    info = g_info_list + g_scan_num;
+    info->channel = rx_ctrl->channel;
+    info->rssi    = rx_ctrl->rssi;
+    memcpy(info->mac, src_addr, 6);
+    memcpy(&info->app_desc, &recv_data->app_desc, sizeof(esp_app_desc_t));
+    info->packet_size = ESPNOW_OTA_PACKET_MAX_SIZE;
+    info->flags       = 0;
+    memset(info->running_sha_256, 0, ESPNOW_OTA_HASH_LEN);
+
+    /**< Older responders do not report the packet size, they only accept legacy packets */
+    if (size >= ESPNOW_OTA_INFO_SIZE + sizeof(uint16_t)) {
+        const espnow_ota_info_ext_t *info_ext = (espnow_ota_info_ext_t *)((uint8_t *)data + ESPNOW_OTA_INFO_SIZE);
+        info->packet_size = MIN(MAX(info_ext->packet_size, ESPNOW_OTA_PACKET_MAX_SIZE), ESPNOW_OTA_PACKET_V2_MAX_SIZE);
+
+        /**< The capabilities follow the packet size, responders without them report none */
+        if (size >= ESPNOW_OTA_INFO_SIZE + offsetof(espnow_ota_info_ext_t, running_sha_256)) {
+            info->flags = info_ext->flags;
+        }
+
+        if (size >= ESPNOW_OTA_INFO_SIZE + sizeof(espnow_ota_info_ext_t)) {
+            memcpy(info->running_sha_256, info_ext->running_sha_256, ESPNOW_OTA_HASH_LEN);
         }
     }
 
-    g_info_list = ESP_REALLOC(g_info_list, (g_scan_num + 1) * sizeof(espnow_ota_responder_t));
-    (g_info_list)[g_scan_num].channel = rx_ctrl->channel;
-    (g_info_list)[g_scan_num].rssi    = rx_ctrl->rssi;
-    memcpy((g_info_list)[g_scan_num].mac, src_addr, 6);
-    memcpy(&((g_info_list)[g_scan_num].app_desc), &recv_data->app_desc, sizeof(esp_app_desc_t));
-    g_scan_num++;
+    g_info_index[espnow_ota_info_slot(src_addr)] = ++g_scan_num;
 
     ESP_LOGV(TAG, "Application information:");
     ESP_LOGV(TAG, "Project name:     %s", recv_data->app_desc.project_name);
@@ -105,40 +278,172 @@ static esp_err_t espnow_ota_info(uint8_t *src_addr, void *data,
     ESP_LOGV(TAG, "Secure version:   %d", recv_data->app_desc.secure_version);
     ESP_LOGV(TAG, "Compile time:     %s %s", recv_data->app_desc.date, recv_data->app_desc.time);
     ESP_LOGV(TAG, "ESP-IDF:          %s", recv_data->app_desc.idf_ver);
+    ESP_LOGV(TAG, "Packet size:      %d", info->packet_size);
 
-    return ESP_OK;
+EXIT:
+    xSemaphoreGive(g_info_lock);
+    return ret;
 }
 
-static QueueHandle_t g_ota_queue = NULL;
 typedef struct {
     uint8_t src_addr[6];
     void *data;
     size_t size;
 } espnow_ota_data_t;
 
+/**
+ * @brief Progress of a campaign saved after each round. The data are the addresses of the successed,
+ *        unfinished and requested responders, then the bitmap of the packets all the requested ones received
+ */
+typedef struct {
+    uint8_t version;
+    uint8_t sha_256[ESPNOW_OTA_HASH_LEN];
+    uint32_t size;
+    uint8_t group[ESPNOW_ADDR_LEN];
+    espnow_ota_relay_t relay;
+    uint16_t packet_size;                   /**< espnow_ota_info_ext_t of the responders */
+    uint8_t flags;
+    uint16_t packet_num;
+    uint16_t successed_num;
+    uint16_t unfinished_num;
+    uint16_t requested_num;
+    uint32_t data_crc;                      /**< The data are written before the header, a torn write is detected */
+    uint8_t data[0];
+} espnow_ota_checkpoint_t;
+
+/**
+ * @brief A campaign sending a firmware to the responders in its group, the status replies are routed to
+ *        its queue by the firmware they report, or by the responder when the firmware is not the one sent
+ */
+typedef struct {
+    uint8_t group[ESPNOW_ADDR_LEN];         /**< Group of the responders of the campaign */
+    uint8_t sha_256[ESPNOW_OTA_HASH_LEN];   /**< Firmware sent */
+    const char *project_name;               /**< Only the responders running this project are scanned, NULL for all */
+    QueueHandle_t queue;                    /**< Status replies */
+    espnow_addr_t *members;                 /**< Responders of the campaign */
+    size_t member_num;
+    bool read_ahead;                        /**< One campaign at a time reads ahead */
+    bool scheduled;                         /**< The packets are interleaved with the ones of the other campaigns */
+    bool sending;                           /**< Sending the packets of a round */
+    uint64_t pass;                          /**< Stride scheduling, the campaign of the lowest pass sends next */
+    TaskHandle_t task;
+    espnow_ota_campaign_t *campaign;        /**< Campaign of espnow_ota_initiator_send_multi() */
+    SemaphoreHandle_t done_sem;
+    bool checkpoint;                        /**< The progress is saved after each round */
+    espnow_ota_checkpoint_t *resume;        /**< Progress the campaign carries on from, NULL to scan */
+} espnow_ota_campaign_ctx_t;
+
+#define ESPNOW_OTA_CAMPAIGN_CTX_DEFAULT() { \
+    .group = {'O', 'T', 'A', 0x0, 0x0, 0x0}, \
+    .read_ahead = true, \
+}
+
+static espnow_ota_campaign_ctx_t *g_campaigns[CONFIG_ESPNOW_OTA_CAMPAIGN_MAX] = { 0 };
+static uint32_t g_campaign_busy       = 0;   /**< Status replies being put to a queue */
+static uint32_t g_status_users        = 0;   /**< Campaigns and scans waiting for the status replies */
+static SemaphoreHandle_t g_setup_lock = NULL; /**< The campaigns scan one at a time, g_info_list is shared */
+static bool g_checkpoint_en = false;          /**< Set by espnow_ota_initiator_checkpoint_enable() */
+static portMUX_TYPE g_campaign_lock   = portMUX_INITIALIZER_UNLOCKED;
+
+static espnow_ota_campaign_ctx_t *espnow_ota_campaign_find(const uint8_t *src_addr, const void *data, size_t size)
+{
+    espnow_ota_campaign_ctx_t *found = NULL;
+    size_t num = 0;
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+        espnow_ota_campaign_ctx_t *ctx = g_campaigns[i];
+
+        if (!ctx) {
+            continue;
+        }
+
+        num++;
+        found = ctx;
+
+        if (size >= sizeof(espnow_ota_status_t)
+                && !memcmp(((espnow_ota_status_t *)data)->sha_256, ctx->sha_256, ESPNOW_OTA_HASH_LEN)) {
+            return ctx;
+        }
+    }
+
+    /**< A responder running the firmware already replies with the status of its former upgrade */
+    for (int i = 0; num > 1 && i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+        for (size_t j = 0; g_campaigns[i] && j < g_campaigns[i]->member_num; ++j) {
+            if (ESPNOW_ADDR_IS_EQUAL(g_campaigns[i]->members[j], src_addr)) {
+                return g_campaigns[i];
+            }
+        }
+    }
+
+    return num == 1 ? found : NULL;
+}
+
+static void espnow_ota_campaign_register(espnow_ota_campaign_ctx_t *ctx, bool enable)
+{
+    portENTER_CRITICAL(&g_campaign_lock);
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+        if (enable && !g_campaigns[i]) {
+            g_campaigns[i] = ctx;
+            break;
+        } else if (!enable && g_campaigns[i] == ctx) {
+            g_campaigns[i] = NULL;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_campaign_lock);
+
+    /**< The queue is deleted once no reply is being put to it */
+    while (!enable && g_campaign_busy) {
+        vTaskDelay(1);
+    }
+}
+
 static esp_err_t espnow_ota_status_handle(uint8_t *src_addr, void *data, size_t size)
 {
     ESP_PARAM_CHECK(src_addr);
     ESP_PARAM_CHECK(data);
     ESP_PARAM_CHECK(size);
 
-    if (g_ota_queue) {
+    esp_err_t ret = ESP_OK;
+    QueueHandle_t queue = NULL;
+
+    portENTER_CRITICAL(&g_campaign_lock);
+    espnow_ota_campaign_ctx_t *ctx = espnow_ota_campaign_find(src_addr, data, size);
+
+    if (ctx && ctx->queue) {
+        queue = ctx->queue;
+        g_campaign_busy++;
+    }
+
+    portEXIT_CRITICAL(&g_campaign_lock);
+
+    if (queue) {
         espnow_ota_data_t ota_data = { 0 };
         ota_data.data = ESP_MALLOC(size);
-        if (!ota_data.data) {
-            return ESP_FAIL;
-        }
+        ret = ESP_FAIL;
+        ESP_ERROR_GOTO(!ota_data.data, EXIT, "<ESP_ERR_NO_MEM> ota_data");
+
         memcpy(ota_data.data, data, size);
         ota_data.size = size;
         memcpy(ota_data.src_addr, src_addr, 6);
-        if (xQueueSend(g_ota_queue, &ota_data, 0) != pdPASS) {
+        if (xQueueSend(queue, &ota_data, 0) != pdPASS) {
             ESP_LOGW(TAG, "[%s, %d] Send ota queue failed", __func__, __LINE__);
             ESP_FREE(ota_data.data);
-            return ESP_FAIL;
+            goto EXIT;
         }
+
+        ret = ESP_OK;
     }
 
-    return ESP_OK;
+EXIT:
+    if (queue) {
+        portENTER_CRITICAL(&g_campaign_lock);
+        g_campaign_busy--;
+        portEXIT_CRITICAL(&g_campaign_lock);
+    }
+
+    return ret;
 }
 
 static esp_err_t espnow_ota_initiator_status_process(uint8_t *src_addr, void *data,
@@ -161,6 +466,7 @@ static esp_err_t espnow_ota_initiator_status_process(uint8_t *src_addr, void *da
             break;
 
         case ESPNOW_OTA_TYPE_STATUS:
+        case ESPNOW_OTA_TYPE_NACK:
             ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_STATUS");
             ret = espnow_ota_status_handle(src_addr, data, size);
             break;
@@ -173,226 +479,1618 @@ static esp_err_t espnow_ota_initiator_status_process(uint8_t *src_addr, void *da
     return ret;
 }
 
+/**
+ * @brief The status replies are handled while a campaign or a scan waits for them
+ */
+static void espnow_ota_status_enable(bool enable)
+{
+    bool changed = false;
+
+    portENTER_CRITICAL(&g_campaign_lock);
+    changed = enable ? !g_status_users++ : !--g_status_users;
+    portEXIT_CRITICAL(&g_campaign_lock);
+
+    if (changed) {
+        espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_OTA_STATUS, enable, enable ? espnow_ota_initiator_status_process : NULL);
+    }
+}
+
+/**
+ * @brief Fill the request of a scan with the filter of the responders heard in the part asked,
+ *        the filter is left out when they do not fit in it
+ *
+ * @return the number of the responders heard
+ */
+static size_t espnow_ota_scan_request(espnow_ota_scan_t *request, uint8_t part_num, uint8_t part, uint16_t window)
+{
+    size_t filter_num = 0;
+    size_t heard_num  = 0;
+
+    request->type         = ESPNOW_OTA_TYPE_REQUEST;
+    request->reply_window = window;
+    request->part_num     = part_num;
+    request->part         = part;
+    request->seed         = esp_random();
+    request->hash_num     = ESPNOW_OTA_SCAN_FILTER_HASH_NUM;
+    memset(request->filter, 0, ESPNOW_OTA_SCAN_FILTER_SIZE);
+
+    xSemaphoreTake(g_info_lock, portMAX_DELAY);
+
+    for (size_t i = 0; i < g_scan_num; ++i) {
+        if (espnow_ota_mac_hash(g_info_list[i].mac, 0) % part_num == part) {
+            espnow_ota_filter_add(request->filter, ESPNOW_OTA_SCAN_FILTER_SIZE, request->hash_num,
+                                  request->seed, g_info_list[i].mac);
+            filter_num++;
+        }
+    }
+
+    heard_num = g_scan_num;
+    xSemaphoreGive(g_info_lock);
+
+    if (filter_num > ESPNOW_OTA_SCAN_FILTER_CAPACITY) {
+        request->hash_num = 0;
+    }
+
+    return heard_num;
+}
+
+/**
+ * @brief Responders of a scan left to hear, by the replies of the requests sent so far
+ */
+typedef struct {
+    uint32_t estimate;          /**< Responders not heard yet */
+    uint16_t window;            /**< Reply window of the next request, in ms */
+    uint8_t part_num;
+    uint8_t part;               /**< Part the next request asks */
+    uint8_t done[ESPNOW_OTA_SCAN_PARTS_MAX / 8]; /**< Parts a request had no new reply from */
+    uint32_t request_num;
+} espnow_ota_scan_plan_t;
+
+#define ESPNOW_OTA_SCAN_PLAN_DEFAULT() { \
+    .window   = ESPNOW_OTA_SCAN_WINDOW_FIRST, \
+    .part_num = ESPNOW_OTA_SCAN_PROBE_PARTS, \
+}
+
+/**
+ * @brief Plan the next request by the new replies to the last one, the window is sized to the responders
+ *        left in a part and the parts are split once the window or the filter would not hold them.
+ *
+ * @return false once a request to each part had no new reply
+ */
+static bool espnow_ota_scan_next(espnow_ota_scan_plan_t *plan, size_t new_num, size_t heard_num)
+{
+    uint32_t pending = 0;
+    uint32_t parts   = 1;
+    uint32_t need    = 0;
+
+    if (++plan->request_num == 1) {
+        /**< The other parts of the probe have about as many responders, the scan starts from one part */
+        plan->estimate = new_num * (plan->part_num - 1);
+        plan->part_num = 1;
+        plan->part     = 0;
+    } else {
+        for (int i = 0; i < plan->part_num; ++i) {
+            pending += !ESPNOW_OTA_GET_BITS(plan->done, i);
+        }
+
+        /**< Twice the replies the window was sized for, the other parts may have as many left */
+        if (new_num * ESPNOW_OTA_SCAN_SLOT_MS > plan->window) {
+            plan->estimate = MAX(plan->estimate - MIN(plan->estimate, new_num), new_num * pending);
+        } else {
+            plan->estimate -= MIN(plan->estimate, new_num);
+        }
+
+        if (!new_num) {
+            ESPNOW_OTA_SET_BITS(plan->done, plan->part);
+        }
+    }
+
+    need = MAX((plan->estimate * ESPNOW_OTA_SCAN_SLOT_MS * 2 + ESPNOW_OTA_SCAN_WINDOW_MAX - 1) / ESPNOW_OTA_SCAN_WINDOW_MAX,
+               (heard_num + ESPNOW_OTA_SCAN_FILTER_CAPACITY - 1) / ESPNOW_OTA_SCAN_FILTER_CAPACITY);
+
+    while (parts < need && parts < ESPNOW_OTA_SCAN_PARTS_MAX) {
+        parts *= 2;
+    }
+
+    /**< The parts are split in two, a part is done when the one it was split from was */
+    for (; plan->part_num < parts; plan->part_num *= 2) {
+        for (int i = 0; i < plan->part_num; ++i) {
+            if (ESPNOW_OTA_GET_BITS(plan->done, i)) {
+                ESPNOW_OTA_SET_BITS(plan->done, i + plan->part_num);
+            }
+        }
+    }
+
+    pending = 0;
+
+    for (int i = 0; i < plan->part_num; ++i) {
+        pending += !ESPNOW_OTA_GET_BITS(plan->done, i);
+    }
+
+    if (!pending) {
+        return false;
+    }
+
+    do {
+        plan->part = (plan->part + 1) % plan->part_num;
+    } while (ESPNOW_OTA_GET_BITS(plan->done, plan->part));
+
+    plan->window = MIN(MAX((plan->estimate + pending - 1) / pending * ESPNOW_OTA_SCAN_SLOT_MS * 2,
+                           ESPNOW_OTA_SCAN_WINDOW_MIN), ESPNOW_OTA_SCAN_WINDOW_MAX);
+
+    return true;
+}
+
+/**
+ * @brief Wait for the scan replies, return false once the upgrade is stopped
+ */
+static bool espnow_ota_scan_wait(TickType_t wait_ticks)
+{
+    while (wait_ticks > 0 && !g_ota_scan_stop) {
+        TickType_t slice_ticks = MIN(wait_ticks, pdMS_TO_TICKS(ESPNOW_OTA_STOP_CHECK_MS));
+        vTaskDelay(slice_ticks);
+        wait_ticks -= slice_ticks;
+    }
+
+    return !g_ota_scan_stop;
+}
+
 esp_err_t espnow_ota_initiator_scan(espnow_ota_responder_t **info_list, size_t *num, TickType_t wait_ticks)
 {
+    ESP_PARAM_CHECK(info_list);
+    ESP_PARAM_CHECK(num);
+
     esp_err_t ret = ESP_OK;
-    espnow_ota_info_t request_ota_info = {.type = ESPNOW_OTA_TYPE_REQUEST};
+    size_t request_size = sizeof(espnow_ota_scan_t) + ESPNOW_OTA_SCAN_FILTER_SIZE;
+    espnow_ota_scan_t *request = NULL;
+    espnow_ota_scan_plan_t plan = ESPNOW_OTA_SCAN_PLAN_DEFAULT();
+    TickType_t start_ticks = xTaskGetTickCount();
+    size_t heard_num = 0;
+    size_t new_num   = 0;
+    bool complete    = false;
 
     espnow_frame_head_t frame_head = {
         .retransmit_count = CONFIG_ESPNOW_OTA_RETRANSMISSION_TIMES,
         .broadcast        = true,
-        .magic            = esp_random(),
         .filter_adjacent_channel = true,
         .forward_ttl      = CONFIG_ESPNOW_OTA_SEND_FORWARD_TTL,
         .forward_rssi     = CONFIG_ESPNOW_OTA_SEND_FORWARD_RSSI,
         .security         = CONFIG_ESPNOW_OTA_SECURITY,
     };
 
+    if (!g_info_lock) {
+        g_info_lock = xSemaphoreCreateMutex();
+        ESP_ERROR_RETURN(!g_info_lock, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> g_info_lock");
+    }
+
+    request = ESP_MALLOC(request_size);
+    ESP_ERROR_RETURN(!request, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> request");
+
     espnow_ota_initiator_scan_result_free();
 
+    g_ota_scan_stop = false;
     g_info_en = true;
-    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_OTA_STATUS, 1, espnow_ota_initiator_status_process);
+    espnow_ota_status_enable(true);
 
-    for (int i = 0, start_ticks = xTaskGetTickCount(), recv_ticks = 500; i < 5 && wait_ticks - (xTaskGetTickCount() - start_ticks) > 0;
-            ++i, recv_ticks = 500) {
-        ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, ESPNOW_ADDR_BROADCAST, &request_ota_info, 1, &frame_head, portMAX_DELAY);
+    /**< Older responders reply to every request at once, their replies are only counted the first time */
+    while (!complete) {
+        TickType_t spent_ticks = xTaskGetTickCount() - start_ticks;
+
+        if (spent_ticks >= wait_ticks) {
+            break;
+        }
+
+        heard_num = espnow_ota_scan_request(request, plan.part_num, plan.part, plan.window);
+        frame_head.magic = esp_random();
+
+        ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, ESPNOW_ADDR_BROADCAST, request, request_size, &frame_head, portMAX_DELAY);
         ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_send");
 
-        vTaskDelay(recv_ticks);
+        if (!espnow_ota_scan_wait(MIN(pdMS_TO_TICKS(plan.window + ESPNOW_OTA_SCAN_MARGIN_MS), wait_ticks - spent_ticks))) {
+            ESP_LOGW(TAG, "The scan is stopped");
+            break;
+        }
+
+        xSemaphoreTake(g_info_lock, portMAX_DELAY);
+        new_num   = g_scan_num - heard_num;
+        heard_num = g_scan_num;
+        xSemaphoreGive(g_info_lock);
+
+        ESP_LOGD(TAG, "Scan request: %" PRIu32 ", part: %d/%d, window: %d ms, new: %d, estimate: %" PRIu32,
+                 plan.request_num + 1, plan.part, plan.part_num, plan.window, new_num, plan.estimate);
+
+        complete = !espnow_ota_scan_next(&plan, new_num, heard_num);
     }
 
+    ESP_LOGI(TAG, "Scan %s, responders: %d, not heard about: %" PRIu32 ", requests: %" PRIu32 ", spent: %" PRIu32 " ms",
+             complete ? "complete" : "timeout", heard_num, complete ? 0 : plan.estimate, plan.request_num,
+             (uint32_t)((xTaskGetTickCount() - start_ticks) * portTICK_PERIOD_MS));
+
     *info_list = g_info_list;
     *num = g_scan_num;
 
 EXIT:
-    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_OTA_STATUS, 0, NULL);
+    espnow_ota_status_enable(false);
     g_info_en = false;
+    ESP_FREE(request);
 
     return ret;
 }
 
 esp_err_t espnow_ota_initiator_scan_result_free(void)
 {
+    if (g_info_lock) {
+        xSemaphoreTake(g_info_lock, portMAX_DELAY);
+    }
+
     ESP_FREE(g_info_list);
-    g_scan_num = 0;
+    ESP_FREE(g_info_index);
+    g_scan_num        = 0;
+    g_info_capacity   = 0;
+    g_info_index_size = 0;
+
+    if (g_info_lock) {
+        xSemaphoreGive(g_info_lock);
+    }
 
     return ESP_OK;
 }
 
-static esp_err_t espnow_ota_request_status(uint8_t (*progress_array)[ESPNOW_OTA_PROGRESS_MAX_SIZE],
-        const espnow_ota_status_t *status, espnow_ota_result_t *result)
+/**
+ * @brief The largest packet size and the capabilities all the responders in the scan result have,
+ *        the responders not in the scan result are taken as older ones.
+ */
+static void espnow_ota_caps_min(const espnow_addr_t *addrs_list, size_t addrs_num, espnow_ota_info_ext_t *caps)
 {
-    esp_err_t ret       = ESP_OK;
-    uint8_t src_addr[6] = {0};
-    espnow_ota_status_t *response_data = ESP_MALLOC(ESPNOW_DATA_LEN);
-    espnow_ota_data_t ota_data = { 0 };
-
-    result->requested_num = 0;
-    ESP_FREE(result->requested_addr);
-
-    /**
-     * @brief Remove the device that the firmware upgrade has completed.
-     */
-    while (g_ota_queue && (xQueueReceive(g_ota_queue, &ota_data, 0) == pdPASS)) {
-        memcpy(src_addr, ota_data.src_addr, 6);
-        memcpy(response_data, ota_data.data, ota_data.size);
-        ESP_FREE(ota_data.data);
-        if (response_data->written_size == response_data->total_size || response_data->error_code == ESP_ERR_ESPNOW_OTA_FINISH) {
-            if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr)) {
-                ESP_LOGW(TAG, "The device has been removed from the list waiting for the upgrade");
-                continue;
-            }
+    caps->packet_size = ESPNOW_OTA_PACKET_V2_MAX_SIZE;
+    caps->flags       = 0xFF;
 
-            result->successed_num++;
-            result->successed_addr = ESP_REALLOC_RETRY(result->successed_addr,
-                                     result->successed_num * ESPNOW_ADDR_LEN);
-            memcpy(result->successed_addr + (result->successed_num - 1), src_addr, ESPNOW_ADDR_LEN);
-            espnow_set_group((uint8_t (*)[6])src_addr, 1, ESPNOW_ADDR_GROUP_OTA, NULL, false, portMAX_DELAY);
-        } else if (response_data->error_code == ESP_ERR_ESPNOW_OTA_STOP) {
-            addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr);
-            espnow_set_group((uint8_t (*)[6])src_addr, 1, ESPNOW_ADDR_GROUP_OTA, NULL, false, portMAX_DELAY);
-        }
+    for (size_t i = 0; i < addrs_num; ++i) {
+        const espnow_ota_responder_t *info = espnow_ota_info_find(addrs_list[i]);
+        uint16_t size = info ? info->packet_size : ESPNOW_OTA_PACKET_MAX_SIZE;
+        uint8_t flags = info ? info->flags : 0;
 
-        if (result->unfinished_num == 0) {
-            return ESP_OK;
-        }
+        caps->packet_size = MIN(caps->packet_size, size);
+        caps->flags &= flags;
     }
+}
 
-    size_t response_num = result->unfinished_num;
-    uint8_t (*response_addrs)[6] = ESP_REALLOC_RETRY(NULL, result->unfinished_num * ESPNOW_ADDR_LEN);
-    memcpy(response_addrs, result->unfinished_addr, ESPNOW_ADDR_LEN * response_num);
-
-    /**
-     * @brief Request all devices upgrade status from unfinished device.
-     */
-    espnow_frame_head_t status_frame = {
-        .group = true,
-        .broadcast = true,
+/**
+ * @brief Ask the responders in the group for the packet size and the capabilities they have,
+ *        the responses are left in g_info_list for the caller to free
+ */
+static void espnow_ota_initiator_caps(const espnow_addr_t *addrs_list, size_t addrs_num, const uint8_t group[ESPNOW_ADDR_LEN],
+                                      espnow_ota_info_ext_t *caps)
+{
+    size_t request_size = sizeof(espnow_ota_scan_t) + ESPNOW_OTA_SCAN_FILTER_SIZE;
+    espnow_ota_scan_t *request = NULL;
+    espnow_frame_head_t frame_head = {
         .retransmit_count = CONFIG_ESPNOW_OTA_RETRANSMISSION_TIMES,
-        .magic    = esp_random(),
+        .broadcast        = true,
+        .group            = true,
         .filter_adjacent_channel = true,
         .forward_ttl      = CONFIG_ESPNOW_OTA_SEND_FORWARD_TTL,
         .forward_rssi     = CONFIG_ESPNOW_OTA_SEND_FORWARD_RSSI,
         .security         = CONFIG_ESPNOW_OTA_SECURITY,
     };
 
-    for (int i = 0, wait_ticks = pdMS_TO_TICKS(1000); i < 3 && response_num > 0; ++i, wait_ticks = pdMS_TO_TICKS(500)) {
-        if (espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, ESPNOW_ADDR_GROUP_OTA, status,
-                        sizeof(espnow_ota_status_t), &status_frame, portMAX_DELAY) != ESP_OK) {
-            ESP_LOGW(TAG, "Request devices upgrade status");
-        }
+    caps->packet_size = ESPNOW_OTA_PACKET_MAX_SIZE;
+    caps->flags       = 0;
 
-        uint8_t mac_ota_wait[6] = {0};
+    if (ESPNOW_OTA_PACKET_V2_MAX_SIZE == ESPNOW_OTA_PACKET_MAX_SIZE) {
+        return;
+    }
 
-        while (response_num > 0 && g_ota_queue) {
-            ret = xQueueReceive(g_ota_queue, &ota_data, wait_ticks);
-            ESP_ERROR_BREAK(ret != pdPASS, "<%s> wait_ticks: %d", esp_err_to_name(ret), wait_ticks);
-            memcpy(src_addr, ota_data.src_addr, 6);
-            memcpy(response_data, ota_data.data, ota_data.size);
-            ESP_FREE(ota_data.data);
-            ret = response_data->error_code;
+    if (!g_info_lock) {
+        g_info_lock = xSemaphoreCreateMutex();
+    }
 
-            if (response_data->error_code == ESP_ERR_ESPNOW_OTA_FIRMWARE_NOT_INIT) {
-                wait_ticks = pdMS_TO_TICKS(CONFIG_ESPNOW_OTA_WAIT_RESPONSE_TIMEOUT);
-                memcpy(mac_ota_wait, src_addr, 6);
-                continue;
-            }
+    request = g_info_lock ? ESP_MALLOC(request_size) : NULL;
 
-            if (response_data->error_code == ESP_ERR_ESPNOW_OTA_STOP
-                    || response_data->error_code == ESP_ERR_ESPNOW_OTA_FINISH) {
-                ESP_LOGW(TAG, "<ESP_ERR_ESPNOW_OTA_FIRMWARE_PARTITION> response_data->error_code: ");
-                addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr);
-                addrs_remove(response_addrs, &response_num, src_addr);
-                espnow_set_group((uint8_t (*)[6])src_addr, 1, ESPNOW_ADDR_GROUP_OTA, NULL, false, portMAX_DELAY);
-                continue;
-            }
+    if (!request) {
+        ESP_LOGW(TAG, "<ESP_ERR_NO_MEM> request, the responders are taken as older ones");
+        return;
+    }
 
-            ESP_LOGD(TAG, "Response, src_addr: " MACSTR ", response_num: %d, total_size: %d, written_size: %d, error_code: %s",
-                     MAC2STR(src_addr), response_num, response_data->total_size,
-                     response_data->written_size, esp_err_to_name(response_data->error_code));
+    espnow_ota_initiator_scan_result_free();
 
-            if (wait_ticks == pdMS_TO_TICKS(CONFIG_ESPNOW_OTA_WAIT_RESPONSE_TIMEOUT)) {
-                if (!memcmp(src_addr, mac_ota_wait, 6)) {
-                    wait_ticks = pdMS_TO_TICKS(100);
-                }
-            }
+    g_ota_scan_stop = false;
+    g_info_en = true;
+    espnow_ota_status_enable(true);
+
+    /**< The window is sized to the responders not heard, the ones heard are in the filter */
+    for (int i = 0; i < 3 && g_scan_num < addrs_num; ++i) {
+        uint16_t window = MIN(MAX((addrs_num - g_scan_num) * ESPNOW_OTA_SCAN_SLOT_MS * 2,
+                                  ESPNOW_OTA_SCAN_WINDOW_MIN), ESPNOW_OTA_SCAN_WINDOW_MAX);
+        espnow_ota_scan_request(request, 1, 0, window);
+        frame_head.magic = esp_random();
+        ESP_ERROR_BREAK(espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, group, request, request_size,
+                                    &frame_head, portMAX_DELAY) != ESP_OK, "espnow_send");
+        ESP_ERROR_BREAK(!espnow_ota_scan_wait(pdMS_TO_TICKS(window + ESPNOW_OTA_SCAN_MARGIN_MS)), "The upgrade is stopped");
+    }
 
-            /**< Remove the device that upgrade status has been received */
-            if (!addrs_remove(response_addrs, &response_num, src_addr)) {
-                continue;
-            }
+    espnow_ota_status_enable(false);
+    g_info_en = false;
+    ESP_FREE(request);
 
-            if (response_data->written_size == response_data->total_size) {
-                if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr)) {
-                    ESP_LOGW(TAG, "The device has been removed from the list waiting for the upgrade");
-                    continue;
-                }
+    espnow_ota_caps_min(addrs_list, addrs_num, caps);
+}
+
+/**
+ * @brief Move the responders which do not run the base of the patch, or do not apply patches,
+ *        from the unfinished list to the skipped list, by the responses in g_info_list
+ */
+static void espnow_ota_delta_targets(espnow_ota_result_t *result, const uint8_t base_sha_256[ESPNOW_OTA_HASH_LEN],
+                                     const uint8_t group[ESPNOW_ADDR_LEN], espnow_addr_t **skipped_addr, size_t *skipped_num)
+{
+    for (size_t i = 0; i < result->unfinished_num;) {
+        const espnow_ota_responder_t *info = espnow_ota_info_find(result->unfinished_addr[i]);
+        bool matched = info && (info->flags & ESPNOW_OTA_CAP_DELTA)
+                       && !memcmp(info->running_sha_256, base_sha_256, ESPNOW_OTA_HASH_LEN);
+
+        if (matched) {
+            ++i;
+            continue;
+        }
+
+        ESP_LOGI(TAG, "Skip " MACSTR ", the patch does not apply to it", MAC2STR(result->unfinished_addr[i]));
+        *skipped_addr = ESP_REALLOC_RETRY(*skipped_addr, (*skipped_num + 1) * ESPNOW_ADDR_LEN);
+        memcpy((*skipped_addr)[(*skipped_num)++], result->unfinished_addr[i], ESPNOW_ADDR_LEN);
+        espnow_set_group((uint8_t (*)[6])result->unfinished_addr[i], 1, group, NULL, false, portMAX_DELAY);
+        addrs_remove(result->unfinished_addr, &result->unfinished_num, result->unfinished_addr[i]);
+    }
+}
+
+/**
+ * @brief Record the most packets of each block one responder lost, only the blocks of the chunk of
+ *        progress bitmap in the response are updated
+ */
+static void espnow_ota_block_loss(uint8_t *block_loss, const espnow_ota_status_t *response, uint16_t packet_num)
+{
+    uint32_t seq_start = response->progress_index * ESPNOW_OTA_PROGRESS_MAX_SIZE * 8;
+    uint32_t seq_end   = MIN(seq_start + ESPNOW_OTA_PROGRESS_MAX_SIZE * 8, packet_num);
+    uint8_t loss       = 0;
+
+    for (uint32_t seq = seq_start; seq < seq_end; ++seq) {
+        if (!ESPNOW_OTA_GET_BITS(response->progress_array[0], seq - seq_start)) {
+            loss++;
+        }
+
+        if ((seq + 1) % ESPNOW_OTA_FEC_BLOCK_SIZE == 0 || seq + 1 == seq_end) {
+            block_loss[seq / ESPNOW_OTA_FEC_BLOCK_SIZE] = MAX(block_loss[seq / ESPNOW_OTA_FEC_BLOCK_SIZE], loss);
+            loss = 0;
+        }
+    }
+}
+
+/**
+ * @brief Merge the packets lost by a responder into the packets to send, and the loss of each block of it
+ */
+static void espnow_ota_nack_merge(uint8_t (*progress_array)[ESPNOW_OTA_PROGRESS_MAX_SIZE], uint8_t *block_loss,
+                                  const espnow_ota_nack_t *nack, size_t size, uint16_t packet_num)
+{
+    uint32_t block = UINT32_MAX;
+    uint8_t loss   = 0;
+
+    if (size < sizeof(espnow_ota_nack_t) || size < sizeof(espnow_ota_nack_t) + nack->range_num * sizeof(espnow_ota_range_t)) {
+        ESP_LOGD(TAG, "Invalid NACK reply, size: %d", size);
+        return;
+    }
+
+    for (int i = 0; i < nack->range_num; ++i) {
+        uint32_t start = nack->ranges[i].start;
+        uint32_t end   = MIN(start + nack->ranges[i].num, packet_num);
+
+        for (uint32_t seq = start; seq < end; ++seq) {
+            ((uint8_t *)progress_array)[seq / 8] &= ~BIT(seq % 8);
+
+            if (!block_loss) {
+                continue;
+            }
+
+            if (seq / ESPNOW_OTA_FEC_BLOCK_SIZE != block) {
+                loss  = 0;
+                block = seq / ESPNOW_OTA_FEC_BLOCK_SIZE;
+            }
+
+            block_loss[block] = MAX(block_loss[block], ++loss);
+        }
+    }
+}
+
+/**
+ * @brief Pacing of the packets of a campaign by the feedback of the responders in each round
+ */
+typedef struct {
+    uint32_t rate;              /**< Packets per second, 0 for as fast as they are sent */
+    uint32_t interval_min;      /**< Least time between the packets, in us */
+    uint8_t retransmit_count;   /**< Times each packet is sent */
+    int64_t next_time;          /**< Time the next packet is sent at */
+    int64_t send_time;          /**< Time spent sending the packets of the round, the waits left out */
+    uint32_t sent_num;          /**< Packets sent in the round */
+    uint32_t report_num;        /**< Responders which reported the packets of the round */
+    uint16_t drop_permille;     /**< Most frames dropped by the queue of a responder */
+    uint16_t loss_permille;     /**< Most packets lost on the air by a responder */
+} espnow_ota_pace_t;
+
+static void espnow_ota_pace_begin(espnow_ota_pace_t *pace)
+{
+    pace->next_time     = esp_timer_get_time();
+    pace->send_time     = 0;
+    pace->sent_num      = 0;
+    pace->report_num    = 0;
+    pace->drop_permille = 0;
+    pace->loss_permille = 0;
+}
+
+/**
+ * @brief Wait for the time of the packets sent, the waits shorter than a tick add up until they reach one
+ */
+static void espnow_ota_pace_sent(espnow_ota_pace_t *pace, int64_t start_time, uint32_t packet_num)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t interval = pace->rate ? MAX(1000000 / pace->rate, pace->interval_min) : pace->interval_min;
+
+    pace->send_time += now - start_time;
+    pace->sent_num  += packet_num;
+    pace->next_time  = MAX(pace->next_time, start_time) + (int64_t)interval * packet_num;
+
+    if (pace->next_time - now >= portTICK_PERIOD_MS * 1000) {
+        vTaskDelay((pace->next_time - now) / (portTICK_PERIOD_MS * 1000));
+    }
+}
+
+/**
+ * @brief Take the feedback a responder appended to its status reply, the replies with
+ *        a chunk of the progress bitmap and the ones of older responders have none
+ */
+static void espnow_ota_pace_feedback(espnow_ota_pace_t *pace, const espnow_ota_status_t *response, size_t size)
+{
+    size_t offset = sizeof(espnow_ota_status_t);
+    espnow_ota_feedback_t feedback = { 0 };
+
+    if (response->type == ESPNOW_OTA_TYPE_NACK && size >= sizeof(espnow_ota_nack_t)) {
+        offset = sizeof(espnow_ota_nack_t) + ((espnow_ota_nack_t *)response)->range_num * sizeof(espnow_ota_range_t);
+    } else if (response->type == ESPNOW_OTA_TYPE_NACK || size != offset + sizeof(espnow_ota_feedback_t)) {
+        return;
+    }
+
+    if (!pace->sent_num || size < offset + sizeof(espnow_ota_feedback_t)) {
+        return;
+    }
+
+    memcpy(&feedback, (uint8_t *)response + offset, sizeof(espnow_ota_feedback_t));
+
+    /**< The frames dropped by the queue were received on the air */
+    uint32_t lost = pace->sent_num - MIN(feedback.received, pace->sent_num);
+    lost -= MIN(feedback.dropped, lost);
+
+    pace->drop_permille = MAX(pace->drop_permille, MIN(feedback.dropped * 1000 / pace->sent_num, 1000));
+    pace->loss_permille = MAX(pace->loss_permille, lost * 1000 / pace->sent_num);
+    pace->report_num++;
+}
+
+static uint32_t espnow_ota_pace_pow(uint32_t permille, uint8_t exponent)
+{
+    uint32_t result = 1000;
+
+    while (exponent--) {
+        result = result * permille / 1000;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Set the rate and the retransmissions of the next round by the feedback of this one
+ */
+static void espnow_ota_pace_update(espnow_ota_pace_t *pace)
+{
+    if (!ESPNOW_OTA_PACE_ENABLE || !pace->sent_num || !pace->report_num || !pace->send_time) {
+        return;
+    }
+
+    /**< The rate the packets were sent at, the waits left out */
+    uint32_t send_rate = MAX(pace->sent_num * 1000000LL / pace->send_time, 1);
+
+    if (pace->drop_permille > ESPNOW_OTA_PACE_DROP_PERMILLE) {
+        pace->rate = MAX((pace->rate ? MIN(pace->rate, send_rate) : send_rate) / 2, ESPNOW_OTA_PACE_RATE_MIN);
+    } else if (pace->rate) {
+        pace->rate += ESPNOW_OTA_PACE_RATE_STEP;
+
+        /**< The sending is slower than the rate, it does not need pacing */
+        if (pace->rate > send_rate) {
+            pace->rate = 0;
+        }
+    }
+
+    /**< The loss measured is the one left by the retransmissions of the round, a packet sent n times is lost
+         as loss ^ (n / retransmit_count). The fewest retransmissions leaving less than the loss wanted */
+    uint8_t count = 1;
+    uint32_t target = espnow_ota_pace_pow(ESPNOW_OTA_PACE_LOSS_PERMILLE, pace->retransmit_count);
+
+    while (count < ESPNOW_OTA_PACE_RETRANSMIT_MAX && espnow_ota_pace_pow(pace->loss_permille, count) > target) {
+        count++;
+    }
+
+    ESP_LOGI(TAG, "Pace, sent: %" PRIu32 ", drop: %d/1000, loss: %d/1000, rate: %" PRIu32 " -> %" PRIu32 " packets/s, retransmit: %d -> %d",
+             pace->sent_num, pace->drop_permille, pace->loss_permille, send_rate, pace->rate,
+             pace->retransmit_count, count);
+
+    pace->retransmit_count = count;
+}
+
+/**
+ * @brief Receive a status reply, the wait returns early once the upgrade is stopped
+ */
+static BaseType_t espnow_ota_status_receive(QueueHandle_t queue, espnow_ota_data_t *ota_data, TickType_t wait_ticks)
+{
+    for (;;) {
+        TickType_t slice_ticks = MIN(wait_ticks, pdMS_TO_TICKS(ESPNOW_OTA_STOP_CHECK_MS));
+
+        if (xQueueReceive(queue, ota_data, slice_ticks) == pdPASS) {
+            return pdPASS;
+        }
+
+        wait_ticks -= slice_ticks;
+
+        if (!wait_ticks || !g_ota_send_running_flag) {
+            return pdFAIL;
+        }
+    }
+}
+
+static esp_err_t espnow_ota_request_status(espnow_ota_campaign_ctx_t *ctx,
+        uint8_t (*progress_array)[ESPNOW_OTA_PROGRESS_MAX_SIZE], uint8_t *block_loss,
+        const espnow_ota_status_t *status, const espnow_ota_status_ext_t *status_ext,
+        espnow_ota_pace_t *pace, espnow_ota_result_t *result)
+{
+    esp_err_t ret       = ESP_OK;
+    uint8_t src_addr[6] = {0};
+    espnow_ota_status_t *response_data = ESP_MALLOC(ESPNOW_DATA_LEN);
+    size_t response_size = 0;
+    espnow_ota_data_t ota_data = { 0 };
+    uint8_t request[sizeof(espnow_ota_status_t) + sizeof(espnow_ota_status_ext_t)];
+    size_t request_size = sizeof(espnow_ota_status_t);
+
+    memcpy(request, status, sizeof(espnow_ota_status_t));
+
+    /**< Older responders only take legacy packets, they are not sent the packet size unless it is relayed */
+    if (status_ext->packet_size != ESPNOW_OTA_PACKET_MAX_SIZE || status_ext->relay_hops || status_ext->relay_depth) {
+        memcpy(request + sizeof(espnow_ota_status_t), status_ext, sizeof(espnow_ota_status_ext_t));
+        request_size += sizeof(espnow_ota_status_ext_t);
+    }
+
+    result->requested_num = 0;
+    ESP_FREE(result->requested_addr);
+
+    /**
+     * @brief Remove the device that the firmware upgrade has completed.
+     */
+    while (ctx->queue && (xQueueReceive(ctx->queue, &ota_data, 0) == pdPASS)) {
+        memcpy(src_addr, ota_data.src_addr, 6);
+        memcpy(response_data, ota_data.data, ota_data.size);
+        ESP_FREE(ota_data.data);
+        if (response_data->written_size == response_data->total_size || response_data->error_code == ESP_ERR_ESPNOW_OTA_FINISH) {
+            if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr)) {
+                ESP_LOGW(TAG, "The device has been removed from the list waiting for the upgrade");
+                continue;
+            }
+
+            result->successed_num++;
+            result->successed_addr = ESP_REALLOC_RETRY(result->successed_addr,
+                                     result->successed_num * ESPNOW_ADDR_LEN);
+            memcpy(result->successed_addr + (result->successed_num - 1), src_addr, ESPNOW_ADDR_LEN);
+            espnow_set_group((uint8_t (*)[6])src_addr, 1, ctx->group, NULL, false, portMAX_DELAY);
+        } else if (response_data->error_code == ESP_ERR_ESPNOW_OTA_STOP) {
+            addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr);
+            espnow_set_group((uint8_t (*)[6])src_addr, 1, ctx->group, NULL, false, portMAX_DELAY);
+        }
+
+        if (result->unfinished_num == 0) {
+            return ESP_OK;
+        }
+    }
+
+    size_t response_num = result->unfinished_num;
+    uint8_t (*response_addrs)[6] = ESP_REALLOC_RETRY(NULL, result->unfinished_num * ESPNOW_ADDR_LEN);
+    memcpy(response_addrs, result->unfinished_addr, ESPNOW_ADDR_LEN * response_num);
+
+    /**
+     * @brief Request all devices upgrade status from unfinished device.
+     */
+    espnow_frame_head_t status_frame = {
+        .group = true,
+        .broadcast = true,
+        .retransmit_count = CONFIG_ESPNOW_OTA_RETRANSMISSION_TIMES,
+        .magic    = esp_random(),
+        .filter_adjacent_channel = true,
+        .forward_ttl      = CONFIG_ESPNOW_OTA_SEND_FORWARD_TTL,
+        .forward_rssi     = CONFIG_ESPNOW_OTA_SEND_FORWARD_RSSI,
+        .security         = CONFIG_ESPNOW_OTA_SECURITY,
+    };
+
+    /**< The responders replying with NACK take a random time in the window */
+    for (int i = 0, wait_ticks = pdMS_TO_TICKS(1000 + status_ext->reply_window); i < 3 && response_num > 0 && g_ota_send_running_flag;
+            ++i, wait_ticks = pdMS_TO_TICKS(500 + status_ext->reply_window)) {
+        if (espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, ctx->group, request,
+                        request_size, &status_frame, portMAX_DELAY) != ESP_OK) {
+            ESP_LOGW(TAG, "Request devices upgrade status");
+        }
+
+        uint8_t mac_ota_wait[6] = {0};
+
+        while (response_num > 0 && ctx->queue) {
+            ret = espnow_ota_status_receive(ctx->queue, &ota_data, wait_ticks);
+            ESP_ERROR_BREAK(ret != pdPASS, "<%s> wait_ticks: %d", esp_err_to_name(ret), wait_ticks);
+            memcpy(src_addr, ota_data.src_addr, 6);
+            response_size = MIN(ota_data.size, ESPNOW_DATA_LEN);
+            memcpy(response_data, ota_data.data, response_size);
+            ESP_FREE(ota_data.data);
+            ret = response_data->error_code;
+
+            if (response_data->error_code == ESP_ERR_ESPNOW_OTA_FIRMWARE_NOT_INIT) {
+                wait_ticks = pdMS_TO_TICKS(CONFIG_ESPNOW_OTA_WAIT_RESPONSE_TIMEOUT);
+                memcpy(mac_ota_wait, src_addr, 6);
+                continue;
+            }
+
+            if (response_data->error_code == ESP_ERR_ESPNOW_OTA_STOP
+                    || response_data->error_code == ESP_ERR_ESPNOW_OTA_FINISH) {
+                ESP_LOGW(TAG, "<ESP_ERR_ESPNOW_OTA_FIRMWARE_PARTITION> response_data->error_code: ");
+                addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr);
+                addrs_remove(response_addrs, &response_num, src_addr);
+                espnow_set_group((uint8_t (*)[6])src_addr, 1, ctx->group, NULL, false, portMAX_DELAY);
+                continue;
+            }
+
+            ESP_LOGD(TAG, "Response, src_addr: " MACSTR ", response_num: %d, total_size: %d, written_size: %d, error_code: %s",
+                     MAC2STR(src_addr), response_num, response_data->total_size,
+                     response_data->written_size, esp_err_to_name(response_data->error_code));
+
+            if (wait_ticks == pdMS_TO_TICKS(CONFIG_ESPNOW_OTA_WAIT_RESPONSE_TIMEOUT)) {
+                if (!memcmp(src_addr, mac_ota_wait, 6)) {
+                    wait_ticks = pdMS_TO_TICKS(100);
+                }
+            }
+
+            /**< Remove the device that upgrade status has been received */
+            if (!addrs_remove(response_addrs, &response_num, src_addr)) {
+                continue;
+            }
+
+            if (response_data->written_size == response_data->total_size) {
+                if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr)) {
+                    ESP_LOGW(TAG, "The device has been removed from the list waiting for the upgrade");
+                    continue;
+                }
 
                 result->successed_num++;
                 result->successed_addr = ESP_REALLOC_RETRY(result->successed_addr,
                                          result->successed_num * ESPNOW_ADDR_LEN);
                 memcpy(result->successed_addr + (result->successed_num - 1), src_addr, ESPNOW_ADDR_LEN);
 
-                espnow_set_group((uint8_t (*)[6])src_addr, 1, ESPNOW_ADDR_GROUP_OTA, NULL, false, portMAX_DELAY);
-            } else {
-                ESP_LOG_BUFFER_HEXDUMP(TAG, response_data->progress_array[0],
-                                       sizeof(espnow_ota_status_t) + ESPNOW_OTA_PROGRESS_MAX_SIZE, ESP_LOG_VERBOSE);
+                espnow_set_group((uint8_t (*)[6])src_addr, 1, ctx->group, NULL, false, portMAX_DELAY);
+            } else {
+                ESP_LOG_BUFFER_HEXDUMP(TAG, response_data->progress_array[0],
+                                       sizeof(espnow_ota_status_t) + ESPNOW_OTA_PROGRESS_MAX_SIZE, ESP_LOG_VERBOSE);
+
+                result->requested_num++;
+                result->requested_addr = ESP_REALLOC_RETRY(result->requested_addr, result->requested_num * ESPNOW_ADDR_LEN);
+                memcpy(result->requested_addr + (result->requested_num - 1), src_addr, ESPNOW_ADDR_LEN);
+                espnow_ota_pace_feedback(pace, response_data, response_size);
+
+                if (response_data->type == ESPNOW_OTA_TYPE_NACK) {
+                    espnow_ota_nack_merge(progress_array, block_loss, (espnow_ota_nack_t *)response_data,
+                                          response_size, status->packet_num);
+                } else if (response_data->written_size == 0) {
+                    memset(progress_array, 0x0, status->packet_num / 8 + 1);
+
+                    if (block_loss) {
+                        memset(block_loss, ESPNOW_OTA_FEC_BLOCK_SIZE,
+                               (status->packet_num + ESPNOW_OTA_FEC_BLOCK_SIZE - 1) / ESPNOW_OTA_FEC_BLOCK_SIZE);
+                    }
+                } else {
+                    for (int i = 0; i < ESPNOW_OTA_PROGRESS_MAX_SIZE
+                            && (response_data->progress_index * ESPNOW_OTA_PROGRESS_MAX_SIZE  + i) * 8 < status->packet_num; i++) {
+                        progress_array[response_data->progress_index][i] &= response_data->progress_array[0][i];
+                    }
+
+                    if (block_loss) {
+                        espnow_ota_block_loss(block_loss, response_data, status->packet_num);
+                    }
+                }
+            }
+        }
+    }
+
+    ret = ESP_OK;
+
+    if (response_num && response_num == result->unfinished_num) {
+        ESP_LOGW(TAG, "ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST");
+        ret = ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST;
+    } else if (response_num > 0) {
+        ESP_LOGW(TAG, "ESP_ERR_ESPNOW_OTA_SEND_PACKET_LOSS");
+        ret = ESP_ERR_ESPNOW_OTA_SEND_PACKET_LOSS;
+    } else if (result->requested_num > 0) {
+        ret = ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE;
+        ESP_LOGD(TAG, "ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE");
+    }
+
+    ESP_FREE(response_addrs);
+    ESP_FREE(response_data);
+    return ret;
+}
+
+#if CONFIG_ESPNOW_OTA_READ_AHEAD_NUM > 0
+#define ESPNOW_OTA_READ_AHEAD_NUM   CONFIG_ESPNOW_OTA_READ_AHEAD_NUM
+#define ESPNOW_OTA_READ_AHEAD_BLOCK CONFIG_ESPNOW_OTA_READ_AHEAD_BLOCK_SIZE
+
+/**
+ * @brief Blocks of the data read by a task ahead of the packets sent, so the sending does not wait for
+ *        the storage. The blocks of a round are read in the order the packets are sent,
+ *        block schedule[i] into the slot i % ESPNOW_OTA_READ_AHEAD_NUM.
+ */
+typedef struct {
+    espnow_ota_initiator_data_cb_t read_cb; /**< Data callback function of the upgrade */
+    size_t size;                            /**< Size of the data read by read_cb */
+    uint32_t *schedule;                     /**< Blocks to read, in ascending order */
+    size_t schedule_num;                    /**< Number of the blocks to read */
+    size_t acquired;                        /**< Blocks of the schedule the sender has taken */
+    size_t released;                        /**< Blocks of the schedule the sender is done with */
+    uint8_t *buf;                           /**< The slots of the blocks */
+    esp_err_t errors[ESPNOW_OTA_READ_AHEAD_NUM]; /**< Error of reading the block in each slot */
+    SemaphoreHandle_t free_sem;             /**< Slots free */
+    SemaphoreHandle_t filled_sem;           /**< Blocks read and not taken by the sender */
+    SemaphoreHandle_t exit_sem;             /**< Given when the task exits */
+    SemaphoreHandle_t read_lock;            /**< read_cb is called by one task at a time */
+    bool running;
+} espnow_ota_read_ahead_t;
+
+static espnow_ota_read_ahead_t g_read_ahead = { 0 };
+
+static void espnow_ota_read_ahead_task(void *arg)
+{
+    espnow_ota_read_ahead_t *ra = &g_read_ahead;
+
+    for (size_t i = 0; i < ra->schedule_num && ra->running; ++i) {
+        /**< Wait for the sender to be done with a block */
+        while (ra->running && xSemaphoreTake(ra->free_sem, pdMS_TO_TICKS(100)) != pdTRUE) {
+        }
+
+        if (!ra->running) {
+            break;
+        }
+
+        uint32_t offset = ra->schedule[i] * ESPNOW_OTA_READ_AHEAD_BLOCK;
+        size_t slot     = i % ESPNOW_OTA_READ_AHEAD_NUM;
+
+        xSemaphoreTake(ra->read_lock, portMAX_DELAY);
+        ra->errors[slot] = ra->read_cb(offset, ra->buf + slot * ESPNOW_OTA_READ_AHEAD_BLOCK,
+                                       MIN(ESPNOW_OTA_READ_AHEAD_BLOCK, ra->size - offset));
+        xSemaphoreGive(ra->read_lock);
+
+        xSemaphoreGive(ra->filled_sem);
+    }
+
+    xSemaphoreGive(ra->exit_sem);
+    vTaskDelete(NULL);
+}
+
+static void espnow_ota_read_ahead_stop(void)
+{
+    espnow_ota_read_ahead_t *ra = &g_read_ahead;
+
+    if (ra->running) {
+        ra->running = false;
+        xSemaphoreTake(ra->exit_sem, portMAX_DELAY);
+    }
+
+    if (ra->free_sem) {
+        vSemaphoreDelete(ra->free_sem);
+    }
+
+    if (ra->filled_sem) {
+        vSemaphoreDelete(ra->filled_sem);
+    }
+
+    if (ra->exit_sem) {
+        vSemaphoreDelete(ra->exit_sem);
+    }
+
+    if (ra->read_lock) {
+        vSemaphoreDelete(ra->read_lock);
+    }
+
+    ESP_FREE(ra->buf);
+    ESP_FREE(ra->schedule);
+    memset(ra, 0, sizeof(espnow_ota_read_ahead_t));
+}
+
+/**
+ * @brief Read from the blocks read ahead, the data out of them is read at once.
+ *        The reads are in ascending order but for the repair packets, the blocks before the
+ *        first one of a read are taken as done with.
+ */
+static esp_err_t espnow_ota_read_ahead_read(size_t src_offset, void *dst, size_t size)
+{
+    esp_err_t ret = ESP_OK;
+    espnow_ota_read_ahead_t *ra = &g_read_ahead;
+    uint8_t *out = (uint8_t *)dst;
+
+    for (uint32_t block = src_offset / ESPNOW_OTA_READ_AHEAD_BLOCK;
+            ra->released < ra->schedule_num && ra->schedule[ra->released] < block; ra->released++) {
+        if (ra->acquired == ra->released) {
+            xSemaphoreTake(ra->filled_sem, portMAX_DELAY);
+            ra->acquired++;
+        }
+
+        xSemaphoreGive(ra->free_sem);
+    }
+
+    while (size > 0) {
+        uint32_t block = src_offset / ESPNOW_OTA_READ_AHEAD_BLOCK;
+        size_t offset  = src_offset % ESPNOW_OTA_READ_AHEAD_BLOCK;
+        size_t len     = MIN(size, ESPNOW_OTA_READ_AHEAD_BLOCK - offset);
+        size_t index   = ra->released;
+
+        while (index < ra->schedule_num && index < ra->released + ESPNOW_OTA_READ_AHEAD_NUM
+                && ra->schedule[index] < block) {
+            index++;
+        }
+
+        if (index < ra->schedule_num && index < ra->released + ESPNOW_OTA_READ_AHEAD_NUM
+                && ra->schedule[index] == block) {
+            for (; ra->acquired <= index; ra->acquired++) {
+                xSemaphoreTake(ra->filled_sem, portMAX_DELAY);
+            }
+
+            size_t slot = index % ESPNOW_OTA_READ_AHEAD_NUM;
+            ESP_ERROR_RETURN(ra->errors[slot] != ESP_OK, ra->errors[slot], "<%s> Read ahead, block: %" PRIu32,
+                             esp_err_to_name(ra->errors[slot]), block);
+            memcpy(out, ra->buf + slot * ESPNOW_OTA_READ_AHEAD_BLOCK + offset, len);
+        } else {
+            xSemaphoreTake(ra->read_lock, portMAX_DELAY);
+            ret = ra->read_cb(src_offset, out, len);
+            xSemaphoreGive(ra->read_lock);
+            ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Read data", esp_err_to_name(ret));
+        }
+
+        src_offset += len;
+        out        += len;
+        size       -= len;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Start reading ahead the blocks of the packets not received by all the responders, or of all
+ *        the data if progress is NULL. Packet seq is read at offsets[seq] up to offsets[seq + 1] if offsets
+ *        is given, at seq * packet_size otherwise.
+ *
+ * @return The data callback function the packets are read with
+ */
+static espnow_ota_initiator_data_cb_t espnow_ota_read_ahead_round(espnow_ota_initiator_data_cb_t read_cb, size_t size,
+        const uint8_t *progress, uint16_t packet_num, uint16_t packet_size, const uint32_t *offsets)
+{
+    espnow_ota_read_ahead_t *ra = &g_read_ahead;
+    size_t block_num = (size + ESPNOW_OTA_READ_AHEAD_BLOCK - 1) / ESPNOW_OTA_READ_AHEAD_BLOCK;
+
+    espnow_ota_read_ahead_stop();
+
+    ra->read_cb    = read_cb;
+    ra->size       = size;
+    ra->schedule   = ESP_MALLOC(block_num * sizeof(uint32_t));
+    ra->buf        = ESP_MALLOC(ESPNOW_OTA_READ_AHEAD_NUM * ESPNOW_OTA_READ_AHEAD_BLOCK);
+    ra->free_sem   = xSemaphoreCreateCounting(ESPNOW_OTA_READ_AHEAD_NUM, ESPNOW_OTA_READ_AHEAD_NUM);
+    ra->filled_sem = xSemaphoreCreateCounting(ESPNOW_OTA_READ_AHEAD_NUM, 0);
+    ra->exit_sem   = xSemaphoreCreateBinary();
+    ra->read_lock  = xSemaphoreCreateMutex();
+
+    if (!ra->schedule || !ra->buf || !ra->free_sem || !ra->filled_sem || !ra->exit_sem || !ra->read_lock) {
+        ESP_LOGW(TAG, "<ESP_ERR_NO_MEM> Read the data without reading ahead");
+        espnow_ota_read_ahead_stop();
+        return read_cb;
+    }
+
+    for (uint32_t seq = 0; !progress && seq < block_num; ++seq) {
+        ra->schedule[ra->schedule_num++] = seq;
+    }
+
+    for (uint32_t seq = 0; progress && seq < packet_num; ++seq) {
+        if (ESPNOW_OTA_GET_BITS(progress, seq)) {
+            continue;
+        }
+
+        uint32_t start = offsets ? offsets[seq] : seq * packet_size;
+        uint32_t end   = offsets ? offsets[seq + 1] : MIN(start + packet_size, size);
+
+        for (uint32_t block = start / ESPNOW_OTA_READ_AHEAD_BLOCK; end > start
+                && block <= (end - 1) / ESPNOW_OTA_READ_AHEAD_BLOCK; ++block) {
+            if (!ra->schedule_num || ra->schedule[ra->schedule_num - 1] < block) {
+                ra->schedule[ra->schedule_num++] = block;
+            }
+        }
+    }
+
+    ra->running = true;
+
+    if (xTaskCreate(espnow_ota_read_ahead_task, "espnow_ota_read", 3 * 1024, NULL,
+                    uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        ESP_LOGW(TAG, "Read the data without reading ahead");
+        ra->running = false;
+        espnow_ota_read_ahead_stop();
+        return read_cb;
+    }
+
+    ESP_LOGD(TAG, "Read ahead %d blocks", ra->schedule_num);
+
+    return espnow_ota_read_ahead_read;
+}
+#else
+static void espnow_ota_read_ahead_stop(void)
+{
+}
+
+static espnow_ota_initiator_data_cb_t espnow_ota_read_ahead_round(espnow_ota_initiator_data_cb_t read_cb, size_t size,
+        const uint8_t *progress, uint16_t packet_num, uint16_t packet_size, const uint32_t *offsets)
+{
+    return read_cb;
+}
+#endif /**< CONFIG_ESPNOW_OTA_READ_AHEAD_NUM > 0 */
+
+/**
+ * @brief Send one firmware packet, the error of reading the firmware is returned,
+ *        the error of sending is only logged as the packet is requested again in the next round
+ */
+static esp_err_t espnow_ota_send_packet(espnow_ota_initiator_data_cb_t ota_data_cb, const espnow_ota_status_t *status,
+                                        uint16_t packet_size, uint16_t seq, uint8_t *packet_buf,
+                                        const uint8_t group[ESPNOW_ADDR_LEN], const espnow_frame_head_t *frame_head)
+{
+    esp_err_t ret     = ESP_OK;
+    uint8_t *data     = NULL;
+    size_t packet_len = 0;
+    uint16_t data_size = (seq == status->packet_num - 1) ? status->total_size - packet_size * seq : packet_size;
+
+    /**< Older responders only take espnow_ota_packet_t, it is used whenever the size allows */
+    if (packet_size == ESPNOW_OTA_PACKET_MAX_SIZE) {
+        espnow_ota_packet_t *packet = (espnow_ota_packet_t *)packet_buf;
+        packet->type = ESPNOW_OTA_TYPE_DATA;
+        packet->seq  = seq;
+        packet->size = data_size;
+        data         = packet->data;
+        packet_len   = sizeof(espnow_ota_packet_t);
+    } else {
+        espnow_ota_packet_v2_t *packet = (espnow_ota_packet_v2_t *)packet_buf;
+        packet->type = ESPNOW_OTA_TYPE_DATA_V2;
+        packet->seq  = seq;
+        packet->size = data_size;
+        data         = packet->data;
+        packet_len   = sizeof(espnow_ota_packet_v2_t) + data_size;
+    }
+
+    /**
+     * @brief Read firmware data from Flash to send to unfinished device.
+     */
+    ret = ota_data_cb(seq * packet_size, data, data_size);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Read data from Flash", esp_err_to_name(ret));
+
+    ESP_LOGD(TAG, "seq: %d, size: %d", seq, data_size);
+    ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, group, packet_buf, packet_len, frame_head, portMAX_DELAY);
+    ESP_ERROR_RETURN(ret != ESP_OK, ESP_OK, "<%s> espnow write", esp_err_to_name(ret));
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Send repair packets for the packets of one block lost by the responders. Each repair packet is
+ *        the XOR of a random subset of the lost packets, a responder rebuilds the packets it lost
+ *        once it has as many independent repair packets, whichever packets they are.
+ */
+static esp_err_t espnow_ota_send_repair(espnow_ota_initiator_data_cb_t ota_data_cb, const espnow_ota_status_t *status,
+                                        uint16_t packet_size, uint16_t block_seq, uint32_t missing, uint8_t repair_num,
+                                        uint8_t *packet_buf, const uint8_t group[ESPNOW_ADDR_LEN],
+                                        const espnow_frame_head_t *frame_head)
+{
+    esp_err_t ret     = ESP_OK;
+    size_t repair_len = sizeof(espnow_ota_repair_t) + packet_size;
+    uint8_t *repairs  = ESP_CALLOC(repair_num, repair_len);
+    ESP_ERROR_RETURN(!repairs, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> repair packets");
+
+    for (int i = 0; i < repair_num; ++i) {
+        espnow_ota_repair_t *repair = (espnow_ota_repair_t *)(repairs + i * repair_len);
+        repair->type = ESPNOW_OTA_TYPE_REPAIR;
+        repair->seq  = block_seq;
+        repair->size = packet_size;
+
+        do {
+            repair->mask = esp_random() & missing;
+        } while (!repair->mask);
+    }
+
+    for (int n = 0; n < ESPNOW_OTA_FEC_BLOCK_SIZE; ++n) {
+        if (!(missing & BIT(n))) {
+            continue;
+        }
+
+        uint16_t seq = block_seq + n;
+        uint16_t data_size = (seq == status->packet_num - 1) ? status->total_size - packet_size * seq : packet_size;
+
+        /**< Each lost packet is read once and added to every repair packet covering it */
+        memset(packet_buf, 0, packet_size);
+        ret = ota_data_cb(seq * packet_size, packet_buf, data_size);
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", esp_err_to_name(ret));
+
+        for (int i = 0; i < repair_num; ++i) {
+            espnow_ota_repair_t *repair = (espnow_ota_repair_t *)(repairs + i * repair_len);
+
+            if (repair->mask & BIT(n)) {
+                for (int j = 0; j < packet_size; ++j) {
+                    repair->data[j] ^= packet_buf[j];
+                }
+            }
+        }
+    }
+
+    ESP_LOGD(TAG, "block seq: %d, missing: 0x%08x, repair_num: %d", block_seq, (unsigned)missing, repair_num);
+
+    for (int i = 0; i < repair_num; ++i) {
+        ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, group, repairs + i * repair_len, repair_len, frame_head, portMAX_DELAY);
+        ESP_ERROR_CONTINUE(ret != ESP_OK, "<%s> espnow write", esp_err_to_name(ret));
+    }
+
+    ret = ESP_OK;
+
+EXIT:
+    ESP_FREE(repairs);
+    return ret;
+}
+
+/**
+ * @brief Hash every block of the firmware, the root is the hash of the list
+ */
+static esp_err_t espnow_ota_hash_list(espnow_ota_initiator_data_cb_t ota_data_cb, size_t size,
+                                      uint8_t **hashes, uint8_t root[ESPNOW_OTA_HASH_LEN])
+{
+    esp_err_t ret      = ESP_ERR_NO_MEM;
+    size_t block_num   = (size + ESPNOW_OTA_HASH_BLOCK_SIZE - 1) / ESPNOW_OTA_HASH_BLOCK_SIZE;
+    uint8_t *block     = ESP_MALLOC(ESPNOW_OTA_HASH_BLOCK_SIZE);
+    uint8_t *list      = ESP_MALLOC(block_num * ESPNOW_OTA_BLOCK_HASH_LEN);
+    ESP_ERROR_GOTO(!block || !list, EXIT, "<ESP_ERR_NO_MEM> hash list");
+
+    for (size_t i = 0; i < block_num; ++i) {
+        size_t block_size = MIN(ESPNOW_OTA_HASH_BLOCK_SIZE, size - i * ESPNOW_OTA_HASH_BLOCK_SIZE);
+
+        ret = ota_data_cb(i * ESPNOW_OTA_HASH_BLOCK_SIZE, block, block_size);
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", esp_err_to_name(ret));
+
+        ret = espnow_ota_hash(block, block_size, list + i * ESPNOW_OTA_BLOCK_HASH_LEN, ESPNOW_OTA_BLOCK_HASH_LEN);
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_hash", esp_err_to_name(ret));
+    }
+
+    ret = espnow_ota_hash(list, block_num * ESPNOW_OTA_BLOCK_HASH_LEN, root, ESPNOW_OTA_HASH_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_hash", esp_err_to_name(ret));
+
+    *hashes = list;
+    list    = NULL;
+
+    ESP_LOGI(TAG, "Hash list, block_num: %d", block_num);
+
+EXIT:
+    ESP_FREE(block);
+    ESP_FREE(list);
+    return ret;
+}
+
+/**
+ * @brief Send the hash list, as many hashes in a packet as the firmware it carries,
+ *        the responders which have it already drop it
+ */
+static esp_err_t espnow_ota_send_hash(const uint8_t *hashes, size_t size, uint16_t packet_size,
+                                      uint8_t *packet_buf, const uint8_t group[ESPNOW_ADDR_LEN],
+                                      const espnow_frame_head_t *frame_head)
+{
+    esp_err_t ret       = ESP_OK;
+    size_t block_num    = (size + ESPNOW_OTA_HASH_BLOCK_SIZE - 1) / ESPNOW_OTA_HASH_BLOCK_SIZE;
+    size_t hash_max     = packet_size / ESPNOW_OTA_BLOCK_HASH_LEN;
+    espnow_ota_hash_t *packet = (espnow_ota_hash_t *)packet_buf;
+
+    for (size_t index = 0; index < block_num; index += hash_max) {
+        packet->type  = ESPNOW_OTA_TYPE_HASH;
+        packet->index = index;
+        packet->num   = MIN(hash_max, block_num - index);
+        memcpy(packet->hashes, hashes + index * ESPNOW_OTA_BLOCK_HASH_LEN, packet->num * ESPNOW_OTA_BLOCK_HASH_LEN);
+
+        ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, group, packet_buf,
+                          sizeof(espnow_ota_hash_t) + packet->num * ESPNOW_OTA_BLOCK_HASH_LEN, frame_head, portMAX_DELAY);
+        ESP_ERROR_CONTINUE(ret != ESP_OK, "<%s> espnow write", esp_err_to_name(ret));
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Split the firmware into compressed packets, each one takes as much firmware as fits in the packet
+ *        once compressed. The offset of every packet is kept so a packet is compressed again on its own
+ *        when it is sent, the compression gives the same packet every time.
+ */
+static esp_err_t espnow_ota_lz_index(espnow_ota_initiator_data_cb_t ota_data_cb, size_t size, uint16_t packet_size,
+                                     uint32_t **offsets, uint16_t *packet_num)
+{
+    esp_err_t ret    = ESP_ERR_NO_MEM;
+    uint32_t *list   = NULL;
+    size_t num       = 0;
+    size_t list_size = size / packet_size + 2;
+    uint8_t *raw     = ESP_MALLOC(ESPNOW_OTA_LZ_BLOCK_MAX);
+    uint8_t *packet  = ESP_MALLOC(packet_size);
+    list             = ESP_MALLOC(list_size * sizeof(uint32_t));
+    ESP_ERROR_GOTO(!raw || !packet || !list, EXIT, "<ESP_ERR_NO_MEM> compress index");
+
+    for (uint32_t offset = 0; offset < size;) {
+        size_t raw_size = MIN(size - offset, ESPNOW_OTA_LZ_BLOCK_MAX);
+        size_t consumed = 0;
+        size_t olen     = 0;
+
+        ret = ota_data_cb(offset, raw, raw_size);
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", esp_err_to_name(ret));
+
+        ret = espnow_ota_lz_compress(raw, raw_size, packet, packet_size, &consumed, &olen);
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_lz_compress", esp_err_to_name(ret));
+
+        ret = ESP_ERR_INVALID_SIZE;
+        ESP_ERROR_GOTO(!consumed || num + 1 >= UINT16_MAX, EXIT, "Too many compressed packets");
+
+        /**< Incompressible data takes a little more packets than it does uncompressed */
+        if (num + 2 > list_size) {
+            uint32_t *new_list = ESP_REALLOC(list, (list_size + list_size / 8 + 1) * sizeof(uint32_t));
+            ret = ESP_ERR_NO_MEM;
+            ESP_ERROR_GOTO(!new_list, EXIT, "<ESP_ERR_NO_MEM> compress index");
+
+            list       = new_list;
+            list_size += list_size / 8 + 1;
+        }
+
+        list[num++] = offset;
+        offset += consumed;
+    }
+
+    list[num]   = size;
+    *offsets    = list;
+    *packet_num = num;
+    list        = NULL;
+    ret         = ESP_OK;
+
+    ESP_LOGI(TAG, "Compressed packet_num: %d, uncompressed packet_num: %d",
+             num, (size + packet_size - 1) / packet_size);
+
+EXIT:
+    ESP_FREE(raw);
+    ESP_FREE(packet);
+    ESP_FREE(list);
+    return ret;
+}
+
+/**
+ * @brief Send one compressed packet, the errors are handled as espnow_ota_send_packet()
+ */
+static esp_err_t espnow_ota_send_packet_lz(espnow_ota_initiator_data_cb_t ota_data_cb, const uint32_t *offsets,
+                                           uint16_t packet_size, uint16_t seq, uint8_t *packet_buf, uint8_t *raw_buf,
+                                           const uint8_t group[ESPNOW_ADDR_LEN], const espnow_frame_head_t *frame_head)
+{
+    esp_err_t ret    = ESP_OK;
+    size_t raw_size  = offsets[seq + 1] - offsets[seq];
+    size_t consumed  = 0;
+    size_t olen      = 0;
+    espnow_ota_packet_lz_t *packet = (espnow_ota_packet_lz_t *)packet_buf;
+
+    ret = ota_data_cb(offsets[seq], raw_buf, raw_size);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Read data from Flash", esp_err_to_name(ret));
+
+    ret = espnow_ota_lz_compress(raw_buf, raw_size, packet->data, packet_size, &consumed, &olen);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> espnow_ota_lz_compress", esp_err_to_name(ret));
+    ESP_ERROR_RETURN(consumed != raw_size, ESP_ERR_INVALID_SIZE,
+                     "The firmware changed, seq: %d, consumed: %d, raw_size: %d", seq, consumed, raw_size);
+
+    packet->type     = ESPNOW_OTA_TYPE_DATA_LZ;
+    packet->seq      = seq;
+    packet->offset   = offsets[seq];
+    packet->raw_size = raw_size;
+    packet->size     = olen;
+
+    ESP_LOGD(TAG, "seq: %d, raw_size: %d, size: %d", seq, raw_size, olen);
+    ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, group, packet_buf,
+                      sizeof(espnow_ota_packet_lz_t) + olen, frame_head, portMAX_DELAY);
+    ESP_ERROR_RETURN(ret != ESP_OK, ESP_OK, "<%s> espnow write", esp_err_to_name(ret));
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Patch sent instead of the firmware
+ */
+typedef struct {
+    const uint8_t *base_sha_256;            /**< Running firmware the patch applies to */
+    size_t size;                            /**< Total size of the records */
+    espnow_ota_initiator_data_cb_t data_cb; /**< Patch data callback function */
+} espnow_ota_patch_t;
+
+/**
+ * @brief Check the records of the patch and keep the offset of each one, a record is sent in a packet
+ */
+static esp_err_t espnow_ota_delta_index(const espnow_ota_patch_t *patch, size_t size, uint16_t packet_size,
+                                        uint32_t **offsets, uint16_t *packet_num)
+{
+    esp_err_t ret    = ESP_OK;
+    uint32_t *list   = NULL;
+    size_t list_size = 0;
+    size_t num       = 0;
+    uint32_t target  = 0;
+    espnow_ota_delta_record_t record = { 0 };
+
+    for (uint32_t offset = 0; offset < patch->size; offset += sizeof(espnow_ota_delta_record_t) + record.size) {
+        ret = ESP_ERR_INVALID_SIZE;
+        ESP_ERROR_GOTO(patch->size - offset < sizeof(espnow_ota_delta_record_t), EXIT,
+                       "Patch truncated, offset: %" PRIu32, offset);
+
+        ret = patch->data_cb(offset, &record, sizeof(espnow_ota_delta_record_t));
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read patch", esp_err_to_name(ret));
+
+        /**< The records rebuild the firmware in order, each one fits in a packet */
+        ret = ESP_ERR_INVALID_SIZE;
+        ESP_ERROR_GOTO(record.offset != target || !record.raw_size || record.raw_size > ESPNOW_OTA_LZ_BLOCK_MAX
+                       || record.size > packet_size || num + 1 >= UINT16_MAX
+                       || patch->size - offset - sizeof(espnow_ota_delta_record_t) < record.size,
+                       EXIT, "Invalid patch record %d, offset: %" PRIu32 ", raw_size: %d, size: %d, packet_size: %d",
+                       num, record.offset, record.raw_size, record.size, packet_size);
+
+        if (num + 2 > list_size) {
+            uint32_t *new_list = ESP_REALLOC(list, (list_size * 2 + 64) * sizeof(uint32_t));
+            ret = ESP_ERR_NO_MEM;
+            ESP_ERROR_GOTO(!new_list, EXIT, "<ESP_ERR_NO_MEM> patch index");
+
+            list       = new_list;
+            list_size  = list_size * 2 + 64;
+        }
+
+        list[num++] = offset;
+        target += record.raw_size;
+    }
+
+    ret = ESP_ERR_INVALID_SIZE;
+    ESP_ERROR_GOTO(!num || target != size, EXIT, "The patch rebuilds %" PRIu32 " bytes of the %d bytes firmware", target, size);
+
+    list[num]   = patch->size;
+    *offsets    = list;
+    *packet_num = num;
+    list        = NULL;
+    ret         = ESP_OK;
+
+    ESP_LOGI(TAG, "Patch size: %d, packet_num: %d, firmware size: %d, packet_num: %d",
+             patch->size, num, size, (size + packet_size - 1) / packet_size);
+
+EXIT:
+    ESP_FREE(list);
+    return ret;
+}
+
+/**
+ * @brief Send one record of the patch, the errors are handled as espnow_ota_send_packet()
+ */
+static esp_err_t espnow_ota_send_packet_delta(espnow_ota_initiator_data_cb_t patch_data_cb, const uint32_t *offsets,
+                                              uint16_t seq, uint8_t *packet_buf, const uint8_t group[ESPNOW_ADDR_LEN],
+                                              const espnow_frame_head_t *frame_head)
+{
+    esp_err_t ret      = ESP_OK;
+    size_t record_size = offsets[seq + 1] - offsets[seq];
+    espnow_ota_packet_delta_t *packet = (espnow_ota_packet_delta_t *)packet_buf;
+
+    ret = patch_data_cb(offsets[seq], &packet->record, record_size);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Read patch", esp_err_to_name(ret));
+
+    packet->type = ESPNOW_OTA_TYPE_DATA_DELTA;
+    packet->seq  = seq;
+
+    ESP_LOGD(TAG, "seq: %d, raw_size: %d, size: %d", seq, packet->record.raw_size, packet->record.size);
+    ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, group, packet_buf,
+                      offsetof(espnow_ota_packet_delta_t, record) + record_size, frame_head, portMAX_DELAY);
+    ESP_ERROR_RETURN(ret != ESP_OK, ESP_OK, "<%s> espnow write", esp_err_to_name(ret));
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Stride scheduling of the campaigns sending at once. Each packet sent moves the pass of the campaign
+ *        by the stride divided by the packets it has left, the campaign of the lowest pass sends next, so the
+ *        air is shared in proportion to the work left and the campaigns are done about together.
+ */
+#define ESPNOW_OTA_CAMPAIGN_STRIDE  (1ULL << 32)
+
+static void espnow_ota_schedule_begin(espnow_ota_campaign_ctx_t *ctx)
+{
+    if (!ctx->scheduled) {
+        return;
+    }
+
+    uint64_t pass_min = UINT64_MAX;
+
+    portENTER_CRITICAL(&g_campaign_lock);
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+        if (g_campaigns[i] && g_campaigns[i] != ctx && g_campaigns[i]->sending) {
+            pass_min = MIN(pass_min, g_campaigns[i]->pass);
+        }
+    }
+
+    /**< A campaign back from waiting for the status does not take the air for the time it waited */
+    if (pass_min != UINT64_MAX) {
+        ctx->pass = MAX(ctx->pass, pass_min);
+    }
+
+    ctx->sending = true;
+
+    portEXIT_CRITICAL(&g_campaign_lock);
+}
+
+static void espnow_ota_schedule_notify(espnow_ota_campaign_ctx_t *ctx)
+{
+    TaskHandle_t tasks[CONFIG_ESPNOW_OTA_CAMPAIGN_MAX] = { 0 };
+
+    portENTER_CRITICAL(&g_campaign_lock);
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+        if (g_campaigns[i] && g_campaigns[i] != ctx && g_campaigns[i]->sending) {
+            tasks[i] = g_campaigns[i]->task;
+        }
+    }
+
+    portEXIT_CRITICAL(&g_campaign_lock);
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+        if (tasks[i]) {
+            xTaskNotifyGive(tasks[i]);
+        }
+    }
+}
+
+/**
+ * @brief Wait for the turn of the campaign to send a packet
+ *
+ * @param[in]  remaining  packets the campaign has left to send in the round
+ */
+static void espnow_ota_schedule_wait(espnow_ota_campaign_ctx_t *ctx, uint32_t remaining)
+{
+    if (!ctx->scheduled) {
+        return;
+    }
+
+    for (bool lowest = false; !lowest && g_ota_send_running_flag;) {
+        lowest = true;
+
+        portENTER_CRITICAL(&g_campaign_lock);
+
+        for (int i = 0; i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+            if (g_campaigns[i] && g_campaigns[i] != ctx && g_campaigns[i]->sending
+                    && g_campaigns[i]->pass < ctx->pass) {
+                lowest = false;
+                break;
+            }
+        }
+
+        if (lowest) {
+            ctx->pass += ESPNOW_OTA_CAMPAIGN_STRIDE / MAX(remaining, 1);
+        }
+
+        portEXIT_CRITICAL(&g_campaign_lock);
+
+        /**< The timeout covers a campaign which stopped sending without notifying */
+        if (!lowest) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+        }
+    }
+
+    espnow_ota_schedule_notify(ctx);
+}
+
+static void espnow_ota_schedule_end(espnow_ota_campaign_ctx_t *ctx)
+{
+    if (!ctx->scheduled) {
+        return;
+    }
+
+    portENTER_CRITICAL(&g_campaign_lock);
+    ctx->sending = false;
+    portEXIT_CRITICAL(&g_campaign_lock);
+
+    espnow_ota_schedule_notify(ctx);
+}
+
+#if ESPNOW_OTA_CHECKPOINT_ENABLE
+static void espnow_ota_checkpoint_save(const espnow_ota_campaign_ctx_t *ctx, const espnow_ota_status_t *status,
+                                       const espnow_ota_status_ext_t *status_ext, const espnow_ota_info_ext_t *caps,
+                                       const uint8_t *progress_array, const espnow_ota_result_t *result)
+{
+    esp_err_t ret = ESP_OK;
+    char key[16]  = {0};
+    uint32_t campaign_id = ESPNOW_OTA_CAMPAIGN_ID(status->sha_256);
+    size_t addrs_num     = result->successed_num + result->unfinished_num + result->requested_num;
+    size_t data_size     = addrs_num * ESPNOW_ADDR_LEN + status->packet_num / 8 + 1;
+    uint8_t *data        = ESP_MALLOC(data_size);
+    espnow_ota_checkpoint_t checkpoint = {
+        .version        = ESPNOW_OTA_CHECKPOINT_VERSION,
+        .size           = status->total_size,
+        .relay          = {.hops = status_ext->relay_hops, .depth = status_ext->relay_depth},
+        .packet_size    = caps->packet_size,
+        .flags          = caps->flags,
+        .packet_num     = status->packet_num,
+        .successed_num  = result->successed_num,
+        .unfinished_num = result->unfinished_num,
+        .requested_num  = result->requested_num,
+    };
+
+    if (!data) {
+        ESP_LOGW(TAG, "<ESP_ERR_NO_MEM> checkpoint of campaign %08" PRIx32, campaign_id);
+        return;
+    }
+
+    memcpy(checkpoint.sha_256, status->sha_256, ESPNOW_OTA_HASH_LEN);
+    memcpy(checkpoint.group, ctx->group, ESPNOW_ADDR_LEN);
+
+    uint8_t *ptr = data;
+    memcpy(ptr, result->successed_addr, result->successed_num * ESPNOW_ADDR_LEN);
+    ptr += result->successed_num * ESPNOW_ADDR_LEN;
+    memcpy(ptr, result->unfinished_addr, result->unfinished_num * ESPNOW_ADDR_LEN);
+    ptr += result->unfinished_num * ESPNOW_ADDR_LEN;
+    memcpy(ptr, result->requested_addr, result->requested_num * ESPNOW_ADDR_LEN);
+    ptr += result->requested_num * ESPNOW_ADDR_LEN;
+    memcpy(ptr, progress_array, status->packet_num / 8 + 1);
+    checkpoint.data_crc = esp_crc32_le(UINT32_MAX, data, data_size);
+
+    snprintf(key, sizeof(key), ESPNOW_OTA_CHECKPOINT_DATA_KEY, campaign_id);
+    ret = espnow_storage_set(key, data, data_size);
+
+    if (ret == ESP_OK) {
+        snprintf(key, sizeof(key), ESPNOW_OTA_CHECKPOINT_KEY, campaign_id);
+        ret = espnow_storage_set(key, &checkpoint, sizeof(espnow_ota_checkpoint_t));
+    }
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "<%s> Save the checkpoint of campaign %08" PRIx32, esp_err_to_name(ret), campaign_id);
+    }
+
+    ESP_FREE(data);
+}
+
+static esp_err_t espnow_ota_checkpoint_load(uint32_t campaign_id, espnow_ota_checkpoint_t **checkpoint)
+{
+    esp_err_t ret = ESP_OK;
+    char key[16]  = {0};
+    espnow_ota_checkpoint_t head = { 0 };
+    espnow_ota_checkpoint_t *loaded = NULL;
+    size_t data_size = 0;
+
+    snprintf(key, sizeof(key), ESPNOW_OTA_CHECKPOINT_KEY, campaign_id);
+    ret = espnow_storage_get(key, &head, sizeof(espnow_ota_checkpoint_t));
+    ESP_ERROR_RETURN(ret != ESP_OK, ESP_ERR_NOT_FOUND, "<%s> No checkpoint of campaign %08" PRIx32,
+                     esp_err_to_name(ret), campaign_id);
+    ESP_ERROR_RETURN(head.version != ESPNOW_OTA_CHECKPOINT_VERSION || ESPNOW_OTA_CAMPAIGN_ID(head.sha_256) != campaign_id,
+                     ESP_ERR_NOT_FOUND, "Checkpoint of campaign %08" PRIx32 ", version: %d", campaign_id, head.version);
+
+    data_size = (head.successed_num + head.unfinished_num + head.requested_num) * ESPNOW_ADDR_LEN
+                + head.packet_num / 8 + 1;
+    loaded = ESP_MALLOC(sizeof(espnow_ota_checkpoint_t) + data_size);
+    ESP_ERROR_RETURN(!loaded, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> checkpoint of campaign %08" PRIx32, campaign_id);
+    memcpy(loaded, &head, sizeof(espnow_ota_checkpoint_t));
+
+    /**< The data of the next round may have been written and not its header */
+    snprintf(key, sizeof(key), ESPNOW_OTA_CHECKPOINT_DATA_KEY, campaign_id);
+    ret = espnow_storage_get(key, loaded->data, data_size);
+
+    if (ret != ESP_OK || esp_crc32_le(UINT32_MAX, loaded->data, data_size) != head.data_crc) {
+        ESP_LOGW(TAG, "<%s> The data of the checkpoint of campaign %08" PRIx32 " do not match",
+                 esp_err_to_name(ret), campaign_id);
+        ESP_FREE(loaded);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    *checkpoint = loaded;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief The campaigns starting replace the checkpoints of the firmwares sent before, which no responder
+ *        would be resumed to, so at most CONFIG_ESPNOW_OTA_CAMPAIGN_MAX checkpoints stay in the flash
+ */
+static void espnow_ota_checkpoint_begin(const uint32_t *campaign_ids, size_t num)
+{
+    uint32_t list[CONFIG_ESPNOW_OTA_CAMPAIGN_MAX] = { 0 };
 
-                result->requested_num++;
-                result->requested_addr = ESP_REALLOC_RETRY(result->requested_addr, result->requested_num * ESPNOW_ADDR_LEN);
-                memcpy(result->requested_addr + (result->requested_num - 1), src_addr, ESPNOW_ADDR_LEN);
+    if (espnow_storage_get(ESPNOW_OTA_CHECKPOINT_LIST_KEY, list, sizeof(list)) == ESP_OK) {
+        for (size_t i = 0; i < CONFIG_ESPNOW_OTA_CAMPAIGN_MAX; ++i) {
+            bool kept = false;
 
-                if (response_data->written_size == 0) {
-                    memset(progress_array, 0x0, status->packet_num / 8 + 1);
-                } else {
-                    for (int i = 0; i < ESPNOW_OTA_PROGRESS_MAX_SIZE
-                            && (response_data->progress_index * ESPNOW_OTA_PROGRESS_MAX_SIZE  + i) * 8 < status->packet_num; i++) {
-                        progress_array[response_data->progress_index][i] &= response_data->progress_array[0][i];
-                    }
-                }
+            for (size_t j = 0; j < num && !kept; ++j) {
+                kept = (list[i] == campaign_ids[j]);
+            }
+
+            if (list[i] && !kept) {
+                ESP_LOGI(TAG, "Erase the checkpoint of campaign %08" PRIx32 ", its firmware is not sent", list[i]);
+                espnow_ota_initiator_checkpoint_erase(list[i]);
             }
         }
     }
 
-    ret = ESP_OK;
+    memset(list, 0, sizeof(list));
+    memcpy(list, campaign_ids, MIN(num, CONFIG_ESPNOW_OTA_CAMPAIGN_MAX) * sizeof(uint32_t));
 
-    if (response_num && response_num == result->unfinished_num) {
-        ESP_LOGW(TAG, "ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST");
-        ret = ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST;
-    } else if (response_num > 0) {
-        ESP_LOGW(TAG, "ESP_ERR_ESPNOW_OTA_SEND_PACKET_LOSS");
-        ret = ESP_ERR_ESPNOW_OTA_SEND_PACKET_LOSS;
-    } else if (result->requested_num > 0) {
-        ret = ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE;
-        ESP_LOGD(TAG, "ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE");
+    if (espnow_storage_set(ESPNOW_OTA_CHECKPOINT_LIST_KEY, list, sizeof(list)) != ESP_OK) {
+        ESP_LOGW(TAG, "Save the list of the checkpoints");
     }
+}
 
-    ESP_FREE(response_addrs);
-    ESP_FREE(response_data);
-    return ret;
+#else
+static void espnow_ota_checkpoint_begin(const uint32_t *campaign_ids, size_t num)
+{
 }
 
-esp_err_t espnow_ota_initiator_send(const uint8_t addrs_list[][6], size_t addrs_num,
-                                   const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
-                                   espnow_ota_initiator_data_cb_t ota_data_cb, espnow_ota_result_t *res)
+static void espnow_ota_checkpoint_save(const espnow_ota_campaign_ctx_t *ctx, const espnow_ota_status_t *status,
+                                       const espnow_ota_status_ext_t *status_ext, const espnow_ota_info_ext_t *caps,
+                                       const uint8_t *progress_array, const espnow_ota_result_t *result)
 {
-    ESP_PARAM_CHECK(addrs_list);
-    ESP_PARAM_CHECK(addrs_num);
+}
 
+static esp_err_t espnow_ota_checkpoint_load(uint32_t campaign_id, espnow_ota_checkpoint_t **checkpoint)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif /**< ESPNOW_OTA_CHECKPOINT_ENABLE */
+
+static esp_err_t espnow_ota_initiator_campaign(espnow_ota_campaign_ctx_t *ctx,
+                                               const uint8_t addrs_list[][6], size_t addrs_num,
+                                               const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
+                                               espnow_ota_initiator_data_cb_t ota_data_cb,
+                                               const espnow_ota_patch_t *patch, const espnow_ota_relay_t *relay,
+                                               espnow_ota_result_t *res)
+{
     esp_err_t ret = ESP_OK;
+    espnow_ota_info_ext_t caps = {
+        .packet_size = ESPNOW_OTA_PACKET_MAX_SIZE,
+    };
+    uint16_t packet_size = ESPNOW_OTA_PACKET_MAX_SIZE;
     espnow_ota_status_t status = {
         .type = ESPNOW_OTA_TYPE_STATUS,
         .total_size = size,
-        .packet_num = (size + ESPNOW_OTA_PACKET_MAX_SIZE - 1) / ESPNOW_OTA_PACKET_MAX_SIZE,
     };
     memcpy(status.sha_256, sha_256, ESPNOW_OTA_HASH_LEN);
 
-    ESP_LOGI(TAG, "[%s, %d]: total_size: %d, packet_num: %d", __func__, __LINE__, size, status.packet_num);
-
-    espnow_ota_packet_t *packet = ESP_MALLOC(sizeof(espnow_ota_packet_t));
-    uint8_t (*progress_array)[ESPNOW_OTA_PROGRESS_MAX_SIZE] = ESP_MALLOC(status.packet_num / 8 + 1);
+    /**< Large enough for the packets of any size */
+    uint8_t *packet_buf = ESP_MALLOC(sizeof(espnow_ota_packet_delta_t) + ESPNOW_OTA_PACKET_V2_MAX_SIZE);
+    uint32_t *lz_offsets = NULL;
+    uint32_t *delta_offsets = NULL;
+    espnow_addr_t *skipped_addr = NULL;
+    size_t skipped_num  = 0;
+    uint8_t *raw_buf    = NULL;
+    espnow_ota_status_ext_t status_ext = { 0 };
+    uint8_t (*progress_array)[ESPNOW_OTA_PROGRESS_MAX_SIZE] = NULL;
+    uint8_t *block_loss = NULL;
+    uint8_t *hashes     = NULL;
+    espnow_ota_initiator_data_cb_t read_cb = NULL;
     espnow_ota_result_t *result = ESP_CALLOC(1, sizeof(espnow_ota_result_t));
-    g_ota_send_running_flag = true;
+    uint32_t remaining  = 0;
+    bool setup_locked   = false;
+    int64_t start_time  = 0;
+    espnow_ota_pace_t pace = {
+        .retransmit_count = CONFIG_ESPNOW_OTA_RETRANSMISSION_TIMES,
+        .interval_min     = relay->depth ? CONFIG_ESPNOW_OTA_RELAY_PACKET_INTERVAL * 1000 : 0,
+    };
+
+    /**< The campaigns of espnow_ota_initiator_send_multi() are run and stopped together */
+    if (!ctx->scheduled) {
+        g_ota_send_running_flag = true;
+    } else {
+        setup_locked = xSemaphoreTake(g_setup_lock, portMAX_DELAY) == pdTRUE;
+    }
 
     espnow_frame_head_t frame_head = {
         .broadcast        = true,
@@ -403,88 +2101,351 @@ esp_err_t espnow_ota_initiator_send(const uint8_t addrs_list[][6], size_t addrs_
         .security         = CONFIG_ESPNOW_OTA_SECURITY,
     };
 
-    if (addrs_num == 1 && ESPNOW_ADDR_IS_BROADCAST(addrs_list[0])) {
+    if (ctx->resume) {
+        /**< The responders were scanned and their capabilities taken before the checkpoint */
+        const espnow_ota_checkpoint_t *checkpoint = ctx->resume;
+        const espnow_addr_t *checkpoint_addrs = (const espnow_addr_t *)checkpoint->data;
+
+        result->successed_num  = checkpoint->successed_num;
+        result->successed_addr = ESP_REALLOC_RETRY(NULL, MAX(result->successed_num, 1) * ESPNOW_ADDR_LEN);
+        memcpy(result->successed_addr, checkpoint_addrs, result->successed_num * ESPNOW_ADDR_LEN);
+        checkpoint_addrs += result->successed_num;
+
+        result->unfinished_num  = checkpoint->unfinished_num;
+        result->unfinished_addr = ESP_REALLOC_RETRY(NULL, MAX(result->unfinished_num, 1) * ESPNOW_ADDR_LEN);
+        memcpy(result->unfinished_addr, checkpoint_addrs, result->unfinished_num * ESPNOW_ADDR_LEN);
+
+        caps.packet_size = checkpoint->packet_size;
+        caps.flags       = checkpoint->flags;
+
+        if (result->unfinished_num > 0) {
+            espnow_set_group(result->unfinished_addr, result->unfinished_num, ctx->group, NULL, true, portMAX_DELAY);
+        }
+    } else if (addrs_num == 1 && ESPNOW_ADDR_IS_BROADCAST(addrs_list[0])) {
         espnow_ota_responder_t *info_list = NULL;
         size_t info_num = 0;
-        ret = espnow_ota_initiator_scan(&info_list, &info_num, 3000);
+        ret = espnow_ota_initiator_scan(&info_list, &info_num, pdMS_TO_TICKS(30 * 1000));
         ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_initiator_scan", esp_err_to_name(ret));
 
         ESP_LOGI(TAG, "Scan OTA list, num: %d", info_num);
 
-        result->unfinished_num  = info_num;
-        result->unfinished_addr = ESP_MALLOC(result->unfinished_num * ESPNOW_ADDR_LEN);
+        result->unfinished_addr = ESP_MALLOC(info_num * ESPNOW_ADDR_LEN);
 
         for (size_t i = 0; i < info_num; i++) {
-            memcpy(result->unfinished_addr[i], info_list[i].mac, ESPNOW_ADDR_LEN);
+            if (ctx->project_name && strncmp(info_list[i].app_desc.project_name, ctx->project_name,
+                                             sizeof(info_list[i].app_desc.project_name))) {
+                continue;
+            }
+
+            memcpy(result->unfinished_addr[result->unfinished_num++], info_list[i].mac, ESPNOW_ADDR_LEN);
+        }
+
+        if (patch) {
+            espnow_ota_delta_targets(result, patch->base_sha_256, ctx->group, &skipped_addr, &skipped_num);
         }
 
+        espnow_ota_caps_min(result->unfinished_addr, result->unfinished_num, &caps);
         espnow_ota_initiator_scan_result_free();
+
+        /**< Only the responders running the base of the patch, or the project of the firmware, join the group */
+        if (patch || ctx->project_name) {
+            espnow_set_group(result->unfinished_addr, result->unfinished_num, ctx->group, NULL, true, portMAX_DELAY);
+        } else {
+            espnow_set_group(addrs_list, addrs_num, ctx->group, NULL, true, portMAX_DELAY);
+        }
     } else {
         result->unfinished_num  = addrs_num;
         result->unfinished_addr = ESP_CALLOC(result->unfinished_num, ESPNOW_ADDR_LEN);
         memcpy(result->unfinished_addr, addrs_list, result->unfinished_num * ESPNOW_ADDR_LEN);
+
+        espnow_set_group(addrs_list, addrs_num, ctx->group, NULL, true, portMAX_DELAY);
+        espnow_ota_initiator_caps(result->unfinished_addr, result->unfinished_num, ctx->group, &caps);
+
+        if (patch) {
+            espnow_ota_delta_targets(result, patch->base_sha_256, ctx->group, &skipped_addr, &skipped_num);
+            espnow_ota_caps_min(result->unfinished_addr, result->unfinished_num, &caps);
+        }
+
+        espnow_ota_initiator_scan_result_free();
     }
 
-    espnow_set_group(addrs_list, addrs_num, ESPNOW_ADDR_GROUP_OTA, NULL, true, portMAX_DELAY);
-    /* Set queue size to unfinished num to avoid send queue failed */
-    g_ota_queue = xQueueCreate(result->unfinished_num, sizeof(espnow_ota_data_t));
-    ESP_ERROR_GOTO(!g_ota_queue, EXIT, "Create espnow ota queue fail");
-    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_OTA_STATUS, 1, espnow_ota_initiator_status_process);
+    if (setup_locked) {
+        xSemaphoreGive(g_setup_lock);
+        setup_locked = false;
+    }
+
+    packet_size = caps.packet_size;
+    status.packet_num = (size + packet_size - 1) / packet_size;
+    status_ext.packet_size = packet_size;
+    status_ext.relay_hops  = relay->hops;
+    status_ext.relay_depth = relay->depth;
+
+    /**< The responders of the patch all apply patches, which is only done with large packets */
+    if (patch && result->unfinished_num > 0) {
+        uint16_t packet_num = 0;
+        ret = espnow_ota_delta_index(patch, size, packet_size, &delta_offsets, &packet_num);
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_delta_index", esp_err_to_name(ret));
+
+        status.packet_num = packet_num;
+        status_ext.flags |= ESPNOW_OTA_CAP_DELTA;
+        memcpy(status_ext.base_sha_256, patch->base_sha_256, ESPNOW_OTA_HASH_LEN);
+    }
+
+    /**< Compressed packets do not fit in the legacy packets, all the responders must decode them */
+    if (ESPNOW_OTA_COMPRESS_ENABLE && !patch && (caps.flags & ESPNOW_OTA_CAP_COMPRESS)
+            && packet_size != ESPNOW_OTA_PACKET_MAX_SIZE) {
+        uint16_t packet_num = 0;
+        raw_buf = ESP_MALLOC(ESPNOW_OTA_LZ_BLOCK_MAX);
+
+        /**< The whole firmware is read to split it */
+        read_cb = ctx->read_ahead ? espnow_ota_read_ahead_round(ota_data_cb, size, NULL, 0, 0, NULL) : ota_data_cb;
+
+        if (raw_buf && espnow_ota_lz_index(read_cb, size, packet_size, &lz_offsets, &packet_num) == ESP_OK) {
+            status.packet_num = packet_num;
+            status_ext.flags |= ESPNOW_OTA_CAP_COMPRESS;
+        } else {
+            ESP_LOGW(TAG, "Send the firmware uncompressed");
+            ESP_FREE(raw_buf);
+        }
+
+        if (ctx->read_ahead) {
+            espnow_ota_read_ahead_stop();
+        }
+    }
+
+    progress_array = ESP_MALLOC(status.packet_num / 8 + 1);
+
+    /**< Repair packets do not fit in the legacy packets, all the responders must decode them.
+         They are the XOR of packets at fixed offsets, which the compressed and patch packets are not */
+    if (CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM > 0 && (caps.flags & ESPNOW_OTA_CAP_FEC)
+            && packet_size != ESPNOW_OTA_PACKET_MAX_SIZE && !status_ext.flags) {
+        block_loss = ESP_MALLOC((status.packet_num + ESPNOW_OTA_FEC_BLOCK_SIZE - 1) / ESPNOW_OTA_FEC_BLOCK_SIZE);
+    }
 
-    packet->type = ESPNOW_OTA_TYPE_DATA;
-    packet->size = ESPNOW_OTA_PACKET_MAX_SIZE;
+    /**< The responders verify the blocks as they are written, and the hash list against the root.
+         The blocks are at fixed offsets of the firmware, which the compressed and patch packets are not */
+    if ((caps.flags & ESPNOW_OTA_CAP_HASH) && packet_size != ESPNOW_OTA_PACKET_MAX_SIZE && !status_ext.flags) {
+        read_cb = ctx->read_ahead ? espnow_ota_read_ahead_round(ota_data_cb, size, NULL, 0, 0, NULL) : ota_data_cb;
+
+        if (espnow_ota_hash_list(read_cb, size, &hashes, status_ext.hash_root) != ESP_OK) {
+            ESP_LOGW(TAG, "Send the firmware without the hash list");
+            memset(status_ext.hash_root, 0, ESPNOW_OTA_HASH_LEN);
+        }
+
+        if (ctx->read_ahead) {
+            espnow_ota_read_ahead_stop();
+        }
+    }
+
+    ESP_LOGI(TAG, "[%s, %d]: total_size: %d, packet_num: %d, packet_size: %d, fec: %d, hash: %d",
+             __func__, __LINE__, size, status.packet_num, packet_size, block_loss != NULL, hashes != NULL);
+
+    ctx->member_num = result->unfinished_num;
+    ctx->members    = ESP_MALLOC(MAX(ctx->member_num, 1) * ESPNOW_ADDR_LEN);
+    ESP_ERROR_GOTO(!ctx->members, EXIT, "<ESP_ERR_NO_MEM> members");
+    memcpy(ctx->members, result->unfinished_addr, ctx->member_num * ESPNOW_ADDR_LEN);
+    memcpy(ctx->sha_256, sha_256, ESPNOW_OTA_HASH_LEN);
+
+    /* Set queue size to unfinished num to avoid send queue failed */
+    ctx->queue = xQueueCreate(MAX(result->unfinished_num, 1), sizeof(espnow_ota_data_t));
+    ESP_ERROR_GOTO(!ctx->queue, EXIT, "Create espnow ota queue fail");
+    espnow_ota_campaign_register(ctx, true);
+    espnow_ota_status_enable(true);
 
     ESP_LOGD(TAG, "packet_num: %d, total_size: %d", status.packet_num, status.total_size);
 
+    /**< The first round resumed sends the packets missed at the checkpoint, the status is asked after it */
+    bool resume_round = ctx->resume && ctx->resume->requested_num > 0 && ctx->resume->packet_num == status.packet_num;
+
     for (int i = 0; i < CONFIG_ESPNOW_OTA_RETRY_COUNT && result->unfinished_num > 0 && g_ota_send_running_flag; ++i) {
         /**
          * @brief Request all devices upgrade status.
          */
         memset(progress_array, 0xff, status.packet_num / 8 + 1);
 
-        ret = espnow_ota_request_status(progress_array, &status, result);
-        ESP_ERROR_BREAK(ret == ESP_OK || ret == ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST, "");
+        if (block_loss) {
+            memset(block_loss, 0, (status.packet_num + ESPNOW_OTA_FEC_BLOCK_SIZE - 1) / ESPNOW_OTA_FEC_BLOCK_SIZE);
+        }
+
+        /**< A slot for the NACK reply of every responder */
+        status_ext.reply_window = MIN(result->unfinished_num * ESPNOW_OTA_NACK_SLOT_MS, ESPNOW_OTA_NACK_WINDOW_MAX);
+
+        if (resume_round) {
+            const espnow_ota_checkpoint_t *checkpoint = ctx->resume;
+            const espnow_addr_t *checkpoint_addrs = (const espnow_addr_t *)checkpoint->data
+                                                    + checkpoint->successed_num + checkpoint->unfinished_num;
+
+            result->requested_num  = checkpoint->requested_num;
+            result->requested_addr = ESP_REALLOC_RETRY(NULL, result->requested_num * ESPNOW_ADDR_LEN);
+            memcpy(result->requested_addr, checkpoint_addrs, result->requested_num * ESPNOW_ADDR_LEN);
+            memcpy(progress_array, checkpoint_addrs + result->requested_num, status.packet_num / 8 + 1);
+
+            /**< The loss of the blocks is not saved, the packets are sent as they are */
+            if (block_loss) {
+                memset(block_loss, ESPNOW_OTA_FEC_BLOCK_SIZE,
+                       (status.packet_num + ESPNOW_OTA_FEC_BLOCK_SIZE - 1) / ESPNOW_OTA_FEC_BLOCK_SIZE);
+            }
+
+            resume_round = false;
+        } else {
+            ret = espnow_ota_request_status(ctx, progress_array, block_loss, &status, &status_ext, &pace, result);
+            ESP_ERROR_BREAK(ret == ESP_OK || ret == ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST, "");
+
+            if (ctx->checkpoint) {
+                espnow_ota_checkpoint_save(ctx, &status, &status_ext, &caps, (uint8_t *)progress_array, result);
+            }
+        }
+
+        /**< The rate and the retransmissions of this round are set by the packets the responders lost in the last one */
+        espnow_ota_pace_update(&pace);
+        espnow_ota_pace_begin(&pace);
+        frame_head.retransmit_count = pace.retransmit_count;
 
         ESP_LOGI(TAG, "count: %d, Upgrade_initiator_send, requested_num: %d, unfinished_num: %d, successed_num: %d",
                  i, result->unfinished_num, result->requested_num, result->successed_num);
         ESP_LOG_BUFFER_HEXDUMP(TAG, progress_array, sizeof(espnow_ota_status_t) + ESPNOW_OTA_PROGRESS_MAX_SIZE, ESP_LOG_DEBUG);
 
-        for (packet->seq = 0; result->requested_num > 0 && packet->seq < status.packet_num && g_ota_send_running_flag; ++packet->seq) {
-            if (!ESPNOW_OTA_GET_BITS(progress_array, packet->seq)) {
-                packet->size = (packet->seq == status.packet_num - 1) ? status.total_size - ESPNOW_OTA_PACKET_MAX_SIZE * packet->seq : ESPNOW_OTA_PACKET_MAX_SIZE;
-                /**
-                 * @brief Read firmware data from Flash to send to unfinished device.
-                 */
-                ret = ota_data_cb(packet->seq * ESPNOW_OTA_PACKET_MAX_SIZE, packet->data, packet->size);
-                ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> Read data from Flash", esp_err_to_name(ret));
-
-                ESP_LOGD(TAG, "seq: %d, size: %d, addrs_num: %d", packet->seq, packet->size, result->requested_num);
-                ret = espnow_send(ESPNOW_DATA_TYPE_OTA_DATA, ESPNOW_ADDR_GROUP_OTA, packet, sizeof(espnow_ota_packet_t), &frame_head, portMAX_DELAY);
-                ESP_ERROR_CONTINUE(ret != ESP_OK, "<%s> espnow write", esp_err_to_name(ret));
+        /**< The packets lost are read ahead, in the order they are sent */
+        if (result->requested_num > 0 && ctx->read_ahead && delta_offsets) {
+            read_cb = espnow_ota_read_ahead_round(patch->data_cb, patch->size, (uint8_t *)progress_array,
+                                                  status.packet_num, packet_size, delta_offsets);
+        } else if (result->requested_num > 0 && ctx->read_ahead) {
+            read_cb = espnow_ota_read_ahead_round(ota_data_cb, size, (uint8_t *)progress_array,
+                                                  status.packet_num, packet_size, lz_offsets);
+        } else {
+            read_cb = delta_offsets ? patch->data_cb : ota_data_cb;
+        }
+
+        remaining = 0;
+
+        for (uint32_t seq = 0; result->requested_num > 0 && seq < status.packet_num; ++seq) {
+            remaining += !ESPNOW_OTA_GET_BITS(progress_array, seq);
+        }
+
+        espnow_ota_schedule_begin(ctx);
+
+        /**< The responders which lost the hash list, or started the upgrade in this round, verify the blocks with it */
+        if (result->requested_num > 0 && hashes) {
+            espnow_ota_schedule_wait(ctx, remaining);
+            espnow_ota_send_hash(hashes, size, packet_size, packet_buf, ctx->group, &frame_head);
+        }
+
+        for (uint32_t block_seq = 0; result->requested_num > 0 && block_seq < status.packet_num && g_ota_send_running_flag;
+                block_seq += ESPNOW_OTA_FEC_BLOCK_SIZE) {
+            uint16_t block_size = MIN(ESPNOW_OTA_FEC_BLOCK_SIZE, status.packet_num - block_seq);
+            uint32_t missing    = 0;
+
+            for (int n = 0; n < block_size; ++n) {
+                if (!ESPNOW_OTA_GET_BITS(progress_array, block_seq + n)) {
+                    missing |= BIT(n);
+                }
+            }
+
+            if (!missing) {
+                continue;
+            }
+
+            /**
+             * @brief Send repair packets when the responders lost different packets of the block,
+             *        fewer of them are needed than the packets lost by any responder.
+             */
+            if (block_loss) {
+                int missing_num = __builtin_popcount(missing);
+                int repair_num  = block_loss[block_seq / ESPNOW_OTA_FEC_BLOCK_SIZE] + ESPNOW_OTA_FEC_MARGIN;
+
+                if (missing_num > 1 && repair_num < missing_num && repair_num <= CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM) {
+                    espnow_ota_schedule_wait(ctx, remaining);
+                    remaining -= missing_num;
+                    start_time = esp_timer_get_time();
+
+                    ret = espnow_ota_send_repair(read_cb, &status, packet_size, block_seq, missing, repair_num,
+                                                 packet_buf, ctx->group, &frame_head);
+                    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_send_repair", esp_err_to_name(ret));
+
+                    espnow_ota_pace_sent(&pace, start_time, repair_num);
+                    continue;
+                }
+            }
+
+            for (int n = 0; n < block_size && g_ota_send_running_flag; ++n) {
+                if (!(missing & BIT(n))) {
+                    continue;
+                }
+
+                espnow_ota_schedule_wait(ctx, remaining--);
+                start_time = esp_timer_get_time();
+
+                if (delta_offsets) {
+                    ret = espnow_ota_send_packet_delta(read_cb, delta_offsets, block_seq + n, packet_buf,
+                                                       ctx->group, &frame_head);
+                } else if (lz_offsets) {
+                    ret = espnow_ota_send_packet_lz(read_cb, lz_offsets, packet_size, block_seq + n,
+                                                    packet_buf, raw_buf, ctx->group, &frame_head);
+                } else {
+                    ret = espnow_ota_send_packet(read_cb, &status, packet_size, block_seq + n, packet_buf,
+                                                 ctx->group, &frame_head);
+                }
+
+                ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_ota_send_packet", esp_err_to_name(ret));
+
+                /**< A relay leaves the air to the upgrades around it, at least its interval between the packets */
+                espnow_ota_pace_sent(&pace, start_time, 1);
             }
         }
+
+        /**< The other campaigns take the air while this one waits for the status */
+        espnow_ota_schedule_end(ctx);
     }
 
 EXIT:
 
-    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_OTA_STATUS, 0, NULL);
-    if (g_ota_queue) {
-        espnow_ota_data_t *tmp_data = NULL;
+    espnow_ota_schedule_end(ctx);
+
+    if (setup_locked) {
+        xSemaphoreGive(g_setup_lock);
+    }
+
+    if (ctx->read_ahead) {
+        espnow_ota_read_ahead_stop();
+    }
+
+    if (ctx->queue) {
+        espnow_ota_data_t tmp_data = { 0 };
+
+        espnow_ota_status_enable(false);
+        espnow_ota_campaign_register(ctx, false);
 
-        while (xQueueReceive(g_ota_queue, &tmp_data, 0)) {
-            ESP_FREE(tmp_data->data);
+        while (xQueueReceive(ctx->queue, &tmp_data, 0)) {
+            ESP_FREE(tmp_data.data);
         }
 
-        vQueueDelete(g_ota_queue);
-        g_ota_queue = NULL;
+        vQueueDelete(ctx->queue);
+        ctx->queue = NULL;
     }
 
+    ESP_FREE(ctx->members);
+    ctx->member_num = 0;
+
     if (result->unfinished_num > 0) {
-        espnow_set_group(result->unfinished_addr, result->unfinished_num, ESPNOW_ADDR_GROUP_OTA, NULL, false, portMAX_DELAY);
+        espnow_set_group(result->unfinished_addr, result->unfinished_num, ctx->group, NULL, false, portMAX_DELAY);
         ret = ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE;
+    } else if (ctx->checkpoint) {
+        /**< No responder is left to resume, whether they were all upgraded or the campaign failed */
+        espnow_ota_initiator_checkpoint_erase(ESPNOW_OTA_CAMPAIGN_ID(sha_256));
     }
 
-    g_ota_send_running_flag = false;
+    /**< The responders the patch does not apply to still wait for their upgrade */
+    if (skipped_num > 0) {
+        result->unfinished_addr = ESP_REALLOC_RETRY(result->unfinished_addr,
+                                  (result->unfinished_num + skipped_num) * ESPNOW_ADDR_LEN);
+        memcpy(result->unfinished_addr + result->unfinished_num, skipped_addr, skipped_num * ESPNOW_ADDR_LEN);
+        result->unfinished_num += skipped_num;
+        ret = ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE;
+    }
+
+    if (!ctx->scheduled) {
+        g_ota_send_running_flag = false;
+    }
 
     if (res) {
         memcpy(res, result, sizeof(espnow_ota_result_t));
@@ -492,10 +2453,214 @@ EXIT:
         espnow_ota_initiator_result_free(result);
     }
 
-    ESP_FREE(packet);
+    ESP_FREE(packet_buf);
     ESP_FREE(progress_array);
+    ESP_FREE(block_loss);
+    ESP_FREE(hashes);
+    ESP_FREE(lz_offsets);
+    ESP_FREE(delta_offsets);
+    ESP_FREE(skipped_addr);
+    ESP_FREE(raw_buf);
     ESP_FREE(result);
 
+    if (!ctx->scheduled && g_ota_send_exit_sem) {
+        xSemaphoreGive(g_ota_send_exit_sem);
+    }
+
+    return ret;
+}
+
+esp_err_t espnow_ota_initiator_send(const uint8_t addrs_list[][6], size_t addrs_num,
+                                   const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
+                                   espnow_ota_initiator_data_cb_t ota_data_cb, espnow_ota_result_t *res)
+{
+    ESP_PARAM_CHECK(addrs_list);
+    ESP_PARAM_CHECK(addrs_num);
+    ESP_PARAM_CHECK(ota_data_cb);
+
+    const espnow_ota_relay_t relay = {
+        .hops = CONFIG_ESPNOW_OTA_RELAY_HOPS,
+    };
+    espnow_ota_campaign_ctx_t ctx = ESPNOW_OTA_CAMPAIGN_CTX_DEFAULT();
+    uint32_t campaign_id = ESPNOW_OTA_CAMPAIGN_ID(sha_256);
+    ctx.checkpoint = g_checkpoint_en;
+
+    if (ctx.checkpoint) {
+        espnow_ota_checkpoint_begin(&campaign_id, 1);
+    }
+
+    return espnow_ota_initiator_campaign(&ctx, addrs_list, addrs_num, sha_256, size, ota_data_cb, NULL, &relay, res);
+}
+
+esp_err_t espnow_ota_initiator_send_relay(const uint8_t addrs_list[][6], size_t addrs_num,
+                                         const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
+                                         espnow_ota_initiator_data_cb_t ota_data_cb, const espnow_ota_relay_t *relay,
+                                         espnow_ota_result_t *res)
+{
+    ESP_PARAM_CHECK(addrs_list);
+    ESP_PARAM_CHECK(addrs_num);
+    ESP_PARAM_CHECK(ota_data_cb);
+    ESP_PARAM_CHECK(relay);
+
+    espnow_ota_campaign_ctx_t ctx = ESPNOW_OTA_CAMPAIGN_CTX_DEFAULT();
+    uint32_t campaign_id = ESPNOW_OTA_CAMPAIGN_ID(sha_256);
+
+    /**< The responders relaying the firmware run it again on their timer, only the root saves its progress */
+    ctx.checkpoint = g_checkpoint_en && !relay->depth;
+
+    if (ctx.checkpoint) {
+        espnow_ota_checkpoint_begin(&campaign_id, 1);
+    }
+
+    return espnow_ota_initiator_campaign(&ctx, addrs_list, addrs_num, sha_256, size, ota_data_cb, NULL, relay, res);
+}
+
+esp_err_t espnow_ota_initiator_send_delta(const uint8_t addrs_list[][6], size_t addrs_num,
+                                         const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
+                                         const uint8_t base_sha_256[ESPNOW_OTA_HASH_LEN], size_t patch_size,
+                                         espnow_ota_initiator_data_cb_t patch_data_cb, espnow_ota_result_t *res)
+{
+    ESP_PARAM_CHECK(addrs_list);
+    ESP_PARAM_CHECK(addrs_num);
+    ESP_PARAM_CHECK(base_sha_256);
+    ESP_PARAM_CHECK(patch_size);
+    ESP_PARAM_CHECK(patch_data_cb);
+
+    const espnow_ota_patch_t patch = {
+        .base_sha_256 = base_sha_256,
+        .size         = patch_size,
+        .data_cb      = patch_data_cb,
+    };
+
+    const espnow_ota_relay_t relay = { 0 };
+    espnow_ota_campaign_ctx_t ctx = ESPNOW_OTA_CAMPAIGN_CTX_DEFAULT();
+
+    return espnow_ota_initiator_campaign(&ctx, addrs_list, addrs_num, sha_256, size, NULL, &patch, &relay, res);
+}
+
+typedef struct {
+    espnow_ota_campaign_ctx_t ctx;
+    espnow_ota_relay_t relay;
+    char project_name[sizeof(((esp_app_desc_t *)0)->project_name)];
+} espnow_ota_campaign_task_arg_t;
+
+static void espnow_ota_campaign_task(void *arg)
+{
+    espnow_ota_campaign_task_arg_t *task_arg = (espnow_ota_campaign_task_arg_t *)arg;
+    espnow_ota_campaign_ctx_t *ctx = &task_arg->ctx;
+    espnow_ota_campaign_t *campaign = ctx->campaign;
+
+    campaign->ret = espnow_ota_initiator_campaign(ctx, campaign->addrs_list, campaign->addrs_num, campaign->sha_256,
+                    campaign->size, campaign->ota_data_cb, NULL, &task_arg->relay, &campaign->result);
+
+    ESP_LOGI(TAG, "Campaign " MACSTR " done, <%s> successed_num: %d, unfinished_num: %d",
+             MAC2STR(ctx->group), esp_err_to_name(campaign->ret),
+             campaign->result.successed_num, campaign->result.unfinished_num);
+
+    xSemaphoreGive(ctx->done_sem);
+    vTaskDelete(NULL);
+}
+
+esp_err_t espnow_ota_initiator_send_multi(espnow_ota_campaign_t *campaigns, size_t num)
+{
+    ESP_PARAM_CHECK(campaigns);
+    ESP_PARAM_CHECK(num && num <= CONFIG_ESPNOW_OTA_CAMPAIGN_MAX);
+    ESP_ERROR_RETURN(g_ota_send_running_flag, ESP_ERR_INVALID_STATE, "An upgrade is in progress");
+
+    esp_err_t ret    = ESP_OK;
+    size_t started   = 0;
+    size_t largest   = 0;
+    espnow_ota_campaign_task_arg_t *args = ESP_CALLOC(num, sizeof(espnow_ota_campaign_task_arg_t));
+    SemaphoreHandle_t done_sem = xSemaphoreCreateCounting(num, 0);
+    g_setup_lock = xSemaphoreCreateMutex();
+
+    ret = ESP_ERR_NO_MEM;
+    ESP_ERROR_GOTO(!args || !done_sem || !g_setup_lock, EXIT, "<ESP_ERR_NO_MEM> campaigns");
+
+    for (size_t i = 0; i < num; ++i) {
+        ret = ESP_ERR_INVALID_ARG;
+        ESP_ERROR_GOTO(!campaigns[i].addrs_list || !campaigns[i].addrs_num || !campaigns[i].ota_data_cb, EXIT,
+                       "Campaign %d, invalid argument", i);
+
+        if (campaigns[i].size > campaigns[largest].size) {
+            largest = i;
+        }
+    }
+
+    ret = ESP_OK;
+    g_ota_send_running_flag = true;
+
+    if (g_checkpoint_en) {
+        uint32_t campaign_ids[CONFIG_ESPNOW_OTA_CAMPAIGN_MAX] = { 0 };
+
+        for (size_t i = 0; i < num; ++i) {
+            campaign_ids[i] = ESPNOW_OTA_CAMPAIGN_ID(campaigns[i].sha_256);
+        }
+
+        espnow_ota_checkpoint_begin(campaign_ids, num);
+    }
+
+    for (size_t i = 0; i < num; ++i) {
+        espnow_ota_campaign_task_arg_t *task_arg = args + i;
+        espnow_ota_campaign_ctx_t *ctx = &task_arg->ctx;
+        esp_app_desc_t app_desc = { 0 };
+
+        memset(&campaigns[i].result, 0, sizeof(espnow_ota_result_t));
+        campaigns[i].ret = ESP_OK;
+
+        /**< The group of each campaign is derived from the OTA one */
+        memcpy(ctx->group, ESPNOW_ADDR_GROUP_OTA, ESPNOW_ADDR_LEN);
+        ctx->group[ESPNOW_ADDR_LEN - 1] = i + 1;
+        ctx->scheduled = true;
+        ctx->campaign  = campaigns + i;
+        ctx->done_sem  = done_sem;
+        ctx->checkpoint = g_checkpoint_en;
+        task_arg->relay.hops = CONFIG_ESPNOW_OTA_RELAY_HOPS;
+
+        /**< The read ahead is taken by the largest firmware, which takes the longest to send */
+        ctx->read_ahead = (i == largest);
+
+        /**< The responders of a broadcast campaign are the ones running the project of its firmware */
+        if (campaigns[i].addrs_num == 1 && ESPNOW_ADDR_IS_BROADCAST(campaigns[i].addrs_list[0])
+                && campaigns[i].ota_data_cb(sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t),
+                                            &app_desc, sizeof(esp_app_desc_t)) == ESP_OK
+                && app_desc.magic_word == ESP_APP_DESC_MAGIC_WORD) {
+            strlcpy(task_arg->project_name, app_desc.project_name, sizeof(task_arg->project_name));
+            ctx->project_name = task_arg->project_name;
+        }
+
+        if (xTaskCreate(espnow_ota_campaign_task, "espnow_ota_campaign", 4 * 1024, task_arg,
+                        uxTaskPriorityGet(NULL), &ctx->task) != pdPASS) {
+            ESP_LOGE(TAG, "Create the task of campaign %d", i);
+            campaigns[i].ret = ESP_ERR_NO_MEM;
+            continue;
+        }
+
+        started++;
+    }
+
+    for (size_t i = 0; i < started; ++i) {
+        xSemaphoreTake(done_sem, portMAX_DELAY);
+    }
+
+    g_ota_send_running_flag = false;
+
+    for (size_t i = 0; i < num && ret == ESP_OK; ++i) {
+        ret = campaigns[i].ret;
+    }
+
+EXIT:
+    if (done_sem) {
+        vSemaphoreDelete(done_sem);
+    }
+
+    if (g_setup_lock) {
+        vSemaphoreDelete(g_setup_lock);
+        g_setup_lock = NULL;
+    }
+
+    ESP_FREE(args);
+
     if (g_ota_send_exit_sem) {
         xSemaphoreGive(g_ota_send_exit_sem);
     }
@@ -503,6 +2668,67 @@ EXIT:
     return ret;
 }
 
+esp_err_t espnow_ota_initiator_resume(uint32_t campaign_id, espnow_ota_initiator_data_cb_t ota_data_cb,
+                                      espnow_ota_result_t *res)
+{
+    ESP_PARAM_CHECK(ota_data_cb);
+
+    esp_err_t ret = ESP_OK;
+    espnow_ota_checkpoint_t *checkpoint = NULL;
+    espnow_ota_campaign_ctx_t ctx = ESPNOW_OTA_CAMPAIGN_CTX_DEFAULT();
+
+    ret = espnow_ota_checkpoint_load(campaign_id, &checkpoint);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> espnow_ota_checkpoint_load", esp_err_to_name(ret));
+
+    ESP_LOGI(TAG, "Resume campaign %08" PRIx32 ", successed_num: %d, unfinished_num: %d, requested_num: %d",
+             campaign_id, checkpoint->successed_num, checkpoint->unfinished_num, checkpoint->requested_num);
+
+    /**< The group of a campaign of espnow_ota_initiator_send_multi() is kept, the responders may still be in it */
+    memcpy(ctx.group, checkpoint->group, ESPNOW_ADDR_LEN);
+    ctx.checkpoint = true;
+    ctx.resume     = checkpoint;
+
+    ret = espnow_ota_initiator_campaign(&ctx, (const espnow_addr_t *)checkpoint->data + checkpoint->successed_num,
+                                        checkpoint->unfinished_num, checkpoint->sha_256, checkpoint->size,
+                                        ota_data_cb, NULL, &checkpoint->relay, res);
+
+    ESP_FREE(checkpoint);
+
+    return ret;
+}
+
+esp_err_t espnow_ota_initiator_checkpoint_enable(bool enable)
+{
+    ESP_ERROR_RETURN(!ESPNOW_OTA_CHECKPOINT_ENABLE && enable, ESP_ERR_NOT_SUPPORTED,
+                     "CONFIG_ESPNOW_OTA_CHECKPOINT is not enabled");
+
+    g_checkpoint_en = enable;
+
+    return ESP_OK;
+}
+
+esp_err_t espnow_ota_initiator_checkpoint_erase(uint32_t campaign_id)
+{
+#if ESPNOW_OTA_CHECKPOINT_ENABLE
+    esp_err_t ret = ESP_OK;
+    char key[16]  = {0};
+
+    /**< The header first, the data left alone are not loaded */
+    snprintf(key, sizeof(key), ESPNOW_OTA_CHECKPOINT_KEY, campaign_id);
+    ret = espnow_storage_erase(key);
+
+    if (ret == ESP_OK || ret == ESP_ERR_NVS_NOT_FOUND) {
+        snprintf(key, sizeof(key), ESPNOW_OTA_CHECKPOINT_DATA_KEY, campaign_id);
+        ret = espnow_storage_erase(key);
+    }
+
+    ESP_ERROR_RETURN(ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND, ESP_FAIL,
+                     "<%s> Erase the checkpoint of campaign %08" PRIx32, esp_err_to_name(ret), campaign_id);
+#endif
+
+    return ESP_OK;
+}
+
 esp_err_t espnow_ota_initiator_result_free(espnow_ota_result_t *result)
 {
     ESP_PARAM_CHECK(result);
@@ -517,8 +2743,18 @@ esp_err_t espnow_ota_initiator_result_free(espnow_ota_result_t *result)
     return ESP_OK;
 }
 
+esp_err_t espnow_ota_initiator_request_stop(void)
+{
+    g_ota_scan_stop         = true;
+    g_ota_send_running_flag = false;
+
+    return ESP_OK;
+}
+
 esp_err_t espnow_ota_initiator_stop()
 {
+    g_ota_scan_stop = true;
+
     if (!g_ota_send_running_flag) {
         return ESP_OK;
     }
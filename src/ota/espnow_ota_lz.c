@@ -0,0 +1,166 @@
+// Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "espnow.h"
+#include "espnow_ota.h"
+#include "espnow_utils.h"
+
+/**
+ * @brief Format of the compressed block, a sequence of tokens:
+ *        - 0b0LLLLLLL: L + 1 literals follow
+ *        - 0b1LLLLLLL: copy L + 3 bytes from the distance in the next 2 bytes (little endian),
+ *                      counted back from the end of the data decompressed
+ *        Distances never reach out of the block, so blocks are decompressed in any order
+ *        with no RAM but the output.
+ */
+#define ESPNOW_OTA_LZ_MIN_MATCH     3
+#define ESPNOW_OTA_LZ_MAX_MATCH     (0x7F + ESPNOW_OTA_LZ_MIN_MATCH)
+#define ESPNOW_OTA_LZ_MAX_LITERAL   (0x7F + 1)
+#define ESPNOW_OTA_LZ_MATCH_FLAG    0x80
+
+#define ESPNOW_OTA_LZ_HASH_BITS     12
+#define ESPNOW_OTA_LZ_HASH_NONE     0xFFFF
+#define ESPNOW_OTA_LZ_HASH(p)       ((uint32_t)(((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2]) * 2654435761U) >> (32 - ESPNOW_OTA_LZ_HASH_BITS))
+
+static const char *TAG = "espnow_ota_lz";
+
+esp_err_t espnow_ota_lz_compress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len,
+                                 size_t *consumed, size_t *olen)
+{
+    ESP_PARAM_CHECK(src);
+    ESP_PARAM_CHECK(dst);
+    ESP_PARAM_CHECK(consumed);
+    ESP_PARAM_CHECK(olen);
+    ESP_PARAM_CHECK(src_len <= ESPNOW_OTA_LZ_BLOCK_MAX);
+
+    size_t in       = 0;
+    size_t out      = 0;
+    size_t lit_pos  = 0;
+    size_t lit_num  = 0;
+
+    /**< Last position of each hash of 3 bytes */
+    uint16_t *table = ESP_MALLOC(sizeof(uint16_t) << ESPNOW_OTA_LZ_HASH_BITS);
+    ESP_ERROR_RETURN(!table, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> hash table");
+    memset(table, 0xFF, sizeof(uint16_t) << ESPNOW_OTA_LZ_HASH_BITS);
+
+    while (in < src_len) {
+        size_t match_len = 0;
+        size_t distance  = 0;
+
+        if (in + ESPNOW_OTA_LZ_MIN_MATCH <= src_len) {
+            uint32_t hash  = ESPNOW_OTA_LZ_HASH(src + in);
+            uint16_t match = table[hash];
+            table[hash]    = in;
+
+            if (match != ESPNOW_OTA_LZ_HASH_NONE) {
+                size_t max_len = MIN(src_len - in, ESPNOW_OTA_LZ_MAX_MATCH);
+
+                while (match_len < max_len && src[match + match_len] == src[in + match_len]) {
+                    match_len++;
+                }
+
+                distance = in - match;
+            }
+        }
+
+        if (match_len >= ESPNOW_OTA_LZ_MIN_MATCH) {
+            if (out + 3 > dst_len) {
+                break;
+            }
+
+            dst[out++] = ESPNOW_OTA_LZ_MATCH_FLAG | (match_len - ESPNOW_OTA_LZ_MIN_MATCH);
+            dst[out++] = distance & 0xFF;
+            dst[out++] = distance >> 8;
+
+            /**< Index the bytes the match covers, they are referenced by the later matches */
+            for (size_t i = in + 1; i < in + match_len && i + ESPNOW_OTA_LZ_MIN_MATCH <= src_len; ++i) {
+                table[ESPNOW_OTA_LZ_HASH(src + i)] = i;
+            }
+
+            in += match_len;
+            lit_num = 0;
+            continue;
+        }
+
+        /**< Start a new run of literals, it takes one more byte for the token */
+        if (!lit_num || lit_num == ESPNOW_OTA_LZ_MAX_LITERAL) {
+            if (out + 2 > dst_len) {
+                break;
+            }
+
+            lit_pos = out++;
+            lit_num = 0;
+        } else if (out + 1 > dst_len) {
+            break;
+        }
+
+        dst[out++]   = src[in++];
+        dst[lit_pos] = lit_num++;
+    }
+
+    ESP_FREE(table);
+
+    *consumed = in;
+    *olen     = out;
+
+    ESP_LOGV(TAG, "Compress %d bytes to %d bytes", in, out);
+
+    return ESP_OK;
+}
+
+esp_err_t espnow_ota_lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len, size_t *olen)
+{
+    ESP_PARAM_CHECK(src);
+    ESP_PARAM_CHECK(dst);
+    ESP_PARAM_CHECK(olen);
+
+    size_t in  = 0;
+    size_t out = 0;
+
+    while (in < src_len) {
+        uint8_t token = src[in++];
+
+        if (!(token & ESPNOW_OTA_LZ_MATCH_FLAG)) {
+            size_t len = token + 1;
+            ESP_ERROR_RETURN(in + len > src_len || out + len > dst_len, ESP_ERR_INVALID_SIZE,
+                             "Literals out of range, in: %d, out: %d, len: %d", in, out, len);
+
+            memcpy(dst + out, src + in, len);
+            in  += len;
+            out += len;
+        } else {
+            size_t len = (token & ~ESPNOW_OTA_LZ_MATCH_FLAG) + ESPNOW_OTA_LZ_MIN_MATCH;
+            ESP_ERROR_RETURN(in + 2 > src_len, ESP_ERR_INVALID_SIZE, "Match truncated, in: %d", in);
+
+            size_t distance = src[in] | src[in + 1] << 8;
+            in += 2;
+
+            ESP_ERROR_RETURN(!distance || distance > out || out + len > dst_len, ESP_ERR_INVALID_SIZE,
+                             "Match out of range, out: %d, distance: %d, len: %d", out, distance, len);
+
+            /**< The source may overlap the destination, copy byte by byte */
+            for (; len > 0; --len, ++out) {
+                dst[out] = dst[out - distance];
+            }
+        }
+    }
+
+    *olen = out;
+
+    return ESP_OK;
+}
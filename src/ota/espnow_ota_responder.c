@@ -12,117 +12,1663 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
 
 #include "esp_wifi.h"
 
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
 #include "esp_mac.h"
+#include "esp_random.h"
+#else
+#include "esp_system.h"
 #endif
 
 #ifdef CONFIG_BOOTLOADER_APP_ANTI_ROLLBACK
 #include "esp_efuse.h"
 #endif
 
+#include "esp_crc.h"
+#include "esp_flash_encrypt.h"
+
 #include "espnow.h"
 #include "espnow_ota.h"
 #include "espnow_utils.h"
 
 #define ESPNOW_OTA_STORE_CONFIG_KEY "upugrad_config"
+#define ESPNOW_OTA_STORE_PACKET_KEY "ota_packet"
+#define ESPNOW_OTA_STORE_RELAY_KEY  "ota_relay"
 #define CONFIG_ESPNOW_OTA_SKIP_VERSION_CHECK
 
-/**< Usable capacity (in bytes) of status.progress_array, matching the g_ota_config
-     allocation of `sizeof(ota_config_t) + ESPNOW_OTA_PROGRESS_MAX_SIZE * ESPNOW_OTA_PROGRESS_CHUNK_NUM`.
-     The attacker-controlled packet_num is bounded against this to avoid a heap overflow. */
-#define ESPNOW_OTA_PROGRESS_ARRAY_CAPACITY (ESPNOW_OTA_PROGRESS_MAX_SIZE * ESPNOW_OTA_PROGRESS_CHUNK_NUM)
-#define ESPNOW_OTA_BITMAP_PACKET_LIMIT     (((ESPNOW_OTA_PROGRESS_ARRAY_CAPACITY) - 1) * 8)
+#ifndef CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM
+#define CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM 8
+#endif
+
+#ifndef CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM
+#define CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM 4
+#endif
+
+#ifndef CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MIN
+#define CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MIN 10000
+#endif
+
+#ifndef CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MAX
+#define CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MAX 320000
+#endif
+
+/**< The relay stops after these intervals of the maximum length in which no neighbor needed the firmware,
+     and skips the interval in which it heard this number of other relays serving the neighbors */
+#define ESPNOW_OTA_RELAY_QUIET_NUM       2
+#define ESPNOW_OTA_RELAY_REDUNDANCY      1
+
+/**< The replies sent from the timer service task wait no longer for the radio, a late reply misses its slot */
+#define ESPNOW_OTA_REPLY_SEND_TIMEOUT_MS 100
+
+#define ESPNOW_OTA_SECTOR_SIZE           4096
+#define ESPNOW_OTA_CACHE_PIECE_NUM       32
+
+/**< The journal takes two halves at the end of the update partition, written in turn */
+#define ESPNOW_OTA_JOURNAL_MAGIC         0x4A41544F
+#define ESPNOW_OTA_JOURNAL_HALF_SIZE     (2 * ESPNOW_OTA_SECTOR_SIZE)
+#define ESPNOW_OTA_JOURNAL_RECORD_NUM    32
+
+/**< Capabilities an upgrade may use, one at most, the packets of which replace the uncompressed ones */
+#define ESPNOW_OTA_UPGRADE_FLAGS         (ESPNOW_OTA_CAP_COMPRESS | ESPNOW_OTA_CAP_DELTA)
+
+/**< The repair packets only fit in the packets of ESP-NOW v2, the sizes are not known to the preprocessor */
+#if CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM > 0 && defined(ESP_NOW_MAX_DATA_LEN_V2)
+#define ESPNOW_OTA_FEC_ENABLE 1
+#else
+#define ESPNOW_OTA_FEC_ENABLE 0
+#endif
+
+/**< Usable capacity (in bytes) of status.progress_array, matching the g_ota_config
+     allocation of `sizeof(ota_config_t) + ESPNOW_OTA_PROGRESS_MAX_SIZE * ESPNOW_OTA_PROGRESS_CHUNK_NUM`.
+     The attacker-controlled packet_num is bounded against this to avoid a heap overflow. */
+#define ESPNOW_OTA_PROGRESS_ARRAY_CAPACITY (ESPNOW_OTA_PROGRESS_MAX_SIZE * ESPNOW_OTA_PROGRESS_CHUNK_NUM)
+#define ESPNOW_OTA_BITMAP_PACKET_LIMIT     (((ESPNOW_OTA_PROGRESS_ARRAY_CAPACITY) - 1) * 8)
+
+/**< packet_num is a 16-bit wire field; the configured firmware must not need more packets */
+_Static_assert(ESPNOW_OTA_PACKET_MAX_NUM <= 65535,
+               "CONFIG_ESPNOW_OTA_FIRMWARE_SIZE_MAX too large: OTA packet_num (uint16_t) would overflow");
+/**< The blob stored under ESPNOW_OTA_STORE_CONFIG_KEY, its layout is shared with the former versions.
+     The bitmap follows status, so the packet parameters are stored under their own key. */
+typedef struct {
+    esp_ota_handle_t handle;      /**< OTA handle */
+    const esp_partition_t *partition; /**< Pointer to partition structure obtained using
+                                           esp_partition_find_first or esp_partition_get */
+    uint32_t start_time;         /**< Start time of the upgrade */
+    espnow_ota_status_t status;  /**< Upgrade status */
+} ota_config_t;
+
+/**< Stored under ESPNOW_OTA_STORE_PACKET_KEY, a session of the former versions has none and uses the legacy packets */
+typedef struct {
+    uint16_t packet_size;        /**< Firmware length of every packet but the last one */
+    uint8_t flags;               /**< Capabilities the upgrade uses, ESPNOW_OTA_UPGRADE_FLAGS */
+} ota_packet_config_t;
+
+static const char *TAG = "espnow_ota_responder";
+static ota_config_t *g_ota_config = NULL;
+static ota_packet_config_t g_ota_packet = { 0 };
+static bool g_ota_finished_flag        = false;
+static espnow_frame_head_t g_frame_config = { .security = CONFIG_ESPNOW_OTA_SECURITY,
+                                              .retransmit_count = CONFIG_ESPNOW_OTA_RETRANSMISSION_TIMES};
+static espnow_ota_config_t *g_espnow_ota_config = NULL;
+static uint32_t g_ota_flash_writes     = 0;
+static espnow_ota_relay_t g_ota_relay  = { 0 }; /**< Relay asked by the initiator of the upgrade */
+
+static esp_err_t validate_image_header(const esp_partition_t *update)
+{
+    esp_app_desc_t new_app_info;
+    esp_app_desc_t running_app_info;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+
+    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK) {
+        ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
+    }
+
+    if (esp_ota_get_partition_description(update, &new_app_info) == ESP_OK) {
+        ESP_LOGI(TAG, "Running firmware version: %s", new_app_info.version);
+    }
+
+    if (!g_espnow_ota_config->skip_version_check
+            && !memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version))) {
+        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_BOOTLOADER_APP_ANTI_ROLLBACK
+    /**
+     * Secure version check from firmware image header prevents subsequent download and flash write of
+     * entire firmware image. However this is optional because it is also taken care in API
+     * esp_https_ota_finish at the end of OTA update procedure.
+     */
+    const uint32_t hw_sec_version = esp_efuse_read_secure_version();
+
+    if (new_app_info.secure_version < hw_sec_version) {
+        ESP_LOGW(TAG, "New firmware security version is less than eFuse programmed, %d < %d", new_app_info.secure_version, hw_sec_version);
+        return ESP_FAIL;
+    }
+
+#endif
+
+    return ESP_OK;
+}
+
+/**< The running firmware is hashed once, the info reply is sent from the timer service task */
+static uint8_t g_running_sha_256[ESPNOW_OTA_HASH_LEN] = { 0 };
+static bool g_running_sha_256_set = false;
+
+/**
+ * @brief Send the info reply, wait_ticks is bounded when it is sent from the timer service task
+ */
+static esp_err_t espnow_ota_info(const uint8_t *src_addr, TickType_t wait_ticks)
+{
+    esp_err_t ret = ESP_OK;
+    /**< Remove useless data, sha256 of elf file (32 Byte) +  reserv2 (20 Byte)*/
+    size_t size = ESPNOW_OTA_INFO_SIZE + sizeof(espnow_ota_info_ext_t);
+    espnow_ota_info_t *info = ESP_MALLOC(sizeof(espnow_ota_info_t));
+    espnow_ota_info_ext_t info_ext = {
+        .packet_size = ESPNOW_OTA_PACKET_V2_MAX_SIZE,
+        .flags       = (ESPNOW_OTA_FEC_ENABLE ? ESPNOW_OTA_CAP_FEC : 0)
+                       | (ESPNOW_OTA_PACKET_V2_MAX_SIZE > ESPNOW_OTA_PACKET_MAX_SIZE ? ESPNOW_OTA_UPGRADE_FLAGS | ESPNOW_OTA_CAP_HASH : 0),
+    };
+
+    info->type = ESPNOW_OTA_TYPE_INFO;
+
+    /**< The initiator picks the patch by the running firmware */
+    if (!g_running_sha_256_set) {
+        g_running_sha_256_set = esp_partition_get_sha256(esp_ota_get_running_partition(), g_running_sha_256) == ESP_OK;
+    }
+
+    if (g_running_sha_256_set) {
+        memcpy(info_ext.running_sha_256, g_running_sha_256, ESPNOW_OTA_HASH_LEN);
+    }
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    memcpy(&info->app_desc, esp_app_get_description(), sizeof(esp_app_desc_t));
+#else
+    memcpy(&info->app_desc, esp_ota_get_app_description(), sizeof(esp_app_desc_t));
+#endif
+
+    /**< The capabilities follow the part of the description sent */
+    memcpy((uint8_t *)info + ESPNOW_OTA_INFO_SIZE, &info_ext, sizeof(espnow_ota_info_ext_t));
+
+    ret = espnow_send(ESPNOW_DATA_TYPE_OTA_STATUS, src_addr, info, size, &g_frame_config, wait_ticks);
+
+    if (ret != ESP_OK) {
+        ESP_FREE(info);
+        ESP_LOGW(TAG, "<%s> espnow_write", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGD(TAG, "Application information:");
+    ESP_LOGD(TAG, "Project name:     %s", info->app_desc.project_name);
+    ESP_LOGD(TAG, "App version:      %s", info->app_desc.version);
+    ESP_LOGD(TAG, "Secure version:   %d", info->app_desc.secure_version);
+    ESP_LOGD(TAG, "Compile time:     %s %s", info->app_desc.date, info->app_desc.time);
+    ESP_LOGD(TAG, "ESP-IDF:          %s", info->app_desc.idf_ver);
+
+    ESP_FREE(info);
+
+    return ESP_OK;
+}
+
+static TimerHandle_t g_info_timer   = NULL;
+static espnow_addr_t g_info_addr    = { 0 }; /**< Initiator of the scan waiting for the info reply */
+static portMUX_TYPE g_info_lock     = portMUX_INITIALIZER_UNLOCKED;
+
+static void espnow_ota_info_timer_cb(TimerHandle_t timer)
+{
+    espnow_addr_t dest_addr = { 0 };
+
+    portENTER_CRITICAL(&g_info_lock);
+    memcpy(dest_addr, g_info_addr, ESPNOW_ADDR_LEN);
+    portEXIT_CRITICAL(&g_info_lock);
+
+    esp_err_t ret = espnow_ota_info(dest_addr, pdMS_TO_TICKS(ESPNOW_OTA_REPLY_SEND_TIMEOUT_MS));
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "<%s> Send the info reply", esp_err_to_name(ret));
+    }
+}
+
+/**
+ * @brief Reply to the scan at a random time in the window of the request, only when the responder
+ *        is in the part asked and not in the filter of the responders the initiator heard
+ */
+static esp_err_t espnow_ota_scan_reply(const uint8_t *src_addr, const void *data, size_t size)
+{
+    const espnow_ota_scan_t *request = (espnow_ota_scan_t *)data;
+    espnow_addr_t self_addr = { 0 };
+
+    /**< Older initiators only send the type */
+    if (size < sizeof(espnow_ota_scan_t) || !request->reply_window) {
+        return espnow_ota_info(src_addr, portMAX_DELAY);
+    }
+
+    esp_wifi_get_mac(WIFI_IF_STA, self_addr);
+
+    if (request->part_num && espnow_ota_mac_hash(self_addr, 0) % request->part_num != request->part) {
+        return ESP_OK;
+    }
+
+    if (espnow_ota_filter_test(request->filter, size - sizeof(espnow_ota_scan_t), request->hash_num,
+                               request->seed, self_addr)) {
+        ESP_LOGD(TAG, "Scan, the initiator heard the responder");
+        return ESP_OK;
+    }
+
+    if (!g_info_timer) {
+        g_info_timer = xTimerCreate("espnow_ota_info", 1, pdFALSE, NULL, espnow_ota_info_timer_cb);
+        ESP_ERROR_RETURN(!g_info_timer, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> g_info_timer");
+    }
+
+    /**< A later request replaces the reply still waiting */
+    portENTER_CRITICAL(&g_info_lock);
+    memcpy(g_info_addr, src_addr, ESPNOW_ADDR_LEN);
+    portEXIT_CRITICAL(&g_info_lock);
+
+    TickType_t delay = pdMS_TO_TICKS(esp_random() % request->reply_window);
+    xTimerChangePeriod(g_info_timer, delay ? delay : 1, portMAX_DELAY);
+
+    return ESP_OK;
+}
+
+#if ESPNOW_OTA_FEC_ENABLE
+/**
+ * @brief Length of the packet seq, only the last one may be shorter than the packet size
+ */
+static size_t espnow_ota_packet_len(uint16_t seq)
+{
+    uint32_t offset = (uint32_t)seq * g_ota_packet.packet_size;
+    return MIN(g_ota_packet.packet_size, g_ota_config->status.total_size - offset);
+}
+
+/**
+ * @brief Repair packets which can not be decoded yet. Rows of a block are kept reduced:
+ *        every row contains its pivot packet and no other row of the block does,
+ *        a row only holding its pivot is the lost packet itself.
+ */
+typedef struct {
+    bool used;
+    uint8_t pivot;      /**< Bit of the packet this row solves */
+    uint16_t seq;       /**< Sequence of the first packet of the block */
+    uint32_t mask;      /**< Lost packets still in the XOR */
+    uint8_t *data;      /**< XOR of the packets in mask */
+} espnow_ota_fec_row_t;
+
+static espnow_ota_fec_row_t g_fec_rows[CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM];
+
+static void espnow_ota_fec_xor(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        dst[i] ^= src[i];
+    }
+}
+
+static void espnow_ota_fec_reset(void)
+{
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM; ++i) {
+        ESP_FREE(g_fec_rows[i].data);
+        memset(g_fec_rows + i, 0, sizeof(espnow_ota_fec_row_t));
+    }
+}
+
+/**
+ * @brief Reduce a row against the rows of its block and keep it, the other rows lose its pivot
+ */
+static void espnow_ota_fec_insert(uint16_t seq, uint32_t mask, uint8_t *data)
+{
+    espnow_ota_fec_row_t *free_row = NULL;
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM; ++i) {
+        espnow_ota_fec_row_t *row = g_fec_rows + i;
+
+        if (!row->used) {
+            free_row = free_row ? free_row : row;
+        } else if (row->seq == seq && (mask & BIT(row->pivot))) {
+            mask ^= row->mask;
+            espnow_ota_fec_xor(data, row->data, g_ota_packet.packet_size);
+        }
+    }
+
+    /**< Nothing new in it */
+    if (!mask) {
+        return;
+    }
+
+    /**< Make room with a row of another block, it is unlikely to be solved in this round */
+    for (int i = 0; !free_row && i < CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM; ++i) {
+        if (g_fec_rows[i].seq != seq) {
+            free_row = g_fec_rows + i;
+            free_row->used = false;
+        }
+    }
+
+    if (!free_row) {
+        ESP_LOGD(TAG, "No room for the repair packet, seq: %d, mask: 0x%08" PRIx32, seq, mask);
+        return;
+    }
+
+    uint8_t pivot = __builtin_ctz(mask);
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM; ++i) {
+        espnow_ota_fec_row_t *row = g_fec_rows + i;
+
+        if (row->used && row->seq == seq && (row->mask & BIT(pivot))) {
+            row->mask ^= mask;
+            espnow_ota_fec_xor(row->data, data, g_ota_packet.packet_size);
+        }
+    }
+
+    if (!free_row->data) {
+        free_row->data = ESP_MALLOC(g_ota_packet.packet_size);
+
+        if (!free_row->data) {
+            ESP_LOGE(TAG, "<ESP_ERR_NO_MEM> fec row");
+            return;
+        }
+    }
+
+    if (free_row->data != data) {
+        memcpy(free_row->data, data, g_ota_packet.packet_size);
+    }
+
+    free_row->used  = true;
+    free_row->seq   = seq;
+    free_row->mask  = mask;
+    free_row->pivot = pivot;
+}
+
+/**
+ * @brief Remove a packet which has been received from the rows of its block
+ */
+static void espnow_ota_fec_source(uint16_t seq, const uint8_t *data, size_t size)
+{
+    uint16_t block_seq = seq - seq % ESPNOW_OTA_FEC_BLOCK_SIZE;
+    uint32_t bit = BIT(seq % ESPNOW_OTA_FEC_BLOCK_SIZE);
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM; ++i) {
+        espnow_ota_fec_row_t *row = g_fec_rows + i;
+
+        if (!row->used || row->seq != block_seq || !(row->mask & bit)) {
+            continue;
+        }
+
+        row->mask ^= bit;
+        espnow_ota_fec_xor(row->data, data, size);
+
+        /**< The row lost its pivot, reduce it again */
+        if (row->pivot == seq % ESPNOW_OTA_FEC_BLOCK_SIZE) {
+            row->used = false;
+            espnow_ota_fec_insert(row->seq, row->mask, row->data);
+        }
+    }
+}
+#endif /**< ESPNOW_OTA_FEC_ENABLE */
+
+#ifdef CONFIG_ESPNOW_OTA_JOURNAL
+/**
+ * @brief Head of a half of the journal, followed by the progress bitmap at the time it was written,
+ *        then by the records of the packets written to flash since then
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;        /**< The half of the highest generation is the latest */
+    uint8_t sha_256[ESPNOW_OTA_HASH_LEN];
+    uint32_t total_size;
+    uint16_t packet_num;
+    uint16_t packet_size;
+    uint8_t flags;
+    uint8_t reserved[3];
+    uint32_t written_size;      /**< Bytes written at the time of the bitmap */
+    uint32_t bitmap_crc;
+    uint32_t crc;               /**< CRC of the fields above */
+} espnow_ota_journal_head_t;
+
+/**
+ * @brief A packet written to flash, the check fields tell a torn or erased record
+ */
+typedef struct {
+    uint16_t seq;
+    uint16_t size;
+    uint16_t seq_check;         /**< ~seq */
+    uint16_t size_check;        /**< ~size */
+} espnow_ota_journal_record_t;
+
+typedef struct {
+    bool enable;
+    uint32_t addr;              /**< Offset of the journal in the update partition */
+    uint8_t half;               /**< Half written now */
+    uint32_t generation;
+    uint32_t offset;            /**< Offset of the next record in the half */
+    uint8_t record_num;
+    espnow_ota_journal_record_t records[ESPNOW_OTA_JOURNAL_RECORD_NUM]; /**< Records to append */
+} espnow_ota_journal_t;
+
+static espnow_ota_journal_t g_ota_journal = { 0 };
+
+/**< The journal is not secret, it is kept out of flash encryption, which does not allow to append to it */
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+#define espnow_ota_journal_read  esp_partition_read_raw
+#define espnow_ota_journal_write esp_partition_write_raw
+#else
+#define espnow_ota_journal_read  esp_partition_read
+#define espnow_ota_journal_write esp_partition_write
+#endif
+
+static size_t espnow_ota_journal_records_offset(uint16_t packet_num)
+{
+    return sizeof(espnow_ota_journal_head_t) + ((packet_num / 8 + 1 + 7) & ~7);
+}
+
+/**
+ * @brief Find room for the journal after the firmware
+ */
+static bool espnow_ota_journal_fits(void)
+{
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 0, 0)
+    if (esp_flash_encryption_enabled()) {
+        return false;
+    }
+#endif
+
+    const esp_partition_t *partition = g_ota_config->partition;
+    uint32_t image_end = (g_ota_config->status.total_size + ESPNOW_OTA_SECTOR_SIZE - 1) & ~(ESPNOW_OTA_SECTOR_SIZE - 1);
+
+    if (!partition || partition->size < 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE
+            || image_end > partition->size - 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE) {
+        return false;
+    }
+
+    g_ota_journal.addr = partition->size - 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE;
+
+    return true;
+}
+
+/**
+ * @brief Write the progress to the other half, the head is written last so the former half
+ *        is used until this one is complete
+ */
+static esp_err_t espnow_ota_journal_compact(void)
+{
+    esp_err_t ret   = ESP_OK;
+    uint8_t half    = !g_ota_journal.half;
+    uint32_t addr   = g_ota_journal.addr + half * ESPNOW_OTA_JOURNAL_HALF_SIZE;
+    size_t map_size = g_ota_config->status.packet_num / 8 + 1;
+    espnow_ota_journal_head_t head = {
+        .magic        = ESPNOW_OTA_JOURNAL_MAGIC,
+        .generation   = g_ota_journal.generation + 1,
+        .total_size   = g_ota_config->status.total_size,
+        .packet_num   = g_ota_config->status.packet_num,
+        .packet_size  = g_ota_packet.packet_size,
+        .flags        = g_ota_packet.flags,
+        .written_size = g_ota_config->status.written_size,
+        .bitmap_crc   = esp_crc32_le(0, (uint8_t *)g_ota_config->status.progress_array, map_size),
+    };
+    memcpy(head.sha_256, g_ota_config->status.sha_256, ESPNOW_OTA_HASH_LEN);
+    head.crc = esp_crc32_le(0, (uint8_t *)&head, offsetof(espnow_ota_journal_head_t, crc));
+
+    ret = esp_partition_erase_range(g_ota_config->partition, addr, ESPNOW_OTA_JOURNAL_HALF_SIZE);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "esp_partition_erase_range %s", esp_err_to_name(ret));
+
+    ret = espnow_ota_journal_write(g_ota_config->partition, addr + sizeof(espnow_ota_journal_head_t),
+                                   g_ota_config->status.progress_array, map_size);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "Write the journal bitmap %s", esp_err_to_name(ret));
+
+    ret = espnow_ota_journal_write(g_ota_config->partition, addr, &head, sizeof(espnow_ota_journal_head_t));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "Write the journal head %s", esp_err_to_name(ret));
+
+    ESP_LOGD(TAG, "Compact the journal, half: %d, generation: %" PRIu32 ", written_size: %" PRIu32,
+             half, head.generation, head.written_size);
+
+    g_ota_journal.half       = half;
+    g_ota_journal.generation = head.generation;
+    g_ota_journal.offset     = espnow_ota_journal_records_offset(head.packet_num);
+    g_ota_journal.record_num = 0;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief The packets dropped are still in the records, write the progress to the other half without them
+ */
+static void espnow_ota_journal_rewrite(void)
+{
+    if (g_ota_journal.enable && espnow_ota_journal_compact() != ESP_OK) {
+        ESP_LOGW(TAG, "Journal the OTA progress");
+        g_ota_journal.enable = false;
+    }
+}
+
+/**
+ * @brief Start the journal of a new upgrade, the NVS is used when there is no room for it
+ */
+static esp_err_t espnow_ota_journal_start(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    g_ota_journal.enable = false;
+
+    if (!espnow_ota_journal_fits()) {
+        const esp_partition_t *partition = g_ota_config->partition;
+        uint32_t image_end = (g_ota_config->status.total_size + ESPNOW_OTA_SECTOR_SIZE - 1) & ~(ESPNOW_OTA_SECTOR_SIZE - 1);
+
+        /**< A former journal left after the firmware must not be restored for this upgrade */
+        if (partition && partition->size >= 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE && image_end < partition->size) {
+            esp_partition_erase_range(partition, MAX(image_end, partition->size - 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE),
+                                      partition->size - MAX(image_end, partition->size - 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE));
+        }
+
+        ESP_LOGD(TAG, "No room for the OTA journal");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    /**< The half of the former upgrade must not be taken for this one */
+    ret = esp_partition_erase_range(g_ota_config->partition, g_ota_journal.addr, 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "esp_partition_erase_range %s", esp_err_to_name(ret));
+
+    g_ota_journal.half       = 1;
+    g_ota_journal.generation = 0;
+
+    ret = espnow_ota_journal_compact();
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_ota_journal_compact");
+
+    g_ota_journal.enable = true;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Append the records of the packets written to flash since the last commit
+ */
+static esp_err_t espnow_ota_journal_commit(void)
+{
+    esp_err_t ret = ESP_OK;
+    size_t size   = g_ota_journal.record_num * sizeof(espnow_ota_journal_record_t);
+
+    if (!g_ota_journal.enable || !size) {
+        return ESP_OK;
+    }
+
+    /**< The half is full, the bitmap has the records */
+    if (g_ota_journal.offset + size > ESPNOW_OTA_JOURNAL_HALF_SIZE) {
+        ret = espnow_ota_journal_compact();
+    } else {
+        ret = espnow_ota_journal_write(g_ota_config->partition,
+                                       g_ota_journal.addr + g_ota_journal.half * ESPNOW_OTA_JOURNAL_HALF_SIZE + g_ota_journal.offset,
+                                       g_ota_journal.records, size);
+        g_ota_journal.offset    += size;
+        g_ota_journal.record_num = 0;
+    }
+
+    /**< The packets not journaled are requested again after a reset */
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "<%s> Journal the OTA progress", esp_err_to_name(ret));
+        g_ota_journal.enable = false;
+    }
+
+    return ret;
+}
+
+static void espnow_ota_journal_append(uint16_t seq, uint16_t size)
+{
+    if (!g_ota_journal.enable) {
+        return;
+    }
+
+    espnow_ota_journal_record_t *record = g_ota_journal.records + g_ota_journal.record_num++;
+    record->seq        = seq;
+    record->size       = size;
+    record->seq_check  = ~seq;
+    record->size_check = ~size;
+
+    if (g_ota_journal.record_num == ESPNOW_OTA_JOURNAL_RECORD_NUM) {
+        espnow_ota_journal_commit();
+    }
+}
+
+/**
+ * @brief Rebuild the upgrade status from the latest half of the journal and the records appended to it
+ */
+static esp_err_t espnow_ota_journal_restore(void)
+{
+    esp_err_t ret = ESP_OK;
+    espnow_ota_journal_head_t head[2] = { 0 };
+    espnow_ota_journal_record_t records[ESPNOW_OTA_JOURNAL_RECORD_NUM];
+    int half = -1;
+
+    ESP_ERROR_RETURN(!espnow_ota_journal_fits(), ESP_ERR_NOT_FOUND, "No room for the OTA journal");
+
+    for (int i = 0; i < 2; ++i) {
+        ret = espnow_ota_journal_read(g_ota_config->partition, g_ota_journal.addr + i * ESPNOW_OTA_JOURNAL_HALF_SIZE,
+                                      head + i, sizeof(espnow_ota_journal_head_t));
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "Read the journal head %s", esp_err_to_name(ret));
+
+        if (head[i].magic != ESPNOW_OTA_JOURNAL_MAGIC
+                || head[i].crc != esp_crc32_le(0, (uint8_t *)(head + i), offsetof(espnow_ota_journal_head_t, crc))
+                || head[i].packet_num > ESPNOW_OTA_BITMAP_PACKET_LIMIT
+                || espnow_ota_journal_records_offset(head[i].packet_num) > ESPNOW_OTA_JOURNAL_HALF_SIZE) {
+            continue;
+        }
+
+        if (half < 0 || head[i].generation > head[half].generation) {
+            half = i;
+        }
+    }
+
+    ESP_ERROR_RETURN(half < 0, ESP_ERR_NOT_FOUND, "No OTA journal");
+
+    uint32_t addr   = g_ota_journal.addr + half * ESPNOW_OTA_JOURNAL_HALF_SIZE;
+    size_t map_size = head[half].packet_num / 8 + 1;
+
+    ret = espnow_ota_journal_read(g_ota_config->partition, addr + sizeof(espnow_ota_journal_head_t),
+                                  g_ota_config->status.progress_array, map_size);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "Read the journal bitmap %s", esp_err_to_name(ret));
+    ESP_ERROR_RETURN(head[half].bitmap_crc != esp_crc32_le(0, (uint8_t *)g_ota_config->status.progress_array, map_size),
+                     ESP_ERR_INVALID_CRC, "The journal bitmap is corrupted");
+
+    g_ota_config->status.type         = ESPNOW_OTA_TYPE_STATUS;
+    g_ota_config->status.total_size   = head[half].total_size;
+    g_ota_config->status.packet_num   = head[half].packet_num;
+    g_ota_config->status.written_size = head[half].written_size;
+    g_ota_packet.packet_size          = head[half].packet_size;
+    g_ota_packet.flags                = head[half].flags;
+    memcpy(g_ota_config->status.sha_256, head[half].sha_256, ESPNOW_OTA_HASH_LEN);
+
+    /**< Replay the records up to the erased ones, torn records are skipped */
+    uint32_t offset = espnow_ota_journal_records_offset(head[half].packet_num);
+    bool erased     = false;
+
+    while (!erased && offset < ESPNOW_OTA_JOURNAL_HALF_SIZE) {
+        size_t size = MIN(sizeof(records), ESPNOW_OTA_JOURNAL_HALF_SIZE - offset);
+        ret = espnow_ota_journal_read(g_ota_config->partition, addr + offset, records, size);
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "Read the journal records %s", esp_err_to_name(ret));
+
+        for (int i = 0; i < size / sizeof(espnow_ota_journal_record_t); ++i, offset += sizeof(espnow_ota_journal_record_t)) {
+            const espnow_ota_journal_record_t *record = records + i;
+
+            if (record->seq == 0xFFFF && record->size == 0xFFFF
+                    && record->seq_check == 0xFFFF && record->size_check == 0xFFFF) {
+                erased = true;
+                break;
+            }
+
+            if (record->seq_check != (uint16_t)~record->seq || record->size_check != (uint16_t)~record->size
+                    || record->seq >= head[half].packet_num
+                    || ESPNOW_OTA_GET_BITS(g_ota_config->status.progress_array, record->seq)) {
+                continue;
+            }
+
+            ESPNOW_OTA_SET_BITS(g_ota_config->status.progress_array, record->seq);
+            g_ota_config->status.written_size += record->size;
+        }
+    }
+
+    if (g_ota_config->status.written_size > g_ota_config->status.total_size) {
+        memset(&g_ota_config->status, 0, sizeof(espnow_ota_status_t));
+        ESP_LOGW(TAG, "The OTA journal is corrupted");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    g_ota_journal.half       = half;
+    g_ota_journal.generation = head[half].generation;
+    g_ota_journal.offset     = offset;
+    g_ota_journal.record_num = 0;
+    g_ota_journal.enable     = true;
+
+    ESP_LOGI(TAG, "Restore the OTA progress from the journal, written_size: %d, total_size: %d",
+             g_ota_config->status.written_size, g_ota_config->status.total_size);
+
+    return ESP_OK;
+}
+
+static bool espnow_ota_journal_enabled(void)
+{
+    return g_ota_journal.enable;
+}
+
+static void espnow_ota_journal_erase(void)
+{
+    if (g_ota_journal.enable) {
+        esp_partition_erase_range(g_ota_config->partition, g_ota_journal.addr, 2 * ESPNOW_OTA_JOURNAL_HALF_SIZE);
+        g_ota_journal.enable = false;
+    }
+}
+#else
+static esp_err_t espnow_ota_journal_start(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t espnow_ota_journal_restore(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t espnow_ota_journal_commit(void)
+{
+    return ESP_OK;
+}
+
+static void espnow_ota_journal_append(uint16_t seq, uint16_t size)
+{
+}
+
+static void espnow_ota_journal_rewrite(void)
+{
+}
+
+static void espnow_ota_journal_erase(void)
+{
+}
+
+static bool espnow_ota_journal_enabled(void)
+{
+    return false;
+}
+#endif /**< CONFIG_ESPNOW_OTA_JOURNAL */
+
+/**
+ * @brief Hash list of the upgrade, the blocks are verified once it matches the root
+ */
+typedef struct {
+    uint8_t root[ESPNOW_OTA_HASH_LEN];
+    uint32_t total_size;
+    uint16_t block_num;
+    uint16_t received_num;      /**< Hashes received */
+    bool valid;                 /**< All the hashes are received and match the root */
+    uint8_t *received;          /**< Bitmap of the hashes received */
+    uint8_t *hashes;
+} espnow_ota_hash_list_t;
+
+static espnow_ota_hash_list_t g_ota_hash = { 0 };
+
+_Static_assert(ESPNOW_OTA_HASH_BLOCK_SIZE % ESPNOW_OTA_SECTOR_SIZE == 0, "A block is erased on its own");
+
+static void espnow_ota_hash_reset(void)
+{
+    ESP_FREE(g_ota_hash.received);
+    ESP_FREE(g_ota_hash.hashes);
+    memset(&g_ota_hash, 0, sizeof(espnow_ota_hash_list_t));
+}
+
+/**
+ * @brief Get the hash list ready for the upgrade, it is kept while the root is the same
+ */
+static void espnow_ota_hash_start(const uint8_t root[ESPNOW_OTA_HASH_LEN], uint32_t total_size, uint8_t flags)
+{
+    const uint8_t root_none[ESPNOW_OTA_HASH_LEN] = {0};
+
+    if (!memcmp(g_ota_hash.root, root, ESPNOW_OTA_HASH_LEN) && g_ota_hash.total_size == total_size) {
+        return;
+    }
+
+    espnow_ota_hash_reset();
+
+    if (flags || !memcmp(root, root_none, ESPNOW_OTA_HASH_LEN)) {
+        return;
+    }
+
+    uint16_t block_num  = (total_size + ESPNOW_OTA_HASH_BLOCK_SIZE - 1) / ESPNOW_OTA_HASH_BLOCK_SIZE;
+    g_ota_hash.hashes   = ESP_MALLOC(block_num * ESPNOW_OTA_BLOCK_HASH_LEN);
+    g_ota_hash.received = ESP_CALLOC(1, block_num / 8 + 1);
+
+    if (!g_ota_hash.hashes || !g_ota_hash.received) {
+        ESP_LOGW(TAG, "<ESP_ERR_NO_MEM> The blocks are not verified");
+        espnow_ota_hash_reset();
+        return;
+    }
+
+    memcpy(g_ota_hash.root, root, ESPNOW_OTA_HASH_LEN);
+    g_ota_hash.total_size = total_size;
+    g_ota_hash.block_num  = block_num;
+}
+
+/**
+ * @brief Check the block against its hash once all its packets are written to flash. A corrupted block
+ *        is erased and its packets are requested again, the packets across its bounds are written again
+ *        whole, over the same data in the next block.
+ */
+static esp_err_t espnow_ota_hash_verify(uint16_t block)
+{
+    esp_err_t ret       = ESP_OK;
+    uint32_t offset     = (uint32_t)block * ESPNOW_OTA_HASH_BLOCK_SIZE;
+    size_t block_size   = MIN(ESPNOW_OTA_HASH_BLOCK_SIZE, g_ota_config->status.total_size - offset);
+    uint16_t packet_size = g_ota_packet.packet_size;
+    uint16_t first      = offset / packet_size;
+    uint16_t last       = (offset + block_size - 1) / packet_size;
+    uint8_t hash[ESPNOW_OTA_BLOCK_HASH_LEN];
+
+    for (uint32_t seq = first; seq <= last; ++seq) {
+        if (!ESPNOW_OTA_GET_BITS(g_ota_config->status.progress_array, seq)) {
+            return ESP_OK;
+        }
+    }
+
+    uint8_t *data = ESP_MALLOC(block_size);
+    ESP_ERROR_RETURN(!data, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> block buffer");
+
+    ret = esp_partition_read(g_ota_config->partition, offset, data, block_size);
+
+    if (ret == ESP_OK) {
+        ret = espnow_ota_hash(data, block_size, hash, ESPNOW_OTA_BLOCK_HASH_LEN);
+    }
+
+    ESP_FREE(data);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> Hash the block %d", esp_err_to_name(ret), block);
+
+    if (!memcmp(hash, g_ota_hash.hashes + block * ESPNOW_OTA_BLOCK_HASH_LEN, ESPNOW_OTA_BLOCK_HASH_LEN)) {
+        ESP_LOGV(TAG, "Block verified, block: %d", block);
+        return ESP_OK;
+    }
+
+    ESP_LOGW(TAG, "Block corrupted, block: %d, packets: %d - %d", block, first, last);
+
+    ret = esp_partition_erase_range(g_ota_config->partition, offset, ESPNOW_OTA_HASH_BLOCK_SIZE);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "esp_partition_erase_range %s", esp_err_to_name(ret));
+
+    for (uint32_t seq = first; seq <= last; ++seq) {
+        ESPNOW_OTA_CLEAR_BITS(g_ota_config->status.progress_array, seq);
+        g_ota_config->status.written_size -= MIN(packet_size, g_ota_config->status.total_size - seq * packet_size);
+    }
+
+    espnow_ota_journal_rewrite();
+
+    return ESP_ERR_INVALID_CRC;
+}
+
+/**
+ * @brief Verify the blocks the packet written to flash completes
+ */
+static void espnow_ota_hash_check(uint16_t seq, uint16_t size)
+{
+    if (!g_ota_hash.valid || g_ota_packet.flags) {
+        return;
+    }
+
+    uint32_t offset = (uint32_t)seq * g_ota_packet.packet_size;
+
+    for (uint32_t block = offset / ESPNOW_OTA_HASH_BLOCK_SIZE;
+            block <= (offset + size - 1) / ESPNOW_OTA_HASH_BLOCK_SIZE; ++block) {
+        espnow_ota_hash_verify(block);
+    }
+}
+
+/**
+ * @brief Take the hashes of the packet, the blocks written before the list matches the root are verified then
+ */
+static esp_err_t espnow_ota_hash_receive(const espnow_ota_hash_t *packet, size_t size)
+{
+    if (!g_ota_config || !g_ota_hash.hashes || g_ota_hash.valid || g_ota_finished_flag
+            || size < sizeof(espnow_ota_hash_t)
+            || size < sizeof(espnow_ota_hash_t) + packet->num * ESPNOW_OTA_BLOCK_HASH_LEN
+            || packet->index >= g_ota_hash.block_num || packet->num > g_ota_hash.block_num - packet->index) {
+        ESP_LOGD(TAG, "Hash packet not used, size: %d", size);
+        return ESP_OK;
+    }
+
+    esp_err_t ret = ESP_OK;
+    uint8_t root[ESPNOW_OTA_HASH_LEN];
+
+    memcpy(g_ota_hash.hashes + packet->index * ESPNOW_OTA_BLOCK_HASH_LEN, packet->hashes,
+           packet->num * ESPNOW_OTA_BLOCK_HASH_LEN);
+
+    for (uint32_t i = packet->index; i < packet->index + packet->num; ++i) {
+        if (!ESPNOW_OTA_GET_BITS(g_ota_hash.received, i)) {
+            ESPNOW_OTA_SET_BITS(g_ota_hash.received, i);
+            g_ota_hash.received_num++;
+        }
+    }
+
+    if (g_ota_hash.received_num < g_ota_hash.block_num) {
+        return ESP_OK;
+    }
+
+    ret = espnow_ota_hash(g_ota_hash.hashes, g_ota_hash.block_num * ESPNOW_OTA_BLOCK_HASH_LEN, root, ESPNOW_OTA_HASH_LEN);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> espnow_ota_hash", esp_err_to_name(ret));
+
+    /**< The list is sent again in the next round */
+    if (memcmp(root, g_ota_hash.root, ESPNOW_OTA_HASH_LEN)) {
+        ESP_LOGW(TAG, "The hash list does not match the root");
+        memset(g_ota_hash.received, 0, g_ota_hash.block_num / 8 + 1);
+        g_ota_hash.received_num = 0;
+        return ESP_OK;
+    }
+
+    g_ota_hash.valid = true;
+    ESP_LOGI(TAG, "Hash list verified, block_num: %d", g_ota_hash.block_num);
+
+    for (uint16_t block = 0; block < g_ota_hash.block_num && !g_ota_packet.flags; ++block) {
+        espnow_ota_hash_verify(block);
+    }
+
+    return ESP_OK;
+}
+
+#if CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM > 0
+/**
+ * @brief Part of a packet staged in a sector buffer, a packet spans two sectors at most
+ *        when it is not larger than a sector
+ */
+typedef struct {
+    uint16_t seq;       /**< Packet the piece belongs to */
+    uint16_t offset;    /**< Offset of the piece in the sector */
+    uint16_t len;       /**< Length of the piece */
+    uint16_t size;      /**< Length of the whole packet */
+} espnow_ota_cache_piece_t;
+
+/**
+ * @brief Sector buffer, written to flash at once when every byte of the sector is staged
+ */
+typedef struct {
+    bool used;
+    uint32_t addr;      /**< Offset of the sector in the update partition */
+    uint32_t filled;    /**< Bytes staged in data */
+    uint8_t piece_num;
+    espnow_ota_cache_piece_t pieces[ESPNOW_OTA_CACHE_PIECE_NUM];
+    uint8_t *data;
+} espnow_ota_cache_t;
+
+static espnow_ota_cache_t g_ota_cache[CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM];
+static uint32_t g_ota_cache_staged = 0; /**< Bytes of the packets staged, not written to flash yet */
+
+static void espnow_ota_cache_reset(void)
+{
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM; ++i) {
+        ESP_FREE(g_ota_cache[i].data);
+        memset(g_ota_cache + i, 0, sizeof(espnow_ota_cache_t));
+    }
+
+    g_ota_cache_staged = 0;
+}
+
+static bool espnow_ota_cache_pending(uint16_t seq)
+{
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM; ++i) {
+        for (int j = 0; g_ota_cache[i].used && j < g_ota_cache[i].piece_num; ++j) {
+            if (g_ota_cache[i].pieces[j].seq == seq) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Mark the packet received once none of its pieces is staged any more
+ */
+static void espnow_ota_cache_confirm(uint16_t seq, uint16_t size)
+{
+    if (espnow_ota_cache_pending(seq)) {
+        return;
+    }
+
+    ESPNOW_OTA_SET_BITS(g_ota_config->status.progress_array, seq);
+    g_ota_config->status.written_size += size;
+    g_ota_cache_staged -= size;
+    espnow_ota_journal_append(seq, size);
+    espnow_ota_hash_check(seq, size);
+}
+
+/**
+ * @brief Write the sector buffer to flash, with one aligned write when it is full.
+ *        The pieces of writing_seq are not confirmed, the rest of the packet is still to be staged.
+ */
+static esp_err_t espnow_ota_cache_flush(espnow_ota_cache_t *cache, int32_t writing_seq)
+{
+    esp_err_t ret     = ESP_OK;
+    size_t sector_len = MIN(ESPNOW_OTA_SECTOR_SIZE, g_ota_config->status.total_size - cache->addr);
+    uint8_t piece_num = cache->piece_num;
+    espnow_ota_cache_piece_t pieces[ESPNOW_OTA_CACHE_PIECE_NUM];
+
+    memcpy(pieces, cache->pieces, piece_num * sizeof(espnow_ota_cache_piece_t));
+
+    if (cache->filled == sector_len) {
+        ret = esp_partition_write(g_ota_config->partition, cache->addr, cache->data, sector_len);
+        g_ota_flash_writes++;
+    } else {
+        /**< Sort the pieces by offset, and write the adjacent ones at once */
+        for (int i = 1; i < piece_num; ++i) {
+            espnow_ota_cache_piece_t piece = pieces[i];
+            int j = i;
+
+            for (; j > 0 && pieces[j - 1].offset > piece.offset; --j) {
+                pieces[j] = pieces[j - 1];
+            }
+
+            pieces[j] = piece;
+        }
+
+        for (int i = 0, j = 0; i < piece_num && ret == ESP_OK; i = j) {
+            uint32_t end = pieces[i].offset + pieces[i].len;
+
+            for (j = i + 1; j < piece_num && pieces[j].offset == end; ++j) {
+                end += pieces[j].len;
+            }
+
+            ret = esp_partition_write(g_ota_config->partition, cache->addr + pieces[i].offset,
+                                      cache->data + pieces[i].offset, end - pieces[i].offset);
+            g_ota_flash_writes++;
+        }
+    }
+
+    /**< The caller drops the packets staged, they are requested again */
+    ESP_ERROR_RETURN(ret != ESP_OK, ESP_ERR_ESPNOW_OTA_FIRMWARE_DOWNLOAD,
+                     "<%s> esp_partition_write, addr: 0x%" PRIx32, esp_err_to_name(ret), cache->addr);
+
+    ESP_LOGD(TAG, "Flush sector, addr: 0x%" PRIx32 ", filled: %" PRIu32 ", pieces: %d", cache->addr, cache->filled, piece_num);
+
+    cache->used      = false;
+    cache->piece_num = 0;
+
+    for (int i = 0; i < piece_num; ++i) {
+        if (pieces[i].seq != writing_seq) {
+            espnow_ota_cache_confirm(pieces[i].seq, pieces[i].size);
+        }
+    }
+
+    /**< A few bytes for the packets of the sector */
+    espnow_ota_journal_commit();
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_ota_cache_flush_all(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM && ret == ESP_OK; ++i) {
+        if (g_ota_cache[i].used) {
+            ret = espnow_ota_cache_flush(g_ota_cache + i, -1);
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Get the buffer of the sector, the lowest sector is written to flash to make room,
+ *        the stream has moved past it
+ */
+static esp_err_t espnow_ota_cache_get(uint32_t addr, uint16_t seq, espnow_ota_cache_t **cache)
+{
+    esp_err_t ret = ESP_OK;
+    espnow_ota_cache_t *free_cache = NULL;
+    espnow_ota_cache_t *lowest = NULL;
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM; ++i) {
+        if (!g_ota_cache[i].used) {
+            free_cache = free_cache ? free_cache : g_ota_cache + i;
+        } else if (g_ota_cache[i].addr == addr) {
+            *cache = g_ota_cache + i;
+            return ESP_OK;
+        } else if (!lowest || g_ota_cache[i].addr < lowest->addr) {
+            lowest = g_ota_cache + i;
+        }
+    }
+
+    if (!free_cache) {
+        ret = espnow_ota_cache_flush(lowest, seq);
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_ota_cache_flush");
+        free_cache = lowest;
+    }
+
+    if (!free_cache->data) {
+        free_cache->data = ESP_MALLOC(ESPNOW_OTA_SECTOR_SIZE);
+        ESP_ERROR_RETURN(!free_cache->data, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> sector buffer");
+    }
+
+    free_cache->used      = true;
+    free_cache->addr      = addr;
+    free_cache->filled    = 0;
+    free_cache->piece_num = 0;
+    *cache = free_cache;
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Stage the packet into the sector buffers, the full sectors are written to flash.
+ *        The buffers are to be reset on failure, they may hold a part of the packet.
+ */
+static esp_err_t espnow_ota_cache_write(uint16_t seq, uint32_t offset, const uint8_t *data, size_t size)
+{
+    esp_err_t ret = ESP_OK;
+    espnow_ota_cache_t *cache = NULL;
+
+    g_ota_cache_staged += size;
+
+    for (size_t pos = 0; pos < size;) {
+        uint32_t addr = (offset + pos) - (offset + pos) % ESPNOW_OTA_SECTOR_SIZE;
+        size_t len    = MIN(size - pos, addr + ESPNOW_OTA_SECTOR_SIZE - (offset + pos));
+
+        ret = espnow_ota_cache_get(addr, seq, &cache);
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_ota_cache_get");
+
+        /**< Too many small packets in the sector, write them as they are */
+        if (cache->piece_num == ESPNOW_OTA_CACHE_PIECE_NUM) {
+            ret = espnow_ota_cache_flush(cache, seq);
+            ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_ota_cache_flush");
+            continue;
+        }
+
+        espnow_ota_cache_piece_t *piece = cache->pieces + cache->piece_num++;
+        piece->seq    = seq;
+        piece->offset = offset + pos - addr;
+        piece->len    = len;
+        piece->size   = size;
+
+        memcpy(cache->data + piece->offset, data + pos, len);
+        cache->filled += len;
+        pos += len;
+    }
+
+    /**< All the pieces of the packet may have been written while making room */
+    espnow_ota_cache_confirm(seq, size);
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM && ret == ESP_OK; ++i) {
+        cache = g_ota_cache + i;
+
+        if (cache->used && cache->filled == MIN(ESPNOW_OTA_SECTOR_SIZE, g_ota_config->status.total_size - cache->addr)) {
+            ret = espnow_ota_cache_flush(cache, -1);
+        }
+    }
+
+    /**< Nothing more to wait for */
+    if (ret == ESP_OK && g_ota_config->status.written_size + g_ota_cache_staged == g_ota_config->status.total_size) {
+        ret = espnow_ota_cache_flush_all();
+    }
+
+    return ret;
+}
+#endif /**< CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM > 0 */
+
+/**
+ * @brief Whether the packet has been received, it may be staged and not written to flash yet
+ */
+static bool espnow_ota_received(uint16_t seq)
+{
+#if CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM > 0
+    if (espnow_ota_cache_pending(seq)) {
+        return true;
+    }
+#endif
+
+    return ESPNOW_OTA_GET_BITS(g_ota_config->status.progress_array, seq);
+}
+
+#if ESPNOW_OTA_FEC_ENABLE
+/**
+ * @brief Read the firmware received, from flash and the sector buffers
+ */
+static esp_err_t espnow_ota_read(uint32_t offset, uint8_t *data, size_t size)
+{
+    esp_err_t ret = esp_partition_read(g_ota_config->partition, offset, data, size);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "esp_partition_read %s", esp_err_to_name(ret));
+
+#if CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM > 0
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM; ++i) {
+        const espnow_ota_cache_t *cache = g_ota_cache + i;
+
+        for (int j = 0; cache->used && j < cache->piece_num; ++j) {
+            uint32_t start = MAX(offset, cache->addr + cache->pieces[j].offset);
+            uint32_t end   = MIN(offset + size, cache->addr + cache->pieces[j].offset + cache->pieces[j].len);
+
+            if (start < end) {
+                memcpy(data + start - offset, cache->data + start - cache->addr, end - start);
+            }
+        }
+    }
+#endif
+
+    return ESP_OK;
+}
+#endif
+
+static void espnow_ota_write_reset(void)
+{
+#if CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM > 0
+    espnow_ota_cache_reset();
+#endif
+#if ESPNOW_OTA_FEC_ENABLE
+    espnow_ota_fec_reset();
+#endif
+}
+
+/**
+ * @brief Packets of the round reported to the initiator, which paces the packets by them.
+ *        The repeated status requests of a round get the same report, the next packet starts a new round.
+ */
+static espnow_ota_feedback_t g_ota_feedback = { 0 };
+static uint32_t g_ota_drop_base             = 0;
+static bool g_ota_feedback_reported         = false;
+
+static void espnow_ota_feedback_count(void)
+{
+    if (g_ota_feedback_reported) {
+        g_ota_feedback_reported = false;
+        g_ota_feedback.received = 0;
+    }
+
+    if (g_ota_feedback.received < UINT16_MAX) {
+        g_ota_feedback.received++;
+    }
+}
+
+static espnow_ota_feedback_t espnow_ota_feedback_report(void)
+{
+    if (!g_ota_feedback_reported) {
+        uint32_t drop_num = espnow_get_recv_drop_num();
+
+        g_ota_feedback.dropped  = MIN(drop_num - g_ota_drop_base, UINT16_MAX);
+        g_ota_drop_base         = drop_num;
+        g_ota_feedback_reported = true;
+    }
+
+    return g_ota_feedback;
+}
+
+/**
+ * @brief NACK reply waiting for its time slot
+ */
+typedef struct {
+    espnow_addr_t dest_addr;
+    size_t size;
+    espnow_ota_nack_t *nack;
+} espnow_ota_nack_reply_t;
+
+static TimerHandle_t g_nack_timer         = NULL;
+static espnow_ota_nack_reply_t g_nack_reply = { 0 };
+static portMUX_TYPE g_nack_lock           = portMUX_INITIALIZER_UNLOCKED;
+
+static void espnow_ota_nack_timer_cb(TimerHandle_t timer)
+{
+    espnow_ota_nack_reply_t reply = { 0 };
+    espnow_frame_head_t frame_head = g_frame_config;
+
+    portENTER_CRITICAL(&g_nack_lock);
+    reply = g_nack_reply;
+    g_nack_reply.nack = NULL;
+    portEXIT_CRITICAL(&g_nack_lock);
+
+    if (!reply.nack) {
+        return;
+    }
+
+    /**< Broadcast with the destination in the header, the initiator is not a peer any more */
+    frame_head.broadcast = true;
+
+    esp_err_t ret = espnow_send(ESPNOW_DATA_TYPE_OTA_STATUS, reply.dest_addr, reply.nack, reply.size,
+                                &frame_head, pdMS_TO_TICKS(ESPNOW_OTA_REPLY_SEND_TIMEOUT_MS));
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "<%s> Send the NACK reply", esp_err_to_name(ret));
+    }
+
+    ESP_LOGD(TAG, "NACK reply, written_size: %d, range_num: %d", reply.nack->status.written_size, reply.nack->range_num);
+    ESP_FREE(reply.nack);
+}
+
+/**
+ * @brief List the packets not written in as many ranges as fit in a frame the initiator receives,
+ *        and send it at a random time in the window so the responders do not reply at once
+ */
+static esp_err_t espnow_ota_nack_reply(const espnow_addr_t src_addr, uint16_t reply_window)
+{
+    /**< The initiator sends packets of packet_size, it receives frames as large */
+    size_t range_max = (MIN(ESPNOW_DATA_LEN, sizeof(espnow_ota_packet_v2_t) + g_ota_packet.packet_size)
+                        - sizeof(espnow_ota_nack_t) - sizeof(espnow_ota_feedback_t)) / sizeof(espnow_ota_range_t);
+    espnow_ota_nack_t *nack = ESP_MALLOC(sizeof(espnow_ota_nack_t) + range_max * sizeof(espnow_ota_range_t)
+                                         + sizeof(espnow_ota_feedback_t));
+    ESP_ERROR_RETURN(!nack, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> nack");
+
+    memcpy(&nack->status, &g_ota_config->status, sizeof(espnow_ota_status_t));
+    nack->status.type = ESPNOW_OTA_TYPE_NACK;
+
+    const uint8_t *progress = (uint8_t *)g_ota_config->status.progress_array;
+    bool overflow = true;
+
+    /**< Merge the ranges closer than gap until they fit, the packets received between them are sent again */
+    for (uint32_t gap = 0; overflow; gap = gap ? gap * 2 : 1) {
+        overflow = false;
+        nack->range_num = 0;
+
+        for (uint32_t seq = 0; seq < g_ota_config->status.packet_num; ++seq) {
+            if (seq % 8 == 0 && progress[seq / 8] == 0xFF) {
+                seq += 7;
+                continue;
+            }
+
+            if (ESPNOW_OTA_GET_BITS(g_ota_config->status.progress_array, seq)) {
+                continue;
+            }
+
+            espnow_ota_range_t *last = nack->ranges + MAX(nack->range_num, 1) - 1;
+
+            if (nack->range_num && seq - (last->start + last->num) <= gap) {
+                last->num = seq - last->start + 1;
+            } else if (nack->range_num == range_max) {
+                overflow = true;
+                break;
+            } else {
+                nack->ranges[nack->range_num].start = seq;
+                nack->ranges[nack->range_num].num   = 1;
+                nack->range_num++;
+            }
+        }
+    }
+
+    if (!g_nack_timer) {
+        g_nack_timer = xTimerCreate("espnow_ota_nack", 1, pdFALSE, NULL, espnow_ota_nack_timer_cb);
+
+        if (!g_nack_timer) {
+            ESP_FREE(nack);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    espnow_ota_feedback_t feedback = espnow_ota_feedback_report();
+    memcpy(nack->ranges + nack->range_num, &feedback, sizeof(espnow_ota_feedback_t));
+
+    espnow_ota_nack_reply_t reply = {
+        .size = sizeof(espnow_ota_nack_t) + nack->range_num * sizeof(espnow_ota_range_t) + sizeof(espnow_ota_feedback_t),
+        .nack = nack,
+    };
+    memcpy(reply.dest_addr, src_addr, ESPNOW_ADDR_LEN);
+
+    /**< The reply is freed by the timer once it is published, it is not read after that */
+    TickType_t delay = pdMS_TO_TICKS(esp_random() % reply_window);
+    ESP_LOGD(TAG, "NACK reply in %" PRIu32 " ms, range_num: %d", (uint32_t)(delay * portTICK_PERIOD_MS), reply.nack->range_num);
+
+    /**< A later request replaces the reply still waiting */
+    portENTER_CRITICAL(&g_nack_lock);
+    nack = g_nack_reply.nack;
+    g_nack_reply = reply;
+    portEXIT_CRITICAL(&g_nack_lock);
+    ESP_FREE(nack);
+
+    xTimerChangePeriod(g_nack_timer, delay ? delay : 1, portMAX_DELAY);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Firmware relayed to the neighbors, saved to resume the relay after the reboot into it
+ */
+typedef struct {
+    uint8_t sha_256[ESPNOW_OTA_HASH_LEN];
+    uint32_t total_size;
+    espnow_ota_relay_t relay;   /**< Relay of the upgrades the responder sends */
+} espnow_ota_relay_store_t;
+
+static TaskHandle_t g_relay_task                = NULL;
+static volatile bool g_relay_running            = false;
+static const esp_partition_t *g_relay_partition = NULL;
+static espnow_ota_relay_store_t g_relay_store   = { 0 };
+static uint32_t g_relay_heard                   = 0;
+static volatile bool g_relay_sending            = false;  /**< The relay task is in an upgrade of the neighbors */
+
+/**< A relay started while the one stopped is still finishing, the relay task takes it over */
+static portMUX_TYPE g_relay_lock                        = portMUX_INITIALIZER_UNLOCKED;
+static bool g_relay_pending                             = false;
+static const esp_partition_t *g_relay_pending_partition = NULL;
+static espnow_ota_relay_store_t g_relay_pending_store   = { 0 };
+
+static esp_err_t espnow_ota_relay_read(size_t src_offset, void *dst, size_t size)
+{
+    /**< The partition may be written by a new upgrade once the relay is stopped */
+    if (!g_relay_running) {
+        return ESP_ERR_ESPNOW_OTA_STOP;
+    }
+
+    return esp_partition_read(g_relay_partition, src_offset, dst, size);
+}
+
+/**
+ * @brief Serve the neighbors on a Trickle timer: once per interval at a random time in its second half,
+ *        unless other relays were heard serving them. The interval doubles while no neighbor needs
+ *        the firmware and is reset when one does, so a new neighbor is served soon and a quiet area
+ *        costs few scans.
+ */
+static void espnow_ota_relay_serve(void)
+{
+    uint32_t interval_ms = CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MIN;
+    uint8_t quiet_num    = 0;
+
+    ESP_LOGI(TAG, "Relay the firmware, hops: %d, depth: %d, partition: %s",
+             g_relay_store.relay.hops, g_relay_store.relay.depth, g_relay_partition->label);
+
+    while (g_relay_running) {
+        uint32_t fire_ms  = interval_ms / 2 + esp_random() % (interval_ms / 2);
+        TickType_t start  = xTaskGetTickCount();
+        bool consistent   = true;
+        g_relay_heard     = 0;
+
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(fire_ms)) || !g_relay_running) {
+            break;
+        }
+
+        if (g_relay_heard >= ESPNOW_OTA_RELAY_REDUNDANCY) {
+            ESP_LOGD(TAG, "Relay suppressed, heard: %" PRIu32, g_relay_heard);
+        } else {
+            espnow_ota_result_t result = { 0 };
+            espnow_addr_t addrs_list[1];
+            memcpy(addrs_list[0], ESPNOW_ADDR_BROADCAST, ESPNOW_ADDR_LEN);
+
+            /**< The neighbors having the firmware reply ESP_ERR_ESPNOW_OTA_FINISH, they are not counted.
+                 The stop is checked again once espnow_ota_relay_stop() sees the upgrade to stop */
+            g_relay_sending = true;
+            esp_err_t ret = !g_relay_running ? ESP_ERR_ESPNOW_OTA_STOP :
+                            espnow_ota_initiator_send_relay(addrs_list, 1, g_relay_store.sha_256, g_relay_store.total_size,
+                                                            espnow_ota_relay_read, &g_relay_store.relay, &result);
+            g_relay_sending = false;
+            consistent = !result.successed_num && !result.unfinished_num;
+
+            ESP_LOGI(TAG, "<%s> Relay, successed_num: %d, unfinished_num: %d, interval: %" PRIu32 " ms",
+                     esp_err_to_name(ret), result.successed_num, result.unfinished_num, interval_ms);
+            espnow_ota_initiator_result_free(&result);
+        }
+
+        uint32_t elapsed_ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+
+        if (!g_relay_running || (elapsed_ms < interval_ms
+                                 && ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(interval_ms - elapsed_ms)))) {
+            break;
+        }
+
+        interval_ms = consistent ? MIN(interval_ms * 2, CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MAX) : CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MIN;
+        quiet_num   = (consistent && interval_ms == CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MAX) ? quiet_num + 1 : 0;
+
+        if (quiet_num >= ESPNOW_OTA_RELAY_QUIET_NUM) {
+            ESP_LOGI(TAG, "No neighbor needs the firmware, stop relaying it");
+            esp_event_post(ESP_EVENT_ESPNOW, ESP_EVENT_ESPNOW_OTA_RELAY_FINISH, NULL, 0, 0);
+            break;
+        }
+    }
+}
+
+/**
+ * @brief The relay stopped is followed by the one started meanwhile, the task only exits when there is none,
+ *        the relay saved is erased when it is not followed
+ */
+static void espnow_ota_relay_task(void *arg)
+{
+    for (bool pending = true; pending;) {
+        espnow_ota_relay_serve();
+
+        portENTER_CRITICAL(&g_relay_lock);
+        pending = g_relay_pending;
+
+        if (pending) {
+            g_relay_partition = g_relay_pending_partition;
+            g_relay_store     = g_relay_pending_store;
+            g_relay_pending   = false;
+            g_relay_running   = true;
+        }
+
+        portEXIT_CRITICAL(&g_relay_lock);
+
+        if (!pending) {
+            espnow_storage_erase(ESPNOW_OTA_STORE_RELAY_KEY);
+
+            /**< A relay started while the saved one was erased */
+            portENTER_CRITICAL(&g_relay_lock);
+            pending = g_relay_pending;
+
+            if (pending) {
+                g_relay_partition = g_relay_pending_partition;
+                g_relay_store     = g_relay_pending_store;
+                g_relay_pending   = false;
+                g_relay_running   = true;
+            } else {
+                g_relay_running = false;
+                g_relay_task    = NULL;
+            }
+
+            portEXIT_CRITICAL(&g_relay_lock);
+        }
 
-/**< packet_num is a 16-bit wire field; the configured firmware must not need more packets */
-_Static_assert(ESPNOW_OTA_PACKET_MAX_NUM <= 65535,
-               "CONFIG_ESPNOW_OTA_FIRMWARE_SIZE_MAX too large: OTA packet_num (uint16_t) would overflow");
-typedef struct {
-    esp_ota_handle_t handle;      /**< OTA handle */
-    const esp_partition_t *partition; /**< Pointer to partition structure obtained using
-                                           esp_partition_find_first or esp_partition_get */
-    uint32_t start_time;         /**< Start time of the upgrade */
-    espnow_ota_status_t status;  /**< Upgrade status */
-} ota_config_t;
+        if (pending) {
+            /**< The notification of the stop is not taken for the relay which follows */
+            ulTaskNotifyTake(pdTRUE, 0);
 
-static const char *TAG = "espnow_ota_responder";
-static ota_config_t *g_ota_config = NULL;
-static bool g_ota_finished_flag        = false;
-static espnow_frame_head_t g_frame_config = { .security = CONFIG_ESPNOW_OTA_SECURITY,
-                                              .retransmit_count = CONFIG_ESPNOW_OTA_RETRANSMISSION_TIMES};
-static espnow_ota_config_t *g_espnow_ota_config = NULL;
+            if (espnow_storage_set(ESPNOW_OTA_STORE_RELAY_KEY, &g_relay_store, sizeof(espnow_ota_relay_store_t)) != ESP_OK) {
+                ESP_LOGW(TAG, "The relay is not resumed after a reboot");
+            }
+        }
+    }
 
-static esp_err_t validate_image_header(const esp_partition_t *update)
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Relay the firmware in the partition, it is saved to go on after the reboot into the firmware.
+ *        A relay being stopped is not waited for, the relay task goes on with this one once it returns.
+ */
+static esp_err_t espnow_ota_relay_start(const esp_partition_t *partition, const espnow_ota_relay_store_t *store)
 {
-    esp_app_desc_t new_app_info;
-    esp_app_desc_t running_app_info;
-    const esp_partition_t *running = esp_ota_get_running_partition();
+    portENTER_CRITICAL(&g_relay_lock);
+    bool running = g_relay_task != NULL;
 
-    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK) {
-        ESP_LOGI(TAG, "Running firmware version: %s", running_app_info.version);
+    if (running) {
+        g_relay_pending_partition = partition;
+        g_relay_pending_store     = *store;
+        g_relay_pending           = true;
     }
 
-    if (esp_ota_get_partition_description(update, &new_app_info) == ESP_OK) {
-        ESP_LOGI(TAG, "Running firmware version: %s", new_app_info.version);
-    }
+    portEXIT_CRITICAL(&g_relay_lock);
 
-    if (!g_espnow_ota_config->skip_version_check
-            && !memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version))) {
-        ESP_LOGW(TAG, "Current running version is the same as a new. We will not continue the update.");
-        return ESP_FAIL;
+    if (running) {
+        ESP_LOGD(TAG, "The relay starts once the one stopped returns");
+        return ESP_OK;
     }
 
-#ifdef CONFIG_BOOTLOADER_APP_ANTI_ROLLBACK
-    /**
-     * Secure version check from firmware image header prevents subsequent download and flash write of
-     * entire firmware image. However this is optional because it is also taken care in API
-     * esp_https_ota_finish at the end of OTA update procedure.
-     */
-    const uint32_t hw_sec_version = esp_efuse_read_secure_version();
+    g_relay_partition = partition;
+    g_relay_store     = *store;
+    g_relay_running   = true;
 
-    if (new_app_info.secure_version < hw_sec_version) {
-        ESP_LOGW(TAG, "New firmware security version is less than eFuse programmed, %d < %d", new_app_info.secure_version, hw_sec_version);
-        return ESP_FAIL;
+    esp_err_t ret = espnow_storage_set(ESPNOW_OTA_STORE_RELAY_KEY, store, sizeof(espnow_ota_relay_store_t));
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "<%s> The relay is not resumed after a reboot", esp_err_to_name(ret));
     }
 
-#endif
+    if (xTaskCreate(espnow_ota_relay_task, "espnow_ota_relay", 4 * 1024, NULL,
+                    tskIDLE_PRIORITY + 1, &g_relay_task) != pdPASS) {
+        g_relay_running = false;
+        ESP_LOGE(TAG, "Create the relay task");
+        return ESP_ERR_NO_MEM;
+    }
 
     return ESP_OK;
 }
 
-static esp_err_t espnow_ota_info(const uint8_t *src_addr)
+/**
+ * @brief Relay the firmware saved by espnow_ota_relay_start() once it runs
+ */
+static esp_err_t espnow_ota_relay_resume(void)
 {
-    esp_err_t ret = ESP_OK;
-    /**< Remove useless data, sha256 of elf file (32 Byte) +  reserv2 (20 Byte)*/
-    size_t size = sizeof(espnow_ota_info_t) - 32 - 20;
-    espnow_ota_info_t *info = ESP_MALLOC(sizeof(espnow_ota_info_t));
+    espnow_ota_relay_store_t store = { 0 };
+    uint8_t running_sha_256[32]    = { 0 };
+    const esp_partition_t *running = esp_ota_get_running_partition();
 
-    info->type = ESPNOW_OTA_TYPE_INFO;
+    if (espnow_storage_get(ESPNOW_OTA_STORE_RELAY_KEY, &store, sizeof(espnow_ota_relay_store_t)) != ESP_OK) {
+        return ESP_OK;
+    }
 
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
-    memcpy(&info->app_desc, esp_app_get_description(), sizeof(esp_app_desc_t));
-#else
-    memcpy(&info->app_desc, esp_ota_get_app_description(), sizeof(esp_app_desc_t));
-#endif
+    /**< The reboot went back to another firmware */
+    if (esp_partition_get_sha256(running, running_sha_256) != ESP_OK
+            || memcmp(running_sha_256, store.sha_256, ESPNOW_OTA_HASH_LEN)
+            || store.total_size > running->size) {
+        ESP_LOGW(TAG, "The firmware relayed is not running");
+        return espnow_storage_erase(ESPNOW_OTA_STORE_RELAY_KEY);
+    }
 
-    ret = espnow_send(ESPNOW_DATA_TYPE_OTA_STATUS, src_addr, info, size, &g_frame_config, portMAX_DELAY);
+    return espnow_ota_relay_start(running, &store);
+}
 
-    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_write");
+/**
+ * @brief Stop relaying the firmware. It only signals the relay task, the upgrade the relay sends may wait
+ *        on the replies delivered by the receive task, which calls it. The task erases the relay saved
+ *        once it returns, unless a relay is started meanwhile.
+ */
+static void espnow_ota_relay_stop(void)
+{
+    portENTER_CRITICAL(&g_relay_lock);
+    TaskHandle_t task = g_relay_task;
+    g_relay_pending   = false;
+    g_relay_running   = false;
+    portEXIT_CRITICAL(&g_relay_lock);
+
+    if (!task) {
+        return;
+    }
 
-    ESP_LOGD(TAG, "Application information:");
-    ESP_LOGD(TAG, "Project name:     %s", info->app_desc.project_name);
-    ESP_LOGD(TAG, "App version:      %s", info->app_desc.version);
-    ESP_LOGD(TAG, "Secure version:   %d", info->app_desc.secure_version);
-    ESP_LOGD(TAG, "Compile time:     %s %s", info->app_desc.date, info->app_desc.time);
-    ESP_LOGD(TAG, "ESP-IDF:          %s", info->app_desc.idf_ver);
+    xTaskNotifyGive(task);
 
-    ESP_FREE(info);
+    if (g_relay_sending) {
+        espnow_ota_initiator_request_stop();
+    }
+}
 
-    return ESP_OK;
+/**
+ * @brief Stop relaying the firmware and wait for the relay task to return, not called on the receive task
+ */
+static void espnow_ota_relay_join(void)
+{
+    espnow_ota_relay_stop();
+
+    while (g_relay_task) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+/**
+ * @brief Reply a status of the firmware requested without the progress, the session is kept
+ */
+static esp_err_t espnow_ota_status_reply(const espnow_addr_t src_addr, const espnow_ota_status_t *status,
+                                         esp_err_t error_code)
+{
+    espnow_ota_status_t reply = {
+        .type       = ESPNOW_OTA_TYPE_STATUS,
+        .error_code = error_code,
+        .packet_num = status->packet_num,
+        .total_size = status->total_size,
+    };
+    memcpy(reply.sha_256, status->sha_256, ESPNOW_OTA_HASH_LEN);
+
+    return espnow_send(ESPNOW_DATA_TYPE_OTA_STATUS, src_addr, &reply,
+                       sizeof(espnow_ota_status_t), &g_frame_config, portMAX_DELAY);
 }
 
 static esp_err_t espnow_ota_status_handle(const espnow_addr_t src_addr, const espnow_ota_status_t *status, size_t size)
@@ -145,13 +1691,65 @@ static esp_err_t espnow_ota_status_handle(const espnow_addr_t src_addr, const es
     esp_err_t ret        = ESP_ERR_NO_MEM;
     size_t response_size = sizeof(espnow_ota_status_t);
     uint8_t running_sha_256[32] = {0};
+    uint16_t packet_size = ESPNOW_OTA_PACKET_MAX_SIZE;
+    uint8_t flags        = 0;
+    uint8_t base_sha_256[ESPNOW_OTA_HASH_LEN] = {0};
+    uint16_t reply_window = 0;
+    espnow_ota_relay_t relay = { 0 };
+    uint8_t hash_root[ESPNOW_OTA_HASH_LEN] = {0};
+
+    /**< Initiators supporting large packets append the packet size of the upgrade,
+         then the capabilities it uses */
+    if (size >= sizeof(espnow_ota_status_t) + sizeof(uint16_t)) {
+        const espnow_ota_status_ext_t *ext = (espnow_ota_status_ext_t *)((uint8_t *)status + sizeof(espnow_ota_status_t));
+        packet_size = ext->packet_size;
+
+        if (size >= sizeof(espnow_ota_status_t) + offsetof(espnow_ota_status_ext_t, base_sha_256)) {
+            flags = ext->flags;
+        }
+
+        if (size >= sizeof(espnow_ota_status_t) + offsetof(espnow_ota_status_ext_t, reply_window)) {
+            memcpy(base_sha_256, ext->base_sha_256, ESPNOW_OTA_HASH_LEN);
+        } else if (flags & ESPNOW_OTA_CAP_DELTA) {
+            ESP_LOGW(TAG, "OTA patch without the firmware it applies to");
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (size >= sizeof(espnow_ota_status_t) + offsetof(espnow_ota_status_ext_t, relay_hops)) {
+            reply_window = ext->reply_window;
+        }
+
+        if (size >= sizeof(espnow_ota_status_t) + offsetof(espnow_ota_status_ext_t, hash_root)) {
+            relay.hops  = ext->relay_hops;
+            relay.depth = ext->relay_depth;
+        }
+
+        if (size >= sizeof(espnow_ota_status_t) + sizeof(espnow_ota_status_ext_t)) {
+            memcpy(hash_root, ext->hash_root, ESPNOW_OTA_HASH_LEN);
+        }
+    }
+
+    ESP_ERROR_RETURN(packet_size < ESPNOW_OTA_PACKET_MAX_SIZE || packet_size > ESPNOW_OTA_PACKET_V2_MAX_SIZE,
+                     ESP_ERR_INVALID_ARG, "OTA packet_size %u is not supported", packet_size);
+
+    /**< The header of the compressed packet only fits with the large packets */
+    ESP_ERROR_RETURN((flags & ~ESPNOW_OTA_UPGRADE_FLAGS) || (flags & (flags - 1))
+                     || (flags && packet_size == ESPNOW_OTA_PACKET_MAX_SIZE),
+                     ESP_ERR_INVALID_ARG, "OTA flags 0x%02x are not supported", flags);
 
     if (!g_ota_config) {
         size_t config_size = sizeof(ota_config_t) + ESPNOW_OTA_PROGRESS_ARRAY_CAPACITY;
         g_ota_config   = ESP_CALLOC(1, config_size);
         ESP_ERROR_GOTO(!g_ota_config, EXIT, "<ESP_ERR_NO_MEM> g_ota_config");
+        memset(&g_ota_packet, 0, sizeof(ota_packet_config_t));
 
-        espnow_storage_get(ESPNOW_OTA_STORE_CONFIG_KEY, g_ota_config, 0);
+        /**< The status saved by the former versions is still in NVS */
+        g_ota_config->partition = esp_ota_get_next_update_partition(NULL);
+
+        if (espnow_ota_journal_restore() != ESP_OK
+                && espnow_storage_get(ESPNOW_OTA_STORE_CONFIG_KEY, g_ota_config, 0) == ESP_OK) {
+            espnow_storage_get(ESPNOW_OTA_STORE_PACKET_KEY, &g_ota_packet, sizeof(ota_packet_config_t));
+        }
 
         /**< Discard an untrusted persisted session (e.g. written by an older, vulnerable
              build) whose packet_num would overflow the progress bitmap during resume. */
@@ -159,6 +1757,15 @@ static esp_err_t espnow_ota_status_handle(const espnow_addr_t src_addr, const es
             memset(&g_ota_config->status, 0, sizeof(espnow_ota_status_t));
         }
 
+        if (g_ota_packet.packet_size < ESPNOW_OTA_PACKET_MAX_SIZE
+                || g_ota_packet.packet_size > ESPNOW_OTA_PACKET_V2_MAX_SIZE) {
+            g_ota_packet.packet_size = ESPNOW_OTA_PACKET_MAX_SIZE;
+        }
+
+        if (g_ota_packet.flags & ~ESPNOW_OTA_UPGRADE_FLAGS) {
+            g_ota_packet.flags = 0;
+        }
+
         g_ota_config->start_time = xTaskGetTickCount();
         g_ota_config->partition = esp_ota_get_next_update_partition(NULL);
     }
@@ -176,16 +1783,51 @@ static esp_err_t espnow_ota_status_handle(const espnow_addr_t src_addr, const es
         goto EXIT;
     }
 
+    /**< The patch only rebuilds the firmware from the one it was made against, the session is kept */
+    if ((flags & ESPNOW_OTA_CAP_DELTA) && memcmp(running_sha_256, base_sha_256, ESPNOW_OTA_HASH_LEN)) {
+        ESP_LOGW(TAG, "The patch does not apply to the running firmware");
+        return espnow_ota_status_reply(src_addr, status, ESP_ERR_ESPNOW_OTA_STOP);
+    }
+
+    bool same_firmware = !memcmp(g_ota_config->status.sha_256, status->sha_256, ESPNOW_OTA_HASH_LEN)
+                         && g_ota_config->status.total_size == status->total_size;
+
+    /**< The neighbors which have the firmware are not counted by a relay, which stops once none needs it.
+         The upgrade of another relay in progress is kept, rather than started again with other packets */
+    if (relay.depth && same_firmware && g_ota_config->status.written_size == g_ota_config->status.total_size) {
+        return espnow_ota_status_reply(src_addr, status, ESP_ERR_ESPNOW_OTA_FINISH);
+    } else if (relay.depth && same_firmware && g_ota_config->status.written_size
+               && (g_ota_packet.packet_size != packet_size || g_ota_packet.flags != flags)) {
+        ESP_LOGD(TAG, "Keep the upgrade in progress, packet_size: %d", g_ota_packet.packet_size);
+        return espnow_ota_status_reply(src_addr, status, ESP_ERR_ESPNOW_OTA_STOP);
+    }
+
+    g_ota_relay = relay;
+    espnow_ota_hash_start(hash_root, status->total_size, flags);
+
     /**< If g_ota_config->status has been created and
          once again upgrade the same name bin, just return ESP_OK */
-    if (!memcmp(g_ota_config->status.sha_256, status->sha_256, ESPNOW_OTA_HASH_LEN)
-            && g_ota_config->status.total_size == status->total_size) {
+    if (same_firmware && g_ota_packet.packet_size == packet_size
+            && g_ota_packet.flags == flags) {
+#if CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM > 0
+        /**< Answer the progress written to flash, the initiator requests the rest again */
+        ret = espnow_ota_cache_flush_all();
+
+        if (ret != ESP_OK) {
+            espnow_ota_write_reset();
+        }
+#endif
         ret = ESP_OK;
         goto EXIT;
     }
 
     memset(g_ota_config, 0, sizeof(ota_config_t));
     memcpy(&g_ota_config->status, status, sizeof(espnow_ota_status_t));
+    g_ota_packet.packet_size  = packet_size;
+    g_ota_packet.flags        = flags;
+    g_ota_flash_writes        = 0;
+
+    espnow_ota_write_reset();
     memset(g_ota_config->status.progress_array, 0, status->packet_num / 8 + 1);
     g_ota_config->status.written_size = 0;
     g_ota_config->status.error_code = ESP_ERR_ESPNOW_OTA_FIRMWARE_NOT_INIT;
@@ -194,7 +1836,8 @@ static esp_err_t espnow_ota_status_handle(const espnow_addr_t src_addr, const es
                       sizeof(espnow_ota_status_t), &g_frame_config, portMAX_DELAY);
     ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_write");
 
-    ESP_LOGI(TAG, "The device starts to upgrade");
+    ESP_LOGI(TAG, "The device starts to upgrade, packet_size: %d, compressed: %d, patch: %d",
+             packet_size, !!(flags & ESPNOW_OTA_CAP_COMPRESS), !!(flags & ESPNOW_OTA_CAP_DELTA));
 
     g_ota_finished_flag = false;
     /**< Get partition info of currently running app
@@ -213,14 +1856,26 @@ static esp_err_t espnow_ota_status_handle(const espnow_addr_t src_addr, const es
     g_ota_config->partition  = update;
     g_ota_config->start_time = xTaskGetTickCount();
 
+    /**< The firmware relayed before the reboot is in the partition to write */
+    if (g_relay_partition == update) {
+        espnow_ota_relay_stop();
+    }
+
     /**< Commence an OTA update writing to the specified partition. */
     ret = esp_ota_begin(update, g_ota_config->status.total_size, &g_ota_config->handle);
     ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "esp_ota_begin failed");
 
-    /**< Save upgrade information to flash. */
-    ret = espnow_storage_set(ESPNOW_OTA_STORE_CONFIG_KEY, g_ota_config,
-                          sizeof(ota_config_t) + g_ota_config->status.packet_num / 8 + 1);
-    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "info_store_save, ret: %d", ret);
+    /**< Save upgrade information to flash, in the journal after the firmware if there is room for it */
+    if (espnow_ota_journal_start() == ESP_OK) {
+        espnow_storage_erase(ESPNOW_OTA_STORE_CONFIG_KEY);
+        espnow_storage_erase(ESPNOW_OTA_STORE_PACKET_KEY);
+    } else {
+        ret = espnow_storage_set(ESPNOW_OTA_STORE_PACKET_KEY, &g_ota_packet, sizeof(ota_packet_config_t));
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "info_store_save, ret: %d", ret);
+        ret = espnow_storage_set(ESPNOW_OTA_STORE_CONFIG_KEY, g_ota_config,
+                                 sizeof(ota_config_t) + g_ota_config->status.packet_num / 8 + 1);
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "info_store_save, ret: %d", ret);
+    }
 
     /**< Send ESP_EVENT_ESPNOW_OTA_STARTED event to the event handler */
     esp_event_post(ESP_EVENT_ESPNOW, ESP_EVENT_ESPNOW_OTA_STARTED, NULL, 0, 0);
@@ -229,6 +1884,12 @@ static esp_err_t espnow_ota_status_handle(const espnow_addr_t src_addr, const es
 
 EXIT:
 
+    /**< All the packets lost in one reply, the replies of the responders are spread over the window */
+    if (reply_window && g_ota_config->status.written_size
+            && g_ota_config->status.written_size != g_ota_config->status.total_size) {
+        return espnow_ota_nack_reply(src_addr, reply_window);
+    }
+
     /**< Update g_ota_config->status */
     if (g_ota_config->status.written_size
             && g_ota_config->status.written_size != g_ota_config->status.total_size) {
@@ -260,19 +1921,26 @@ EXIT:
         g_ota_config->status.error_code = ret;
     }
 
+    /**< The packets received are reported by a responder which wrote none of them too */
+    uint8_t response[sizeof(espnow_ota_status_t) + sizeof(espnow_ota_feedback_t)];
+    espnow_ota_feedback_t feedback = espnow_ota_feedback_report();
+    memcpy(response, &g_ota_config->status, sizeof(espnow_ota_status_t));
+    memcpy(response + sizeof(espnow_ota_status_t), &feedback, sizeof(espnow_ota_feedback_t));
+    response_size = sizeof(response);
+
     ESP_LOGD(TAG, "Response upgrade status, written_size: %d, response_size: %d, addr: " MACSTR,
              g_ota_config->status.written_size, response_size, MAC2STR(src_addr));
-    ret = espnow_send(ESPNOW_DATA_TYPE_OTA_STATUS, src_addr, &g_ota_config->status,
-                      sizeof(espnow_ota_status_t), &g_frame_config, portMAX_DELAY);
+    ret = espnow_send(ESPNOW_DATA_TYPE_OTA_STATUS, src_addr, response, response_size, &g_frame_config, portMAX_DELAY);
     ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_write");
 
     return ESP_OK;
 }
 
-static esp_err_t espnow_ota_write(const espnow_addr_t src_addr, const espnow_ota_packet_t *packet, size_t size)
+static esp_err_t espnow_ota_write(const espnow_addr_t src_addr, uint16_t seq, uint32_t offset,
+                                  const uint8_t *data, size_t size)
 {
     ESP_PARAM_CHECK(src_addr);
-    ESP_PARAM_CHECK(packet);
+    ESP_PARAM_CHECK(data);
     ESP_PARAM_CHECK(size);
 
     esp_err_t ret = ESP_OK;
@@ -287,6 +1955,9 @@ static esp_err_t espnow_ota_write(const espnow_addr_t src_addr, const espnow_ota
         g_ota_config->status.written_size = 0;
         memset(g_ota_config->status.progress_array, 0, g_ota_config->status.packet_num / 8 + 1);
         espnow_storage_erase(ESPNOW_OTA_STORE_CONFIG_KEY);
+        espnow_storage_erase(ESPNOW_OTA_STORE_PACKET_KEY);
+        espnow_ota_journal_erase();
+        espnow_ota_write_reset();
 
         ret = espnow_send(ESPNOW_DATA_TYPE_OTA_STATUS, src_addr, &g_ota_config->status,
                           sizeof(espnow_ota_status_t), &g_frame_config, portMAX_DELAY);
@@ -298,27 +1969,52 @@ static esp_err_t espnow_ota_write(const espnow_addr_t src_addr, const espnow_ota
     /**< Bound the attacker-controlled packet->seq before it indexes status.progress_array
          (ESPNOW_OTA_GET_BITS/SET_BITS below), so a large seq cannot read/write outside the
          bitmap regardless of total_size or the configured firmware size. */
-    ESP_ERROR_RETURN(packet->seq > ESPNOW_OTA_BITMAP_PACKET_LIMIT, ESP_ERR_INVALID_ARG,
+    ESP_ERROR_RETURN(seq > ESPNOW_OTA_BITMAP_PACKET_LIMIT, ESP_ERR_INVALID_ARG,
                      "OTA packet seq %u exceeds bitmap capacity (max %u)",
-                     packet->seq, (unsigned)ESPNOW_OTA_BITMAP_PACKET_LIMIT);
+                     seq, (unsigned)ESPNOW_OTA_BITMAP_PACKET_LIMIT);
 
-    ESP_ERROR_RETURN(packet->seq * ESPNOW_OTA_PACKET_MAX_SIZE > g_ota_config->status.total_size,
-                     ESP_ERR_INVALID_ARG, "packet->seq: %d", packet->seq);
+    /**< A compressed or patch packet holds up to a sector, at any offset */
+    size_t size_max = g_ota_packet.flags ? ESPNOW_OTA_LZ_BLOCK_MAX : g_ota_packet.packet_size;
+    ESP_ERROR_RETURN(size > size_max, ESP_ERR_INVALID_ARG,
+                     "packet size %d exceeds %d", size, size_max);
+
+    ESP_ERROR_RETURN(offset > g_ota_config->status.total_size || size > g_ota_config->status.total_size - offset,
+                     ESP_ERR_INVALID_ARG, "packet->seq: %d, offset: %d, size: %d", seq, offset, size);
 
     /**< Received a duplicate packet */
-    if (ESPNOW_OTA_GET_BITS(g_ota_config->status.progress_array, packet->seq)) {
-        ESP_LOGD(TAG, "Received a duplicate packet, packet_seq: %d", packet->seq);
+    if (espnow_ota_received(seq)) {
+        ESP_LOGD(TAG, "Received a duplicate packet, packet_seq: %d", seq);
         return ESP_OK;
     }
 
+#if CONFIG_ESPNOW_OTA_WRITE_CACHE_NUM > 0
+    /**< The packet is marked received once its sectors are written to flash */
+    ret = espnow_ota_cache_write(seq, offset, data, size);
+
+    /**< The packets staged and the repair packets reduced by them are dropped together */
+    if (ret != ESP_OK) {
+        espnow_ota_write_reset();
+        ESP_LOGW(TAG, "<%s> espnow_ota_cache_write", esp_err_to_name(ret));
+        return ret;
+    }
+#else
     /**< Write firmware data to the update partition */
-    ret = esp_partition_write(g_ota_config->partition, packet->seq * ESPNOW_OTA_PACKET_MAX_SIZE,
-                              packet->data, packet->size);
+    ret = esp_partition_write(g_ota_config->partition, offset, data, size);
     ESP_ERROR_RETURN(ret != ESP_OK, ESP_ERR_ESPNOW_OTA_FIRMWARE_DOWNLOAD,
                      "esp_partition_write %s", esp_err_to_name(ret));
 
-    ESPNOW_OTA_SET_BITS(g_ota_config->status.progress_array, packet->seq);
-    g_ota_config->status.written_size += packet->size;
+    g_ota_flash_writes++;
+    ESPNOW_OTA_SET_BITS(g_ota_config->status.progress_array, seq);
+    g_ota_config->status.written_size += size;
+    espnow_ota_journal_append(seq, size);
+    espnow_ota_hash_check(seq, size);
+#endif
+
+#if ESPNOW_OTA_FEC_ENABLE
+    if (!g_ota_packet.flags) {
+        espnow_ota_fec_source(seq, data, size);
+    }
+#endif
 
     /**< Save OTA status periodically, it can be used to
          resumable data transfers from breakpoint after system reset */
@@ -331,22 +2027,25 @@ static esp_err_t espnow_ota_write(const espnow_addr_t src_addr, const espnow_ota
         }
 
         ESP_LOGD(TAG, "packet_seq: %d, packet_size: %d, written_size: %d, progress: %03d%%, next_percentage: %03d%%",
-                 packet->seq, packet->size, g_ota_config->status.written_size, written_percentage, s_next_written_percentage);
+                 seq, size, g_ota_config->status.written_size, written_percentage, s_next_written_percentage);
 
-        if (written_percentage == s_next_written_percentage) {
+        /**< A sector written at once may step over the percentage */
+        if (written_percentage >= s_next_written_percentage) {
             ESP_LOGD(TAG, "Save the data of upgrade status to flash");
-            s_next_written_percentage += g_espnow_ota_config->progress_report_interval;
+            s_next_written_percentage = (written_percentage / g_espnow_ota_config->progress_report_interval + 1) * g_espnow_ota_config->progress_report_interval;
 
-            espnow_storage_set(ESPNOW_OTA_STORE_CONFIG_KEY, g_ota_config,
-                            sizeof(ota_config_t) + g_ota_config->status.packet_num / 8 + 1);
+            if (espnow_ota_journal_enabled()) {
+                espnow_ota_journal_commit();
+            } else {
+                espnow_storage_set(ESPNOW_OTA_STORE_CONFIG_KEY, g_ota_config,
+                                   sizeof(ota_config_t) + g_ota_config->status.packet_num / 8 + 1);
+            }
 
             /**< Send ESP_EVENT_ESPNOW_OTA_STATUS event to the event handler */
             esp_event_post(ESP_EVENT_ESPNOW, ESP_EVENT_ESPNOW_OTA_STATUS, &written_percentage, sizeof(uint32_t), 0);
 
             ESP_LOGD(TAG, "packet_seq: %d, packet_size: %d, written_size: %d, progress: %d%%",
-                     packet->seq, packet->size, g_ota_config->status.written_size, written_percentage);
-        } else if (written_percentage > s_next_written_percentage) {
-            s_next_written_percentage = (written_percentage / g_espnow_ota_config->progress_report_interval + 1) * g_espnow_ota_config->progress_report_interval;
+                     seq, size, g_ota_config->status.written_size, written_percentage);
         }
     }
 
@@ -354,14 +2053,17 @@ static esp_err_t espnow_ota_write(const espnow_addr_t src_addr, const espnow_ota
         s_next_written_percentage = 0;
         ESP_LOG_BUFFER_CHAR_LEVEL(TAG, g_ota_config->status.progress_array,
                                   ESPNOW_OTA_PROGRESS_MAX_SIZE, ESP_LOG_VERBOSE);
-        ESP_LOGI(TAG, "Write total_size: %d, written_size: %d, spend time: %ds",
-                 g_ota_config->status.total_size, g_ota_config->status.written_size,
-                 (xTaskGetTickCount() - g_ota_config->start_time) * portTICK_PERIOD_MS / 1000);
+        ESP_LOGI(TAG, "Write total_size: %d, written_size: %d, flash writes: %" PRIu32 ", spend time: %dms, verified by the hash root: %d",
+                 g_ota_config->status.total_size, g_ota_config->status.written_size, g_ota_flash_writes,
+                 (xTaskGetTickCount() - g_ota_config->start_time) * portTICK_PERIOD_MS, g_ota_hash.valid);
 
         /**< If ESP32 was reset duration OTA, and after restart, the update_handle will be invalid,
              but it still can switch boot partition and reboot successful */
         esp_ota_end(g_ota_config->handle);
         espnow_storage_erase(ESPNOW_OTA_STORE_CONFIG_KEY);
+        espnow_storage_erase(ESPNOW_OTA_STORE_PACKET_KEY);
+        espnow_ota_journal_erase();
+        espnow_ota_write_reset();
 
         const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
 
@@ -387,11 +2089,216 @@ static esp_err_t espnow_ota_write(const espnow_addr_t src_addr, const espnow_ota
         ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_send");
     
         esp_event_post(ESP_EVENT_ESPNOW, ESP_EVENT_ESPNOW_OTA_FINISH, NULL, 0, 0);
+
+        /**< The firmware verified is served to the neighbors from the update partition until the reboot,
+             then from the running partition */
+        if (g_ota_relay.hops) {
+            espnow_ota_relay_store_t store = {
+                .total_size  = g_ota_config->status.total_size,
+                .relay.hops  = g_ota_relay.hops - 1,
+                .relay.depth = g_ota_relay.depth + 1,
+            };
+            memcpy(store.sha_256, g_ota_config->status.sha_256, ESPNOW_OTA_HASH_LEN);
+
+            /**< The firmware relayed since the last reboot is not the latest any more */
+            espnow_ota_relay_stop();
+
+            if (espnow_ota_relay_start(update_partition, &store) != ESP_OK) {
+                ESP_LOGW(TAG, "The firmware is not relayed");
+            }
+        }
     }
 
     return ESP_OK;
 }
 
+#if ESPNOW_OTA_FEC_ENABLE
+/**
+ * @brief Write the packets the rows have been reduced to
+ */
+static esp_err_t espnow_ota_fec_solve(const espnow_addr_t src_addr)
+{
+    esp_err_t ret = ESP_OK;
+
+    for (int i = 0; i < CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM && g_ota_config; ++i) {
+        espnow_ota_fec_row_t *row = g_fec_rows + i;
+
+        if (!row->used || row->mask != BIT(row->pivot)) {
+            continue;
+        }
+
+        uint16_t seq = row->seq + row->pivot;
+        row->used = false;
+
+        ESP_LOGD(TAG, "Recover packet, seq: %d", seq);
+        ret = espnow_ota_write(src_addr, seq, (uint32_t)seq * g_ota_packet.packet_size,
+                               row->data, espnow_ota_packet_len(seq));
+        ESP_ERROR_BREAK(ret != ESP_OK, "espnow_ota_write");
+
+        /**< Writing may have solved the rows checked already */
+        i = -1;
+    }
+
+    return ret;
+}
+
+static esp_err_t espnow_ota_repair(const espnow_addr_t src_addr, const espnow_ota_repair_t *repair, size_t size)
+{
+    ESP_PARAM_CHECK(size >= sizeof(espnow_ota_repair_t));
+
+    if (!g_ota_config || g_ota_config->status.error_code != ESP_OK
+            || g_ota_packet.flags
+            || repair->size != g_ota_packet.packet_size
+            || size < sizeof(espnow_ota_repair_t) + repair->size
+            || repair->seq % ESPNOW_OTA_FEC_BLOCK_SIZE) {
+        ESP_LOGD(TAG, "Invalid repair packet, seq: %d, size: %d", repair->seq, size);
+        return ESP_OK;
+    }
+
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    uint32_t mask = repair->mask;
+    uint8_t *data = ESP_MALLOC(g_ota_packet.packet_size);
+    uint8_t *packet = ESP_MALLOC(g_ota_packet.packet_size);
+    ESP_ERROR_GOTO(!data || !packet, EXIT, "<ESP_ERR_NO_MEM> repair");
+    ret = ESP_OK;
+
+    memcpy(data, repair->data, g_ota_packet.packet_size);
+
+    for (int i = 0; i < ESPNOW_OTA_FEC_BLOCK_SIZE; ++i) {
+        uint16_t seq = repair->seq + i;
+
+        if (!(mask & BIT(i))) {
+            continue;
+        }
+
+        if (seq >= g_ota_config->status.packet_num) {
+            ESP_LOGD(TAG, "Repair packet out of range, seq: %d", seq);
+            goto EXIT;
+        }
+
+        /**< Take the packets received already out of the XOR */
+        if (espnow_ota_received(seq)) {
+            size_t len = espnow_ota_packet_len(seq);
+            ret = espnow_ota_read((uint32_t)seq * g_ota_packet.packet_size, packet, len);
+            ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_ota_read %s", esp_err_to_name(ret));
+
+            espnow_ota_fec_xor(data, packet, len);
+            mask &= ~BIT(i);
+        }
+    }
+
+    if (mask) {
+        espnow_ota_fec_insert(repair->seq, mask, data);
+        ret = espnow_ota_fec_solve(src_addr);
+    }
+
+EXIT:
+    ESP_FREE(data);
+    ESP_FREE(packet);
+    return ret;
+}
+#endif /**< ESPNOW_OTA_FEC_ENABLE */
+
+/**
+ * @brief Decompress the packet into a sector buffer and write it, the packet is dropped if it is corrupted
+ */
+static esp_err_t espnow_ota_write_lz(const espnow_addr_t src_addr, const espnow_ota_packet_lz_t *packet, size_t size)
+{
+    if (!g_ota_config || !(g_ota_packet.flags & ESPNOW_OTA_CAP_COMPRESS)
+            || size < sizeof(espnow_ota_packet_lz_t) || size < sizeof(espnow_ota_packet_lz_t) + packet->size
+            || packet->size > g_ota_packet.packet_size
+            || !packet->raw_size || packet->raw_size > ESPNOW_OTA_LZ_BLOCK_MAX) {
+        ESP_LOGD(TAG, "Invalid compressed packet, size: %d", size);
+        return ESP_OK;
+    }
+
+    /**< Received a duplicate packet, skip decompressing it */
+    if (packet->seq <= ESPNOW_OTA_BITMAP_PACKET_LIMIT && espnow_ota_received(packet->seq)) {
+        ESP_LOGD(TAG, "Received a duplicate packet, packet_seq: %d", packet->seq);
+        return ESP_OK;
+    }
+
+    esp_err_t ret  = ESP_OK;
+    size_t raw_len = 0;
+    uint8_t *raw   = ESP_MALLOC(packet->raw_size);
+    ESP_ERROR_RETURN(!raw, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> decompress buffer");
+
+    ret = espnow_ota_lz_decompress(packet->data, packet->size, raw, packet->raw_size, &raw_len);
+
+    if (ret != ESP_OK || raw_len != packet->raw_size) {
+        ESP_LOGW(TAG, "<%s> Decompress packet, seq: %d, raw_len: %d, raw_size: %d",
+                 esp_err_to_name(ret), packet->seq, raw_len, packet->raw_size);
+        ESP_FREE(raw);
+        return ESP_OK;
+    }
+
+    ret = espnow_ota_write(src_addr, packet->seq, packet->offset, raw, raw_len);
+    ESP_FREE(raw);
+
+    return ret;
+}
+
+/**
+ * @brief Rebuild the data of the new firmware from the patch packet and the running firmware, and write it
+ */
+static esp_err_t espnow_ota_write_delta(const espnow_addr_t src_addr, const espnow_ota_packet_delta_t *packet, size_t size)
+{
+    const espnow_ota_delta_record_t *record = &packet->record;
+
+    if (!g_ota_config || !(g_ota_packet.flags & ESPNOW_OTA_CAP_DELTA)
+            || size < sizeof(espnow_ota_packet_delta_t) || size < sizeof(espnow_ota_packet_delta_t) + record->size
+            || record->size > g_ota_packet.packet_size
+            || !record->raw_size || record->raw_size > ESPNOW_OTA_LZ_BLOCK_MAX) {
+        ESP_LOGD(TAG, "Invalid patch packet, size: %d", size);
+        return ESP_OK;
+    }
+
+    /**< Received a duplicate packet, skip applying it */
+    if (packet->seq <= ESPNOW_OTA_BITMAP_PACKET_LIMIT && espnow_ota_received(packet->seq)) {
+        ESP_LOGD(TAG, "Received a duplicate packet, packet_seq: %d", packet->seq);
+        return ESP_OK;
+    }
+
+    esp_err_t ret  = ESP_OK;
+    size_t raw_len = 0;
+    uint8_t base[64];
+    uint8_t *raw   = ESP_MALLOC(record->raw_size);
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    ESP_ERROR_RETURN(!raw, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> patch buffer");
+
+    ret = espnow_ota_lz_decompress(record->data, record->size, raw, record->raw_size, &raw_len);
+
+    if (ret != ESP_OK || raw_len != record->raw_size) {
+        ESP_LOGW(TAG, "<%s> Decompress patch, seq: %d, raw_len: %d, raw_size: %d",
+                 esp_err_to_name(ret), packet->seq, raw_len, record->raw_size);
+        ret = ESP_OK;
+        goto EXIT;
+    }
+
+    /**< Add the running firmware to the diff, streaming it from the running partition */
+    if (record->base_offset != ESPNOW_OTA_DELTA_BASE_NONE) {
+        ret = ESP_ERR_INVALID_ARG;
+        ESP_ERROR_GOTO(!running || record->base_offset > running->size || raw_len > running->size - record->base_offset,
+                       EXIT, "Patch out of the running firmware, base_offset: %" PRIu32, record->base_offset);
+
+        for (size_t i = 0; i < raw_len; i += sizeof(base)) {
+            size_t len = MIN(sizeof(base), raw_len - i);
+            ret = esp_partition_read(running, record->base_offset + i, base, len);
+            ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "esp_partition_read %s", esp_err_to_name(ret));
+
+            for (size_t j = 0; j < len; ++j) {
+                raw[i + j] += base[j];
+            }
+        }
+    }
+
+    ret = espnow_ota_write(src_addr, packet->seq, record->offset, raw, raw_len);
+
+EXIT:
+    ESP_FREE(raw);
+    return ret;
+}
+
 esp_err_t espnow_ota_responder_get_status(espnow_ota_status_t *status)
 {
     ESP_PARAM_CHECK(status);
@@ -406,6 +2313,9 @@ esp_err_t espnow_ota_responder_stop()
 {
     esp_err_t ret = ESP_OK;
 
+    espnow_ota_relay_join();
+    espnow_ota_hash_reset();
+
     if (!g_ota_config) {
         return ESP_OK;
     }
@@ -421,6 +2331,9 @@ esp_err_t espnow_ota_responder_stop()
     g_ota_config->status.written_size = 0;
     memset(g_ota_config->status.progress_array, 0, g_ota_config->status.packet_num / 8 + 1);
     espnow_storage_erase(ESPNOW_OTA_STORE_CONFIG_KEY);
+    espnow_storage_erase(ESPNOW_OTA_STORE_PACKET_KEY);
+    espnow_ota_journal_erase();
+    espnow_ota_write_reset();
     espnow_frame_head_t frame_head = ESPNOW_FRAME_CONFIG_DEFAULT();
     frame_head.security = CONFIG_ESPNOW_OTA_SECURITY;
 
@@ -443,10 +2356,16 @@ static esp_err_t espnow_ota_responder_data_process(uint8_t *src_addr, void *data
     uint8_t data_type = ((uint8_t *)data)[0];
     espnow_add_peer(src_addr, NULL);
 
+    if (data_type == ESPNOW_OTA_TYPE_DATA
+            || (data_type >= ESPNOW_OTA_TYPE_DATA_V2 && data_type <= ESPNOW_OTA_TYPE_DATA_DELTA)) {
+        espnow_ota_feedback_count();
+    }
+
     switch (data_type) {
         case ESPNOW_OTA_TYPE_REQUEST:
             ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_INFO");
-            ret = espnow_ota_info(src_addr);
+            g_relay_heard++;
+            ret = espnow_ota_scan_reply(src_addr, data, size);
             break;
 
         case ESPNOW_OTA_TYPE_STATUS:
@@ -454,9 +2373,66 @@ static esp_err_t espnow_ota_responder_data_process(uint8_t *src_addr, void *data
             ret = espnow_ota_status_handle(src_addr, (espnow_ota_status_t *)data, size);
             break;
 
-        case ESPNOW_OTA_TYPE_DATA:
+        case ESPNOW_OTA_TYPE_DATA: {
             ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_DATA");
-            ret = espnow_ota_write(src_addr, (espnow_ota_packet_t *)data, size);
+            const espnow_ota_packet_t *packet = (espnow_ota_packet_t *)data;
+
+            if (g_ota_config && (g_ota_packet.packet_size != ESPNOW_OTA_PACKET_MAX_SIZE || g_ota_packet.flags)) {
+                ESP_LOGD(TAG, "Legacy packet in an upgrade with packet_size: %d", g_ota_packet.packet_size);
+                break;
+            }
+
+            ret = espnow_ota_write(src_addr, packet->seq, (uint32_t)packet->seq * ESPNOW_OTA_PACKET_MAX_SIZE,
+                                   packet->data, packet->size);
+            break;
+        }
+
+#if ESPNOW_OTA_FEC_ENABLE
+        case ESPNOW_OTA_TYPE_REPAIR:
+            ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_REPAIR");
+            ret = espnow_ota_repair(src_addr, (espnow_ota_repair_t *)data, size);
+            break;
+#endif
+
+        case ESPNOW_OTA_TYPE_DATA_V2: {
+            ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_DATA_V2");
+            const espnow_ota_packet_v2_t *packet = (espnow_ota_packet_v2_t *)data;
+
+            if (size < sizeof(espnow_ota_packet_v2_t) || size < sizeof(espnow_ota_packet_v2_t) + packet->size
+                    || packet->size > ESPNOW_OTA_PACKET_V2_MAX_SIZE) {
+                ESP_LOGD(TAG, "Invalid packet, size: %d", size);
+                break;
+            }
+
+            if (!g_ota_config || g_ota_packet.flags) {
+                ESP_LOGD(TAG, "Not an upgrade with uncompressed packets");
+                break;
+            }
+
+            ret = espnow_ota_write(src_addr, packet->seq, (uint32_t)packet->seq * g_ota_packet.packet_size,
+                                   packet->data, packet->size);
+
+#if ESPNOW_OTA_FEC_ENABLE
+            if (ret == ESP_OK) {
+                ret = espnow_ota_fec_solve(src_addr);
+            }
+#endif
+            break;
+        }
+
+        case ESPNOW_OTA_TYPE_DATA_LZ:
+            ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_DATA_LZ");
+            ret = espnow_ota_write_lz(src_addr, (espnow_ota_packet_lz_t *)data, size);
+            break;
+
+        case ESPNOW_OTA_TYPE_DATA_DELTA:
+            ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_DATA_DELTA");
+            ret = espnow_ota_write_delta(src_addr, (espnow_ota_packet_delta_t *)data, size);
+            break;
+
+        case ESPNOW_OTA_TYPE_HASH:
+            ESP_LOGD(TAG, "ESPNOW_OTA_TYPE_HASH");
+            ret = espnow_ota_hash_receive((espnow_ota_hash_t *)data, size);
             break;
 
         default:
@@ -474,7 +2450,11 @@ esp_err_t espnow_ota_responder_start(const espnow_ota_config_t *config)
 
     g_espnow_ota_config = ESP_MALLOC(sizeof(espnow_ota_config_t));
     memcpy(g_espnow_ota_config, config, sizeof(espnow_ota_config_t));
+
+    /**< Hashed here rather than by the first info reply, which the timer service task sends */
+    g_running_sha_256_set = esp_partition_get_sha256(esp_ota_get_running_partition(), g_running_sha_256) == ESP_OK;
+
     espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_OTA_DATA, 1, espnow_ota_responder_data_process);
 
-    return ESP_OK;
+    return espnow_ota_relay_resume();
 }
@@ -51,16 +51,16 @@ extern "C" {
 #define ESP_EVENT_ESPNOW_OTA_STOPED            (ESP_EVENT_ESPNOW_OTA_BASE + 4) /**< Stop upgrading */
 #define ESP_EVENT_ESPNOW_OTA_FIRMWARE_DOWNLOAD (ESP_EVENT_ESPNOW_OTA_BASE + 5) /**< Start writing firmware to flash */
 #define ESP_EVENT_ESPNOW_OTA_SEND_FINISH       (ESP_EVENT_ESPNOW_OTA_BASE + 6) /**< Send the firmware to other devices to complete */
+#define ESP_EVENT_ESPNOW_OTA_RELAY_FINISH      (ESP_EVENT_ESPNOW_OTA_BASE + 7) /**< No neighbor needs the firmware relayed any more */
 
 /**
  * @brief Firmware subcontract upgrade.
  *
- * OTA chunk sizes are pinned to the legacy 230-byte budget so frames remain
+ * The default OTA chunk size is pinned to the legacy 230-byte budget so frames remain
  * byte-compatible with esp-now <= v2.5.3 and fit in the uint8_t
- * espnow_ota_packet_t::size field. The wider ESP-NOW v2 frame budget
- * benefits general application traffic; OTA does not require it and
- * preserves interoperability with older responders by keeping the legacy
- * sizing.
+ * espnow_ota_packet_t::size field. Responders built on ESP-NOW v2 report a larger
+ * packet size in ESPNOW_OTA_TYPE_INFO, the initiator uses it with espnow_ota_packet_v2_t
+ * only when every responder of the upgrade supports it.
  */
 #ifdef CONFIG_ESPNOW_APP_SECURITY
 #define ESPNOW_OTA_LEGACY_DATA_LEN             (218)  /* 230 - TAG_LEN(4) - IV_LEN(8) */
@@ -84,6 +84,13 @@ extern "C" {
  */
 #define ESPNOW_OTA_GET_BITS(data, bits)        ( (((uint8_t *)(data))[(bits) >> 0x3]) & ( 1 << ((bits) & 0x7)) )
 #define ESPNOW_OTA_SET_BITS(data, bits)        do { (((uint8_t *)(data))[(bits) >> 0x3]) |= ( 1 << ((bits) & 0x7)); } while(0);
+#define ESPNOW_OTA_CLEAR_BITS(data, bits)      do { (((uint8_t *)(data))[(bits) >> 0x3]) &= ~( 1 << ((bits) & 0x7)); } while(0);
+
+/**
+ * @brief ID of the campaign sending a firmware, the checkpoint of espnow_ota_initiator_send() is resumed by it
+ */
+#define ESPNOW_OTA_CAMPAIGN_ID(sha_256)        ( ((uint32_t)(sha_256)[0] << 24) | ((uint32_t)(sha_256)[1] << 16) \
+                                                 | ((uint32_t)(sha_256)[2] << 8) | (uint32_t)(sha_256)[3] )
 
 /**
  * @brief Firmware upgrade information
@@ -101,8 +108,44 @@ typedef struct espnow_ota_responder_s {
     int8_t rssi;                /**< Packet rssi */
     uint8_t channel;            /**< Responder channel */
     esp_app_desc_t app_desc;    /**< Application description of responder */
+    uint16_t packet_size;       /**< Maximum firmware length of a single packet the responder accepts */
+    uint8_t flags;              /**< Capabilities of the responder, ESPNOW_OTA_CAP_* */
+    uint8_t running_sha_256[ESPNOW_OTA_HASH_LEN]; /**< Running firmware of the responder, the base of a patch, 0 if not reported */
 } espnow_ota_responder_t;
 
+/**
+ * @brief Length of ESPNOW_OTA_TYPE_INFO on air, sha256 of elf file (32 Byte) + reserv2 (20 Byte) are not sent
+ */
+#define ESPNOW_OTA_INFO_SIZE                   (sizeof(espnow_ota_info_t) - 32 - 20)
+
+/**
+ * @brief Capabilities appended to ESPNOW_OTA_TYPE_INFO, older responders do not send them
+ */
+typedef struct espnow_ota_info_ext_s {
+    uint16_t packet_size;       /**< Maximum firmware length of a single packet the responder accepts */
+    uint8_t flags;              /**< Capabilities of the responder, ESPNOW_OTA_CAP_* */
+    uint8_t running_sha_256[ESPNOW_OTA_HASH_LEN]; /**< SHA-256 of the running partition, the same as espnow_ota_status_t::sha_256 */
+} ESPNOW_PACKED_STRUCT espnow_ota_info_ext_t;
+
+#define ESPNOW_OTA_CAP_FEC                     BIT(0)  /**< Decodes ESPNOW_OTA_TYPE_REPAIR */
+#define ESPNOW_OTA_CAP_COMPRESS                BIT(1)  /**< Decodes ESPNOW_OTA_TYPE_DATA_LZ */
+#define ESPNOW_OTA_CAP_DELTA                   BIT(2)  /**< Applies ESPNOW_OTA_TYPE_DATA_DELTA to the running firmware */
+#define ESPNOW_OTA_CAP_HASH                    BIT(3)  /**< Verifies the blocks of the firmware with ESPNOW_OTA_TYPE_HASH */
+
+/**
+ * @brief ESPNOW_OTA_TYPE_REQUEST of espnow_ota_initiator_scan(), older responders only read the type and reply at once.
+ *        The responders in the part asked reply at a random time in the window, the ones in the filter do not reply.
+ */
+typedef struct espnow_ota_scan_s {
+    uint8_t type;               /**< Type of packet, ESPNOW_OTA_TYPE_REQUEST */
+    uint16_t reply_window;      /**< The replies are spread over it, in ms */
+    uint8_t part_num;           /**< The responders are split by espnow_ota_mac_hash(mac, 0) % part_num */
+    uint8_t part;               /**< Part of the responders asked */
+    uint16_t seed;              /**< Seed of the hashes of the filter */
+    uint8_t hash_num;           /**< Bits set for a MAC in the filter, 0 for no filter */
+    uint8_t filter[0];          /**< Bloom filter of the responders heard, to the end of the request */
+} ESPNOW_PACKED_STRUCT espnow_ota_scan_t;
+
 /**
  * @brief Type of packet
  */
@@ -111,6 +154,12 @@ typedef enum {
     ESPNOW_OTA_TYPE_INFO,
     ESPNOW_OTA_TYPE_DATA,
     ESPNOW_OTA_TYPE_STATUS,
+    ESPNOW_OTA_TYPE_DATA_V2,    /**< Firmware packet larger than ESPNOW_OTA_PACKET_MAX_SIZE */
+    ESPNOW_OTA_TYPE_REPAIR,     /**< XOR of the firmware packets lost by the responders */
+    ESPNOW_OTA_TYPE_DATA_LZ,    /**< Compressed firmware packet */
+    ESPNOW_OTA_TYPE_DATA_DELTA, /**< Patch packet, applied to the running firmware */
+    ESPNOW_OTA_TYPE_NACK,       /**< Status with the ranges of all the packets lost */
+    ESPNOW_OTA_TYPE_HASH,       /**< Hashes of the blocks of the firmware */
 } espnow_ota_type_t;
 
 /**
@@ -123,6 +172,89 @@ typedef struct espnow_ota_packet_s {
     uint8_t data[ESPNOW_OTA_PACKET_MAX_SIZE];   /**< Firmware */
 } ESPNOW_PACKED_STRUCT espnow_ota_packet_t;
 
+/**
+ * @brief Firmware packet of the upgrade with a negotiated packet size
+ */
+typedef struct espnow_ota_packet_v2_s {
+    uint8_t type;                               /**< Type of packet, ESPNOW_OTA_TYPE_DATA_V2 */
+    uint16_t seq;                               /**< Sequence */
+    uint16_t size;                              /**< Size */
+    uint8_t data[0];                            /**< Firmware */
+} ESPNOW_PACKED_STRUCT espnow_ota_packet_v2_t;
+
+/**
+ * @brief Repair packet, the XOR of the packets of one block picked by mask.
+ *        Packets shorter than the packet size are padded with 0.
+ */
+typedef struct espnow_ota_repair_s {
+    uint8_t type;                               /**< Type of packet, ESPNOW_OTA_TYPE_REPAIR */
+    uint16_t seq;                               /**< Sequence of the first packet of the block */
+    uint32_t mask;                              /**< Bit n is set if packet seq + n is in the XOR */
+    uint16_t size;                              /**< Size, the packet size of the upgrade */
+    uint8_t data[0];                            /**< XOR of the packets */
+} ESPNOW_PACKED_STRUCT espnow_ota_repair_t;
+
+#define ESPNOW_OTA_FEC_BLOCK_SIZE              32  /**< Number of packets a repair packet can cover, bits of espnow_ota_repair_t::mask */
+
+/**
+ * @brief Compressed packet, the firmware at offset compressed on its own with espnow_ota_lz_compress(),
+ *        so it is decompressed whatever packets have been received before
+ */
+typedef struct espnow_ota_packet_lz_s {
+    uint8_t type;                               /**< Type of packet, ESPNOW_OTA_TYPE_DATA_LZ */
+    uint16_t seq;                               /**< Sequence */
+    uint32_t offset;                            /**< Offset of the decompressed data in the firmware */
+    uint16_t raw_size;                          /**< Size of the decompressed data */
+    uint16_t size;                              /**< Size of the compressed data, at most the packet size */
+    uint8_t data[0];                            /**< Compressed firmware */
+} ESPNOW_PACKED_STRUCT espnow_ota_packet_lz_t;
+
+#define ESPNOW_OTA_LZ_BLOCK_MAX                4096  /**< Maximum decompressed size of a compressed packet, one flash sector */
+
+/**
+ * @brief Record of a patch. A patch is the records of the new firmware in order, one per packet,
+ *        each one rebuilds raw_size bytes of the new firmware on its own:
+ *        new[offset + i] = running[base_offset + i] + diff[i] (mod 256),
+ *        diff is data decompressed with espnow_ota_lz_decompress().
+ */
+typedef struct espnow_ota_delta_record_s {
+    uint32_t offset;                            /**< Offset of the data in the new firmware */
+    uint16_t raw_size;                          /**< Size of the data in the new firmware */
+    uint16_t size;                              /**< Size of the compressed diff, at most the packet size */
+    uint32_t base_offset;                       /**< Offset in the running firmware, ESPNOW_OTA_DELTA_BASE_NONE to take diff as is */
+    uint8_t data[0];                            /**< Compressed diff */
+} ESPNOW_PACKED_STRUCT espnow_ota_delta_record_t;
+
+#define ESPNOW_OTA_DELTA_BASE_NONE             UINT32_MAX  /**< The record does not use the running firmware */
+
+/**
+ * @brief Patch packet, a record of the patch
+ */
+typedef struct espnow_ota_packet_delta_s {
+    uint8_t type;                               /**< Type of packet, ESPNOW_OTA_TYPE_DATA_DELTA */
+    uint16_t seq;                               /**< Sequence, the index of the record */
+    espnow_ota_delta_record_t record;           /**< Record of the patch */
+} ESPNOW_PACKED_STRUCT espnow_ota_packet_delta_t;
+
+#define ESPNOW_OTA_HASH_BLOCK_SIZE             4096  /**< Size of a block verified on its own, one flash sector */
+#define ESPNOW_OTA_BLOCK_HASH_LEN              8     /**< Length of the hash of a block */
+
+/**
+ * @brief Hashes of the blocks of the firmware from index, the first ESPNOW_OTA_BLOCK_HASH_LEN bytes
+ *        of the SHA-256 of each block of ESPNOW_OTA_HASH_BLOCK_SIZE bytes. The hash list is checked
+ *        against espnow_ota_status_ext_t::hash_root, then each block against its hash once received.
+ */
+typedef struct espnow_ota_hash_s {
+    uint8_t type;                               /**< Type of packet, ESPNOW_OTA_TYPE_HASH */
+    uint16_t index;                             /**< Block of the first hash */
+    uint16_t num;                               /**< Number of the hashes */
+    uint8_t hashes[0][ESPNOW_OTA_BLOCK_HASH_LEN]; /**< Hashes of the blocks */
+} ESPNOW_PACKED_STRUCT espnow_ota_hash_t;
+
+/**< The packet size leaves room for the largest header, the one of the patch packet */
+#define ESPNOW_OTA_PACKET_V2_DATA_LEN          ((ESPNOW_DATA_LEN - sizeof(espnow_ota_packet_delta_t)) - (ESPNOW_DATA_LEN - sizeof(espnow_ota_packet_delta_t)) % 16)
+#define ESPNOW_OTA_PACKET_V2_MAX_SIZE          (ESPNOW_OTA_PACKET_V2_DATA_LEN > ESPNOW_OTA_PACKET_MAX_SIZE ? ESPNOW_OTA_PACKET_V2_DATA_LEN : ESPNOW_OTA_PACKET_MAX_SIZE)  /**< Maximum length of a single packet on ESP-NOW v2 */
+
 /**
  * @brief Upgrade configuration
  */
@@ -145,6 +277,61 @@ typedef struct espnow_ota_status_s {
     uint8_t progress_array[0][ESPNOW_OTA_PROGRESS_MAX_SIZE]; /**< Identify if each packet of data has been written */
 } ESPNOW_PACKED_STRUCT espnow_ota_status_t;
 
+/**
+ * @brief Appended to the status request of the initiator, older responders ignore it.
+ *        With ESPNOW_OTA_CAP_COMPRESS or ESPNOW_OTA_CAP_DELTA, sha_256, total_size and written_size
+ *        of the status still describe the new firmware, packet_num is the number of packets sent.
+ */
+typedef struct espnow_ota_status_ext_s {
+    uint16_t packet_size;                   /**< Firmware length of every packet but the last one */
+    uint8_t flags;                          /**< Capabilities the upgrade uses, ESPNOW_OTA_CAP_COMPRESS or ESPNOW_OTA_CAP_DELTA */
+    uint8_t base_sha_256[ESPNOW_OTA_HASH_LEN]; /**< With ESPNOW_OTA_CAP_DELTA, the running firmware the patch applies to */
+    uint16_t reply_window;                  /**< The responders reply with espnow_ota_nack_t at a random time in this window (ms),
+                                                 0 or older responders reply with a chunk of the progress bitmap */
+    uint8_t relay_hops;                     /**< Hops further the responders relay the firmware once finished, 0 for none */
+    uint8_t relay_depth;                    /**< Hops from the root of the initiator, 0 at the root */
+    uint8_t hash_root[ESPNOW_OTA_HASH_LEN]; /**< First bytes of the SHA-256 of the hash list, all 0 if the blocks
+                                                 are not verified. Only used for the uncompressed upgrades */
+} ESPNOW_PACKED_STRUCT espnow_ota_status_ext_t;
+
+/**
+ * @brief Relay of the firmware. A responder told to relay serves the firmware to its neighbors
+ *        once finished, as the root does, and tells them to relay it relay_hops - 1 hops further.
+ *        The firmware spreads hop by hop to the devices out of range of the root.
+ */
+typedef struct espnow_ota_relay_s {
+    uint8_t hops;                           /**< Hops further the responders relay the firmware, 0 for none */
+    uint8_t depth;                          /**< Hops from the root of the initiator, 0 at the root */
+} espnow_ota_relay_t;
+
+/**
+ * @brief Packets lost from start to start + num - 1
+ */
+typedef struct espnow_ota_range_s {
+    uint16_t start;
+    uint16_t num;
+} ESPNOW_PACKED_STRUCT espnow_ota_range_t;
+
+/**
+ * @brief Status reply listing all the packets lost, the close ranges are merged into one
+ *        when they do not fit in a frame, which only resends some packets again
+ */
+typedef struct espnow_ota_nack_s {
+    espnow_ota_status_t status;             /**< Type is ESPNOW_OTA_TYPE_NACK, progress_index is not used */
+    uint16_t range_num;                     /**< Number of the ranges */
+    espnow_ota_range_t ranges[0];           /**< Ranges in ascending order */
+} ESPNOW_PACKED_STRUCT espnow_ota_nack_t;
+
+/**
+ * @brief Appended to the ranges of espnow_ota_nack_t and to the status reply without the progress bitmap,
+ *        older initiators ignore it. Counted since the packets of the last round, the initiator paces
+ *        the packets by it.
+ */
+typedef struct espnow_ota_feedback_s {
+    uint16_t received;                      /**< Firmware and repair packets received */
+    uint16_t dropped;                       /**< Frames lost as the receive queue of ESP-NOW was full */
+} ESPNOW_PACKED_STRUCT espnow_ota_feedback_t;
+
 /**
  * @brief List of device status during the upgrade process
  */
@@ -171,6 +358,10 @@ typedef struct espnow_ota_result_s {
  * @brief  The upgrade data callback function
  *         Read firmware data from flash to send to unfinished device.
  *
+ * @note   With CONFIG_ESPNOW_OTA_READ_AHEAD_NUM, it is called by a task reading ahead of the sending,
+ *         for blocks of CONFIG_ESPNOW_OTA_READ_AHEAD_BLOCK_SIZE bytes at any offset, one call at a time.
+ *         Set CONFIG_ESPNOW_OTA_READ_AHEAD_NUM to 0 for the data sources reading a packet at a time.
+ *
  * @param[in]  src_offset  address of the data to be read, relative to the
  *             beginning of the partition.
  * @param[out]  dst  pointer to the buffer where data should be stored.
@@ -183,6 +374,104 @@ typedef struct espnow_ota_result_s {
  */
 typedef esp_err_t (* espnow_ota_initiator_data_cb_t)(size_t src_offset, void *dst, size_t size);
 
+/**
+ * @brief Firmware sent by espnow_ota_initiator_send_multi() to its own responders
+ */
+typedef struct {
+    const espnow_addr_t *addrs_list;            /**< Responders of the firmware, ESPNOW_ADDR_BROADCAST for the
+                                                     responders running the project of the firmware */
+    size_t addrs_num;                           /**< Number of the responders */
+    uint8_t sha_256[ESPNOW_OTA_HASH_LEN];       /**< SHA-256 digest of the firmware */
+    size_t size;                                /**< Size of the firmware */
+    espnow_ota_initiator_data_cb_t ota_data_cb; /**< Data callback function of the firmware */
+    esp_err_t ret;                              /**< Result of the upgrade, set when it is done */
+    espnow_ota_result_t result;                 /**< Responders upgraded, must call espnow_ota_initiator_result_free to free memory */
+} espnow_ota_campaign_t;
+
+/**
+ * @brief  Compress data into a block which is decompressed on its own, LZ77 with the window in the block.
+ *         It stops when dst is full, so as much of src as fits in dst is taken.
+ *
+ * @param[in]   src  data to compress, at most ESPNOW_OTA_LZ_BLOCK_MAX bytes
+ * @param[in]   src_len  length of src
+ * @param[out]  dst  buffer of the compressed data
+ * @param[in]   dst_len  length of dst
+ * @param[out]  consumed  length of src compressed
+ * @param[out]  olen  length of the compressed data
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_NO_MEM
+ */
+esp_err_t espnow_ota_lz_compress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len,
+                                 size_t *consumed, size_t *olen);
+
+/**
+ * @brief  Decompress a block compressed by espnow_ota_lz_compress()
+ *
+ * @param[in]   src  compressed data
+ * @param[in]   src_len  length of src
+ * @param[out]  dst  buffer of the decompressed data
+ * @param[in]   dst_len  length of dst
+ * @param[out]  olen  length of the decompressed data
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_INVALID_SIZE  the data is corrupted or dst is too small
+ */
+esp_err_t espnow_ota_lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len, size_t *olen);
+
+/**
+ * @brief  Hash data with SHA-256, truncated to the length given
+ *
+ * @param[in]   data  data to hash
+ * @param[in]   size  length of data
+ * @param[out]  hash  buffer of the hash
+ * @param[in]   hash_len  length of hash, at most 32
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_FAIL
+ */
+esp_err_t espnow_ota_hash(const void *data, size_t size, uint8_t *hash, size_t hash_len);
+
+/**
+ * @brief  Hash a MAC address with FNV-1a, the responders of a scan are split by it
+ *
+ * @param[in]  mac  MAC address
+ * @param[in]  seed  seed of the hash
+ *
+ * @return  hash of the MAC address
+ */
+uint32_t espnow_ota_mac_hash(const uint8_t mac[ESPNOW_ADDR_LEN], uint32_t seed);
+
+/**
+ * @brief  Add a MAC address to the Bloom filter of espnow_ota_scan_t
+ *
+ * @param[inout]  filter  Bloom filter
+ * @param[in]  size  length of filter
+ * @param[in]  hash_num  bits set for a MAC address
+ * @param[in]  seed  seed of the hashes
+ * @param[in]  mac  MAC address
+ */
+void espnow_ota_filter_add(uint8_t *filter, size_t size, uint8_t hash_num, uint32_t seed, const uint8_t mac[ESPNOW_ADDR_LEN]);
+
+/**
+ * @brief  Check if a MAC address may be in the Bloom filter of espnow_ota_scan_t
+ *
+ * @param[in]  filter  Bloom filter
+ * @param[in]  size  length of filter
+ * @param[in]  hash_num  bits set for a MAC address
+ * @param[in]  seed  seed of the hashes
+ * @param[in]  mac  MAC address
+ *
+ * @return  false if the MAC address was not added, true if it was or for a false positive
+ */
+bool espnow_ota_filter_test(const uint8_t *filter, size_t size, uint8_t hash_num, uint32_t seed, const uint8_t mac[ESPNOW_ADDR_LEN]);
+
 /**
  * @brief  Root sends firmware to other nodes
  *
@@ -204,6 +493,133 @@ esp_err_t espnow_ota_initiator_send(const espnow_addr_t *addrs_list, size_t addr
                                    const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
                                    espnow_ota_initiator_data_cb_t ota_data_cb, espnow_ota_result_t *res);
 
+/**
+ * @brief  Root sends a patch to the nodes running the firmware it applies to, the nodes rebuild
+ *         the new firmware from the running one, the patch is much smaller than the firmware
+ *         when they differ a little.
+ *
+ * @note   Nodes running another firmware or not supporting patches are skipped, they are left in
+ *         the unfinished list of res, send the patch of their firmware or the full firmware to them.
+ *         Group a mixed fleet by espnow_ota_responder_t::running_sha_256 from espnow_ota_initiator_scan().
+ *         The patch is generated by tools/espnow_ota_delta.py.
+ *
+ * @attention Only called at the root
+ *
+ * @param[in]  addrs_list  destination node mac list
+ * @param[in]  addrs_num  number of destination nodes
+ * @param[in]  sha_256  SHA-256 digest of the new firmware
+ * @param[in]  size  new firmware total size
+ * @param[in]  base_sha_256  SHA-256 digest of the firmware the patch applies to
+ * @param[in]  patch_size  total size of the patch, records of espnow_ota_delta_record_t
+ * @param[in]  patch_data_cb  patch data callback function
+ * @param[out]  res  must call espnow_ota_initiator_result_free to free memory
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE
+ *    - ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST
+ */
+esp_err_t espnow_ota_initiator_send_delta(const espnow_addr_t *addrs_list, size_t addrs_num,
+                                         const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
+                                         const uint8_t base_sha_256[ESPNOW_OTA_HASH_LEN], size_t patch_size,
+                                         espnow_ota_initiator_data_cb_t patch_data_cb, espnow_ota_result_t *res);
+
+/**
+ * @brief  Send firmware to other nodes, which relay it to their neighbors once finished
+ *
+ * @note   espnow_ota_initiator_send() relays CONFIG_ESPNOW_OTA_RELAY_HOPS hops. The responders relaying
+ *         the firmware call it with the depth of theirs, they are rate limited and the responders keep
+ *         the upgrade of another relay in progress, a relay is only sent ESP_ERR_ESPNOW_OTA_FINISH
+ *         by the responders which have the firmware already.
+ *
+ * @param[in]  addrs_list  destination node mac list
+ * @param[in]  addrs_num  number of destination nodes
+ * @param[in]  sha_256  SHA-256 digest for the upgrade partition
+ * @param[in]  size  upgrade firmware total size
+ * @param[in]  ota_data_cb  upgrade data callback function
+ * @param[in]  relay  hops the responders relay the firmware
+ * @param[out]  res  must call espnow_ota_initiator_result_free to free memory
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_ESPNOW_OTA_FIRMWARE_NOT_INIT
+ *    - ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST
+ */
+esp_err_t espnow_ota_initiator_send_relay(const espnow_addr_t *addrs_list, size_t addrs_num,
+                                         const uint8_t sha_256[ESPNOW_OTA_HASH_LEN], size_t size,
+                                         espnow_ota_initiator_data_cb_t ota_data_cb, const espnow_ota_relay_t *relay,
+                                         espnow_ota_result_t *res);
+
+/**
+ * @brief  Send several firmwares at once, each one to its own responders
+ *
+ * @note   Each firmware is sent by a task to a group of its own, the packets of the firmwares are interleaved
+ *         in proportion to the packets each one has left to send, so they are done about together. The status
+ *         of a firmware is waited for while the others are sent. A campaign to ESPNOW_ADDR_BROADCAST only
+ *         upgrades the responders running the project of its firmware, which is read from the esp_app_desc_t
+ *         of the firmware.
+ *
+ * @param[inout]  campaigns  firmwares to send, the result of each one is set when the call returns
+ * @param[in]  num  number of the firmwares, at most CONFIG_ESPNOW_OTA_CAMPAIGN_MAX
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_INVALID_STATE
+ *    - ESP_ERR_NO_MEM
+ *    - the first error of the firmwares
+ */
+esp_err_t espnow_ota_initiator_send_multi(espnow_ota_campaign_t *campaigns, size_t num);
+
+/**
+ * @brief  Resume a campaign of espnow_ota_initiator_send() or espnow_ota_initiator_send_multi() stopped
+ *         by espnow_ota_initiator_stop(), a reboot or a failure
+ *
+ * @note   The campaigns save a checkpoint after each round once espnow_ota_initiator_checkpoint_enable() is
+ *         called: the firmware, the responders upgraded, the ones left and the packets they miss. The campaign
+ *         resumed skips the scan and the responders upgraded, and sends the packets missed before asking for
+ *         the status again. The checkpoint is erased when no responder is left to upgrade, and when a campaign
+ *         of another firmware starts.
+ *
+ * @param[in]  campaign_id  ESPNOW_OTA_CAMPAIGN_ID() of the SHA-256 digest of the firmware
+ * @param[in]  ota_data_cb  data callback function of the same firmware
+ * @param[out]  res  must call espnow_ota_initiator_result_free to free memory, the responders upgraded
+ *                   before the checkpoint included
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_NOT_FOUND
+ *    - ESP_ERR_NOT_SUPPORTED
+ *    - ESP_ERR_ESPNOW_OTA_FIRMWARE_INCOMPLETE
+ *    - ESP_ERR_ESPNOW_OTA_DEVICE_NO_EXIST
+ */
+esp_err_t espnow_ota_initiator_resume(uint32_t campaign_id, espnow_ota_initiator_data_cb_t ota_data_cb,
+                                      espnow_ota_result_t *res);
+
+/**
+ * @brief  Save the checkpoints of the campaigns started from now on, they are not saved by default
+ *
+ * @param[in]  enable  true to save the progress of each round to the flash
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_NOT_SUPPORTED: CONFIG_ESPNOW_OTA_CHECKPOINT is not enabled
+ */
+esp_err_t espnow_ota_initiator_checkpoint_enable(bool enable);
+
+/**
+ * @brief  Erase the checkpoint of a campaign, it is then not resumed
+ *
+ * @param[in]  campaign_id  ESPNOW_OTA_CAMPAIGN_ID() of the SHA-256 digest of the firmware
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_FAIL
+ */
+esp_err_t espnow_ota_initiator_checkpoint_erase(uint32_t campaign_id);
+
 /**
  * @brief Stop root to send firmware to other nodes
  *
@@ -213,6 +629,15 @@ esp_err_t espnow_ota_initiator_send(const espnow_addr_t *addrs_list, size_t addr
  */
 esp_err_t espnow_ota_initiator_stop();
 
+/**
+ * @brief Ask root to stop sending firmware without waiting for it, for the tasks the upgrade may wait on.
+ *        The scan and the waits for the status replies return within 100 ms.
+ *
+ * @return
+ *    - ESP_OK
+ */
+esp_err_t espnow_ota_initiator_request_stop(void);
+
 /**
  * @brief  Free memory in the result list
  *
@@ -29,6 +29,8 @@ extern "C" {
 #define IV_LEN                              8       /**< The initialization vector (nonce) length */
 #define TAG_LEN                             4       /**< The length of the authentication field */
 #define ESPNOW_SEC_PACKET_MAX_SIZE          (ESPNOW_PAYLOAD_LEN - TAG_LEN - IV_LEN)  /**< Maximum length of a single encrypted packet transmitted */
+#define ESPNOW_SEC_KEY_SLOT_NUM             2       /**< Current and next key */
+#define ESPNOW_SEC_KEY_ID_MASK              0x3     /**< Key id carried in the frame header, see espnow_frame_head_t */
 
 #define ESP_EVENT_ESPNOW_SEC_OK             0x600
 #define ESP_EVENT_ESPNOW_SEC_FAIL           0x601
@@ -41,6 +43,17 @@ typedef enum {
     ESPNOW_SEC_OVER,            /**< Security handshake is over and APP key is received */
 } espnow_sec_state_t;
 
+/**
+ * @brief Cipher suite of the frame encryption, all suites use the same key, nonce and tag length
+ */
+typedef enum {
+    ESPNOW_SEC_SUITE_AES_CCM,       /**< AES-128-CCM, the default */
+    ESPNOW_SEC_SUITE_AES_GCM,       /**< Reserved, not offered: GCM with the 4-byte tag and the random 64-bit nonce
+                                         of the frame leaks its authentication key to forgery attempts */
+    ESPNOW_SEC_SUITE_CHACHAPOLY,    /**< ChaCha20-Poly1305, faster without AES acceleration */
+    ESPNOW_SEC_SUITE_MAX,
+} espnow_sec_suite_t;
+
 /**
  * @brief Struct of security
  */
@@ -51,6 +64,7 @@ typedef struct espnow_sec_s {
     uint8_t key_len;            /**< Secret key length */
     uint8_t iv_len;             /**< The initialization vector (nonce) length */
     uint8_t tag_len;            /**< The length of the authentication field */
+    uint8_t suite;              /**< Cipher suite defined by espnow_sec_suite_t */
     void *cipher_ctx;           /**< The cipher context */
 } espnow_sec_t;
 
@@ -74,6 +88,25 @@ esp_err_t espnow_sec_init(espnow_sec_t *sec);
  */
 esp_err_t espnow_sec_deinit(espnow_sec_t *sec);
 
+/**
+ * @brief Change the cipher suite of the specified security info, the key which has been set is kept
+ *
+ * @param[in]  sec    the security info to change. This must not be NULL.
+ * @param[in]  suite  cipher suite defined by espnow_sec_suite_t
+ *
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ *    - ESP_ERR_NOT_SUPPORTED
+ */
+esp_err_t espnow_sec_set_suite(espnow_sec_t *sec, uint8_t suite);
+
+/**
+ * @brief Get the cipher suites built in
+ *
+ * @return bitmap of espnow_sec_suite_t, bit n is set if suite n is supported
+ */
+uint8_t espnow_sec_suite_supported(void);
+
 /**
  * @brief Set the security key info
  * 
@@ -87,7 +120,7 @@ esp_err_t espnow_sec_setkey(espnow_sec_t *sec, uint8_t app_key[APP_KEY_LEN]);
 
 /**
  * @brief The authenticated encryption function.
- *        Encryption with 128 bit AES-CCM
+ *        Encryption with the cipher suite of sec, 128 bit AES-CCM by default
  *
  * @note  the tag will be appended to the ciphertext
  * 
@@ -109,7 +142,7 @@ esp_err_t espnow_sec_auth_encrypt(espnow_sec_t *sec, const uint8_t *input, size_
 
 /**
  * @brief The authenticated decryption function.
- *        Decryption with 128 bit AES-CCM
+ *        Decryption with the cipher suite of sec, 128 bit AES-CCM by default
  *
  * @note  the tag must be appended to the ciphertext
  * 
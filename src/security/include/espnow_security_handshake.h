@@ -35,8 +35,15 @@ typedef enum {
     ESPNOW_SEC_TYPE_KEY,        /**< Packet containing app key */
     ESPNOW_SEC_TYPE_KEY_RESP,   /**< Response to confirm gotten the app key */
     ESPNOW_SEC_TYPE_REST,       /**< Reset security information */
+    ESPNOW_SEC_TYPE_REKEY,      /**< New app key wrapped for a group of responders */
+    ESPNOW_SEC_TYPE_REKEY_ACK,  /**< Response to confirm gotten the new app key */
+    ESPNOW_SEC_TYPE_REKEY_SWITCH, /**< Switch over to the new app key */
+    ESPNOW_SEC_TYPE_RESUME,     /**< Resume with the ticket got in the last handshake */
+    ESPNOW_SEC_TYPE_RESUME_RESP,/**< Current app key and a new ticket */
 } espnow_sec_type_t;
 
+#define ESPNOW_SEC_KEK_LEN          KEY_LEN     /**< Key-encryption key length */
+
 /**
  * @brief Security version
  */
@@ -46,12 +53,20 @@ typedef enum {
     ESPNOW_SEC_VER_V1_1,        /**< Used in the future */
 } espnow_sec_ver_type_t;
 
+/**
+ * @brief An unconfigured responder reports the cipher suites it supports in the high 4 bits of sec_ver,
+ *        bit n for suite n of espnow_sec_suite_t. Older responders leave them 0, AES-CCM is always supported.
+ */
+#define ESPNOW_SEC_VER(sec_ver)             ((sec_ver) & 0x0F)
+#define ESPNOW_SEC_VER_SUITES(sec_ver)      ((((sec_ver) >> 4) & 0x0F) | BIT(ESPNOW_SEC_SUITE_AES_CCM))
+#define ESPNOW_SEC_VER_SET_SUITES(sec_ver, suites) (((sec_ver) & 0x0F) | (((suites) & 0x0F) << 4))
+
 /**
  * @brief Security information
  */
 typedef struct espnow_sec_info_s {
     uint8_t type;               /**< ESPNOW_SEC_TYPE_REQUEST or ESPNOW_SEC_TYPE_INFO */
-    uint8_t sec_ver;            /**< Security version */
+    uint8_t sec_ver;            /**< Security version and the supported cipher suites, see ESPNOW_SEC_VER_SUITES */
     uint8_t client_mac[6];      /**< Mac address of initiator */
 } espnow_sec_info_t;
 
@@ -74,6 +89,107 @@ typedef struct espnow_sec_packet_s {
     uint8_t data[0];            /**< Message */
 } ESPNOW_PACKED_STRUCT espnow_sec_packet_t;
 
+/**
+ * @brief When a resumption ticket was issued, the root tells the age of a ticket from it without keeping any state
+ */
+typedef struct espnow_sec_ticket_issue_s {
+    uint32_t ticket_id;                         /**< Rekey id of the root when the ticket was issued */
+    uint32_t boot_count;                        /**< Boot count of the root when the ticket was issued */
+    uint32_t time;                              /**< Time of the root in seconds when the ticket was issued */
+} ESPNOW_PACKED_STRUCT espnow_sec_ticket_issue_t;
+
+#define ESPNOW_SEC_RESUME_NONCE_LEN     8
+
+/**
+ * @brief Content of ESPNOW_SEC_TYPE_KEY, older initiators only send app_key
+ */
+typedef struct espnow_sec_key_data_s {
+    uint8_t app_key[APP_KEY_LEN];               /**< APP key */
+    uint8_t kek[ESPNOW_SEC_KEK_LEN];            /**< Key-encryption key used by rekeying */
+    uint8_t key_id;                             /**< Key id of the APP key */
+    espnow_sec_ticket_issue_t issue;            /**< Issue of the resumption ticket */
+    uint8_t ticket[KEY_LEN];                    /**< Secret of the resumption ticket */
+    uint8_t suite;                              /**< Cipher suite, espnow_sec_suite_t */
+} ESPNOW_PACKED_STRUCT espnow_sec_key_data_t;
+
+/**
+ * @brief APP key, rekey id and cipher suite of the new key, wrapped for one responder.
+ *        The suite changes together with the key, so a network changes suites without handshaking again.
+ */
+#define ESPNOW_SEC_REKEY_PLAIN_LEN  (APP_KEY_LEN + sizeof(uint32_t) + sizeof(uint8_t))
+
+typedef struct espnow_sec_rekey_entry_s {
+    uint8_t addr[6];                                        /**< Mac address of responder */
+    uint8_t data[ESPNOW_SEC_REKEY_PLAIN_LEN + TAG_LEN];     /**< Wrapped key, encrypted with the KEK of responder */
+} ESPNOW_PACKED_STRUCT espnow_sec_rekey_entry_t;
+
+/**
+ * @brief Rekey packet, one broadcast carries the new APP key for many responders
+ */
+typedef struct espnow_sec_rekey_s {
+    uint8_t type;                       /**< ESPNOW_SEC_TYPE_REKEY */
+    uint32_t rekey_id;                  /**< Increases on every rekey, old packets are ignored */
+    uint8_t iv[IV_LEN];                 /**< The initialization vector (nonce) of the entries */
+    uint8_t num;                        /**< Number of entries */
+    espnow_sec_rekey_entry_t entry[0];  /**< Wrapped APP keys */
+} ESPNOW_PACKED_STRUCT espnow_sec_rekey_t;
+
+#define ESPNOW_SEC_REKEY_ENTRY_MAX  ((ESPNOW_DATA_LEN - sizeof(espnow_sec_rekey_t)) / sizeof(espnow_sec_rekey_entry_t))
+
+/**
+ * @brief Rekey response, the rekey id encrypted with the KEK proves it comes from the responder the key was wrapped for
+ */
+typedef struct espnow_sec_rekey_ack_s {
+    uint8_t type;                               /**< ESPNOW_SEC_TYPE_REKEY_ACK */
+    uint32_t rekey_id;                          /**< Rekey id of the APP key in use */
+    uint8_t iv[IV_LEN];                         /**< The initialization vector (nonce) of mic */
+    uint8_t mic[sizeof(uint32_t) + TAG_LEN];    /**< Rekey id, encrypted with the KEK of responder */
+} ESPNOW_PACKED_STRUCT espnow_sec_rekey_ack_t;
+
+/**
+ * @brief Switch-over command, the rekey id encrypted with the new APP key proves the sender owns it
+ */
+typedef struct espnow_sec_rekey_switch_s {
+    uint8_t type;                               /**< ESPNOW_SEC_TYPE_REKEY_SWITCH */
+    uint32_t rekey_id;                          /**< Rekey id of the APP key to switch to */
+    uint8_t iv[IV_LEN];                         /**< The initialization vector (nonce) of mic */
+    uint8_t mic[sizeof(uint32_t) + TAG_LEN];    /**< Rekey id, encrypted with the new APP key */
+} ESPNOW_PACKED_STRUCT espnow_sec_rekey_switch_t;
+
+/**
+ * @brief Resumption request, the nonce encrypted with the ticket secret proves the possession.
+ *        The nonce is fresh for every request and sent back in the response, so an old response can not be replayed.
+ */
+typedef struct espnow_sec_resume_s {
+    uint8_t type;                                           /**< ESPNOW_SEC_TYPE_RESUME */
+    espnow_sec_ticket_issue_t issue;                        /**< Issue of the ticket, the ticket secret is derived from it */
+    uint8_t nonce[ESPNOW_SEC_RESUME_NONCE_LEN];             /**< Random number of the responder */
+    uint8_t iv[IV_LEN];                                     /**< The initialization vector (nonce) of mic */
+    uint8_t mic[ESPNOW_SEC_RESUME_NONCE_LEN + TAG_LEN];     /**< Nonce, encrypted with the ticket secret */
+} ESPNOW_PACKED_STRUCT espnow_sec_resume_t;
+
+/**
+ * @brief Content of the resumption response
+ */
+typedef struct espnow_sec_resume_key_s {
+    uint8_t app_key[APP_KEY_LEN];               /**< Current APP key */
+    uint8_t key_id;                             /**< Key id of the APP key */
+    uint32_t rekey_id;                          /**< Rekey id of the APP key */
+    espnow_sec_ticket_issue_t issue;            /**< Issue of the new ticket */
+    uint8_t ticket[KEY_LEN];                    /**< Secret of the new ticket */
+    uint8_t suite;                              /**< Cipher suite, espnow_sec_suite_t */
+    uint8_t nonce[ESPNOW_SEC_RESUME_NONCE_LEN]; /**< Nonce of the request answered */
+} ESPNOW_PACKED_STRUCT espnow_sec_resume_key_t;
+
+/**
+ * @brief Resumption response
+ */
+typedef struct espnow_sec_resume_resp_s {
+    uint8_t type;                                           /**< ESPNOW_SEC_TYPE_RESUME_RESP */
+    uint8_t iv[IV_LEN];                                     /**< The initialization vector (nonce) of data */
+    uint8_t data[sizeof(espnow_sec_resume_key_t) + TAG_LEN];/**< espnow_sec_resume_key_t, encrypted with the ticket secret */
+} ESPNOW_PACKED_STRUCT espnow_sec_resume_resp_t;
+
 /**
  * @brief List of device status during the security process
  */
@@ -129,6 +245,60 @@ esp_err_t espnow_sec_initiator_scan_result_free(void);
 esp_err_t espnow_sec_initiator_start(uint8_t key_info[APP_KEY_LEN], const char *pop_data, const uint8_t addrs_list[][6], size_t addrs_num,
                                     espnow_sec_result_t *res);
 
+/**
+ * @brief  Root distributes a new APP key to the nodes without handshaking again
+ *
+ * @attention Only called at the root, the nodes must have finished espnow_sec_initiator_start
+ *            with this root before, which gives each of them a key-encryption key (KEK).
+ *            The new key is wrapped with the KEK of every node and broadcast in as few packets
+ *            as possible, only the nodes that have not confirmed are resent.
+ *            The nodes install it as the next key, call espnow_sec_initiator_switch_key to use it.
+ *            The new key is used with the suite of espnow_get_next_sec_suite, call espnow_set_next_sec_suite
+ *            before to change the cipher suite of the network, the nodes that do not support it are skipped.
+ *
+ * @param[in]  key_info  the new security key info to sent to responder
+ * @param[in]  addrs_list  destination nodes of mac
+ * @param[in]  addrs_num  number of destination nodes
+ * @param[out]  res  must call espnow_sec_initiator_result_free to free memory
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_INVALID_ARG
+ */
+esp_err_t espnow_sec_initiator_rekey(uint8_t key_info[APP_KEY_LEN], const uint8_t addrs_list[][6], size_t addrs_num,
+                                     espnow_sec_result_t *res);
+
+/**
+ * @brief  Root tells the nodes to switch over to the key distributed by espnow_sec_initiator_rekey
+ *
+ * @attention Only called at the root. The nodes keep the previous key to decrypt,
+ *            so the traffic goes on while the command is propagating.
+ *            The command is sent once, a node that misses it switches on the first data
+ *            it receives encrypted with the new key.
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_NOT_FOUND
+ */
+esp_err_t espnow_sec_initiator_switch_key(void);
+
+/**
+ * @brief  Root answers the resumption requests of the nodes
+ *
+ * @attention Only called at the root. A node which has finished espnow_sec_initiator_start holds
+ *            a ticket, with it espnow_sec_responder_resume gets the current APP key in one round trip.
+ *            Tickets expire after CONFIG_ESPNOW_SEC_TICKET_LIFETIME calls of espnow_sec_initiator_rekey,
+ *            CONFIG_ESPNOW_SEC_TICKET_HOURS hours or CONFIG_ESPNOW_SEC_TICKET_BOOTS reboots of the root,
+ *            whichever comes first. The hours of an earlier boot only count once the root's clock is set.
+ *
+ * @param[in]  enable  enable or disable
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_FAIL
+ */
+esp_err_t espnow_sec_initiator_resume_enable(bool enable);
+
 /**
  * @brief Stop Root to send security to other nodes
  *
@@ -159,6 +329,22 @@ esp_err_t espnow_sec_initiator_result_free(espnow_sec_result_t *result);
  */
 esp_err_t espnow_sec_responder_start(const char *pop_data);
 
+/**
+ * @brief Get the current APP key from the root with the ticket of the last handshake,
+ *        instead of doing the whole handshake again
+ *
+ * @attention espnow_sec_responder_start must be called first
+ *
+ * @param[in]  wait_ticks  the maximum waiting time in ticks
+ *
+ * @return
+ *    - ESP_OK
+ *    - ESP_ERR_NOT_FOUND
+ *    - ESP_ERR_TIMEOUT
+ *    - ESP_ERR_INVALID_STATE
+ */
+esp_err_t espnow_sec_responder_resume(TickType_t wait_ticks);
+
 /**
  * @brief Stop security process
  *
@@ -24,6 +24,9 @@
 #include <psa/crypto.h>
 #else
 #include <mbedtls/ccm.h>
+#if defined(MBEDTLS_CHACHAPOLY_C)
+#include <mbedtls/chachapoly.h>
+#endif
 #endif
 
 #include "esp_wifi.h"
@@ -32,6 +35,23 @@
 
 static const char* TAG = "espnow_sec";
 
+/**
+ * @brief Operations of a cipher suite
+ *        Every suite takes the same 16-byte key, 8-byte nonce and truncated tag,
+ *        so the frame layout does not depend on the suite.
+ */
+typedef struct {
+    const char *name;
+    size_t ctx_size;
+    esp_err_t (*init)(espnow_sec_t *sec);
+    void (*free)(espnow_sec_t *sec);
+    esp_err_t (*setkey)(espnow_sec_t *sec, const uint8_t *key);
+    esp_err_t (*encrypt)(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                         uint8_t *output, size_t output_len, size_t tag_len);
+    esp_err_t (*decrypt)(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                         uint8_t *output, size_t output_len, size_t tag_len);
+} espnow_sec_suite_ops_t;
+
 #if ESPNOW_USE_PSA_CRYPTO
 typedef struct {
     psa_key_id_t key_id;
@@ -52,53 +72,338 @@ static esp_err_t espnow_psa_init_once(espnow_psa_ctx_t *ctx)
     ctx->key_id = (psa_key_id_t)0;
     return ESP_OK;
 }
+
+static psa_algorithm_t espnow_psa_alg(const espnow_sec_t *sec, size_t tag_len)
+{
+    return PSA_ALG_AEAD_WITH_SHORTENED_TAG(PSA_ALG_CCM, tag_len);
+}
+
+static esp_err_t espnow_psa_init(espnow_sec_t *sec)
+{
+    return espnow_psa_init_once((espnow_psa_ctx_t *)sec->cipher_ctx);
+}
+
+static void espnow_psa_free(espnow_sec_t *sec)
+{
+    espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
+    if (ctx->key_id != (psa_key_id_t)0) {
+        (void)psa_destroy_key(ctx->key_id);
+        ctx->key_id = (psa_key_id_t)0;
+    }
+}
+
+static esp_err_t espnow_psa_setkey(espnow_sec_t *sec, const uint8_t *key)
+{
+    espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
+    espnow_psa_free(sec);
+
+    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
+    psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
+    psa_set_key_bits(&attr, 8 * sec->key_len);
+    psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT);
+    psa_set_key_algorithm(&attr, espnow_psa_alg(sec, sec->tag_len));
+
+    psa_status_t st = psa_import_key(&attr, key, sec->key_len, &ctx->key_id);
+    psa_reset_key_attributes(&attr);
+    ESP_ERROR_RETURN(st != PSA_SUCCESS, ESP_FAIL, "psa_import_key failed: %d", (int)st);
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_psa_encrypt(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                                    uint8_t *output, size_t output_len, size_t tag_len)
+{
+    espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
+    size_t out_len = 0;
+    psa_status_t st = psa_aead_encrypt(ctx->key_id, espnow_psa_alg(sec, tag_len),
+                                       sec->iv, sec->iv_len,
+                                       NULL, 0,
+                                       input, ilen,
+                                       output, output_len,
+                                       &out_len);
+    ESP_ERROR_RETURN(st != PSA_SUCCESS, ESP_FAIL, "psa_aead_encrypt failed: %d", (int)st);
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_psa_decrypt(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                                    uint8_t *output, size_t output_len, size_t tag_len)
+{
+    espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
+    size_t out_len = 0;
+    psa_status_t st = psa_aead_decrypt(ctx->key_id, espnow_psa_alg(sec, tag_len),
+                                       sec->iv, sec->iv_len,
+                                       NULL, 0,
+                                       input, ilen + tag_len,
+                                       output, output_len,
+                                       &out_len);
+    ESP_ERROR_RETURN(st != PSA_SUCCESS, ESP_FAIL, "psa_aead_decrypt failed: %d", (int)st);
+
+    return ESP_OK;
+}
+
+/**
+ * PSA only defines ChaCha20-Poly1305 with the full 16-byte tag, which does not fit
+ * the frame layout, so the suite is not offered with PSA crypto.
+ */
+static const espnow_sec_suite_ops_t g_suite_ops[ESPNOW_SEC_SUITE_MAX] = {
+    [ESPNOW_SEC_SUITE_AES_CCM] = {
+        "AES-CCM", sizeof(espnow_psa_ctx_t), espnow_psa_init, espnow_psa_free,
+        espnow_psa_setkey, espnow_psa_encrypt, espnow_psa_decrypt,
+    },
+};
+#else
+static esp_err_t espnow_ccm_init(espnow_sec_t *sec)
+{
+    mbedtls_ccm_init((mbedtls_ccm_context *)sec->cipher_ctx);
+    return ESP_OK;
+}
+
+static void espnow_ccm_free(espnow_sec_t *sec)
+{
+    mbedtls_ccm_free((mbedtls_ccm_context *)sec->cipher_ctx);
+}
+
+static esp_err_t espnow_ccm_setkey(espnow_sec_t *sec, const uint8_t *key)
+{
+    int ret = mbedtls_ccm_setkey((mbedtls_ccm_context *)sec->cipher_ctx, MBEDTLS_CIPHER_ID_AES, key, 8 * sec->key_len);
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "mbedtls_ccm_setkey %x", ret);
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_ccm_encrypt(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                                    uint8_t *output, size_t output_len, size_t tag_len)
+{
+    int ret = mbedtls_ccm_encrypt_and_tag((mbedtls_ccm_context *)sec->cipher_ctx, ilen, sec->iv, sec->iv_len, NULL, 0,
+                                          input, output, output + ilen, tag_len);
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "Failed at mbedtls_ccm_encrypt_and_tag with error code : %d", ret);
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_ccm_decrypt(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                                    uint8_t *output, size_t output_len, size_t tag_len)
+{
+    int ret = mbedtls_ccm_auth_decrypt((mbedtls_ccm_context *)sec->cipher_ctx, ilen,
+                                       sec->iv, sec->iv_len, NULL, 0,
+                                       input, output, input + ilen, tag_len);
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "Failed at mbedtls_ccm_auth_decrypt with error code : %d", ret);
+
+    return ESP_OK;
+}
+
+#if defined(MBEDTLS_CHACHAPOLY_C)
+#define ESPNOW_CHACHAPOLY_KEY_LEN   32
+#define ESPNOW_CHACHAPOLY_NONCE_LEN 12
+#define ESPNOW_CHACHAPOLY_TAG_LEN   16
+
+/**
+ * @brief ChaCha20 takes a 256-bit key and a 96-bit nonce. The 128-bit key is repeated
+ *        and the nonce is zero padded, the security level stays the one of AES-128.
+ */
+static void espnow_chachapoly_nonce(const espnow_sec_t *sec, uint8_t nonce[ESPNOW_CHACHAPOLY_NONCE_LEN])
+{
+    memset(nonce, 0, ESPNOW_CHACHAPOLY_NONCE_LEN);
+    memcpy(nonce, sec->iv, sec->iv_len);
+}
+
+static esp_err_t espnow_chachapoly_init(espnow_sec_t *sec)
+{
+    mbedtls_chachapoly_init((mbedtls_chachapoly_context *)sec->cipher_ctx);
+    return ESP_OK;
+}
+
+static void espnow_chachapoly_free(espnow_sec_t *sec)
+{
+    mbedtls_chachapoly_free((mbedtls_chachapoly_context *)sec->cipher_ctx);
+}
+
+static esp_err_t espnow_chachapoly_setkey(espnow_sec_t *sec, const uint8_t *key)
+{
+    uint8_t chacha_key[ESPNOW_CHACHAPOLY_KEY_LEN];
+
+    memcpy(chacha_key, key, KEY_LEN);
+    memcpy(chacha_key + KEY_LEN, key, KEY_LEN);
+
+    int ret = mbedtls_chachapoly_setkey((mbedtls_chachapoly_context *)sec->cipher_ctx, chacha_key);
+    memset(chacha_key, 0, sizeof(chacha_key));
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "mbedtls_chachapoly_setkey %x", ret);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Poly1305 always produces a 16-byte tag, the streaming API is used so the
+ *        tag can be truncated to tag_len like the AES suites.
+ */
+static esp_err_t espnow_chachapoly_crypt(espnow_sec_t *sec, mbedtls_chachapoly_mode_t mode,
+                                         const uint8_t *input, size_t ilen, uint8_t *output,
+                                         uint8_t tag[ESPNOW_CHACHAPOLY_TAG_LEN])
+{
+    mbedtls_chachapoly_context *ctx = (mbedtls_chachapoly_context *)sec->cipher_ctx;
+    uint8_t nonce[ESPNOW_CHACHAPOLY_NONCE_LEN];
+    int ret = 0;
+
+    espnow_chachapoly_nonce(sec, nonce);
+
+    ret = mbedtls_chachapoly_starts(ctx, nonce, mode);
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "mbedtls_chachapoly_starts %x", ret);
+    ret = mbedtls_chachapoly_update(ctx, ilen, input, output);
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "mbedtls_chachapoly_update %x", ret);
+    ret = mbedtls_chachapoly_finish(ctx, tag);
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "mbedtls_chachapoly_finish %x", ret);
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_chachapoly_encrypt(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                                           uint8_t *output, size_t output_len, size_t tag_len)
+{
+    uint8_t tag[ESPNOW_CHACHAPOLY_TAG_LEN];
+
+    ESP_ERROR_RETURN(tag_len > ESPNOW_CHACHAPOLY_TAG_LEN, ESP_ERR_INVALID_ARG, "tag_len: %d", (int)tag_len);
+    esp_err_t ret = espnow_chachapoly_crypt(sec, MBEDTLS_CHACHAPOLY_ENCRYPT, input, ilen, output, tag);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_chachapoly_crypt");
+
+    memcpy(output + ilen, tag, tag_len);
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_chachapoly_decrypt(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
+                                           uint8_t *output, size_t output_len, size_t tag_len)
+{
+    uint8_t tag[ESPNOW_CHACHAPOLY_TAG_LEN];
+    uint8_t diff = 0;
+
+    ESP_ERROR_RETURN(tag_len > ESPNOW_CHACHAPOLY_TAG_LEN, ESP_ERR_INVALID_ARG, "tag_len: %d", (int)tag_len);
+    esp_err_t ret = espnow_chachapoly_crypt(sec, MBEDTLS_CHACHAPOLY_DECRYPT, input, ilen, output, tag);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_chachapoly_crypt");
+
+    /* Constant time compare */
+    for (size_t i = 0; i < tag_len; ++i) {
+        diff |= tag[i] ^ input[ilen + i];
+    }
+
+    if (diff) {
+        memset(output, 0, ilen);
+        ESP_LOGE(TAG, "ChaCha20-Poly1305 authentication failed");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+#endif /**< MBEDTLS_CHACHAPOLY_C */
+
+static const espnow_sec_suite_ops_t g_suite_ops[ESPNOW_SEC_SUITE_MAX] = {
+    [ESPNOW_SEC_SUITE_AES_CCM] = {
+        "AES-CCM", sizeof(mbedtls_ccm_context), espnow_ccm_init, espnow_ccm_free,
+        espnow_ccm_setkey, espnow_ccm_encrypt, espnow_ccm_decrypt,
+    },
+#if defined(MBEDTLS_CHACHAPOLY_C)
+    [ESPNOW_SEC_SUITE_CHACHAPOLY] = {
+        "ChaCha20-Poly1305", sizeof(mbedtls_chachapoly_context), espnow_chachapoly_init, espnow_chachapoly_free,
+        espnow_chachapoly_setkey, espnow_chachapoly_encrypt, espnow_chachapoly_decrypt,
+    },
 #endif
+};
+#endif /**< ESPNOW_USE_PSA_CRYPTO */
+
+static const espnow_sec_suite_ops_t *espnow_sec_suite_ops(uint8_t suite)
+{
+    if (suite >= ESPNOW_SEC_SUITE_MAX || !g_suite_ops[suite].name) {
+        return NULL;
+    }
+
+    return g_suite_ops + suite;
+}
+
+uint8_t espnow_sec_suite_supported(void)
+{
+    uint8_t mask = 0;
+
+    for (int i = 0; i < ESPNOW_SEC_SUITE_MAX; ++i) {
+        if (g_suite_ops[i].name) {
+            mask |= BIT(i);
+        }
+    }
+
+    return mask;
+}
+
+static esp_err_t espnow_sec_ctx_create(espnow_sec_t *sec, const espnow_sec_suite_ops_t *ops)
+{
+    sec->cipher_ctx = ESP_CALLOC(1, ops->ctx_size);
+    ESP_ERROR_RETURN(!sec->cipher_ctx, ESP_ERR_NO_MEM, "calloc %s ctx failed", ops->name);
+
+    esp_err_t ret = ops->init(sec);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s init failed", ops->name);
+        ESP_FREE(sec->cipher_ctx);
+    }
+
+    return ret;
+}
+
+static void espnow_sec_ctx_delete(espnow_sec_t *sec)
+{
+    const espnow_sec_suite_ops_t *ops = espnow_sec_suite_ops(sec->suite);
+
+    if (sec->cipher_ctx && ops) {
+        ops->free(sec);
+    }
+
+    ESP_FREE(sec->cipher_ctx);
+}
 
 esp_err_t espnow_sec_init(espnow_sec_t *sec)
 {
     ESP_PARAM_CHECK(sec);
 
     memset(sec, 0, sizeof(espnow_sec_t));
-#if ESPNOW_USE_PSA_CRYPTO
-    sec->cipher_ctx = ESP_CALLOC(1, sizeof(espnow_psa_ctx_t));
-#else
-    sec->cipher_ctx = (mbedtls_ccm_context *)ESP_CALLOC(1, sizeof(mbedtls_ccm_context));
-#endif
     sec->key_len = KEY_LEN;
     sec->iv_len = IV_LEN;
     sec->tag_len = TAG_LEN;
+    sec->suite = ESPNOW_SEC_SUITE_AES_CCM;
 
-#if ESPNOW_USE_PSA_CRYPTO
-    ESP_ERROR_RETURN(!sec->cipher_ctx, ESP_ERR_NO_MEM, "calloc psa ctx failed");
-    if (espnow_psa_init_once((espnow_psa_ctx_t *)sec->cipher_ctx) != ESP_OK) {
-        ESP_LOGE(TAG, "psa init failed");
-        return ESP_FAIL;
-    }
-#else
-    mbedtls_ccm_init((mbedtls_ccm_context *)sec->cipher_ctx);
-#endif
+    return espnow_sec_ctx_create(sec, espnow_sec_suite_ops(sec->suite));
+}
+
+esp_err_t espnow_sec_deinit(espnow_sec_t *sec)
+{
+    ESP_PARAM_CHECK(sec);
+
+    espnow_sec_ctx_delete(sec);
+    memset(sec, 0, sizeof(espnow_sec_t));
 
     return ESP_OK;
 }
 
-esp_err_t espnow_sec_deinit(espnow_sec_t *sec)
+esp_err_t espnow_sec_set_suite(espnow_sec_t *sec, uint8_t suite)
 {
     ESP_PARAM_CHECK(sec);
 
-    if (sec->cipher_ctx) {
-#if ESPNOW_USE_PSA_CRYPTO
-        espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
-        if (ctx->key_id != (psa_key_id_t)0) {
-            (void)psa_destroy_key(ctx->key_id);
-            ctx->key_id = (psa_key_id_t)0;
-        }
-        ESP_FREE(sec->cipher_ctx);
-#else
-        mbedtls_ccm_free((mbedtls_ccm_context *)sec->cipher_ctx);
-        ESP_FREE(sec->cipher_ctx);
-#endif
+    const espnow_sec_suite_ops_t *ops = espnow_sec_suite_ops(suite);
+    ESP_ERROR_RETURN(!ops, ESP_ERR_NOT_SUPPORTED, "Cipher suite %d is not supported", suite);
+
+    if (suite == sec->suite && sec->cipher_ctx) {
+        return ESP_OK;
     }
-    memset(sec, 0, sizeof(espnow_sec_t));
+
+    espnow_sec_ctx_delete(sec);
+    sec->suite = suite;
+
+    esp_err_t ret = espnow_sec_ctx_create(sec, ops);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_ctx_create");
+
+    /* Keep the key which has been set */
+    if (sec->state == ESPNOW_SEC_OVER) {
+        ret = ops->setkey(sec, sec->key);
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "%s setkey", ops->name);
+    }
+
+    ESP_LOGI(TAG, "Cipher suite: %s", ops->name);
 
     return ESP_OK;
 }
@@ -109,26 +414,11 @@ esp_err_t espnow_sec_setkey(espnow_sec_t *sec, uint8_t app_key[APP_KEY_LEN])
     ESP_PARAM_CHECK(app_key);
     ESP_PARAM_CHECK(sec->cipher_ctx);
 
-#if ESPNOW_USE_PSA_CRYPTO
-    espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
-    if (ctx->key_id != (psa_key_id_t)0) {
-        (void)psa_destroy_key(ctx->key_id);
-        ctx->key_id = (psa_key_id_t)0;
-    }
+    const espnow_sec_suite_ops_t *ops = espnow_sec_suite_ops(sec->suite);
+    ESP_PARAM_CHECK(ops);
 
-    psa_key_attributes_t attr = PSA_KEY_ATTRIBUTES_INIT;
-    psa_set_key_type(&attr, PSA_KEY_TYPE_AES);
-    psa_set_key_bits(&attr, 8 * sec->key_len);
-    psa_set_key_usage_flags(&attr, PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT);
-    psa_set_key_algorithm(&attr, PSA_ALG_AEAD_WITH_SHORTENED_TAG(PSA_ALG_CCM, sec->tag_len));
-
-    psa_status_t st = psa_import_key(&attr, app_key, sec->key_len, &ctx->key_id);
-    psa_reset_key_attributes(&attr);
-    ESP_ERROR_RETURN(st != PSA_SUCCESS, ESP_FAIL, "psa_import_key failed: %d", (int)st);
-#else
-    int ret = mbedtls_ccm_setkey((mbedtls_ccm_context *)sec->cipher_ctx, MBEDTLS_CIPHER_ID_AES, app_key, 8 * sec->key_len);
-    ESP_ERROR_RETURN(ret != ESP_OK, ret, "mbedtls_ccm_setkey %x", ret);
-#endif
+    esp_err_t ret = ops->setkey(sec, app_key);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "%s setkey", ops->name);
 
     memcpy(sec->key, app_key, sec->key_len);
     memcpy(sec->iv, app_key + sec->key_len, sec->iv_len);
@@ -154,34 +444,13 @@ esp_err_t espnow_sec_auth_encrypt(espnow_sec_t *sec, const uint8_t *input, size_
         return ESP_FAIL;
     }
 
-#if ESPNOW_USE_PSA_CRYPTO
-    espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
-    psa_algorithm_t alg = PSA_ALG_AEAD_WITH_SHORTENED_TAG(PSA_ALG_CCM, tag_len);
-    size_t out_len = 0;
-    psa_status_t st = psa_aead_encrypt(ctx->key_id, alg,
-                                       sec->iv, sec->iv_len,
-                                       NULL, 0,
-                                       input, ilen,
-                                       output, output_len,
-                                       &out_len);
-    if (st != PSA_SUCCESS) {
-        ESP_LOGE(TAG, "psa_aead_encrypt failed: %d", (int)st);
+    if (g_suite_ops[sec->suite].encrypt(sec, input, ilen, output, output_len, tag_len) != ESP_OK) {
         return ESP_FAIL;
     }
-    *olen = out_len;
-    return ESP_OK;
-#else
-    int ret = mbedtls_ccm_encrypt_and_tag((mbedtls_ccm_context *)sec->cipher_ctx, ilen, sec->iv, sec->iv_len, NULL, 0,
-                                    input, output, output + ilen, tag_len);
-    *olen = ilen + tag_len;
 
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Failed at mbedtls_ccm_encrypt_and_tag with error code : %d", ret);
-        return ESP_FAIL;
-    }
+    *olen = ilen + tag_len;
 
-    return ret;
-#endif
+    return ESP_OK;
 }
 
 esp_err_t espnow_sec_auth_decrypt(espnow_sec_t *sec, const uint8_t *input, size_t ilen,
@@ -202,35 +471,13 @@ esp_err_t espnow_sec_auth_decrypt(espnow_sec_t *sec, const uint8_t *input, size_
         return ESP_FAIL;
     }
 
-#if ESPNOW_USE_PSA_CRYPTO
-    espnow_psa_ctx_t *ctx = (espnow_psa_ctx_t *)sec->cipher_ctx;
-    psa_algorithm_t alg = PSA_ALG_AEAD_WITH_SHORTENED_TAG(PSA_ALG_CCM, tag_len);
-    size_t out_len = 0;
-    psa_status_t st = psa_aead_decrypt(ctx->key_id, alg,
-                                       sec->iv, sec->iv_len,
-                                       NULL, 0,
-                                       input, ilen,
-                                       output, output_len,
-                                       &out_len);
-    if (st != PSA_SUCCESS) {
-        ESP_LOGE(TAG, "psa_aead_decrypt failed: %d", (int)st);
-        return ESP_FAIL;
-    }
-    *olen = out_len;
-    return ESP_OK;
-#else
-    int ret = ESP_OK;
     ilen -= tag_len;
-    ret = mbedtls_ccm_auth_decrypt((mbedtls_ccm_context *)sec->cipher_ctx, ilen,
-                                        sec->iv, sec->iv_len, NULL, 0,
-                                        input, output, input + ilen, tag_len);
-    *olen = ilen;
 
-    if (ret != 0) {
-        ESP_LOGE(TAG, "Failed at mbedtls_ccm_auth_decrypt with error code : %d", ret);
+    if (g_suite_ops[sec->suite].decrypt(sec, input, ilen, output, output_len, tag_len) != ESP_OK) {
         return ESP_FAIL;
     }
 
-    return ret;
-#endif
+    *olen = ilen;
+
+    return ESP_OK;
 }
@@ -15,6 +15,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/param.h>
 #include <esp_err.h>
 #include <esp_log.h>
 #include "esp_system.h"
@@ -26,10 +29,18 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #include <protocomm.h>
 #include <protocomm_client_security1.h>
 
+#if ESPNOW_USE_PSA_CRYPTO
+#include "psa/crypto.h"
+#else
+#include <mbedtls/sha256.h>
+#endif
+
 #include "esp_wifi.h"
 #include "espnow.h"
 #include "espnow_security_handshake.h"
@@ -37,6 +48,10 @@
 static const char* TAG = "espnow_sec_init";
 
 static uint8_t app_key[APP_KEY_LEN] = { 0 };
+static uint8_t g_sec_master[APP_KEY_LEN] = { 0 };
+static espnow_sec_ticket_issue_t g_sec_ticket = { 0 };
+static uint32_t g_sec_boot_count = 0;
+static bool g_sec_resume_flag = false;
 static bool g_sec_initiator_flag = false;
 
 static size_t g_scan_num = 0;
@@ -54,6 +69,34 @@ static espnow_sec_responder_t *g_info_list = NULL;
 #define CONFIG_ESPNOW_SEC_SEND_FORWARD_RSSI     -65
 #endif
 
+#ifndef CONFIG_ESPNOW_SEC_WORKER_NUM
+#define CONFIG_ESPNOW_SEC_WORKER_NUM            2
+#endif
+
+#define ESPNOW_SEC_WORKER_STACK_SIZE            (6 * 1024)
+#define ESPNOW_SEC_RESUME_STACK_SIZE            (4 * 1024)
+#define ESPNOW_SEC_RESUME_QUEUE_SIZE            8
+#define ESPNOW_SEC_SEND_TIMEOUT_MS              100
+
+#define ESPNOW_SEC_REKEY_RETRY_NUM              3
+#define ESPNOW_SEC_MASTER_KEY                   "sec_master"
+#define ESPNOW_SEC_REKEY_ID_KEY                 "sec_rekey_tx"
+
+#ifndef CONFIG_ESPNOW_SEC_TICKET_LIFETIME
+#define CONFIG_ESPNOW_SEC_TICKET_LIFETIME       2
+#endif
+
+#ifndef CONFIG_ESPNOW_SEC_TICKET_HOURS
+#define CONFIG_ESPNOW_SEC_TICKET_HOURS          24
+#endif
+
+#ifndef CONFIG_ESPNOW_SEC_TICKET_BOOTS
+#define CONFIG_ESPNOW_SEC_TICKET_BOOTS          4
+#endif
+
+#define ESPNOW_SEC_BOOT_COUNT_KEY               "sec_boot"
+#define ESPNOW_SEC_TIME_SET                     1577836800  /**< 2020-01-01, the clock is set by SNTP after it */
+
 static bool addrs_remove(uint8_t addrs_list[][ESPNOW_ADDR_LEN],
                          size_t *addrs_num, const uint8_t addr[6])
 {
@@ -89,7 +132,7 @@ static esp_err_t espnow_sec_info(uint8_t *src_addr, void *data,
     espnow_addr_t addr_self    = {0};
     esp_wifi_get_mac(WIFI_IF_STA, addr_self);
 
-    if (recv_data->sec_ver == ESPNOW_SEC_VER_V1_0
+    if (ESPNOW_SEC_VER(recv_data->sec_ver) == ESPNOW_SEC_VER_V1_0
         && !memcmp(recv_data->client_mac, addr_self, 6)) {
         ESP_LOGD(TAG, "Device security has been configured by this client, skip.");
         return ESP_OK;
@@ -204,6 +247,45 @@ typedef struct {
     size_t size;
 } espnow_sec_data_t;
 
+/**
+ * @brief Handshake message dispatched to a worker, data is NULL for a flush request
+ */
+typedef struct {
+    protocomm_security_handle_t session;
+    int32_t session_id;
+    bool exit;
+    espnow_sec_data_t sec_data;
+} espnow_sec_work_t;
+
+typedef struct {
+    QueueHandle_t queue;
+    const protocomm_security_t *proto_sec;
+    const void *pop;
+} espnow_sec_worker_t;
+
+static SemaphoreHandle_t g_sec_worker_sem = NULL;
+static QueueHandle_t g_sec_resume_queue = NULL;
+static SemaphoreHandle_t g_sec_resume_exit = NULL;
+
+static esp_err_t espnow_sec_data_queue(QueueHandle_t queue, const uint8_t *src_addr, const void *data, size_t size)
+{
+    espnow_sec_data_t sec_data = { 0 };
+    sec_data.data = ESP_MALLOC(size);
+    if (!sec_data.data) {
+        return ESP_FAIL;
+    }
+    memcpy(sec_data.data, data, size);
+    sec_data.size = size;
+    memcpy(sec_data.src_addr, src_addr, 6);
+    if (xQueueSend(queue, &sec_data, 0) != pdPASS) {
+        ESP_LOGW(TAG, "[%s, %d] Send sec queue failed", __func__, __LINE__);
+        ESP_FREE(sec_data.data);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
 static esp_err_t espnow_initiator_sec_process(uint8_t *src_addr, void *data,
                       size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
 {
@@ -212,25 +294,308 @@ static esp_err_t espnow_initiator_sec_process(uint8_t *src_addr, void *data,
     ESP_PARAM_CHECK(size);
     ESP_PARAM_CHECK(rx_ctrl);
 
+    /* Answered by the resume task, it takes no state of the handshake */
+    if (((uint8_t *)data)[0] == ESPNOW_SEC_TYPE_RESUME) {
+        return (g_sec_resume_flag && g_sec_resume_queue) ? espnow_sec_data_queue(g_sec_resume_queue, src_addr, data, size) : ESP_OK;
+    }
+
     if (g_sec_queue) {
-        espnow_sec_data_t sec_data = { 0 };
-        sec_data.data = ESP_MALLOC(size);
-        if (!sec_data.data) {
-            return ESP_FAIL;
-        }
-        memcpy(sec_data.data, data, size);
-        sec_data.size = size;
-        memcpy(sec_data.src_addr, src_addr, 6);
-        if (xQueueSend(g_sec_queue, &sec_data, 0) != pdPASS) {
-            ESP_LOGW(TAG, "[%s, %d] Send sec queue failed", __func__, __LINE__);
-            ESP_FREE(sec_data.data);
-            return ESP_FAIL;
+        return espnow_sec_data_queue(g_sec_queue, src_addr, data, size);
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_sec_initiator_queue_create(size_t addrs_num)
+{
+    g_sec_queue = xQueueCreate(addrs_num, sizeof(espnow_sec_data_t));
+    ESP_ERROR_RETURN(!g_sec_queue, ESP_FAIL, "Create espnow security queue fail");
+    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_SECURITY, 1, espnow_initiator_sec_process);
+
+    return ESP_OK;
+}
+
+static void espnow_sec_initiator_queue_delete(void)
+{
+    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_SECURITY, g_sec_resume_flag,
+                                    g_sec_resume_flag ? espnow_initiator_sec_process : NULL);
+
+    if (g_sec_queue) {
+        espnow_sec_data_t tmp_data = { 0 };
+
+        while (xQueueReceive(g_sec_queue, &tmp_data, 0)) {
+            ESP_FREE(tmp_data.data);
         }
+
+        vQueueDelete(g_sec_queue);
+        g_sec_queue = NULL;
     }
+}
+
+/**
+ * @brief Load the master secret the KEKs are derived from, create it the first time
+ */
+static esp_err_t espnow_sec_master_load(void)
+{
+    /* Counted once a boot, the tickets of earlier boots age by it */
+    if (!g_sec_boot_count) {
+        espnow_storage_get(ESPNOW_SEC_BOOT_COUNT_KEY, &g_sec_boot_count, sizeof(uint32_t));
+        g_sec_boot_count++;
+        espnow_storage_set(ESPNOW_SEC_BOOT_COUNT_KEY, &g_sec_boot_count, sizeof(uint32_t));
+    }
+
+    if (espnow_storage_get(ESPNOW_SEC_MASTER_KEY, g_sec_master, APP_KEY_LEN) == ESP_OK) {
+        return ESP_OK;
+    }
+
+    esp_fill_random(g_sec_master, APP_KEY_LEN);
+
+    return espnow_storage_set(ESPNOW_SEC_MASTER_KEY, g_sec_master, APP_KEY_LEN);
+}
+
+/**
+ * @brief SHA-256(master || info), so no per device state is kept on the initiator
+ */
+static esp_err_t espnow_sec_key_derive(const void *info, size_t info_len, uint8_t key[KEY_LEN])
+{
+    uint8_t input[APP_KEY_LEN + ESPNOW_ADDR_LEN + sizeof(espnow_sec_ticket_issue_t)];
+    uint8_t sha_out[32];
+
+    ESP_PARAM_CHECK(info_len <= sizeof(input) - APP_KEY_LEN);
+
+    memcpy(input, g_sec_master, APP_KEY_LEN);
+    memcpy(input + APP_KEY_LEN, info, info_len);
+
+#if ESPNOW_USE_PSA_CRYPTO
+    size_t hash_len = 0;
+    psa_status_t st = psa_hash_compute(PSA_ALG_SHA_256, input, APP_KEY_LEN + info_len,
+                                       sha_out, sizeof(sha_out), &hash_len);
+    ESP_ERROR_RETURN(st != PSA_SUCCESS, ESP_FAIL, "psa_hash_compute failed: %d", (int)st);
+#else
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    int ret = mbedtls_sha256(input, APP_KEY_LEN + info_len, sha_out, 0);
+#else
+    int ret = mbedtls_sha256_ret(input, APP_KEY_LEN + info_len, sha_out, 0);
+#endif
+    ESP_ERROR_RETURN(ret != 0, ESP_FAIL, "mbedtls_sha256 %x", ret);
+#endif
+
+    memcpy(key, sha_out, KEY_LEN);
 
     return ESP_OK;
 }
 
+/**
+ * @brief KEK = SHA-256(master || mac)
+ */
+static esp_err_t espnow_sec_kek_derive(const uint8_t addr[6], uint8_t kek[ESPNOW_SEC_KEK_LEN])
+{
+    return espnow_sec_key_derive(addr, ESPNOW_ADDR_LEN, kek);
+}
+
+/**
+ * @brief Ticket secret = SHA-256(master || mac || issue), the issue can not be changed without the master
+ */
+static esp_err_t espnow_sec_ticket_derive(const uint8_t addr[6], const espnow_sec_ticket_issue_t *issue, uint8_t ticket[KEY_LEN])
+{
+    uint8_t info[ESPNOW_ADDR_LEN + sizeof(espnow_sec_ticket_issue_t)];
+
+    memcpy(info, addr, ESPNOW_ADDR_LEN);
+    memcpy(info + ESPNOW_ADDR_LEN, issue, sizeof(espnow_sec_ticket_issue_t));
+
+    return espnow_sec_key_derive(info, sizeof(info), ticket);
+}
+
+/**
+ * @brief A ticket is issued now for the current rekey id
+ */
+static void espnow_sec_ticket_issue(espnow_sec_ticket_issue_t *issue)
+{
+    issue->ticket_id = 0;
+    espnow_storage_get(ESPNOW_SEC_REKEY_ID_KEY, &issue->ticket_id, sizeof(uint32_t));
+    issue->boot_count = g_sec_boot_count;
+    issue->time = (uint32_t)time(NULL);
+}
+
+/**
+ * @brief The time since the issue counts within the same boot of the root, or once its clock is set.
+ *        Tickets of earlier boots without the clock set are bounded by the boot count.
+ */
+static bool espnow_sec_ticket_expired(const espnow_sec_ticket_issue_t *issue, uint32_t rekey_id)
+{
+    uint32_t now = (uint32_t)time(NULL);
+
+    if (rekey_id - issue->ticket_id > CONFIG_ESPNOW_SEC_TICKET_LIFETIME
+            || g_sec_boot_count - issue->boot_count > CONFIG_ESPNOW_SEC_TICKET_BOOTS) {
+        return true;
+    }
+
+    if (issue->boot_count == g_sec_boot_count || (now >= ESPNOW_SEC_TIME_SET && issue->time >= ESPNOW_SEC_TIME_SET)) {
+        return now - issue->time > CONFIG_ESPNOW_SEC_TICKET_HOURS * 3600;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Cipher suites reported by the responder in the scan, all suites are tried if it has not been scanned
+ */
+static uint8_t espnow_sec_responder_suites(const uint8_t *addr)
+{
+    for (int i = 0; i < g_scan_num; ++i) {
+        if (ESPNOW_ADDR_IS_EQUAL(g_info_list[i].mac, addr)) {
+            return ESPNOW_SEC_VER_SUITES(g_info_list[i].sec_ver);
+        }
+    }
+
+    return 0xFF;
+}
+
+static esp_err_t espnow_sec_initiator_handshake(const espnow_sec_worker_t *worker, const espnow_sec_work_t *work,
+                                                espnow_sec_packet_t *response_data)
+{
+    esp_err_t ret = ESP_OK;
+    const protocomm_security_t *proto_sec = worker->proto_sec;
+    const espnow_sec_packet_t *req_data = (espnow_sec_packet_t *)work->sec_data.data;
+    const uint8_t *src_addr = work->sec_data.src_addr;
+    int32_t session_id = work->session_id;
+    ssize_t response_size = 0;
+    ssize_t outlen = 0;
+    uint8_t *outbuf = NULL;
+    espnow_sec_key_data_t key_data = { 0 };
+    espnow_frame_head_t frame_head = {
+        .retransmit_count = CONFIG_ESPNOW_SEC_SEND_RETRY_NUM,
+        .filter_adjacent_channel = true,
+        .forward_ttl      = CONFIG_ESPNOW_SEC_SEND_FORWARD_TTL,
+        .forward_rssi     = CONFIG_ESPNOW_SEC_SEND_FORWARD_RSSI,
+    };
+
+    ESP_ERROR_RETURN(work->sec_data.size < sizeof(espnow_sec_packet_t)
+                     || work->sec_data.size < sizeof(espnow_sec_packet_t) + req_data->size,
+                     ESP_ERR_INVALID_SIZE, "Handshake packet too short: %u", (unsigned)work->sec_data.size);
+
+    ret = proto_sec->security_req_handler(work->session, worker->pop, session_id, req_data->data, req_data->size, &outbuf, &outlen, NULL);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "espnow-session handler failed");
+        ESP_FREE(outbuf);
+        return ret;
+    } else if (outbuf && outlen) {
+        response_data->type = ESPNOW_SEC_TYPE_HANDSHAKE;
+        response_data->size = outlen;
+        memcpy(response_data->data, outbuf, outlen);
+        response_size = sizeof(espnow_sec_packet_t) + outlen;
+        ESP_FREE(outbuf);
+    } else {
+        /* Send APP key, followed by the KEK used for later rekeying and the resumption ticket */
+        response_data->type = ESPNOW_SEC_TYPE_KEY;
+        memcpy(key_data.app_key, app_key, APP_KEY_LEN);
+        key_data.key_id    = espnow_get_key_id();
+        key_data.issue     = g_sec_ticket;
+        key_data.suite     = espnow_get_sec_suite();
+        ESP_ERROR_RETURN(!(espnow_sec_responder_suites(src_addr) & BIT(key_data.suite)), ESP_ERR_NOT_SUPPORTED,
+                         "Cipher suite %d is not supported by " MACSTR, key_data.suite, MAC2STR(src_addr));
+        ret = espnow_sec_kek_derive(src_addr, key_data.kek);
+        ret |= espnow_sec_ticket_derive(src_addr, &key_data.issue, key_data.ticket);
+        ESP_ERROR_RETURN(ret != ESP_OK, ESP_FAIL, "espnow_sec_key_derive");
+
+        if (proto_sec->encrypt) {
+            outlen = 0;
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+            uint8_t *enc_resp = NULL;
+            ret = proto_sec->encrypt(work->session, session_id, (uint8_t *)&key_data, sizeof(key_data),
+                                &enc_resp, &outlen);
+
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Encryption of data failed for session id %d", session_id);
+                ESP_FREE(enc_resp);
+                return ret;
+            }
+            memcpy(response_data->data, enc_resp, outlen);
+            ESP_FREE(enc_resp);
+#else
+            ret = proto_sec->encrypt(work->session, session_id, (uint8_t *)&key_data, sizeof(key_data),
+                                response_data->data, &outlen);
+
+            if (ret != ESP_OK) {
+                ESP_LOGE(TAG, "Encryption of data failed for session id %d", session_id);
+                return ret;
+            }
+#endif
+            response_data->size = outlen;
+            response_size = sizeof(espnow_sec_packet_t) + outlen;
+        } else {/* will not goto here */
+            response_data->size = APP_KEY_LEN;
+            memcpy(response_data->data, app_key, APP_KEY_LEN);
+            response_size = sizeof(espnow_sec_packet_t) + APP_KEY_LEN;
+        }
+    }
+
+    espnow_add_peer(src_addr, NULL);
+
+    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY, src_addr, response_data, response_size, &frame_head, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "espnow-session send failed");
+    }
+
+    espnow_del_peer(src_addr);
+
+    return ret;
+}
+
+/**
+ * @brief Runs the per-session crypto, so the key agreement of different sessions
+ *        is spread over the cores while the dispatcher keeps receiving.
+ */
+static void espnow_sec_worker_task(void *arg)
+{
+    espnow_sec_worker_t *worker = (espnow_sec_worker_t *)arg;
+    espnow_sec_packet_t *response_data = ESP_MALLOC(ESPNOW_DATA_LEN);
+    espnow_sec_work_t work = { 0 };
+
+    for (;;) {
+        if (xQueueReceive(worker->queue, &work, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+
+        if (!work.sec_data.data) {
+            xSemaphoreGive(g_sec_worker_sem);
+
+            if (work.exit) {
+                break;
+            }
+
+            continue;
+        }
+
+        if (response_data) {
+            espnow_sec_initiator_handshake(worker, &work, response_data);
+        }
+
+        ESP_FREE(work.sec_data.data);
+    }
+
+    ESP_FREE(response_data);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Wait until every worker has handled all the queued messages
+ */
+static void espnow_sec_worker_flush(espnow_sec_worker_t *workers, size_t worker_num, bool exit)
+{
+    espnow_sec_work_t work = { .exit = exit };
+
+    for (int i = 0; i < worker_num; i++) {
+        xQueueSend(workers[i].queue, &work, portMAX_DELAY);
+    }
+
+    for (int i = 0; i < worker_num; i++) {
+        xSemaphoreTake(g_sec_worker_sem, portMAX_DELAY);
+    }
+}
+
 static esp_err_t protocomm_espnow_initiator_start(const protocomm_security_t *proto_sec, const void *pop,
                                                 const uint8_t addrs_list[][6], size_t addrs_num, espnow_sec_result_t *res)
 {
@@ -240,7 +605,6 @@ static esp_err_t protocomm_espnow_initiator_start(const protocomm_security_t *pr
 
     esp_err_t ret       = ESP_OK;
     uint8_t src_addr[6] = {0};
-    espnow_sec_packet_t *req_data = ESP_MALLOC(ESPNOW_DATA_LEN);
     espnow_sec_packet_t *response_data = ESP_MALLOC(ESPNOW_DATA_LEN);
     espnow_sec_result_t *result = res;
     ssize_t  response_size = 0;
@@ -254,6 +618,8 @@ static esp_err_t protocomm_espnow_initiator_start(const protocomm_security_t *pr
         .forward_rssi     = CONFIG_ESPNOW_SEC_SEND_FORWARD_RSSI,
     };
     espnow_sec_data_t sec_data = { 0 };
+    espnow_sec_worker_t workers[CONFIG_ESPNOW_SEC_WORKER_NUM] = { 0 };
+    size_t worker_num = 0;
 
     /* Maximum number of session a time, can be greater but process time will be long*/
     int32_t MAX_NUM = 100;
@@ -263,12 +629,40 @@ static esp_err_t protocomm_espnow_initiator_start(const protocomm_security_t *pr
     int retry_count = (addrs_num % MAX_NUM == 0) ? (addrs_num / MAX_NUM + 1) : (addrs_num / MAX_NUM + 2);
     g_sec_initiator_flag = true;
 
+    g_sec_worker_sem = xSemaphoreCreateCounting(CONFIG_ESPNOW_SEC_WORKER_NUM, 0);
+    ret = (!g_sec_worker_sem || !response_data) ? ESP_ERR_NO_MEM : ESP_OK;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Create espnow security worker semaphore fail");
+
+    for (worker_num = 0; worker_num < CONFIG_ESPNOW_SEC_WORKER_NUM; worker_num++) {
+        workers[worker_num].proto_sec = proto_sec;
+        workers[worker_num].pop = pop;
+        workers[worker_num].queue = xQueueCreate(MAX_NUM, sizeof(espnow_sec_work_t));
+        ESP_ERROR_BREAK(!workers[worker_num].queue, "Create espnow security worker queue fail");
+
+        if (xTaskCreatePinnedToCore(espnow_sec_worker_task, "espnow_sec_worker", ESPNOW_SEC_WORKER_STACK_SIZE,
+                                    &workers[worker_num], uxTaskPriorityGet(NULL),
+                                    NULL, worker_num % portNUM_PROCESSORS) != pdPASS) {
+            ESP_LOGW(TAG, "Create espnow security worker task fail");
+            vQueueDelete(workers[worker_num].queue);
+            workers[worker_num].queue = NULL;
+            break;
+        }
+    }
+
+    ret = worker_num ? ESP_OK : ESP_FAIL;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "No espnow security worker is running");
+
     if (!res) {
         result = ESP_CALLOC(1, sizeof(espnow_sec_result_t));
+        ret = result ? ESP_OK : ESP_ERR_NO_MEM;
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<ESP_ERR_NO_MEM> espnow_sec_result_t");
     }
-    result->successed_addr = ESP_CALLOC(addrs_num, ESPNOW_ADDR_LEN);
+
+    result->successed_addr  = ESP_CALLOC(addrs_num, ESPNOW_ADDR_LEN);
+    result->unfinished_addr = ESP_CALLOC(addrs_num, ESPNOW_ADDR_LEN);
+    ret = (result->successed_addr && result->unfinished_addr) ? ESP_OK : ESP_ERR_NO_MEM;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<ESP_ERR_NO_MEM> result addresses, addrs_num: %d", addrs_num);
     result->unfinished_num  = addrs_num;
-    result->unfinished_addr = ESP_CALLOC(result->unfinished_num, ESPNOW_ADDR_LEN);
     memcpy(result->unfinished_addr, addrs_list, result->unfinished_num * ESPNOW_ADDR_LEN);
 
     for (int i = 0; i < retry_count && result->unfinished_num > 0 && g_sec_initiator_flag; i++) {
@@ -277,10 +671,11 @@ static esp_err_t protocomm_espnow_initiator_start(const protocomm_security_t *pr
         protocomm_security_handle_t *current_session_list = ESP_CALLOC(current_addrs_num, sizeof(protocomm_security_handle_t));
         memcpy(current_addrs_list, result->unfinished_addr, current_addrs_num * ESPNOW_ADDR_LEN);
         size_t success_addrs_num = 0;
-        wait_ticks = pdMS_TO_TICKS(1200 + 300 * current_addrs_num);
+        /* The workers only run in parallel on as many cores, a single core target takes the whole batch */
+        wait_ticks = pdMS_TO_TICKS(1200 + 300 * current_addrs_num / MIN(worker_num, portNUM_PROCESSORS));
 
-        ESP_LOGI(TAG, "count: %d, Secure_initiator_send, requested_num: %d, unfinished_num: %d, successed_num: %d",
-                 i, current_addrs_num, result->unfinished_num, result->successed_num);
+        ESP_LOGI(TAG, "count: %d, Secure_initiator_send, requested_num: %d, unfinished_num: %d, successed_num: %d, worker_num: %d",
+                 i, current_addrs_num, result->unfinished_num, result->successed_num, worker_num);
 
         for (int i = 0; i < current_addrs_num; i++) {
             proto_sec->init(&current_session_list[i]);
@@ -314,89 +709,56 @@ static esp_err_t protocomm_espnow_initiator_start(const protocomm_security_t *pr
         espnow_set_group(current_addrs_list, current_addrs_num, ESPNOW_ADDR_GROUP_SEC, NULL, false, portMAX_DELAY);
 
         /**
-         * @brief Receive Response 0, send Command 1, receive Response 1
+         * @brief Receive Response 0 and Response 1, the workers send Command 1 and the APP key.
+         *        Messages of one session always go to the same worker so they are handled in order.
          */
-        frame_head.broadcast = false;
-        frame_head.group = false;
         start_ticks = xTaskGetTickCount();
         while(xTaskGetTickCount() - start_ticks < wait_ticks && success_addrs_num < current_addrs_num && g_sec_initiator_flag) {
-            while (g_sec_queue && (xQueueReceive(g_sec_queue, &sec_data, recv_ticks) == pdPASS)) {
-                memcpy(src_addr, sec_data.src_addr, 6);
-                memcpy(req_data, sec_data.data, sec_data.size);
+            if (!g_sec_queue || xQueueReceive(g_sec_queue, &sec_data, recv_ticks) != pdPASS) {
+                continue;
+            }
+
+            espnow_sec_packet_t *req_data = (espnow_sec_packet_t *)sec_data.data;
+            memcpy(src_addr, sec_data.src_addr, 6);
+            session_id = addrs_search(current_addrs_list, current_addrs_num, src_addr);
+
+            if (session_id < 0) {
+                ESP_LOGW(TAG, "addr " MACSTR " not searched", MAC2STR(src_addr));
+                ESP_FREE(sec_data.data);
+                continue;
+            }
+
+            if (req_data->type == ESPNOW_SEC_TYPE_KEY_RESP) {
                 ESP_FREE(sec_data.data);
-                session_id = addrs_search(current_addrs_list, current_addrs_num, src_addr);
-                ESP_ERROR_CONTINUE(session_id < 0, "addr " MACSTR " not searched", MAC2STR(src_addr));
-
-                if (req_data->type == ESPNOW_SEC_TYPE_KEY_RESP) {
-                    ESP_LOGD(TAG, "Session %d successful, mac "MACSTR"", session_id, MAC2STR(src_addr));
-                    addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr);
-                    memcpy(result->successed_addr[result->successed_num], src_addr, ESPNOW_ADDR_LEN);
-                    result->successed_num ++;
-                    if (++success_addrs_num == current_addrs_num) {
-                        break;
-                    }
-                } else if (req_data->type == ESPNOW_SEC_TYPE_HANDSHAKE){
-                    ret = proto_sec->security_req_handler(current_session_list[session_id], pop, session_id, req_data->data, req_data->size, &outbuf, &outlen, NULL);
-
-                    if (ret != ESP_OK) {
-                        ESP_LOGE(TAG, "espnow-session handler failed");
-                        ESP_FREE(outbuf);
-                        continue;
-                    } else if (outbuf && outlen) {
-                        response_data->type = ESPNOW_SEC_TYPE_HANDSHAKE;
-                        response_data->size = outlen;
-                        memcpy(response_data->data, outbuf, outlen);
-                        response_size = sizeof(espnow_sec_packet_t) + outlen;
-                        ESP_FREE(outbuf);
-                    } else {
-                        /* Send APP key */
-                        response_data->type = ESPNOW_SEC_TYPE_KEY;
-                        if (proto_sec->encrypt) {
-                            outlen = 0;
 
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
-                            uint8_t *enc_resp = NULL;
-                            ret = proto_sec->encrypt(current_session_list[session_id], session_id, app_key, APP_KEY_LEN,
-                                                &enc_resp, &outlen);
-
-                            if (ret != ESP_OK) {
-                                ESP_LOGE(TAG, "Encryption of data failed for session id %d", session_id);
-                                ESP_FREE(enc_resp);
-                                continue;
-                            }
-                            memcpy(response_data->data, enc_resp, outlen);
-                            ESP_FREE(enc_resp);
-#else
-                            ret = proto_sec->encrypt(current_session_list[session_id], session_id, app_key, APP_KEY_LEN,
-                                                response_data->data, &outlen);
+                if (!addrs_remove(result->unfinished_addr, &result->unfinished_num, src_addr)) {
+                    continue;
+                }
 
-                            if (ret != ESP_OK) {
-                                ESP_LOGE(TAG, "Encryption of data failed for session id %d", session_id);
-                                continue;
-                            }
-#endif
-                            response_data->size = outlen;
-                            response_size = sizeof(espnow_sec_packet_t) + outlen;
-                        } else {/* will not goto here */
-                            response_data->size = APP_KEY_LEN;
-                            memcpy(response_data->data, app_key, APP_KEY_LEN);
-                            response_size = sizeof(espnow_sec_packet_t) + APP_KEY_LEN;
-                        }
-                    }
-
-                    espnow_add_peer(src_addr, NULL);
-
-                    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY, src_addr, response_data, response_size, &frame_head, portMAX_DELAY);
-                    if (ret != ESP_OK) {
-                        ESP_LOGW(TAG, "espnow-session send failed");
-                    }
-
-                    espnow_del_peer(src_addr);
+                ESP_LOGD(TAG, "Session %d successful, mac "MACSTR"", session_id, MAC2STR(src_addr));
+                memcpy(result->successed_addr[result->successed_num], src_addr, ESPNOW_ADDR_LEN);
+                result->successed_num ++;
+                success_addrs_num++;
+            } else if (req_data->type == ESPNOW_SEC_TYPE_HANDSHAKE) {
+                espnow_sec_work_t work = {
+                    .session    = current_session_list[session_id],
+                    .session_id = session_id,
+                    .sec_data   = sec_data,
+                };
+
+                if (xQueueSend(workers[session_id % worker_num].queue, &work, recv_ticks) != pdPASS) {
+                    ESP_LOGW(TAG, "[%s, %d] Send sec worker queue failed", __func__, __LINE__);
+                    ESP_FREE(sec_data.data);
                 }
+            } else {
+                ESP_FREE(sec_data.data);
             }
         }
 exit_init:
 
+        /* The sessions are released below, wait for the workers to be idle */
+        espnow_sec_worker_flush(workers, worker_num, false);
+
         for (int i = 0; i < current_addrs_num; i++) {
             proto_sec->close_transport_session(current_session_list[i], i);
             proto_sec->cleanup(current_session_list[i]);
@@ -407,15 +769,27 @@ exit_init:
 
     }
 
+EXIT:
     g_sec_initiator_flag = false;
 
-    ESP_FREE(req_data);
-    ESP_FREE(response_data);
-    if (!res) {
+    if (!res && result) {
         espnow_sec_initiator_result_free(result);
         ESP_FREE(result);
     }
 
+    espnow_sec_worker_flush(workers, worker_num, true);
+
+    for (int i = 0; i < worker_num; i++) {
+        vQueueDelete(workers[i].queue);
+    }
+
+    if (g_sec_worker_sem) {
+        vSemaphoreDelete(g_sec_worker_sem);
+        g_sec_worker_sem = NULL;
+    }
+
+    ESP_FREE(response_data);
+
     return ret;
 }
 
@@ -447,27 +821,441 @@ esp_err_t espnow_sec_initiator_start(uint8_t key_info[APP_KEY_LEN], const char *
 
     memcpy(app_key, key_info, APP_KEY_LEN);
 
-    g_sec_queue = xQueueCreate(addrs_num, sizeof(espnow_sec_data_t));
-    ESP_ERROR_RETURN(!g_sec_queue, ESP_FAIL, "Create espnow security queue fail");
-    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_SECURITY, 1, espnow_initiator_sec_process);
+    ret = espnow_sec_master_load();
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_master_load");
+
+    /* Tickets are issued for the current rekey id and expire with the later rekeys, the time or the reboots */
+    espnow_sec_ticket_issue(&g_sec_ticket);
+
+    ret = espnow_sec_initiator_queue_create(addrs_num);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "Create espnow security queue fail");
 
     ret = protocomm_espnow_initiator_start(espnow_sec, (const void *)(&pop), addrs_list, addrs_num, res);
 
-    espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_SECURITY, 0, NULL);
-    if (g_sec_queue) {
-        espnow_sec_data_t *tmp_data = NULL;
+    espnow_sec_initiator_queue_delete();
 
-        while (xQueueReceive(g_sec_queue, &tmp_data, 0)) {
-            ESP_FREE(tmp_data->data);
+    return ret;
+}
+
+static esp_err_t espnow_sec_rekey_pack(espnow_sec_t *sec, espnow_sec_rekey_t *rekey, uint32_t rekey_id,
+                                       const espnow_addr_t *addrs_list, size_t addrs_num)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    uint8_t plain[ESPNOW_SEC_REKEY_PLAIN_LEN];
+    size_t olen = 0;
+
+    rekey->type     = ESPNOW_SEC_TYPE_REKEY;
+    rekey->rekey_id = rekey_id;
+    rekey->num      = addrs_num;
+    esp_fill_random(rekey->iv, IV_LEN);
+
+    /* The rekey id is wrapped with the key, so it can not be rolled back by a forged header */
+    memcpy(plain, app_key, APP_KEY_LEN);
+    memcpy(plain + APP_KEY_LEN, &rekey_id, sizeof(uint32_t));
+    plain[APP_KEY_LEN + sizeof(uint32_t)] = espnow_get_next_sec_suite();
+    memcpy(key_info + ESPNOW_SEC_KEK_LEN, rekey->iv, IV_LEN);
+
+    for (int i = 0; i < addrs_num; i++) {
+        espnow_sec_rekey_entry_t *entry = rekey->entry + i;
+        memcpy(entry->addr, addrs_list[i], ESPNOW_ADDR_LEN);
+
+        ret = espnow_sec_kek_derive(addrs_list[i], key_info);
+        ESP_ERROR_BREAK(ret != ESP_OK, "espnow_sec_kek_derive");
+        ret = espnow_sec_setkey(sec, key_info);
+        ESP_ERROR_BREAK(ret != ESP_OK, "espnow_sec_setkey");
+        ret = espnow_sec_auth_encrypt(sec, plain, sizeof(plain), entry->data, sizeof(entry->data), &olen, TAG_LEN);
+        ESP_ERROR_BREAK(ret != ESP_OK, "espnow_sec_auth_encrypt");
+    }
+
+    memset(key_info, 0, sizeof(key_info));
+    memset(plain, 0, sizeof(plain));
+
+    return ret;
+}
+
+/**
+ * @brief The ack counts only if its mic decrypts with the KEK of the sender, others can not confirm for it
+ */
+static bool espnow_sec_rekey_ack_verify(espnow_sec_t *sec, const espnow_sec_data_t *sec_data, uint32_t rekey_id)
+{
+    const espnow_sec_rekey_ack_t *ack = (espnow_sec_rekey_ack_t *)sec_data->data;
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    uint32_t mic_rekey_id = 0;
+    size_t olen = 0;
+    bool verified = false;
+
+    if (sec_data->size < sizeof(espnow_sec_rekey_ack_t) || ack->type != ESPNOW_SEC_TYPE_REKEY_ACK
+            || ack->rekey_id != rekey_id) {
+        return false;
+    }
+
+    memcpy(key_info + ESPNOW_SEC_KEK_LEN, ack->iv, IV_LEN);
+
+    if (espnow_sec_kek_derive(sec_data->src_addr, key_info) == ESP_OK
+            && espnow_sec_setkey(sec, key_info) == ESP_OK
+            && espnow_sec_auth_decrypt(sec, ack->mic, sizeof(ack->mic), (uint8_t *)&mic_rekey_id,
+                                       sizeof(uint32_t), &olen, TAG_LEN) == ESP_OK) {
+        verified = (mic_rekey_id == rekey_id);
+    }
+
+    if (!verified) {
+        ESP_LOGW(TAG, "Rekey ack of " MACSTR " is not authenticated", MAC2STR(sec_data->src_addr));
+    }
+
+    memset(key_info, 0, sizeof(key_info));
+
+    return verified;
+}
+
+esp_err_t espnow_sec_initiator_rekey(uint8_t key_info[APP_KEY_LEN], const uint8_t addrs_list[][6], size_t addrs_num,
+                                     espnow_sec_result_t *res)
+{
+    ESP_PARAM_CHECK(key_info);
+    ESP_PARAM_CHECK(addrs_list);
+    ESP_PARAM_CHECK(addrs_num);
+
+    esp_err_t ret = ESP_OK;
+    uint32_t rekey_id = 0;
+    espnow_sec_t sec = { 0 };
+    espnow_sec_data_t sec_data = { 0 };
+    espnow_sec_result_t *result = res;
+    espnow_sec_rekey_t *rekey = NULL;
+    espnow_frame_head_t frame_head = {
+        .retransmit_count = CONFIG_ESPNOW_SEC_SEND_RETRY_NUM,
+        .broadcast        = true,
+        .filter_adjacent_channel = true,
+        .forward_ttl      = CONFIG_ESPNOW_SEC_SEND_FORWARD_TTL,
+        .forward_rssi     = CONFIG_ESPNOW_SEC_SEND_FORWARD_RSSI,
+    };
+
+    ret = espnow_storage_get(ESPNOW_SEC_MASTER_KEY, g_sec_master, APP_KEY_LEN);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "No master secret, espnow_sec_initiator_start must be called first");
+
+    espnow_storage_get(ESPNOW_SEC_REKEY_ID_KEY, &rekey_id, sizeof(uint32_t));
+    rekey_id++;
+    ret = espnow_storage_set(ESPNOW_SEC_REKEY_ID_KEY, &rekey_id, sizeof(uint32_t));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_storage_set, key: %s", ESPNOW_SEC_REKEY_ID_KEY);
+
+    memcpy(app_key, key_info, APP_KEY_LEN);
+
+    /* Be able to decrypt the nodes that switch over first */
+    if (espnow_set_next_key(key_info) != ESP_OK) {
+        ESP_LOGW(TAG, "The new key is not used by the root, sec_enable is false");
+    }
+
+    rekey = ESP_MALLOC(ESPNOW_DATA_LEN);
+    ESP_ERROR_RETURN(!rekey, ESP_ERR_NO_MEM, "");
+
+    ret = espnow_sec_init(&sec);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_init");
+
+    ret = espnow_sec_initiator_queue_create(addrs_num);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Create espnow security queue fail");
+
+    if (!res) {
+        result = ESP_CALLOC(1, sizeof(espnow_sec_result_t));
+        ret = result ? ESP_OK : ESP_ERR_NO_MEM;
+        ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<ESP_ERR_NO_MEM> espnow_sec_result_t");
+    }
+
+    result->successed_addr  = ESP_CALLOC(addrs_num, ESPNOW_ADDR_LEN);
+    result->unfinished_addr = ESP_CALLOC(addrs_num, ESPNOW_ADDR_LEN);
+    ret = (result->successed_addr && result->unfinished_addr) ? ESP_OK : ESP_ERR_NO_MEM;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<ESP_ERR_NO_MEM> result addresses, addrs_num: %d", addrs_num);
+    result->unfinished_num  = 0;
+
+    /* The nodes can not follow a suite they have not advertised in the scan */
+    for (size_t i = 0; i < addrs_num; i++) {
+        if (espnow_sec_responder_suites(addrs_list[i]) & BIT(espnow_get_next_sec_suite())) {
+            memcpy(result->unfinished_addr[result->unfinished_num++], addrs_list[i], ESPNOW_ADDR_LEN);
+        } else {
+            ESP_LOGW(TAG, "Cipher suite %d is not supported by " MACSTR, espnow_get_next_sec_suite(), MAC2STR(addrs_list[i]));
         }
+    }
 
-        vQueueDelete(g_sec_queue);
-        g_sec_queue = NULL;
+    g_sec_initiator_flag = true;
+
+    for (int count = 0; count < ESPNOW_SEC_REKEY_RETRY_NUM && result->unfinished_num > 0 && g_sec_initiator_flag; count++) {
+        ESP_LOGI(TAG, "count: %d, Secure_initiator_rekey, rekey_id: %"PRIu32", unfinished_num: %d, successed_num: %d",
+                 count, rekey_id, result->unfinished_num, result->successed_num);
+
+        /* Only the devices that have not confirmed are packed into the resent packets */
+        for (size_t i = 0; i < result->unfinished_num; i += ESPNOW_SEC_REKEY_ENTRY_MAX) {
+            size_t num = result->unfinished_num - i;
+            num = (num > ESPNOW_SEC_REKEY_ENTRY_MAX) ? ESPNOW_SEC_REKEY_ENTRY_MAX : num;
+
+            ret = espnow_sec_rekey_pack(&sec, rekey, rekey_id, result->unfinished_addr + i, num);
+            ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_rekey_pack");
+
+            ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY, ESPNOW_ADDR_BROADCAST, rekey,
+                              sizeof(espnow_sec_rekey_t) + num * sizeof(espnow_sec_rekey_entry_t), &frame_head, portMAX_DELAY);
+            ESP_ERROR_CONTINUE(ret != ESP_OK, "<%s> espnow_send", esp_err_to_name(ret));
+        }
+
+        /* Gather the acknowledgements of this round */
+        TickType_t wait_ticks  = pdMS_TO_TICKS(500 + 10 * result->unfinished_num);
+        TickType_t start_ticks = xTaskGetTickCount();
+
+        while (xTaskGetTickCount() - start_ticks < wait_ticks && result->unfinished_num > 0 && g_sec_initiator_flag) {
+            if (xQueueReceive(g_sec_queue, &sec_data, pdMS_TO_TICKS(100)) != pdPASS) {
+                continue;
+            }
+
+            if (espnow_sec_rekey_ack_verify(&sec, &sec_data, rekey_id)
+                    && addrs_remove(result->unfinished_addr, &result->unfinished_num, sec_data.src_addr)) {
+                memcpy(result->successed_addr[result->successed_num], sec_data.src_addr, ESPNOW_ADDR_LEN);
+                result->successed_num++;
+            }
+
+            ESP_FREE(sec_data.data);
+        }
+    }
+
+    ESP_LOGI(TAG, "Secure_initiator_rekey, rekey_id: %"PRIu32", unfinished_num: %d, successed_num: %d",
+             rekey_id, result->unfinished_num, result->successed_num);
+
+EXIT:
+    g_sec_initiator_flag = false;
+
+    espnow_sec_initiator_queue_delete();
+    espnow_sec_deinit(&sec);
+    ESP_FREE(rekey);
+
+    if (!res && result) {
+        espnow_sec_initiator_result_free(result);
+        ESP_FREE(result);
     }
 
     return ret;
 }
 
+esp_err_t espnow_sec_initiator_switch_key(void)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    uint32_t rekey_id = 0;
+    size_t olen = 0;
+    espnow_sec_t sec = { 0 };
+    espnow_sec_rekey_switch_t rekey_switch = {
+        .type = ESPNOW_SEC_TYPE_REKEY_SWITCH,
+    };
+    espnow_frame_head_t frame_head = {
+        .retransmit_count = CONFIG_ESPNOW_SEC_SEND_RETRY_NUM,
+        .broadcast        = true,
+        .filter_adjacent_channel = true,
+        .forward_ttl      = CONFIG_ESPNOW_SEC_SEND_FORWARD_TTL,
+        .forward_rssi     = CONFIG_ESPNOW_SEC_SEND_FORWARD_RSSI,
+    };
+
+    ret = espnow_get_next_key(key_info);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "No next key, espnow_sec_initiator_rekey must be called first");
+
+    ret = espnow_storage_get(ESPNOW_SEC_REKEY_ID_KEY, &rekey_id, sizeof(uint32_t));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_storage_get, key: %s", ESPNOW_SEC_REKEY_ID_KEY);
+
+    rekey_switch.rekey_id = rekey_id;
+    esp_fill_random(rekey_switch.iv, IV_LEN);
+    memcpy(key_info + KEY_LEN, rekey_switch.iv, IV_LEN);
+
+    ret = espnow_sec_init(&sec);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_init");
+    ret = espnow_sec_setkey(&sec, key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_setkey");
+    ret = espnow_sec_auth_encrypt(&sec, (uint8_t *)&rekey_id, sizeof(uint32_t), rekey_switch.mic, sizeof(rekey_switch.mic), &olen, TAG_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_encrypt");
+
+    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY, ESPNOW_ADDR_BROADCAST, &rekey_switch, sizeof(rekey_switch), &frame_head, portMAX_DELAY);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_send", esp_err_to_name(ret));
+
+    ret = espnow_switch_key();
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_switch_key");
+
+EXIT:
+    espnow_sec_deinit(&sec);
+    memset(key_info, 0, sizeof(key_info));
+
+    return ret;
+}
+
+static esp_err_t espnow_sec_resume_handle(const uint8_t *src_addr, const void *data, size_t size)
+{
+    esp_err_t ret = ESP_OK;
+    const espnow_sec_resume_t *req = (espnow_sec_resume_t *)data;
+    espnow_sec_resume_resp_t resp = {
+        .type = ESPNOW_SEC_TYPE_RESUME_RESP,
+    };
+    espnow_sec_resume_key_t resume_key = { 0 };
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    uint32_t rekey_id = 0;
+    uint8_t nonce[ESPNOW_SEC_RESUME_NONCE_LEN] = { 0 };
+    size_t olen = 0;
+    espnow_sec_t sec = { 0 };
+    espnow_frame_head_t frame_head = {
+        .retransmit_count = CONFIG_ESPNOW_SEC_SEND_RETRY_NUM,
+        .filter_adjacent_channel = true,
+        .forward_ttl      = CONFIG_ESPNOW_SEC_SEND_FORWARD_TTL,
+        .forward_rssi     = CONFIG_ESPNOW_SEC_SEND_FORWARD_RSSI,
+    };
+
+    ESP_ERROR_RETURN(size < sizeof(espnow_sec_resume_t), ESP_ERR_INVALID_SIZE, "Resume packet too short: %d", size);
+
+    espnow_storage_get(ESPNOW_SEC_REKEY_ID_KEY, &rekey_id, sizeof(uint32_t));
+    ESP_ERROR_RETURN(espnow_sec_ticket_expired(&req->issue, rekey_id), ESP_ERR_INVALID_STATE,
+                     "Ticket of " MACSTR " expired, ticket_id: %"PRIu32", boot_count: %"PRIu32", time: %"PRIu32,
+                     MAC2STR(src_addr), req->issue.ticket_id, req->issue.boot_count, req->issue.time);
+
+    /* Check the possession of the ticket */
+    ret = espnow_sec_ticket_derive(src_addr, &req->issue, key_info);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_ticket_derive");
+    memcpy(key_info + KEY_LEN, req->iv, IV_LEN);
+
+    ret = espnow_sec_init(&sec);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_init");
+    ret = espnow_sec_setkey(&sec, key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_setkey");
+    ret = espnow_sec_auth_decrypt(&sec, req->mic, sizeof(req->mic), nonce, sizeof(nonce), &olen, TAG_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_decrypt");
+    ret = !memcmp(nonce, req->nonce, sizeof(nonce)) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Nonce mismatch");
+
+    /* The current APP key of the root, with a new ticket */
+    ret = espnow_get_key(resume_key.app_key);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "The root has no APP key");
+    resume_key.key_id    = espnow_get_key_id();
+    resume_key.rekey_id  = rekey_id;
+    resume_key.suite     = espnow_get_sec_suite();
+    memcpy(resume_key.nonce, req->nonce, sizeof(resume_key.nonce));
+    espnow_sec_ticket_issue(&resume_key.issue);
+    ret = espnow_sec_ticket_derive(src_addr, &resume_key.issue, resume_key.ticket);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_ticket_derive");
+
+    esp_fill_random(resp.iv, IV_LEN);
+    memcpy(key_info + KEY_LEN, resp.iv, IV_LEN);
+    ret = espnow_sec_setkey(&sec, key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_setkey");
+    ret = espnow_sec_auth_encrypt(&sec, (uint8_t *)&resume_key, sizeof(resume_key), resp.data, sizeof(resp.data), &olen, TAG_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_encrypt");
+
+    ESP_LOGD(TAG, "Resume " MACSTR ", ticket_id: %"PRIu32, MAC2STR(src_addr), req->issue.ticket_id);
+
+    espnow_add_peer(src_addr, NULL);
+    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY, src_addr, &resp, sizeof(resp), &frame_head, pdMS_TO_TICKS(ESPNOW_SEC_SEND_TIMEOUT_MS));
+    espnow_del_peer(src_addr);
+
+EXIT:
+    espnow_sec_deinit(&sec);
+    memset(key_info, 0, sizeof(key_info));
+    memset(&resume_key, 0, sizeof(resume_key));
+
+    return ret;
+}
+
+/**
+ * @brief Answers the resumption requests off the ESP-NOW receive task, each takes two key derivations and a send
+ */
+static void espnow_sec_resume_task(void *arg)
+{
+    espnow_sec_data_t sec_data = { 0 };
+
+    for (;;) {
+        if (xQueueReceive(g_sec_resume_queue, &sec_data, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+
+        if (!sec_data.data) {
+            break;
+        }
+
+        esp_err_t ret = espnow_sec_resume_handle(sec_data.src_addr, sec_data.data, sec_data.size);
+        ESP_FREE(sec_data.data);
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "<%s> espnow_sec_resume_handle", esp_err_to_name(ret));
+        }
+    }
+
+    xSemaphoreGive(g_sec_resume_exit);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t espnow_sec_resume_task_start(void)
+{
+    if (g_sec_resume_queue) {
+        return ESP_OK;
+    }
+
+    g_sec_resume_exit  = xSemaphoreCreateBinary();
+    g_sec_resume_queue = xQueueCreate(ESPNOW_SEC_RESUME_QUEUE_SIZE, sizeof(espnow_sec_data_t));
+    ESP_ERROR_GOTO(!g_sec_resume_exit || !g_sec_resume_queue, EXIT, "Create espnow resume queue fail");
+
+    if (xTaskCreate(espnow_sec_resume_task, "espnow_sec_resume", ESPNOW_SEC_RESUME_STACK_SIZE,
+                    NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Create espnow resume task fail");
+        goto EXIT;
+    }
+
+    return ESP_OK;
+
+EXIT:
+    if (g_sec_resume_queue) {
+        vQueueDelete(g_sec_resume_queue);
+        g_sec_resume_queue = NULL;
+    }
+
+    if (g_sec_resume_exit) {
+        vSemaphoreDelete(g_sec_resume_exit);
+        g_sec_resume_exit = NULL;
+    }
+
+    return ESP_FAIL;
+}
+
+static void espnow_sec_resume_task_stop(void)
+{
+    if (!g_sec_resume_queue) {
+        return;
+    }
+
+    espnow_sec_data_t sec_data = { 0 };
+
+    /* The queued requests are answered before the exit one */
+    xQueueSend(g_sec_resume_queue, &sec_data, portMAX_DELAY);
+    xSemaphoreTake(g_sec_resume_exit, portMAX_DELAY);
+
+    while (xQueueReceive(g_sec_resume_queue, &sec_data, 0)) {
+        ESP_FREE(sec_data.data);
+    }
+
+    vQueueDelete(g_sec_resume_queue);
+    g_sec_resume_queue = NULL;
+    vSemaphoreDelete(g_sec_resume_exit);
+    g_sec_resume_exit = NULL;
+}
+
+esp_err_t espnow_sec_initiator_resume_enable(bool enable)
+{
+    if (enable) {
+        esp_err_t ret = espnow_sec_master_load();
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_master_load");
+        ret = espnow_sec_resume_task_start();
+        ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_resume_task_start");
+    }
+
+    g_sec_resume_flag = enable;
+
+    /* Keep the handler while a handshake or rekey is running */
+    if (!g_sec_queue) {
+        espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_SECURITY, enable, enable ? espnow_initiator_sec_process : NULL);
+    }
+
+    if (!enable) {
+        espnow_sec_resume_task_stop();
+    }
+
+    return ESP_OK;
+}
+
 esp_err_t espnow_sec_initiator_stop()
 {
     protocomm_espnow_initiator_stop();
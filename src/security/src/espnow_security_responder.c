@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <esp_err.h>
 #include <esp_log.h>
 #include "esp_system.h"
@@ -27,25 +28,75 @@
 #include <protocomm.h>
 #include <protocomm_security1.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "esp_wifi.h"
 #include "espnow.h"
 #include "espnow_security_handshake.h"
 
 static const char* TAG = "espnow_sec_resp";
 
+#define ESPNOW_SEC_KEK_KEY          "sec_kek"
+#define ESPNOW_SEC_REKEY_ID_KEY     "sec_rekey_rx"
+#define ESPNOW_SEC_TICKET_KEY       "sec_ticket"
+
+#define ESPNOW_SEC_TASK_STACK_SIZE  (4 * 1024)
+#define ESPNOW_SEC_QUEUE_SIZE       4
+#define ESPNOW_SEC_SEND_TIMEOUT_MS  100
+
+/**
+ * @brief Resumption ticket got from the initiator
+ */
+typedef struct {
+    uint8_t initiator_addr[6];
+    espnow_sec_ticket_issue_t issue;
+    uint8_t secret[KEY_LEN];
+} espnow_sec_ticket_t;
+
 static uint8_t app_key[APP_KEY_LEN] = { 0 };
 static protocomm_t *g_espnow_pc = NULL;
 static espnow_sec_info_t g_sec_info = { 0 };
 static espnow_frame_head_t g_frame_config = { 0 };
+/**
+ * @brief g_resume_lock is created once and kept, the response handler gives g_resume_sem under it
+ *        while espnow_sec_responder_resume may be timing out and deleting it
+ */
+static SemaphoreHandle_t g_resume_lock = NULL;
+static SemaphoreHandle_t g_resume_sem = NULL;
+static esp_err_t g_resume_ret = ESP_OK;
+static uint8_t g_resume_nonce[ESPNOW_SEC_RESUME_NONCE_LEN] = { 0 };
+
+/**
+ * @brief Message handled by the security task, data is NULL to stop the task
+ */
+typedef struct {
+    uint8_t src_addr[6];
+    void *data;
+    size_t size;
+} espnow_sec_data_t;
+
+static QueueHandle_t g_sec_queue = NULL;
+static SemaphoreHandle_t g_sec_task_exit = NULL;
 
 static esp_err_t espnow_sec_info(const uint8_t *src_addr)
 {
     esp_err_t ret = ESP_OK;
     size_t size = sizeof(espnow_sec_info_t);
     espnow_sec_info_t *info = &g_sec_info;
+    espnow_sec_info_t info_send = { 0 };
 
     info->type = ESPNOW_SEC_TYPE_INFO;
+    memcpy(&info_send, info, size);
+
+    /* Let the initiator pick a cipher suite we support */
+    if (info->sec_ver == ESPNOW_SEC_VER_NONE) {
+        info_send.sec_ver = ESPNOW_SEC_VER_SET_SUITES(info->sec_ver, espnow_sec_suite_supported());
+    }
 
-    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY_STATUS, src_addr, info, size, &g_frame_config, portMAX_DELAY);
+    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY_STATUS, src_addr, &info_send, size, &g_frame_config, portMAX_DELAY);
 
     ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_write");
 
@@ -120,6 +171,313 @@ static esp_err_t espnow_sec_handle(const char *ep_name, uint8_t resp_type, const
     return ret;
 }
 
+/**
+ * @brief Acknowledge the APP key of rekey_id, key_info holds the KEK. The rekey id encrypted
+ *        with it proves to the initiator that the ack comes from this device.
+ */
+static esp_err_t espnow_sec_rekey_ack(espnow_sec_t *sec, uint8_t key_info[APP_KEY_LEN],
+                                      const espnow_addr_t src_addr, uint32_t rekey_id)
+{
+    esp_err_t ret = ESP_OK;
+    size_t olen = 0;
+    espnow_sec_rekey_ack_t ack = {
+        .type     = ESPNOW_SEC_TYPE_REKEY_ACK,
+        .rekey_id = rekey_id,
+    };
+    espnow_frame_head_t frame_head = {
+        .retransmit_count = 1,
+        .broadcast        = false,
+        .filter_adjacent_channel = true,
+        .forward_ttl      = 0,
+    };
+
+    esp_fill_random(ack.iv, IV_LEN);
+    memcpy(key_info + ESPNOW_SEC_KEK_LEN, ack.iv, IV_LEN);
+
+    ret = espnow_sec_setkey(sec, key_info);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_setkey");
+    ret = espnow_sec_auth_encrypt(sec, (uint8_t *)&rekey_id, sizeof(uint32_t), ack.mic, sizeof(ack.mic), &olen, TAG_LEN);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "espnow_sec_auth_encrypt");
+
+    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY, src_addr, &ack, sizeof(ack), &frame_head, pdMS_TO_TICKS(ESPNOW_SEC_SEND_TIMEOUT_MS));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "<%s> espnow_send", esp_err_to_name(ret));
+
+    return ESP_OK;
+}
+
+static esp_err_t espnow_sec_rekey_handle(const espnow_addr_t src_addr, const uint8_t *data, size_t size)
+{
+    esp_err_t ret = ESP_OK;
+    const espnow_sec_rekey_t *rekey = (espnow_sec_rekey_t *)data;
+    const espnow_sec_rekey_entry_t *entry = NULL;
+    uint8_t self_addr[ESPNOW_ADDR_LEN] = { 0 };
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    uint8_t plain[ESPNOW_SEC_REKEY_PLAIN_LEN];
+    uint32_t rekey_id = 0;
+    uint32_t last_rekey_id = 0;
+    size_t olen = 0;
+    espnow_sec_t sec = { 0 };
+
+    ESP_ERROR_RETURN(size < sizeof(espnow_sec_rekey_t) || size < sizeof(espnow_sec_rekey_t) + rekey->num * sizeof(espnow_sec_rekey_entry_t),
+                     ESP_ERR_INVALID_SIZE, "Rekey packet too short: %d", size);
+
+    esp_wifi_get_mac(WIFI_IF_STA, self_addr);
+
+    for (int i = 0; i < rekey->num; i++) {
+        if (ESPNOW_ADDR_IS_EQUAL(rekey->entry[i].addr, self_addr)) {
+            entry = rekey->entry + i;
+            break;
+        }
+    }
+
+    /* Not wrapped for this device */
+    if (!entry) {
+        return ESP_OK;
+    }
+
+    espnow_storage_get(ESPNOW_SEC_REKEY_ID_KEY, &last_rekey_id, sizeof(uint32_t));
+
+    /* Replayed packet of an older key */
+    if (rekey->rekey_id < last_rekey_id) {
+        return ESP_OK;
+    }
+
+    ret = espnow_storage_get(ESPNOW_SEC_KEK_KEY, key_info, ESPNOW_SEC_KEK_LEN);
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "No key-encryption key, the handshake has to be done first");
+
+    ret = espnow_sec_init(&sec);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_init");
+
+    /* Key installed already, the ack was lost */
+    if (rekey->rekey_id == last_rekey_id) {
+        ret = espnow_sec_rekey_ack(&sec, key_info, src_addr, last_rekey_id);
+        goto EXIT;
+    }
+
+    memcpy(key_info + ESPNOW_SEC_KEK_LEN, rekey->iv, IV_LEN);
+    ret = espnow_sec_setkey(&sec, key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_setkey");
+    ret = espnow_sec_auth_decrypt(&sec, entry->data, sizeof(entry->data), plain, sizeof(plain), &olen, TAG_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_decrypt");
+
+    memcpy(&rekey_id, plain + APP_KEY_LEN, sizeof(uint32_t));
+    ret = (rekey_id == rekey->rekey_id) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Rekey id mismatch, %"PRIu32" != %"PRIu32, rekey_id, rekey->rekey_id);
+
+    memcpy(app_key, plain, APP_KEY_LEN);
+
+    ESP_LOGI(TAG, "Get APP key, rekey_id: %"PRIu32, rekey_id);
+
+    /* Only decrypt with it until the switch-over command, the suite changes with the key */
+    ret = espnow_set_next_sec_suite(plain[APP_KEY_LEN + sizeof(uint32_t)]);
+    ret |= espnow_set_next_key(app_key);
+    ret |= espnow_storage_set(ESPNOW_SEC_REKEY_ID_KEY, &rekey_id, sizeof(uint32_t));
+
+    esp_event_post(ESP_EVENT_ESPNOW, ret ? ESP_EVENT_ESPNOW_SEC_FAIL : ESP_EVENT_ESPNOW_SEC_OK, (void *)src_addr, sizeof(espnow_addr_t), 0);
+
+    if (ret == ESP_OK) {
+        ret = espnow_sec_rekey_ack(&sec, key_info, src_addr, rekey_id);
+    }
+
+EXIT:
+    espnow_sec_deinit(&sec);
+    memset(key_info, 0, sizeof(key_info));
+    memset(plain, 0, sizeof(plain));
+
+    return ret;
+}
+
+static esp_err_t espnow_sec_rekey_switch_handle(const uint8_t *data, size_t size)
+{
+    esp_err_t ret = ESP_OK;
+    const espnow_sec_rekey_switch_t *rekey_switch = (espnow_sec_rekey_switch_t *)data;
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    uint32_t rekey_id = 0;
+    uint32_t last_rekey_id = 0;
+    size_t olen = 0;
+    espnow_sec_t sec = { 0 };
+
+    ESP_ERROR_RETURN(size < sizeof(espnow_sec_rekey_switch_t), ESP_ERR_INVALID_SIZE, "Switch packet too short: %d", size);
+
+    espnow_storage_get(ESPNOW_SEC_REKEY_ID_KEY, &last_rekey_id, sizeof(uint32_t));
+
+    /* Switched already or the key of this rekey is not received */
+    if (rekey_switch->rekey_id != last_rekey_id || espnow_get_next_key(key_info) != ESP_OK) {
+        return ESP_OK;
+    }
+
+    memcpy(key_info + KEY_LEN, rekey_switch->iv, IV_LEN);
+
+    ret = espnow_sec_init(&sec);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_init");
+    ret = espnow_sec_setkey(&sec, key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_setkey");
+    ret = espnow_sec_auth_decrypt(&sec, rekey_switch->mic, sizeof(rekey_switch->mic), (uint8_t *)&rekey_id, sizeof(uint32_t), &olen, TAG_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_decrypt");
+
+    ret = (rekey_id == last_rekey_id) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Rekey id mismatch, %"PRIu32" != %"PRIu32, rekey_id, last_rekey_id);
+
+    ret = espnow_switch_key();
+
+EXIT:
+    espnow_sec_deinit(&sec);
+    memset(key_info, 0, sizeof(key_info));
+
+    return ret;
+}
+
+static esp_err_t espnow_sec_resume_resp_handle(const espnow_addr_t src_addr, const uint8_t *data, size_t size)
+{
+    esp_err_t ret = ESP_OK;
+    const espnow_sec_resume_resp_t *resp = (espnow_sec_resume_resp_t *)data;
+    espnow_sec_resume_key_t resume_key = { 0 };
+    espnow_sec_ticket_t ticket = { 0 };
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    uint32_t last_rekey_id = 0;
+    size_t olen = 0;
+    espnow_sec_t sec = { 0 };
+
+    /* Not resuming */
+    if (!g_resume_sem) {
+        return ESP_OK;
+    }
+
+    ESP_ERROR_RETURN(size < sizeof(espnow_sec_resume_resp_t), ESP_ERR_INVALID_SIZE, "Resume packet too short: %d", size);
+
+    ret = espnow_storage_get(ESPNOW_SEC_TICKET_KEY, &ticket, sizeof(espnow_sec_ticket_t));
+    ESP_ERROR_RETURN(ret != ESP_OK, ret, "No resumption ticket");
+    ret = ESPNOW_ADDR_IS_EQUAL(src_addr, ticket.initiator_addr) ? ESP_OK : ESP_ERR_INVALID_ARG;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Not from the initiator of the ticket");
+
+    memcpy(key_info, ticket.secret, KEY_LEN);
+    memcpy(key_info + KEY_LEN, resp->iv, IV_LEN);
+
+    ret = espnow_sec_init(&sec);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_init");
+    ret = espnow_sec_setkey(&sec, key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_setkey");
+    ret = espnow_sec_auth_decrypt(&sec, resp->data, sizeof(resp->data), (uint8_t *)&resume_key, sizeof(resume_key), &olen, TAG_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_decrypt");
+
+    /* The answer to this request, not a replayed one */
+    ret = !memcmp(resume_key.nonce, g_resume_nonce, sizeof(g_resume_nonce)) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Nonce mismatch");
+
+    espnow_storage_get(ESPNOW_SEC_REKEY_ID_KEY, &last_rekey_id, sizeof(uint32_t));
+    ret = (resume_key.rekey_id >= last_rekey_id) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Old APP key, rekey_id: %"PRIu32" < %"PRIu32, resume_key.rekey_id, last_rekey_id);
+
+    memcpy(app_key, resume_key.app_key, APP_KEY_LEN);
+    ticket.issue = resume_key.issue;
+    memcpy(ticket.secret, resume_key.ticket, KEY_LEN);
+
+    ESP_LOGI(TAG, "Get APP key by resumption, rekey_id: %"PRIu32, resume_key.rekey_id);
+
+    espnow_set_key_id(resume_key.key_id);
+    ret = espnow_set_sec_suite(resume_key.suite);
+    ret |= espnow_set_key(app_key);
+    ret |= espnow_set_dec_key(app_key);
+    ret |= espnow_storage_set(ESPNOW_SEC_REKEY_ID_KEY, &resume_key.rekey_id, sizeof(uint32_t));
+    ret |= espnow_storage_set(ESPNOW_SEC_TICKET_KEY, &ticket, sizeof(espnow_sec_ticket_t));
+
+    /* Mark as configured */
+    g_sec_info.sec_ver = ESPNOW_SEC_VER_V1_0;
+    memcpy(g_sec_info.client_mac, src_addr, ESPNOW_ADDR_LEN);
+
+    esp_event_post(ESP_EVENT_ESPNOW, ret ? ESP_EVENT_ESPNOW_SEC_FAIL : ESP_EVENT_ESPNOW_SEC_OK, g_sec_info.client_mac, sizeof(espnow_addr_t), 0);
+
+    xSemaphoreTake(g_resume_lock, portMAX_DELAY);
+
+    if (g_resume_sem) {
+        g_resume_ret = ret;
+        xSemaphoreGive(g_resume_sem);
+    }
+
+    xSemaphoreGive(g_resume_lock);
+
+EXIT:
+    espnow_sec_deinit(&sec);
+    memset(key_info, 0, sizeof(key_info));
+    memset(&ticket, 0, sizeof(ticket));
+    memset(&resume_key, 0, sizeof(resume_key));
+
+    return ret;
+}
+
+/**
+ * @brief Handles the rekey and resumption messages off the ESP-NOW receive task, they take key decryption, NVS writes and a send
+ */
+static void espnow_sec_responder_task(void *arg)
+{
+    esp_err_t ret = ESP_OK;
+    espnow_sec_data_t sec_data = { 0 };
+
+    for (;;) {
+        if (xQueueReceive(g_sec_queue, &sec_data, portMAX_DELAY) != pdPASS) {
+            continue;
+        }
+
+        if (!sec_data.data) {
+            break;
+        }
+
+        espnow_add_peer(sec_data.src_addr, NULL);
+
+        switch (((uint8_t *)sec_data.data)[0]) {
+        case ESPNOW_SEC_TYPE_REKEY:
+            ESP_LOGD(TAG, "ESPNOW_SEC_TYPE_REKEY");
+            ret = espnow_sec_rekey_handle(sec_data.src_addr, sec_data.data, sec_data.size);
+            break;
+
+        case ESPNOW_SEC_TYPE_REKEY_SWITCH:
+            ESP_LOGD(TAG, "ESPNOW_SEC_TYPE_REKEY_SWITCH");
+            ret = espnow_sec_rekey_switch_handle(sec_data.data, sec_data.size);
+            break;
+
+        case ESPNOW_SEC_TYPE_RESUME_RESP:
+            ESP_LOGD(TAG, "ESPNOW_SEC_TYPE_RESUME_RESP");
+            ret = espnow_sec_resume_resp_handle(sec_data.src_addr, sec_data.data, sec_data.size);
+            break;
+
+        default:
+            ret = ESP_OK;
+            break;
+        }
+
+        espnow_del_peer(sec_data.src_addr);
+        ESP_FREE(sec_data.data);
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "<%s> espnow_sec_handle", esp_err_to_name(ret));
+        }
+    }
+
+    xSemaphoreGive(g_sec_task_exit);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t espnow_sec_responder_queue(const uint8_t *src_addr, const void *data, size_t size)
+{
+    espnow_sec_data_t sec_data = { 0 };
+
+    ESP_ERROR_RETURN(!g_sec_queue, ESP_ERR_INVALID_STATE, "The security task is not running");
+
+    sec_data.data = ESP_MALLOC(size);
+    ESP_ERROR_RETURN(!sec_data.data, ESP_ERR_NO_MEM, "<ESP_ERR_NO_MEM> size: %d", size);
+    memcpy(sec_data.data, data, size);
+    sec_data.size = size;
+    memcpy(sec_data.src_addr, src_addr, 6);
+
+    if (xQueueSend(g_sec_queue, &sec_data, 0) != pdPASS) {
+        ESP_LOGW(TAG, "[%s, %d] Send sec queue failed", __func__, __LINE__);
+        ESP_FREE(sec_data.data);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
 static esp_err_t espnow_sec_responder_process(uint8_t *src_addr, void *data,
                       size_t size, wifi_pkt_rx_ctrl_t *rx_ctrl)
 {
@@ -130,6 +488,12 @@ static esp_err_t espnow_sec_responder_process(uint8_t *src_addr, void *data,
 
     esp_err_t ret = ESP_OK;
     uint8_t data_type = ((uint8_t *)data)[0];
+
+    if (data_type == ESPNOW_SEC_TYPE_REKEY || data_type == ESPNOW_SEC_TYPE_REKEY_SWITCH
+            || data_type == ESPNOW_SEC_TYPE_RESUME_RESP) {
+        return espnow_sec_responder_queue(src_addr, data, size);
+    }
+
     espnow_add_peer(src_addr, NULL);
 
     switch (data_type) {
@@ -164,10 +528,33 @@ static esp_err_t espnow_sec_responder_process(uint8_t *src_addr, void *data,
 
 static esp_err_t protocomm_espnow_responder_start(protocomm_t *pc)
 {
+    g_sec_task_exit = xSemaphoreCreateBinary();
+    g_sec_queue = xQueueCreate(ESPNOW_SEC_QUEUE_SIZE, sizeof(espnow_sec_data_t));
+    ESP_ERROR_GOTO(!g_sec_task_exit || !g_sec_queue, EXIT, "Create espnow security queue fail");
+
+    if (xTaskCreate(espnow_sec_responder_task, "espnow_sec_resp", ESPNOW_SEC_TASK_STACK_SIZE,
+                    NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Create espnow security task fail");
+        goto EXIT;
+    }
+
     g_espnow_pc = pc;
     espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_SECURITY, 1, espnow_sec_responder_process);
 
     return ESP_OK;
+
+EXIT:
+    if (g_sec_queue) {
+        vQueueDelete(g_sec_queue);
+        g_sec_queue = NULL;
+    }
+
+    if (g_sec_task_exit) {
+        vSemaphoreDelete(g_sec_task_exit);
+        g_sec_task_exit = NULL;
+    }
+
+    return ESP_FAIL;
 }
 
 static esp_err_t espnow_config_data_handler(uint32_t session_id, const uint8_t *inbuf, ssize_t inlen,
@@ -192,7 +579,30 @@ static esp_err_t espnow_config_data_handler(uint32_t session_id, const uint8_t *
 
     ESP_LOGI(TAG, "Get APP key");
 
-    ret = espnow_set_key(app_key);
+    /* Older initiators only use AES-CCM */
+    uint8_t suite = ESPNOW_SEC_SUITE_AES_CCM;
+
+    /* Initiators of this version append the KEK used for rekeying, the key id and the resumption ticket */
+    if (inlen >= sizeof(espnow_sec_key_data_t)) {
+        const espnow_sec_key_data_t *key_data = (espnow_sec_key_data_t *)inbuf;
+        espnow_sec_ticket_t ticket = {
+            .issue = key_data->issue,
+        };
+
+        memcpy(ticket.initiator_addr, g_sec_info.client_mac, ESPNOW_ADDR_LEN);
+        memcpy(ticket.secret, key_data->ticket, KEY_LEN);
+
+        /* Use the key id of the initiator, it may have switched keys before */
+        espnow_set_key_id(key_data->key_id);
+        ret |= espnow_storage_set(ESPNOW_SEC_KEK_KEY, key_data->kek, ESPNOW_SEC_KEK_LEN);
+        ret |= espnow_storage_set(ESPNOW_SEC_TICKET_KEY, &ticket, sizeof(espnow_sec_ticket_t));
+        espnow_storage_set(ESPNOW_SEC_REKEY_ID_KEY, &ticket.issue.ticket_id, sizeof(uint32_t));
+        memset(&ticket, 0, sizeof(ticket));
+        suite = key_data->suite;
+    }
+
+    ret |= espnow_set_sec_suite(suite);
+    ret |= espnow_set_key(app_key);
     ret |= espnow_set_dec_key(app_key);
 
 
@@ -205,6 +615,23 @@ static esp_err_t protocomm_espnow_responder_stop()
 {
     espnow_set_config_for_data_type(ESPNOW_DATA_TYPE_SECURITY, 0, NULL);
 
+    if (g_sec_queue) {
+        espnow_sec_data_t sec_data = { 0 };
+
+        /* The queued messages are handled before the exit one */
+        xQueueSend(g_sec_queue, &sec_data, portMAX_DELAY);
+        xSemaphoreTake(g_sec_task_exit, portMAX_DELAY);
+
+        while (xQueueReceive(g_sec_queue, &sec_data, 0)) {
+            ESP_FREE(sec_data.data);
+        }
+
+        vQueueDelete(g_sec_queue);
+        g_sec_queue = NULL;
+        vSemaphoreDelete(g_sec_task_exit);
+        g_sec_task_exit = NULL;
+    }
+
     return ESP_OK;
 }
 
@@ -256,11 +683,90 @@ esp_err_t espnow_sec_responder_start(const char *pop_data)
         return ret;
     }
 
-    protocomm_espnow_responder_start(pc);
+    ret = protocomm_espnow_responder_start(pc);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the security task");
+        protocomm_delete(pc);
+        return ret;
+    }
 
     return ESP_OK;
 }
 
+esp_err_t espnow_sec_responder_resume(TickType_t wait_ticks)
+{
+    ESP_ERROR_RETURN(!g_espnow_pc, ESP_ERR_INVALID_STATE, "espnow_sec_responder_start must be called first");
+    ESP_ERROR_RETURN(g_resume_sem, ESP_ERR_INVALID_STATE, "Resumption is running");
+
+    esp_err_t ret = ESP_OK;
+    espnow_sec_ticket_t ticket = { 0 };
+    uint8_t key_info[APP_KEY_LEN] = { 0 };
+    size_t olen = 0;
+    espnow_sec_t sec = { 0 };
+    espnow_sec_resume_t req = {
+        .type = ESPNOW_SEC_TYPE_RESUME,
+    };
+    espnow_frame_head_t frame_head = {
+        .retransmit_count = 1,
+        .broadcast        = false,
+        .filter_adjacent_channel = true,
+        .forward_ttl      = 0,
+    };
+
+    if (!g_resume_lock) {
+        g_resume_lock = xSemaphoreCreateMutex();
+        ESP_ERROR_RETURN(!g_resume_lock, ESP_ERR_NO_MEM, "Create resume mutex fail");
+    }
+
+    ret = espnow_storage_get(ESPNOW_SEC_TICKET_KEY, &ticket, sizeof(espnow_sec_ticket_t));
+    ESP_ERROR_RETURN(ret != ESP_OK, ESP_ERR_NOT_FOUND, "No resumption ticket");
+
+    /* Prove the possession of the ticket with a fresh nonce, the response has to carry it back */
+    req.issue = ticket.issue;
+    esp_fill_random(g_resume_nonce, sizeof(g_resume_nonce));
+    memcpy(req.nonce, g_resume_nonce, sizeof(req.nonce));
+    esp_fill_random(req.iv, IV_LEN);
+    memcpy(key_info, ticket.secret, KEY_LEN);
+    memcpy(key_info + KEY_LEN, req.iv, IV_LEN);
+
+    ret = espnow_sec_init(&sec);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_init");
+    ret = espnow_sec_setkey(&sec, key_info);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_setkey");
+    ret = espnow_sec_auth_encrypt(&sec, req.nonce, sizeof(req.nonce), req.mic, sizeof(req.mic), &olen, TAG_LEN);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "espnow_sec_auth_encrypt");
+
+    g_resume_ret = ESP_ERR_TIMEOUT;
+    g_resume_sem = xSemaphoreCreateBinary();
+    ret = g_resume_sem ? ESP_OK : ESP_ERR_NO_MEM;
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "Create resume semaphore fail");
+
+    espnow_add_peer(ticket.initiator_addr, NULL);
+    ret = espnow_send(ESPNOW_DATA_TYPE_SECURITY, ticket.initiator_addr, &req, sizeof(req), &frame_head, pdMS_TO_TICKS(ESPNOW_SEC_SEND_TIMEOUT_MS));
+    espnow_del_peer(ticket.initiator_addr);
+    ESP_ERROR_GOTO(ret != ESP_OK, EXIT, "<%s> espnow_send", esp_err_to_name(ret));
+
+    xSemaphoreTake(g_resume_sem, wait_ticks);
+    ret = g_resume_ret;
+
+EXIT:
+    /* No response handler is giving it once it is cleared */
+    xSemaphoreTake(g_resume_lock, portMAX_DELAY);
+    SemaphoreHandle_t resume_sem = g_resume_sem;
+    g_resume_sem = NULL;
+    xSemaphoreGive(g_resume_lock);
+
+    if (resume_sem) {
+        vSemaphoreDelete(resume_sem);
+    }
+
+    espnow_sec_deinit(&sec);
+    memset(key_info, 0, sizeof(key_info));
+    memset(&ticket, 0, sizeof(ticket));
+
+    return ret;
+}
+
 esp_err_t espnow_sec_responder_stop()
 {
     protocomm_espnow_responder_stop();
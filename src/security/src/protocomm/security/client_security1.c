@@ -19,6 +19,10 @@
 #include <esp_log.h>
 #include "esp_system.h"
 
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 4, 0)
+#include "esp_random.h"
+#endif
+
 /* ToDo - Remove this once appropriate solution is available.
 We need to define this for the file as ssl_misc.h uses private structures from mbedtls,
 which are undefined if the following flag is not defined */
@@ -122,6 +126,19 @@ static void hexdump(const char *msg, uint8_t *buf, int len)
     ESP_LOG_BUFFER_HEX_LEVEL(TAG, buf, len, ESP_LOG_DEBUG);
 }
 
+#if !ESPNOW_USE_PSA_CRYPTO
+/**
+ * @brief Random source for the per-session key agreement.
+ *        The shared ctr_drbg of pub_session is not thread safe, sessions may be
+ *        handled concurrently by the initiator worker tasks.
+ */
+static int sec1_random(void *ctx, unsigned char *buf, size_t len)
+{
+    esp_fill_random(buf, len);
+    return 0;
+}
+#endif
+
 #if ESPNOW_USE_PSA_CRYPTO
 static esp_err_t sec1_psa_cipher_update(session_t *session, const uint8_t *in, size_t inlen, uint8_t *out)
 {
@@ -417,34 +434,46 @@ static esp_err_t verify_response0(session_t *session, SessionData *resp, const p
         return ESP_FAIL;
     }
 #else
-    ret = mbedtls_mpi_lset(ACCESS_ECDH(&pub_session->ctx_client, Qp).Z, 1);
+    /* Keep the peer point and the shared secret on the stack, pub_session is
+     * shared by all sessions of a batch and must only be read here. */
+    mbedtls_ecp_point Qp;
+    mbedtls_mpi z;
+    mbedtls_ecp_point_init(&Qp);
+    mbedtls_mpi_init(&z);
+
+    ret = mbedtls_mpi_lset(&Qp.Z, 1);
     if (ret != 0) {
         ESP_LOGE(TAG, "Failed at mbedtls_mpi_lset with error code : %d", ret);
-        return ESP_FAIL;
+        goto exit_shared;
     }
 
     flip_endian(session->device_pubkey, PUBLIC_KEY_LEN);
-    ret = mbedtls_mpi_read_binary(ACCESS_ECDH(&pub_session->ctx_client, Qp).X, dev_pubkey, PUBLIC_KEY_LEN);
+    ret = mbedtls_mpi_read_binary(&Qp.X, dev_pubkey, PUBLIC_KEY_LEN);
     flip_endian(session->device_pubkey, PUBLIC_KEY_LEN);
     if (ret != 0) {
         ESP_LOGE(TAG, "Failed at mbedtls_mpi_read_binary with error code : %d", ret);
-        return ESP_FAIL;
+        goto exit_shared;
     }
 
     ret = mbedtls_ecdh_compute_shared(ACCESS_ECDH(&pub_session->ctx_client, grp),
-                                      ACCESS_ECDH(&pub_session->ctx_client, z),
-                                      ACCESS_ECDH(&pub_session->ctx_client, Qp),
+                                      &z, &Qp,
                                       ACCESS_ECDH(&pub_session->ctx_client, d),
-                                      mbedtls_ctr_drbg_random,
-                                      &pub_session->ctr_drbg);
+                                      sec1_random, NULL);
     if (ret != 0) {
         ESP_LOGE(TAG, "Failed at mbedtls_ecdh_compute_shared with error code : %d", ret);
-        return ESP_FAIL;
+        goto exit_shared;
     }
 
-    ret = mbedtls_mpi_write_binary(ACCESS_ECDH(&pub_session->ctx_client, z), session->sym_key, PUBLIC_KEY_LEN);
+    ret = mbedtls_mpi_write_binary(&z, session->sym_key, PUBLIC_KEY_LEN);
     if (ret != 0) {
         ESP_LOGE(TAG, "Failed at mbedtls_mpi_write_binary with error code : %d", ret);
+    }
+
+exit_shared:
+    mbedtls_ecp_point_free(&Qp);
+    mbedtls_mpi_free(&z);
+
+    if (ret != 0) {
         return ESP_FAIL;
     }
     flip_endian(session->sym_key, PUBLIC_KEY_LEN);
@@ -0,0 +1,163 @@
+#!/usr/bin/env python
+#
+# Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate the press-to-light latency of espnow_ctrl_initiator_send() with
+CONFIG_ESPNOW_CONTROL_AUTO_CHANNEL_SENDING.
+
+The responders are connected to routers and follow them when they change channel.
+The initiator sends the frame on a channel and waits WAIT_ACK_MS for the ACK of any
+responder on it, a probe on the right channel is lost with LOSS.
+
+The legacy sending probes the channel saved by the last ACK RETRANSMISSION_TIMES + 1
+times, then each other channel as many times in turn. The learned sending probes the
+channels in the order of espnow_ctrl_channel_plan(): the weights of the channels in
+the history of the responders, the next probe on the channel of the highest chance of
+not having been found yet. A responder moving announces its new channel with
+espnow_ctrl_responder_announce_channel(), heard with ANNOUNCE_HEARD as the initiator
+is mostly asleep.
+
+Usage: espnow_ctrl_channel_sim.py [--presses N] [--hop-every N] [--seed S]
+"""
+
+import argparse
+import random
+import sys
+
+# As espnow_ctrl.c and the Kconfig defaults
+WAIT_ACK_MS = 40            # CONFIG_ESPNOW_CONTROL_WAIT_ACK_DURATION
+RETRANSMISSION_TIMES = 5    # CONFIG_ESPNOW_CONTROL_RETRANSMISSION_TIMES
+HISTORY_NUM = 8             # CONFIG_ESPNOW_CONTROL_CHANNEL_HISTORY_NUM
+CHANNEL_HIT = 64            # ESPNOW_CHANNEL_HIT
+LOSS_PERCENT = 30           # ESPNOW_CHANNEL_LOSS_PERCENT
+CHANNELS = list(range(1, 14))
+
+LOSS = 0.2                  # Probe on the right channel not acknowledged, on the air
+ANNOUNCE_HEARD = 0.3        # Announcement of a new channel heard by the initiator
+ROUTER_CHANNELS = [1, 6, 11, 1, 6, 11, 3, 9]    # Channels the routers pick, the usual ones more often
+
+
+class Legacy(object):
+    def __init__(self):
+        self.saved = 1
+
+    def sequence(self):
+        seq = [self.saved] * (RETRANSMISSION_TIMES + 1)
+        for channel in CHANNELS:
+            if channel != self.saved:
+                seq += [channel] * (RETRANSMISSION_TIMES + 1)
+        return seq
+
+    def learn(self, mac, channel, ack):
+        if ack:
+            self.saved = channel
+
+
+class Learned(object):
+    def __init__(self):
+        self.seq = 0
+        self.entries = {}       # mac: [hits, seen]
+
+    def sequence(self):
+        chance = {}
+        for channel in CHANNELS:
+            chance[channel] = 1 + sum(entry[0][channel - 1] for entry in self.entries.values())
+
+        seq = []
+        for _ in range(len(CHANNELS) * (RETRANSMISSION_TIMES + 1)):
+            best = max(CHANNELS, key=lambda c: (chance[c], -c))
+            seq.append(best)
+            chance[best] = chance[best] * LOSS_PERCENT / 100.0
+        return seq
+
+    def learn(self, mac, channel, ack):
+        """espnow_ctrl_channel_learn()"""
+        if mac not in self.entries and len(self.entries) >= HISTORY_NUM:
+            oldest = min(self.entries, key=lambda m: self.entries[m][1])
+            del self.entries[oldest]
+
+        hits = self.entries.setdefault(mac, [[0] * 14, 0])[0]
+        for i in range(14):
+            hits[i] -= hits[i] // 4
+        hits[channel - 1] += CHANNEL_HIT
+        self.seq += 1
+        self.entries[mac][1] = self.seq
+
+    def missed(self, probed, start):
+        """espnow_ctrl_channel_missed()"""
+        for hits, seen in self.entries.values():
+            if seen > start:
+                continue
+            for channel in probed:
+                hits[channel - 1] = hits[channel - 1] * LOSS_PERCENT // 100
+
+
+def run(initiator, rng, responders, presses, hop_every, announce):
+    channels = [rng.choice(ROUTER_CHANNELS) for _ in range(responders)]
+    latencies = []
+
+    for press in range(presses):
+        for mac in range(responders):
+            if hop_every and rng.randrange(hop_every) == 0:
+                channels[mac] = rng.choice(ROUTER_CHANNELS)
+                if announce and rng.random() < ANNOUNCE_HEARD:
+                    initiator.learn(mac, channels[mac], False)
+
+        probes = 0
+        probed = []
+        acked = []
+        start = getattr(initiator, 'seq', 0)
+        for channel in initiator.sequence():
+            probes += 1
+            probed.append(channel)
+            acked = [mac for mac in range(responders) if channels[mac] == channel and rng.random() >= LOSS]
+            if acked:
+                # The first ACK ends the sending, the others are learned as they arrive in the wait
+                for mac in acked:
+                    initiator.learn(mac, channel, True)
+                break
+        # The probe acknowledged did not wait its full window, the ACKs of the others come after it
+        if hasattr(initiator, 'missed'):
+            initiator.missed(probed[:-1] if acked else probed, start)
+        latencies.append(probes * WAIT_ACK_MS)
+
+    return latencies
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--presses', type=int, default=20000)
+    parser.add_argument('--responders', type=int, default=4)
+    parser.add_argument('--hop-every', type=int, default=50, help='presses between the channel changes of a router, 0 for never')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    worst_case = len(CHANNELS) * (RETRANSMISSION_TIMES + 1) * WAIT_ACK_MS
+    print('%d responders, a router changes channel every %d presses, worst case %d ms'
+          % (args.responders, args.hop_every, worst_case))
+
+    for name, initiator, announce in (('legacy', Legacy(), False),
+                                      ('learned', Learned(), False),
+                                      ('announced', Learned(), True)):
+        latencies = sorted(run(initiator, random.Random(args.seed), args.responders,
+                               args.presses, args.hop_every, announce))
+        print('%-9s: mean %6.1f ms, p99 %5d ms, max %5d ms'
+              % (name, float(sum(latencies)) / len(latencies),
+                 latencies[len(latencies) * 99 // 100], latencies[-1]))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
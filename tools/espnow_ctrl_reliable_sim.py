@@ -0,0 +1,116 @@
+#!/usr/bin/env python
+#
+# Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate a scene sent to a group of responders with espnow_ctrl_initiator_send_batch()
+and with espnow_ctrl_initiator_send_reliable().
+
+The batch frame is broadcast once, a responder misses it with LOSS. The reliable
+sending lists the responders not acknowledging yet in the frame, they acknowledge in
+their slot of SLOT_MS, an acknowledgement is lost with LOSS too. The frame is sent
+again to the ones left until all acknowledged or WAIT_MS is over. A responder applies
+the scene once, whatever the frames it gets.
+
+Usage: espnow_ctrl_reliable_sim.py [--responders N] [--loss P] [--scenes N] [--seed S]
+"""
+
+import argparse
+import random
+import sys
+
+# As espnow_ctrl.c and the Kconfig defaults
+SLOT_MS = 8                 # CONFIG_ESPNOW_CONTROL_RELIABLE_SLOT
+MARGIN_MS = 30              # ESPNOW_RELIABLE_MARGIN_MS
+FRAME_MS = 2                # Frame on air and the sending task
+WAIT_MS = 1000              # wait_ms of the application
+MEMBERS_MAX = 42            # ESPNOW_RELIABLE_MEMBERS_MAX
+
+
+def reliable(rng, responders, loss, capacity):
+    acked = [False] * responders
+    applied = [0] * responders
+    cursor = 0
+    elapsed = 0
+    frames = 0
+
+    while elapsed < WAIT_MS:
+        listed = []
+        for n in range(responders):
+            i = (cursor + n) % responders
+            if not acked[i] and len(listed) < capacity:
+                listed.append(i)
+                cursor = (i + 1) % responders
+        if not listed:
+            break
+
+        frames += 1
+        elapsed += FRAME_MS
+        waiting = len(listed)
+        last = 0
+        for slot, i in enumerate(listed):
+            if rng.random() < loss:
+                continue
+            applied[i] = 1      # Once per seq, the frames after it only get the acknowledgement
+            if rng.random() >= loss:
+                acked[i] = True
+                waiting -= 1
+                last = slot * SLOT_MS + rng.randrange(SLOT_MS // 2 + 1)
+        # The semaphore is given with the last acknowledgement of the frame
+        elapsed += min(last if not waiting else len(listed) * SLOT_MS + MARGIN_MS, WAIT_MS - elapsed)
+
+    return sum(applied), sum(acked), elapsed, frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--responders', type=int, default=20)
+    parser.add_argument('--loss', type=float, default=0.1)
+    parser.add_argument('--capacity', type=int, default=MEMBERS_MAX, help='responders fitting in a frame with the scene')
+    parser.add_argument('--scenes', type=int, default=2000)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    batch_complete = 0
+    batch_applied = 0
+    complete = 0
+    applied = 0
+    latencies = []
+    frames = 0
+
+    for _ in range(args.scenes):
+        got = sum(rng.random() >= args.loss for _ in range(args.responders))
+        batch_applied += got
+        batch_complete += got == args.responders
+
+        got, acked, elapsed, sent = reliable(rng, args.responders, args.loss, args.capacity)
+        applied += got
+        complete += acked == args.responders
+        latencies.append(elapsed)
+        frames += sent
+
+    total = args.scenes * args.responders
+    latencies.sort()
+    print('%d responders, loss %.0f%%' % (args.responders, args.loss * 100))
+    print('batch   : applied %5.1f%%, whole scene %5.1f%%, 1 frame'
+          % (100.0 * batch_applied / total, 100.0 * batch_complete / args.scenes))
+    print('reliable: applied %5.1f%%, all acknowledged %5.1f%%, %.2f frames, mean %.0f ms, p99 %d ms'
+          % (100.0 * applied / total, 100.0 * complete / args.scenes, float(frames) / args.scenes,
+             float(sum(latencies)) / len(latencies), latencies[len(latencies) * 99 // 100]))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
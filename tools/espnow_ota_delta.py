@@ -0,0 +1,181 @@
+#!/usr/bin/env python
+#
+# Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Generate the patch sent by espnow_ota_initiator_send_delta().
+
+The patch is a sequence of records, each one sent in a packet:
+
+    uint32_t offset       Offset of the record in the new firmware
+    uint16_t raw_size     Size of the record once decompressed
+    uint16_t size         Size of the compressed diff that follows
+    uint32_t base_offset  Offset in the running firmware, 0xFFFFFFFF for none
+    uint8_t  data[size]   Diff compressed as espnow_ota_lz.c
+
+The responder rebuilds new[offset + i] = running[base_offset + i] + diff[i].
+The patch only applies to the responders whose running_sha_256, as reported by
+espnow_ota_initiator_scan(), is the one of old.bin.
+
+Usage: espnow_ota_delta.py old.bin new.bin patch.bin [--record-size N]
+"""
+
+import argparse
+import struct
+import sys
+
+LZ_BLOCK_MAX = 4096
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = 0x7F + LZ_MIN_MATCH
+LZ_MAX_LITERAL = 0x7F + 1
+BASE_NONE = 0xFFFFFFFF
+RECORD_HEAD = struct.Struct('<IHHI')
+
+# Packet sizes as in espnow_ota.h, to report the bytes on air
+PACKET_MAX_SIZE = 224
+PACKET_HEAD = 4
+PACKET_DELTA_HEAD = 3
+ANCHOR_LEN = 16
+
+
+def lz_compress(src, limit):
+    """Compress the head of src into at most limit bytes, return (consumed, output)."""
+    out = bytearray()
+    table = {}
+    lit_pos = 0
+    lit_num = 0
+    pos = 0
+
+    while pos < len(src):
+        match_len = 0
+        distance = 0
+
+        if pos + LZ_MIN_MATCH <= len(src):
+            key = bytes(src[pos:pos + LZ_MIN_MATCH])
+            match = table.get(key)
+            table[key] = pos
+
+            if match is not None and pos - match < 0x10000:
+                max_len = min(len(src) - pos, LZ_MAX_MATCH)
+                while match_len < max_len and src[match + match_len] == src[pos + match_len]:
+                    match_len += 1
+                distance = pos - match
+
+        if match_len >= LZ_MIN_MATCH:
+            if len(out) + 3 > limit:
+                break
+
+            out += bytes((0x80 | (match_len - LZ_MIN_MATCH), distance & 0xFF, distance >> 8))
+
+            for i in range(pos + 1, min(pos + match_len, len(src) - LZ_MIN_MATCH + 1)):
+                table[bytes(src[i:i + LZ_MIN_MATCH])] = i
+
+            pos += match_len
+            lit_num = 0
+            continue
+
+        if not lit_num or lit_num == LZ_MAX_LITERAL:
+            if len(out) + 2 > limit:
+                break
+            lit_pos = len(out)
+            out.append(0)
+            lit_num = 0
+        elif len(out) + 1 > limit:
+            break
+
+        out.append(src[pos])
+        out[lit_pos] = lit_num
+        lit_num += 1
+        pos += 1
+
+    return pos, bytes(out)
+
+
+def index_anchors(old):
+    anchors = {}
+    for offset in range(0, len(old) - ANCHOR_LEN + 1, 4):
+        anchors.setdefault(old[offset:offset + ANCHOR_LEN], offset)
+    return anchors
+
+
+def find_base(old, new, offset, length, anchors):
+    """Pick the offset of the running firmware most similar to new[offset:offset + length]."""
+    candidates = set()
+
+    for pos in range(offset, offset + length - ANCHOR_LEN + 1, 32):
+        base = anchors.get(new[pos:pos + ANCHOR_LEN])
+        if base is not None and base >= pos - offset:
+            candidates.add(base - (pos - offset))
+
+    best, best_score = BASE_NONE, length // 4
+    for base in candidates:
+        if base + length > len(old):
+            continue
+        score = sum(1 for i in range(length) if old[base + i] == new[offset + i])
+        if score > best_score:
+            best, best_score = base, score
+
+    return best
+
+
+def make_patch(old, new, record_size):
+    anchors = index_anchors(old)
+    patch = bytearray()
+    records = 0
+    offset = 0
+
+    while offset < len(new):
+        length = min(LZ_BLOCK_MAX, len(new) - offset)
+        base = find_base(old, new, offset, length, anchors)
+
+        if base == BASE_NONE:
+            diff = new[offset:offset + length]
+        else:
+            diff = bytes((new[offset + i] - old[base + i]) & 0xFF for i in range(length))
+
+        consumed, data = lz_compress(diff, record_size)
+        patch += RECORD_HEAD.pack(offset, consumed, len(data), base) + data
+        offset += consumed
+        records += 1
+
+    return bytes(patch), records
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('old', help='Firmware running on the responders')
+    parser.add_argument('new', help='Firmware to upgrade to')
+    parser.add_argument('patch', help='Patch to write')
+    parser.add_argument('--record-size', type=int, default=1024,
+                        help='Max compressed size of a record, at most the packet size of the responders')
+    args = parser.parse_args()
+
+    old = open(args.old, 'rb').read()
+    new = open(args.new, 'rb').read()
+    patch, records = make_patch(old, new, args.record_size)
+
+    with open(args.patch, 'wb') as f:
+        f.write(patch)
+
+    full_packets = (len(new) + PACKET_MAX_SIZE - 1) // PACKET_MAX_SIZE
+    full_bytes = len(new) + full_packets * PACKET_HEAD
+    delta_bytes = len(patch) + records * PACKET_DELTA_HEAD
+    print('full OTA : %d bytes on air, %d packets' % (full_bytes, full_packets))
+    print('delta OTA: %d bytes on air, %d packets (%.1f%% of the full OTA)'
+          % (delta_bytes, records, 100.0 * delta_bytes / full_bytes))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
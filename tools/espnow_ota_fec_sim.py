@@ -0,0 +1,175 @@
+#!/usr/bin/env python
+#
+# Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate the frames espnow_ota_initiator_send() sends to a fleet, with and without the repair packets.
+
+The initiator sends the firmware, then rounds of status requests and the packets lost by any responder,
+up to CONFIG_ESPNOW_OTA_RETRY_COUNT rounds. With the repair packets, a 32-packet block lost by more than
+one responder is sent as the largest loss of one responder in it plus ESPNOW_OTA_FEC_MARGIN repair
+packets, when it is fewer than the packets lost and no more than CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM. Each
+repair packet is the XOR of a random subset of the lost packets of the block. A responder removes the
+packets it has and reduces the rest in at most CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM rows, a row of another
+block is dropped for a new one, as espnow_ota_fec_insert() does.
+
+Each responder loses each frame independently at the loss rate, the status replies are not lost.
+The frames counted are the packets, the repair packets and one status request per round, "saved" is
+the part of the frames sent after the first pass of the firmware that the repair packets save.
+
+Usage: espnow_ota_fec_sim.py [--size BYTES] [--packet-size BYTES] [--devices N,..] [--loss P,..]
+"""
+
+import argparse
+import random
+import sys
+
+BLOCK_SIZE = 32     # ESPNOW_OTA_FEC_BLOCK_SIZE
+FEC_MARGIN = 2      # ESPNOW_OTA_FEC_MARGIN
+REPAIR_NUM = 8      # CONFIG_ESPNOW_OTA_FEC_REPAIR_NUM
+RETRY_COUNT = 50    # CONFIG_ESPNOW_OTA_RETRY_COUNT
+
+
+class Responder(object):
+
+    def __init__(self, packets):
+        self.lost = set(range(packets))
+        self.rows = []      # [block, pivot, mask] reduced against each other within a block
+
+    def source(self, seq):
+        """espnow_ota_fec_source(): a packet received is removed from the rows of its block"""
+        self.lost.discard(seq)
+        block, bit = divmod(seq, BLOCK_SIZE)
+        bit = 1 << bit
+        for row in [r for r in self.rows if r[0] == block and r[2] & bit]:
+            if row not in self.rows:
+                continue
+            self.rows.remove(row)
+            self.insert(block, row[2] ^ bit)
+
+    def insert(self, block, mask):
+        """espnow_ota_fec_insert(), then the rows left with one packet are solved"""
+        for row in self.rows:
+            if row[0] == block and mask & (1 << row[1]):
+                mask ^= row[2]
+
+        if not mask:
+            return
+
+        if len(self.rows) >= REPAIR_NUM:
+            other = [r for r in self.rows if r[0] != block]
+            if not other:
+                return
+            self.rows.remove(other[0])
+
+        pivot = (mask & -mask).bit_length() - 1
+        for row in self.rows:
+            if row[0] == block and row[2] & (1 << pivot):
+                row[2] ^= mask
+        self.rows.append([block, pivot, mask])
+
+        for row in [r for r in self.rows if r[2] == 1 << r[1]]:
+            if row in self.rows:
+                self.rows.remove(row)
+                self.source(row[0] * BLOCK_SIZE + row[1])
+
+    def repair(self, block, mask):
+        known = 0
+        for n in range(BLOCK_SIZE):
+            if mask & (1 << n) and block * BLOCK_SIZE + n not in self.lost:
+                known |= 1 << n
+        self.insert(block, mask & ~known)
+
+
+def run(packets, devices, loss, fec, rng):
+    responders = [Responder(packets) for _ in range(devices)]
+    frames = 0
+    rounds = 0
+
+    for _ in range(RETRY_COUNT):
+        unfinished = [r for r in responders if r.lost]
+        if not unfinished:
+            break
+
+        rounds += 1
+        frames += 1     # Status request, the first round asks for it as well
+
+        for block_seq in range(0, packets, BLOCK_SIZE):
+            block = block_seq // BLOCK_SIZE
+            block_size = min(BLOCK_SIZE, packets - block_seq)
+            missing = 0
+            block_loss = 0
+
+            for r in unfinished:
+                lost = [seq - block_seq for seq in r.lost if block_seq <= seq < block_seq + block_size]
+                block_loss = max(block_loss, len(lost))
+                for n in lost:
+                    missing |= 1 << n
+
+            if not missing:
+                continue
+
+            missing_num = bin(missing).count('1')
+            repair_num = block_loss + FEC_MARGIN
+
+            if fec and missing_num > 1 and repair_num < missing_num and repair_num <= REPAIR_NUM:
+                for _ in range(repair_num):
+                    mask = 0
+                    while not mask:
+                        mask = rng.getrandbits(BLOCK_SIZE) & missing
+                    frames += 1
+                    for r in unfinished:
+                        if rng.random() >= loss:
+                            r.repair(block, mask)
+                continue
+
+            for n in range(block_size):
+                if missing & (1 << n):
+                    frames += 1
+                    for r in unfinished:
+                        if rng.random() >= loss:
+                            r.source(block_seq + n)
+
+    return frames, rounds, sum(1 for r in responders if not r.lost)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--size', type=int, default=1024 * 1024, help='Size of the firmware')
+    parser.add_argument('--packet-size', type=int, default=1400, help='Packet size negotiated for ESP-NOW v2')
+    parser.add_argument('--devices', default='1,10,50,200', help='Fleet sizes')
+    parser.add_argument('--loss', default='0.01,0.02,0.05,0.1', help='Loss rates of a frame')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    packets = (args.size + args.packet_size - 1) // args.packet_size
+    print('%d bytes, %d packets of %d bytes, the frames sent and the rounds' % (args.size, packets, args.packet_size))
+    print('%7s  %5s  %15s  %15s  %6s' % ('devices', 'loss', 'retransmission', 'repair packets', 'saved'))
+
+    for devices in [int(d) for d in args.devices.split(',')]:
+        for loss in [float(p) for p in args.loss.split(',')]:
+            result = {}
+            for fec in (False, True):
+                frames, rounds, done = run(packets, devices, loss, fec, random.Random(args.seed))
+                result[fec] = '%7d / %2d%s' % (frames, rounds, '' if done == devices else ' !')
+                result[fec, 'frames'] = frames
+
+            extra = result[False, 'frames'] - packets - 1
+            saved = (1 - float(result[True, 'frames'] - packets - 1) / extra) if extra > 0 else 0
+            print('%7d  %4.0f%%  %15s  %15s  %5.0f%%' % (devices, loss * 100, result[False], result[True], saved * 100))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,278 @@
+#!/usr/bin/env python
+#
+# Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate the OTA relay (CONFIG_ESPNOW_OTA_RELAY_HOPS) on a multi-hop topology.
+
+The root upgrades its neighbors as espnow_ota_initiator_send() does: scan, then rounds
+of status requests and the packets lost by any responder. A responder finished relays
+the firmware the same way on a Trickle timer: once per interval at a random time in the
+second half of it, skipped if it heard the scan of another relay, the interval doubling
+while no neighbor needs the firmware. It is compared with the root flooding the packets
+with CONFIG_ESPNOW_OTA_SEND_FORWARD_TTL, every node forwarding every packet once.
+
+The time is counted in ms, a node receives a packet when one neighbor only sends in
+that ms and the packet is not lost.
+
+Usage: espnow_ota_relay_sim.py [--topology line|grid|all] [--packets N] [--loss P]
+"""
+
+import argparse
+import random
+import sys
+
+SCAN_MS = 2500              # espnow_ota_initiator_scan(), 5 requests 500 ms apart
+STATUS_MS = 1000            # Wait of the status replies
+PACKET_MS = 2               # Airtime of a packet
+RETRY_COUNT = 50            # CONFIG_ESPNOW_OTA_RETRY_COUNT
+RELAY_PACKET_MS = 5         # CONFIG_ESPNOW_OTA_RELAY_PACKET_INTERVAL
+RELAY_INTERVAL_MIN = 10000  # CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MIN
+RELAY_INTERVAL_MAX = 320000  # CONFIG_ESPNOW_OTA_RELAY_INTERVAL_MAX
+RELAY_QUIET_NUM = 2         # ESPNOW_OTA_RELAY_QUIET_NUM
+RELAY_REDUNDANCY = 1        # ESPNOW_OTA_RELAY_REDUNDANCY
+FORWARD_JITTER_MS = 10      # Random delay of a forwarded packet
+
+
+def line(hops):
+    return {n: [m for m in (n - 1, n + 1) if 0 <= m <= hops] for n in range(hops + 1)}
+
+
+def grid(size):
+    links = {}
+    for x in range(size):
+        for y in range(size):
+            links[x * size + y] = [nx * size + ny for nx, ny in ((x - 1, y), (x + 1, y), (x, y - 1), (x, y + 1))
+                                   if 0 <= nx < size and 0 <= ny < size]
+    return links
+
+
+class Channel(object):
+    """Packets sent in a ms, delivered to the neighbors hearing only one of them"""
+
+    def __init__(self, links, loss, rng):
+        self.links = links
+        self.loss = loss
+        self.rng = rng
+        self.sent = {}
+        self.tx_count = 0
+
+    def send(self, node, seq):
+        self.sent[node] = seq
+        self.tx_count += 1
+
+    def deliver(self):
+        received = []
+        for node, neighbors in self.links.items():
+            senders = [n for n in neighbors if n in self.sent]
+            if len(senders) == 1 and node not in self.sent and self.rng.random() >= self.loss:
+                received.append((node, senders[0], self.sent[senders[0]]))
+        self.sent = {}
+        return received
+
+
+class Campaign(object):
+    """espnow_ota_initiator_send_relay() run by a node, as a generator of the ms it sends packets in"""
+
+    def __init__(self, sim, node, packet_ms):
+        self.sim = sim
+        self.node = node
+        self.packet_ms = packet_ms
+        self.successed = 0
+        self.unfinished = 0
+
+    def run(self):
+        sim = self.sim
+        for neighbor in sim.links[self.node]:
+            sim.heard[neighbor] += 1
+
+        for _ in range(SCAN_MS):
+            yield None
+
+        targets = [n for n in sim.links[self.node] if n not in sim.finished_at]
+        for _ in range(RETRY_COUNT):
+            for _ in range(STATUS_MS):
+                yield None
+
+            for n in list(targets):
+                if len(sim.received[n]) == sim.packets:
+                    targets.remove(n)
+                    self.successed += 1
+
+            if not targets:
+                break
+
+            missing = sorted(set(range(sim.packets)) - set.intersection(*[sim.received[n] for n in targets]))
+            for seq in missing:
+                yield seq
+                for _ in range(self.packet_ms - 1):
+                    yield None
+
+        self.unfinished = len(targets)
+
+
+class Simulation(object):
+    def __init__(self, links, packets, loss, relay_hops, seed):
+        self.links = links
+        self.packets = packets
+        self.relay_hops = relay_hops
+        self.rng = random.Random(seed)
+        self.channel = Channel(links, loss, self.rng)
+        self.received = {n: set() for n in links}
+        self.received[0] = set(range(packets))
+        self.finished_at = {0: 0}
+        self.heard = {n: 0 for n in links}
+        self.hops = {0: relay_hops}
+        self.relays = {}
+        self.scan_count = 0
+        self.suppressed = 0
+
+    def receive(self, now):
+        for node, sender, seq in self.channel.deliver():
+            if node in self.finished_at:
+                continue
+            self.received[node].add(seq)
+            if len(self.received[node]) == self.packets:
+                self.finished_at[node] = now
+                self.hops[node] = max(self.hops[sender] - 1, 0)
+                if self.hops[sender] > 0:
+                    self.relays[node] = self.trickle(node)
+
+    def trickle(self, node):
+        interval = RELAY_INTERVAL_MIN
+        quiet = 0
+
+        while True:
+            fire = interval // 2 + self.rng.randrange(interval // 2)
+            self.heard[node] = 0
+            consistent = True
+
+            for _ in range(fire):
+                yield None
+
+            if self.heard[node] >= RELAY_REDUNDANCY:
+                self.suppressed += 1
+                spent = fire
+            else:
+                self.scan_count += 1
+                campaign = Campaign(self, node, PACKET_MS + RELAY_PACKET_MS)
+                spent = fire
+                for seq in campaign.run():
+                    spent += 1
+                    yield seq
+                consistent = not campaign.successed and not campaign.unfinished
+
+            for _ in range(interval - spent):
+                yield None
+
+            interval = min(interval * 2, RELAY_INTERVAL_MAX) if consistent else RELAY_INTERVAL_MIN
+            quiet = quiet + 1 if consistent and interval == RELAY_INTERVAL_MAX else 0
+            if quiet >= RELAY_QUIET_NUM:
+                return
+
+    def run_relay(self):
+        self.scan_count += 1
+        active = {0: Campaign(self, 0, PACKET_MS).run()}
+        now = 0
+
+        while active or self.relays:
+            active.update(self.relays)
+            self.relays = {}
+
+            for node, process in list(active.items()):
+                try:
+                    seq = next(process)
+                except StopIteration:
+                    del active[node]
+                    continue
+                if seq is not None:
+                    self.channel.send(node, seq)
+
+            now += 1
+            self.receive(now)
+
+        return now
+
+    def run_flood(self):
+        """The root sends the packets lost by any node, every node forwards each frame once"""
+        pending = []
+        now = 0
+
+        for _ in range(RETRY_COUNT):
+            missing = sorted(set(range(self.packets)) - set.intersection(*self.received.values()))
+            if not missing:
+                break
+
+            forwarded = {n: set() for n in self.links}
+            queue = [(i * PACKET_MS, 0, seq) for i, seq in enumerate(missing)]
+            start = now
+
+            while queue or pending:
+                due = [(node, seq) for t, node, seq in queue + pending if start + t <= now]
+                queue = [q for q in queue if start + q[0] > now]
+                pending = [p for p in pending if start + p[0] > now]
+                busy = set()
+                for node, seq in due:
+                    if node in busy:
+                        pending.append((now - start + 1, node, seq))
+                        continue
+                    busy.add(node)
+                    self.channel.send(node, seq)
+
+                now += 1
+                for node, sender, seq in self.channel.deliver():
+                    self.received[node].add(seq)
+                    if node != 0 and seq not in forwarded[node]:
+                        forwarded[node].add(seq)
+                        pending.append((now - start + self.rng.randrange(1, FORWARD_JITTER_MS), node, seq))
+                    if len(self.received[node]) == self.packets and node not in self.finished_at:
+                        self.finished_at[node] = now
+
+            now += STATUS_MS
+
+        return now
+
+
+def report(name, links, args):
+    print('%s, %d nodes, %d packets, loss %.0f%%' % (name, len(links), args.packets, args.loss * 100))
+
+    for mode in ('relay', 'flood', 'none'):
+        sim = Simulation(links, args.packets, args.loss, args.relay_hops if mode == 'relay' else 0, args.seed)
+        end = sim.run_flood() if mode == 'flood' else sim.run_relay()
+        done = len(sim.finished_at)
+        last = max(sim.finished_at.values()) / 1000.0
+        extra = ', scans: %d, suppressed: %d' % (sim.scan_count, sim.suppressed) if mode == 'relay' else ''
+        print('  %-5s: %2d/%d upgraded in %6.1f s, %6d packets sent (%.1f per node), quiet at %6.1f s%s'
+              % (mode, done, len(links), last, sim.channel.tx_count, float(sim.channel.tx_count) / (len(links) - 1),
+                 end / 1000.0, extra))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--topology', choices=('line', 'grid', 'all'), default='all')
+    parser.add_argument('--packets', type=int, default=300, help='Packets of the firmware')
+    parser.add_argument('--loss', type=float, default=0.1, help='Loss rate of a link')
+    parser.add_argument('--relay-hops', type=int, default=15, help='CONFIG_ESPNOW_OTA_RELAY_HOPS')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    if args.topology in ('line', 'all'):
+        report('5-hop line', line(5), args)
+    if args.topology in ('grid', 'all'):
+        report('4x4 grid, root at a corner', grid(4), args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,255 @@
+#!/usr/bin/env python
+#
+# Copyright 2026 Espressif Systems (Shanghai) PTE LTD
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+Simulate espnow_ota_initiator_scan() with many responders in range.
+
+The legacy scan broadcasts the request 5 times 500 ms apart and every responder
+replies at once. The slotted scan sends espnow_ota_scan_t: the responders reply at
+a random time in the window, skip the request when their MAC is in the Bloom filter
+of the responders heard, and only the part of the responders the request names
+replies. The first request probes one part in SCAN_PROBE_PARTS for the number of
+responders, the next ones size the window to the responders left in the part and
+split the parts once the heard ones do not fit in one filter or the window in
+SCAN_WINDOW_MAX. A part is done when a request to it is not answered, as
+espnow_ota_scan_next() does.
+
+The channel is CSMA in slots of 50 us: a reply waits for the medium and a random
+backoff, two replies starting in the same slot collide and are retried up to
+MAC_RETRY times. The initiator takes the replies through a queue of QUEUE_SIZE
+(espnow_config_t::qsize), a reply arriving when it is full is lost.
+
+Usage: espnow_ota_scan_sim.py [--responders N] [--seed S]
+"""
+
+import argparse
+import random
+import sys
+
+SLOT_US = 50                # CSMA slot
+AIRTIME_US = 2200           # Info reply of ESPNOW_OTA_INFO_SIZE + espnow_ota_info_ext_t at 1 Mbps
+BACKOFF_SLOTS = 16          # Contention window
+MAC_RETRY = 7               # Retries of a unicast frame not acknowledged
+QUEUE_SIZE = 32             # espnow_config_t::qsize
+PROC_US = 150               # Initiator handling a reply, hashed dedupe
+LEGACY_PROC_US_PER_ENTRY = 0.3  # Legacy handling, linear dedupe and a realloc copy per reply
+DEBUG = False
+REQUEST_US = 1000           # Request on air
+JITTER_US = 2000            # Responders taking the request, the tasks are not in step
+
+# As espnow_ota_initiator.c
+SCAN_SLOT_MS = 4            # ESPNOW_OTA_SCAN_SLOT_MS
+SCAN_WINDOW_MIN = 100       # ESPNOW_OTA_SCAN_WINDOW_MIN
+SCAN_WINDOW_FIRST = 500     # ESPNOW_OTA_SCAN_WINDOW_FIRST
+SCAN_WINDOW_MAX = 4000      # ESPNOW_OTA_SCAN_WINDOW_MAX
+SCAN_MARGIN_MS = 100        # ESPNOW_OTA_SCAN_MARGIN_MS
+SCAN_PROBE_PARTS = 16       # ESPNOW_OTA_SCAN_PROBE_PARTS
+SCAN_PARTS_MAX = 128        # ESPNOW_OTA_SCAN_PARTS_MAX
+FILTER_BYTES = 222          # ESPNOW_OTA_LEGACY_DATA_LEN - sizeof(espnow_ota_scan_t)
+FILTER_BITS_PER_MAC = 10    # ESPNOW_OTA_SCAN_FILTER_BITS, about 1% false positives
+FILTER_HASH_NUM = 7         # ESPNOW_OTA_SCAN_FILTER_HASH_NUM
+
+
+def fnv1a(mac, seed):
+    """espnow_ota_mac_hash()"""
+    value = (2166136261 ^ seed) & 0xFFFFFFFF
+    for byte in mac:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def filter_bits(mac, seed, hash_num, bits):
+    """Bits of espnow_ota_filter_add(), double hashing"""
+    h1 = fnv1a(mac, seed)
+    h2 = fnv1a(mac, seed ^ 0x5BD1E995) | 1
+    return [((h1 + i * h2) & 0xFFFFFFFF) % bits for i in range(hash_num)]
+
+
+class Air(object):
+    """Replies of one request, sent at their time through CSMA, to the queue of the initiator"""
+
+    def __init__(self, rng, proc_us):
+        self.rng = rng
+        self.proc_us = proc_us
+
+    def run(self, replies, duration_us):
+        """replies: list of (start_us, mac), returns the macs the initiator took"""
+        pending = sorted(replies)
+        waiting = []            # [ready_slot, retries, mac]
+        busy_until = 0
+        queue = []              # completion times of the replies queued
+        taken = []
+        slot = 0
+        end_slot = duration_us // SLOT_US
+        index = 0
+
+        while slot < end_slot and (index < len(pending) or waiting):
+            now = slot * SLOT_US
+
+            while index < len(pending) and pending[index][0] <= now:
+                waiting.append([slot, 0, pending[index][1]])
+                index += 1
+
+            if now >= busy_until:
+                ready = [w for w in waiting if w[0] <= slot]
+                if ready:
+                    if len(ready) == 1:
+                        w = ready[0]
+                        waiting.remove(w)
+                        busy_until = now + AIRTIME_US
+                        queue = [t for t in queue if t > busy_until]
+                        if len(queue) < QUEUE_SIZE:
+                            start = max(queue[-1] if queue else busy_until, busy_until)
+                            queue.append(start + self.proc_us(len(taken)))
+                            taken.append(w[2])
+                    else:
+                        busy_until = now + AIRTIME_US
+                        for w in ready:
+                            w[1] += 1
+                            if w[1] > MAC_RETRY:
+                                waiting.remove(w)
+                            else:
+                                w[0] = (busy_until // SLOT_US) + self.rng.randrange(BACKOFF_SLOTS << w[1])
+                else:
+                    nxt = min([w[0] for w in waiting] + [pending[index][0] // SLOT_US if index < len(pending) else end_slot])
+                    slot = max(slot + 1, nxt)
+                    continue
+                slot = busy_until // SLOT_US
+                continue
+
+            for w in waiting:
+                if w[0] <= slot:
+                    w[0] = busy_until // SLOT_US + self.rng.randrange(BACKOFF_SLOTS << w[1])
+            slot = busy_until // SLOT_US
+
+        return taken
+
+
+def legacy_scan(macs, rng):
+    heard = set()
+    air = Air(rng, lambda n: PROC_US + LEGACY_PROC_US_PER_ENTRY * n)
+    now = 0
+    for _ in range(5):
+        replies = [(REQUEST_US + rng.randrange(JITTER_US), mac) for mac in macs]
+        heard.update(air.run(replies, 500 * 1000))
+        now += 500 * 1000
+    return heard, now, 5
+
+
+def next_pow2(value):
+    result = 1
+    while result < value:
+        result *= 2
+    return result
+
+
+def slotted_scan(macs, rng, wait_ms):
+    heard = []
+    heard_set = set()
+    air = Air(rng, lambda n: PROC_US)
+    now = 0
+    rounds = 0
+    capacity = FILTER_BYTES * 8 // FILTER_BITS_PER_MAC
+
+    # espnow_ota_scan_plan_t
+    estimate = 0
+    part_num = SCAN_PROBE_PARTS
+    part = 0
+    window = SCAN_WINDOW_FIRST
+    done = set()
+
+    while now < wait_ms * 1000:
+        seed = rng.randrange(1 << 16)
+        bits = set()
+        for mac in heard:
+            if fnv1a(mac, 0) % part_num == part:
+                bits.update(filter_bits(mac, seed, FILTER_HASH_NUM, FILTER_BYTES * 8))
+
+        replies = []
+        for mac in macs:
+            if fnv1a(mac, 0) % part_num != part:
+                continue
+            if all(b in bits for b in filter_bits(mac, seed, FILTER_HASH_NUM, FILTER_BYTES * 8)):
+                continue
+            replies.append((REQUEST_US + rng.randrange(JITTER_US + window * 1000), mac))
+
+        new = [m for m in air.run(replies, (window + SCAN_MARGIN_MS) * 1000) if m not in heard_set]
+        heard.extend(new)
+        heard_set.update(new)
+        now += REQUEST_US + (window + SCAN_MARGIN_MS) * 1000
+        rounds += 1
+        n = len(new)
+
+        if DEBUG:
+            print('  request %d, part %d/%d, window %d ms, replying %d, new %d, estimate %d'
+                  % (rounds, part, part_num, window, len(replies), n, estimate))
+
+        # espnow_ota_scan_next()
+        if rounds == 1:
+            # The probe, the part is not done as it is a part of the parts of the scan
+            estimate = n * (part_num - 1)
+            part_num = 1
+        else:
+            pending = part_num - len(done)
+            if n * SCAN_SLOT_MS > window:
+                estimate = max(estimate - n, n * pending)
+            else:
+                estimate = max(estimate - n, 0)
+
+            if not n:
+                done.add(part)
+
+        load_parts = (estimate * SCAN_SLOT_MS * 2 + SCAN_WINDOW_MAX - 1) // SCAN_WINDOW_MAX
+        filter_parts = (len(heard) + capacity - 1) // capacity
+        parts = min(next_pow2(max(load_parts, filter_parts, 1)), SCAN_PARTS_MAX)
+
+        # A part split in two is done when it was
+        while part_num < parts:
+            done.update([p + part_num for p in done])
+            part_num *= 2
+
+        if len(done) == part_num:
+            break
+
+        pending = part_num - len(done)
+        part = next(p % part_num for p in range(part + 1, part + 1 + part_num) if p % part_num not in done)
+        window = min(max((estimate + pending - 1) // pending * SCAN_SLOT_MS * 2, SCAN_WINDOW_MIN), SCAN_WINDOW_MAX)
+
+    return heard_set, now, rounds
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--responders', type=int, default=1000)
+    parser.add_argument('--wait', type=int, default=30000, help='wait_ticks of the slotted scan, in ms')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    macs = set()
+    while len(macs) < args.responders:
+        macs.add(bytes(rng.randrange(256) for _ in range(6)))
+    macs = sorted(macs)
+
+    for name, scan in (('legacy', lambda: legacy_scan(macs, random.Random(args.seed))),
+                       ('slotted', lambda: slotted_scan(macs, random.Random(args.seed), args.wait))):
+        heard, elapsed, rounds = scan()
+        print('%-7s: %4d/%d responders (%.1f%%) in %5.1f s, %d requests'
+              % (name, len(heard), len(macs), 100.0 * len(heard) / len(macs), elapsed / 1e6, rounds))
+
+
+if __name__ == '__main__':
+    sys.exit(main())